@@ -3,8 +3,451 @@
 #include <iostream>
 #include <sstream>
 #include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <hiredis/hiredis.h>
 #include "MiniRedisClient.h"
+#include "MiniRedisPreparedCommand.h"
+#include "MiniRedisCodec.h"
+#include "MiniRedisKeySampler.h"
+#include "MiniRedisLogger.h"
+
+#if (HIREDIS_MAJOR < 1) || ((HIREDIS_MAJOR == 1) && (HIREDIS_MINOR < 1))
+#error "hiredis 1.1.0 or later is required"
+#endif
+
+namespace
+{
+    // Reusable buffer to encode prepared commands, one per thread
+    thread_local std::string preparedBuf;
+
+    // Commands of streaming large values
+    const MiniRedisPreparedCommand getrangeCmd("GETRANGE %b %b %b");
+    const MiniRedisPreparedCommand setCmd("SET %b %b");
+    const MiniRedisPreparedCommand setPxCmd("SET %b %b PX %b");
+    const MiniRedisPreparedCommand existsCmd("EXISTS %b");
+    const MiniRedisPreparedCommand strlenCmd("STRLEN %b");
+    const MiniRedisPreparedCommand appendCmd("APPEND %b %b");
+
+    bool IsStringType(int type)
+    {
+        return (type == REDIS_REPLY_STRING) || (type == REDIS_REPLY_STATUS) || 
+            (type == REDIS_REPLY_VERB) || (type == REDIS_REPLY_DOUBLE) || 
+            (type == REDIS_REPLY_BIGNUM);
+    }
+
+    bool IsArrayType(int type)
+    {
+        return (type == REDIS_REPLY_ARRAY) || (type == REDIS_REPLY_SET) || 
+            (type == REDIS_REPLY_PUSH);
+    }
+
+    // Append the scalar replies as strings, nested arrays are flattened
+    void AppendReplyStrings(redisReply* reply, std::vector<std::string>& replied)
+    {
+        if (IsStringType(reply->type))
+        {
+            replied.emplace_back(reply->str, reply->len);
+        }
+        else if ((reply->type == REDIS_REPLY_INTEGER) || (reply->type == REDIS_REPLY_BOOL))
+        {
+            replied.push_back(std::to_string(reply->integer));
+        }
+        else if (IsArrayType(reply->type) || (reply->type == REDIS_REPLY_MAP))
+        {
+            for (std::size_t i = 0; i < reply->elements; i++)
+            {
+                AppendReplyStrings(reply->element[i], replied);
+            }
+        }
+        else
+        {
+            replied.emplace_back();
+        }
+    }
+
+    // Decode score from RESP3 double, RESP2 string, or integer
+    bool ReplyToScore(redisReply* reply, double& score)
+    {
+        if (reply->type == REDIS_REPLY_DOUBLE)
+        {
+            score = reply->dval;
+            return true;
+        }
+        if (reply->type == REDIS_REPLY_INTEGER)
+        {
+            score = (double)reply->integer;
+            return true;
+        }
+        if (reply->type == REDIS_REPLY_STRING)
+        {
+            return MiniRedisNumeric::FromChars(reply->str, reply->len, score);
+        }
+        return false;
+    }
+
+    // Walk the reply WITHSCORES, and call fn(member, score) for each element
+    // RESP2 replies flat array of member, score, member, score...
+    // RESP3 replies array of [member, score] pairs
+    template <typename F>
+    bool ForEachScored(redisReply* reply, F fn)
+    {
+        if (!reply || !IsArrayType(reply->type))
+        {
+            return false;
+        }
+
+        bool nested = (reply->elements > 0) && (reply->element[0]->type == REDIS_REPLY_ARRAY);
+        std::size_t step = nested ? 1 : 2;
+        if (!nested && (reply->elements % 2 != 0))
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < reply->elements; i += step)
+        {
+            redisReply* member = reply->element[i];
+            redisReply* score = nullptr;
+            if (nested)
+            {
+                if (member->elements != 2)
+                {
+                    return false;
+                }
+                score = member->element[1];
+                member = member->element[0];
+            }
+            else
+            {
+                score = reply->element[i + 1];
+            }
+
+            double val = 0;
+            if (!member->str || !ReplyToScore(score, val))
+            {
+                return false;
+            }
+            fn(std::string_view(member->str, member->len), val);
+        }
+        return true;
+    }
+
+    // RESP3 map has elements of field, value, field, value...
+    // which is the same layout as the RESP2 array of pairs
+    template <typename Map>
+    bool HandleMapReplyImpl(redisReply* reply, Map& replied, MiniRedisCodecLayer* codecLayer)
+    {
+        replied.clear();
+        bool ret = (reply != nullptr) && 
+            ((reply->type == REDIS_REPLY_MAP) || (reply->type == REDIS_REPLY_ARRAY)) && 
+            (reply->elements % 2 == 0);
+        for (std::size_t i = 0; ret && (i < reply->elements); i += 2)
+        {
+            redisReply* field = reply->element[i];
+            redisReply* value = reply->element[i + 1];
+            auto iter = replied.emplace(std::string(field->str, field->len), std::string()).first;
+            if (codecLayer)
+            {
+                ret = codecLayer->Decode(value->str, value->len, iter->second);
+            }
+            else if (value->str)
+            {
+                iter->second.assign(value->str, value->len);
+            }
+        }
+        freeReplyObject(reply);
+        reply = nullptr; 
+        return ret;
+    }
+
+    // In-flight get_or_compute() of one key, shared by the threads of this process
+    struct Flight
+    {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        bool ok = false;
+        std::string value;
+        // Thrown by compute of the leader, rethrown to the waiters
+        std::exception_ptr error;
+    };
+
+    std::mutex flightMutex;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+
+    // Complete the flight when the leader leaves, also by exception, so that waiters never hang
+    class FlightGuard
+    {
+    public:
+        FlightGuard(const std::string& flightKey, std::shared_ptr<Flight> flight)
+            : flightKey(flightKey), flight(std::move(flight))
+        {
+        }
+
+        ~FlightGuard()
+        {
+            {
+                std::lock_guard<std::mutex> lock(flightMutex);
+                flights.erase(flightKey);
+            }
+            {
+                std::lock_guard<std::mutex> lock(flight->mtx);
+                flight->done = true;
+            }
+            flight->cv.notify_all();
+        }
+
+        FlightGuard(const FlightGuard&) = delete;
+        FlightGuard& operator=(const FlightGuard&) = delete;
+
+        void SetResult(bool ok, const std::string& value)
+        {
+            std::lock_guard<std::mutex> lock(flight->mtx);
+            flight->ok = ok;
+            flight->value = value;
+        }
+
+        void SetError(std::exception_ptr error)
+        {
+            std::lock_guard<std::mutex> lock(flight->mtx);
+            flight->error = error;
+        }
+
+    private:
+        const std::string& flightKey;
+        std::shared_ptr<Flight> flight;
+    };
+    // Last measured compute time in ms by key, for XFetch
+    std::unordered_map<std::string, double> computeMs;
+    const std::size_t maxComputeMsEntries = 10000;
+
+    // Release the lock only if still owned, it may have expired and been taken by others
+    const char* unlockScript = 
+        "if redis.call('GET', KEYS[1]) == ARGV[1] then "
+        "return redis.call('DEL', KEYS[1]) else return 0 end";
+
+    // Payload size of reply, for the bytes of hot keys
+    std::size_t ReplyBytes(const redisReply* reply)
+    {
+        if (!reply)
+        {
+            return 0;
+        }
+
+        std::size_t bytes = reply->str ? reply->len : 0;
+        for (std::size_t i = 0; i < reply->elements; i++)
+        {
+            bytes += ReplyBytes(reply->element[i]);
+        }
+        return bytes;
+    }
+
+    void AppendTruncated(std::string& token, const char* data, std::size_t len, 
+        std::size_t maxArg, bool& truncated)
+    {
+        std::size_t room = (maxArg > token.size()) ? maxArg - token.size() : 0;
+        if (len > room)
+        {
+            len = room;
+            truncated = true;
+        }
+        token.append(data, len);
+    }
+
+    // Expand the tokens of hiredis format with the arguments, each truncated to maxArg
+    // Stop after maxTokens, or at unsupported conversion
+    std::vector<std::string> ExpandFormat(const char* format, va_list args, 
+        std::size_t maxArg, std::size_t maxTokens)
+    {
+        std::vector<std::string> tokens;
+        std::string token;
+        bool inToken = false;
+        bool truncated = false;
+        auto finish = [&]() {
+            if (truncated)
+            {
+                token.append("...");
+            }
+            tokens.push_back(std::move(token));
+            token.clear();
+            inToken = false;
+            truncated = false;
+        };
+
+        for (const char* c = format; *c && (tokens.size() < maxTokens); c++)
+        {
+            if (*c == ' ')
+            {
+                if (inToken)
+                {
+                    finish();
+                }
+                continue;
+            }
+
+            inToken = true;
+            if ((*c != '%') || !c[1])
+            {
+                AppendTruncated(token, c, 1, maxArg, truncated);
+                continue;
+            }
+
+            const char* spec = c++;
+            if (*c == '%')
+            {
+                AppendTruncated(token, c, 1, maxArg, truncated);
+            }
+            else if (*c == 's')
+            {
+                const char* str = va_arg(args, const char*);
+                AppendTruncated(token, str, ::strlen(str), maxArg, truncated);
+            }
+            else if (*c == 'b')
+            {
+                const char* str = va_arg(args, const char*);
+                std::size_t len = va_arg(args, std::size_t);
+                AppendTruncated(token, str, len, maxArg, truncated);
+            }
+            else
+            {
+                // printf style: flags, width, precision, length and conversion
+                while (*c && strchr("#0-+ ", *c))
+                {
+                    c++;
+                }
+                while (isdigit((unsigned char)*c))
+                {
+                    c++;
+                }
+                if (*c == '.')
+                {
+                    c++;
+                    while (isdigit((unsigned char)*c))
+                    {
+                        c++;
+                    }
+                }
+                int longs = 0;
+                while ((*c == 'h') || (*c == 'l'))
+                {
+                    longs += (*c == 'l') ? 1 : 0;
+                    c++;
+                }
+
+                char buf[64];
+                std::string conv(spec, c - spec + 1);
+                int len = -1;
+                if (*c && strchr("diouxX", *c))
+                {
+                    if (longs >= 2)
+                    {
+                        len = snprintf(buf, sizeof(buf), conv.c_str(), va_arg(args, long long));
+                    }
+                    else if (longs == 1)
+                    {
+                        len = snprintf(buf, sizeof(buf), conv.c_str(), va_arg(args, long));
+                    }
+                    else
+                    {
+                        len = snprintf(buf, sizeof(buf), conv.c_str(), va_arg(args, int));
+                    }
+                }
+                else if (*c && strchr("eEfFgGaA", *c))
+                {
+                    len = snprintf(buf, sizeof(buf), conv.c_str(), va_arg(args, double));
+                }
+
+                if (len < 0)
+                {
+                    break;
+                }
+                AppendTruncated(token, buf, std::min<std::size_t>(len, sizeof(buf) - 1), 
+                    maxArg, truncated);
+            }
+        }
+
+        if (inToken && (tokens.size() < maxTokens))
+        {
+            finish();
+        }
+        return tokens;
+    }
+
+    std::string JoinTokens(const std::vector<std::string>& tokens)
+    {
+        std::string ans;
+        for (auto& x : tokens)
+        {
+            if (!ans.empty())
+            {
+                ans.push_back(' ');
+            }
+            ans.append(x);
+        }
+        return ans;
+    }
+
+    std::string NewLockToken()
+    {
+        thread_local std::mt19937_64 rng(std::random_device{}());
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)rng());
+        return std::string(buf, 16);
+    }
+}
+
+MiniRedisScoredView::MiniRedisScoredView()
+{
+    reply = nullptr;
+}
+
+MiniRedisScoredView::~MiniRedisScoredView()
+{
+    Reset();
+}
+
+MiniRedisScoredView::MiniRedisScoredView(MiniRedisScoredView&& other) noexcept
+{
+    reply = other.reply;
+    items = std::move(other.items);
+    other.reply = nullptr;
+    other.items.clear();
+}
+
+MiniRedisScoredView& MiniRedisScoredView::operator=(MiniRedisScoredView&& other) noexcept
+{
+    if (this != &other)
+    {
+        Reset(other.reply);
+        items = std::move(other.items);
+        other.reply = nullptr;
+        other.items.clear();
+    }
+    return *this;
+}
+
+void MiniRedisScoredView::Reset(redisReply* newReply)
+{
+    items.clear();
+    freeReplyObject(reply);
+    reply = newReply;
+}
 
 MiniRedisClient::MiniRedisClient()
 {
@@ -21,7 +464,10 @@ void MiniRedisClient::Init()
     host = "127.0.0.1";
     port = 6379;
     timeoutSeconds = 3; 
+    commandTimeoutMs = 0;
     context = nullptr;
+    protocol = 2;
+    pushCb = nullptr;
 }
 
 void MiniRedisClient::Clean()
@@ -63,586 +509,2020 @@ uint32_t MiniRedisClient::GetTimeoutSeconds() const
     return timeoutSeconds;
 }
 
-redisContext* MiniRedisClient::GetRawContext()
+void MiniRedisClient::SetCommandTimeoutMs(uint32_t ms)
 {
-    // The ownership is transferred
-    redisContext* ans = context; 
-    context = nullptr;
-    return ans; 
+    commandTimeoutMs = ms;
+    ApplyTimeout(ms);
 }
 
-bool MiniRedisClient::Connect()
+uint32_t MiniRedisClient::GetCommandTimeoutMs() const
 {
-    // Clean if existing
-    Clean();
+    return commandTimeoutMs;
+}
 
-    timeval tv = {timeoutSeconds, 0};
-    context = redisConnectWithTimeout(host.c_str(), port, tv);
+void MiniRedisClient::ApplyTimeout(uint32_t ms) const
+{
     if (!context || context->err)
     {
-        if (context)
-        {
-            std::cout << "Failed to connect to Redis server: " << context->errstr << std::endl;
-            redisFree(context);
-        }
-        else
-        {
-            std::cout << "Can't allocate redis context" << std::endl;
-        }
+        return;
+    }
 
-        return false;
+    // Zero timeval means blocking without timeout
+    timeval tv = {(time_t)(ms / 1000), (suseconds_t)((ms % 1000) * 1000)};
+    if (redisSetTimeout(context, tv) != REDIS_OK)
+    {
+        MINIREDIS_LOG_WARN("Failed to set command timeout: %s", context->errstr);
     }
+}
 
-    return true;
+MiniRedisDeadline::MiniRedisDeadline(const MiniRedisClient& client, uint32_t ms)
+    : client(client)
+{
+    client.ApplyTimeout(ms);
 }
 
-bool MiniRedisClient::Connect(const std::string& host, uint16_t port, uint32_t timeoutSec)
+MiniRedisDeadline::~MiniRedisDeadline()
 {
-    this->host = host;
-    this->port = port;
-    this->timeoutSeconds = timeoutSec;
+    client.ApplyTimeout(client.commandTimeoutMs);
+}
 
-    return Connect();
+void MiniRedisClient::SetConnectionOptions(const MiniRedisConnectionOptions& options)
+{
+    this->options = options;
 }
 
-// Check the reply type is expected or not
-bool MiniRedisClient::CheckReplyType(redisReply* reply, int expectedType) const
+const MiniRedisConnectionOptions& MiniRedisClient::GetConnectionOptions() const
 {
-    if (!reply)
-    {
-        return false; 
-    }
+    return options;
+}
 
-    return (reply->type == expectedType);
+void MiniRedisClient::SetSampler(std::shared_ptr<MiniRedisKeySampler> sampler)
+{
+    this->sampler = sampler;
 }
 
-// Check the reply str is expected or not
-bool MiniRedisClient::CheckReplyStr(redisReply* reply, const std::string& expectedStr) const
+void MiniRedisClient::SetProtocol(int protover)
 {
-    if (!reply)
-    {
-        return false; 
-    }
+    protocol = protover;
+}
 
-    return (expectedStr.compare(reply->str) == 0);
+int MiniRedisClient::GetProtocol() const
+{
+    return protocol;
 }
 
-// Check the status of reply, and release the reply memory
-bool MiniRedisClient::HandleStatusReply(redisReply* reply, std::string& replied) const
+void MiniRedisClient::SetPushCb(PushCbFunc cb)
 {
-    bool ret = true; 
-    if (!CheckReplyType(reply, REDIS_REPLY_STATUS))
-    {
-        replied = "";
-        ret = false; 
-    }
-    else
-    {
-        replied = std::string(reply->str, reply->len);
-    }
-    freeReplyObject(reply);
-    reply = nullptr; 
-    return ret;
+    pushCb = cb;
 }
 
-// Return the str of reply, and release the reply memory
-bool MiniRedisClient::HandleStringReply(redisReply* reply, std::string& replied) const
+void MiniRedisClient::SetCodec(std::shared_ptr<MiniRedisCodec> codec, std::size_t threshold)
 {
-    bool ret = true; 
-    if (!CheckReplyType(reply, REDIS_REPLY_STRING))
-    {
-        replied = "";
-        ret = false; 
-    }
-    else
+    if (!codec)
     {
-        replied = std::string(reply->str, reply->len);
+        codecLayer = nullptr;
+        return;
     }
-    freeReplyObject(reply);
-    reply = nullptr; 
-    return ret;
+
+    codecLayer = std::make_shared<MiniRedisCodecLayer>(codec, threshold);
 }
 
-// Return the integer of reply, and release the reply memory
-bool MiniRedisClient::HandleIntegerReply(redisReply* reply, long long int& replied) const
+std::shared_ptr<MiniRedisCodec> MiniRedisClient::GetCodec() const
 {
-    bool ret = true; 
-    if (!CheckReplyType(reply, REDIS_REPLY_INTEGER))
+    if (!codecLayer)
     {
-        replied = -1;
-        ret = false; 
+        return nullptr;
     }
-    else
+
+    return codecLayer->GetCodec();
+}
+
+MiniRedisCodecStats MiniRedisClient::GetCodecStats() const
+{
+    if (!codecLayer)
     {
-        replied = reply->integer;
+        return MiniRedisCodecStats();
     }
-    freeReplyObject(reply);
-    reply = nullptr; 
-    return ret;
+
+    return codecLayer->GetStats();
 }
 
-bool MiniRedisClient::HandleArrayReply(redisReply* reply, std::vector<std::string>& replied) const
+redisContext* MiniRedisClient::GetRawContext()
 {
-    if(!reply)
+    // The ownership is transferred, and the push callback would point to this instance
+    redisContext* ans = context; 
+    if (ans)
     {
-        return false;
+        ans->privdata = nullptr;
+        redisSetPushCallback(ans, nullptr);
     }
+    context = nullptr;
+    return ans; 
+}
 
-    bool ret = true; 
-    if (!CheckReplyType(reply, REDIS_REPLY_ARRAY))
+bool MiniRedisClient::Connect()
+{
+    // Clean if existing
+    Clean();
+
+    timeval tv = {timeoutSeconds, 0};
+    redisOptions opts = {};
+    if (options.unixSocket.empty())
     {
-        replied = std::vector<std::string>();
-        ret = false; 
+        REDIS_OPTIONS_SET_TCP(&opts, host.c_str(), port);
     }
     else
     {
-        std::size_t count = reply->elements;
-        replied.clear();
-        for (std::size_t i = 0; i < count; i++)
+        REDIS_OPTIONS_SET_UNIX(&opts, options.unixSocket.c_str());
+    }
+    opts.connect_timeout = &tv;
+    context = redisConnectWithOptions(&opts);
+    if (!context || context->err)
+    {
+        if (context)
         {
-            std::string val(reply->element[i]->str, reply->element[i]->len);
-            replied.push_back(val); 
+            MINIREDIS_LOG_ERROR("Failed to connect to Redis server: %s", context->errstr);
+            redisFree(context);
+        }
+        else
+        {
+            MINIREDIS_LOG_ERROR("Can't allocate redis context");
         }
+
+        context = nullptr;
+        return false;
     }
-    freeReplyObject(reply);
-    reply = nullptr; 
-    return ret;
-}
 
-redisReply* MiniRedisClient::execute(const std::string& command, ...) const
-{
-    if (!context)
+    // Push messages are delivered to this instance
+    context->privdata = this;
+    redisSetPushCallback(context, OnPushMsg);
+    // Default deadline of commands
+    ApplyTimeout(commandTimeoutMs);
+
+    if (!ApplySocketOptions() || !Handshake())
     {
-        return nullptr;
+        Clean();
+        return false;
     }
 
-    va_list args;
-    va_start(args, command); 
-    redisReply* reply = (redisReply*)redisvCommand(context, command.c_str(), args);
-    va_end(args);
-
-    return reply;
+    return true;
 }
 
-redisReply* MiniRedisClient::execute(const std::string& command,
-    const std::vector<std::string>& args) const
+bool MiniRedisClient::ApplySocketOptions()
 {
-    if (!context)
+    int fd = context->fd;
+    if (options.unixSocket.empty())
+    {
+        int noDelay = options.tcpNoDelay ? 1 : 0;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) < 0)
+        {
+            MINIREDIS_LOG_ERROR("Failed to set TCP_NODELAY: %s", strerror(errno));
+            return false;
+        }
+
+        if ((options.keepAliveSeconds > 0) && 
+            (redisEnableKeepAliveWithInterval(context, options.keepAliveSeconds) != REDIS_OK))
+        {
+            MINIREDIS_LOG_ERROR("Failed to enable keepalive: %s", context->errstr);
+            return false;
+        }
+    }
+
+    // The kernel may round or cap the sizes, by net.core.rmem_max and wmem_max
+    if ((options.recvBufferBytes > 0) && 
+        (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.recvBufferBytes, sizeof(int)) < 0))
+    {
+        MINIREDIS_LOG_ERROR("Failed to set SO_RCVBUF: %s", strerror(errno));
+        return false;
+    }
+    if ((options.sendBufferBytes > 0) && 
+        (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.sendBufferBytes, sizeof(int)) < 0))
+    {
+        MINIREDIS_LOG_ERROR("Failed to set SO_SNDBUF: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool MiniRedisClient::Handshake()
+{
+    // All setup commands in one round trip
+    std::vector<std::vector<std::string>> commands;
+    bool nameSent = false;
+    if (protocol == 3)
+    {
+        // HELLO carries AUTH and SETNAME, so that they are not sent separately
+        std::vector<std::string> hello = {"HELLO", "3"};
+        if (!options.password.empty())
+        {
+            hello.insert(hello.end(), {"AUTH", 
+                options.username.empty() ? "default" : options.username, options.password});
+        }
+        if (!options.clientName.empty())
+        {
+            hello.insert(hello.end(), {"SETNAME", options.clientName});
+            nameSent = true;
+        }
+        commands.push_back(hello);
+    }
+    else if (!options.password.empty())
+    {
+        if (options.username.empty())
+        {
+            commands.push_back({"AUTH", options.password});
+        }
+        else
+        {
+            commands.push_back({"AUTH", options.username, options.password});
+        }
+    }
+
+    if (options.database != 0)
+    {
+        commands.push_back({"SELECT", std::to_string(options.database)});
+    }
+    if (!options.clientName.empty() && !nameSent)
+    {
+        commands.push_back({"CLIENT", "SETNAME", options.clientName});
+    }
+    if (options.noEvict)
+    {
+        commands.push_back({"CLIENT", "NO-EVICT", "on"});
+    }
+
+    if (commands.empty())
+    {
+        return true;
+    }
+
+    for (auto& x : commands)
+    {
+        if (!PipelineAppend(x))
+        {
+            return false;
+        }
+    }
+
+    // Read all replies, even after failure, to report each of them
+    bool ret = true;
+    for (auto& x : commands)
+    {
+        redisReply* reply = PipelineGetReply();
+        if (!reply || (reply->type == REDIS_REPLY_ERROR))
+        {
+            MINIREDIS_LOG_ERROR("Failed to %s when connecting: %s%s", x[0].c_str(), 
+                reply ? reply->str : context->errstr, 
+                (x[0] == "HELLO") ? ", HELLO 3 requires Redis 6 or later" : "");
+            ret = false;
+        }
+        freeReplyObject(reply);
+        if (!reply)
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+bool MiniRedisClient::Connect(const std::string& host, uint16_t port, uint32_t timeoutSec)
+{
+    this->host = host;
+    this->port = port;
+    this->timeoutSeconds = timeoutSec;
+
+    return Connect();
+}
+
+bool MiniRedisClient::IsConnected() const
+{
+    return context && !context->err;
+}
+
+MiniRedisError MiniRedisClient::GetLastError() const
+{
+    if (!context)
+    {
+        return REDIS_ERROR_NOT_CONNECTED;
+    }
+
+    switch (context->err)
+    {
+    case 0:
+        return REDIS_ERROR_NONE;
+    case REDIS_ERR_TIMEOUT:
+        return REDIS_ERROR_TIMEOUT;
+    case REDIS_ERR_IO:
+        // Older hiredis reports timeout as IO error of EAGAIN
+        return (strcmp(context->errstr, strerror(EAGAIN)) == 0) ? 
+            REDIS_ERROR_TIMEOUT : REDIS_ERROR_IO;
+    case REDIS_ERR_EOF:
+        return REDIS_ERROR_EOF;
+    case REDIS_ERR_PROTOCOL:
+        return REDIS_ERROR_PROTOCOL;
+    default:
+        return REDIS_ERROR_OTHER;
+    }
+}
+
+int MiniRedisClient::GetFd() const
+{
+    return context ? context->fd : -1;
+}
+
+// Check the reply type is expected or not
+bool MiniRedisClient::CheckReplyType(redisReply* reply, int expectedType) const
+{
+    if (!reply)
+    {
+        return false; 
+    }
+
+    return (reply->type == expectedType);
+}
+
+// Check the reply str is expected or not
+bool MiniRedisClient::CheckReplyStr(redisReply* reply, const std::string& expectedStr) const
+{
+    if (!reply)
+    {
+        return false; 
+    }
+
+    return (expectedStr.compare(reply->str) == 0);
+}
+
+// Check the status of reply, and release the reply memory
+bool MiniRedisClient::HandleStatusReply(redisReply* reply, std::string& replied) const
+{
+    bool ret = true; 
+    if (!CheckReplyType(reply, REDIS_REPLY_STATUS))
+    {
+        replied = "";
+        ret = false; 
+    }
+    else
+    {
+        replied = std::string(reply->str, reply->len);
+    }
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return ret;
+}
+
+// Return the str of reply, and release the reply memory
+bool MiniRedisClient::HandleStringReply(redisReply* reply, std::string& replied) const
+{
+    bool ret = true; 
+    // RESP3 returns verbatim string for commands like INFO
+    if (!CheckReplyType(reply, REDIS_REPLY_STRING) && !CheckReplyType(reply, REDIS_REPLY_VERB))
+    {
+        replied = "";
+        ret = false; 
+    }
+    else
+    {
+        replied = std::string(reply->str, reply->len);
+    }
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return ret;
+}
+
+// Return the integer of reply, and release the reply memory
+bool MiniRedisClient::HandleIntegerReply(redisReply* reply, long long int& replied) const
+{
+    bool ret = true; 
+    if (!CheckReplyType(reply, REDIS_REPLY_INTEGER) && !CheckReplyType(reply, REDIS_REPLY_BOOL))
+    {
+        replied = -1;
+        ret = false; 
+    }
+    else
+    {
+        replied = reply->integer;
+    }
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return ret;
+}
+
+bool MiniRedisClient::HandleArrayReply(redisReply* reply, std::vector<std::string>& replied) const
+{
+    if(!reply)
+    {
+        return false;
+    }
+
+    bool ret = true; 
+    if (!IsArrayType(reply->type))
+    {
+        replied = std::vector<std::string>();
+        ret = false; 
+    }
+    else
+    {
+        std::size_t count = reply->elements;
+        replied.clear();
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::string val(reply->element[i]->str, reply->element[i]->len);
+            replied.push_back(val); 
+        }
+    }
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return ret;
+}
+
+std::string_view MiniRedisClient::EncodeValue(const std::string& value) const
+{
+    if (!codecLayer)
+    {
+        return value;
+    }
+
+    return codecLayer->Encode(value);
+}
+
+// Return the str of reply, decompress it if needed, and release the reply memory
+bool MiniRedisClient::HandleValueReply(redisReply* reply, std::string& replied) const
+{
+    if (!codecLayer)
+    {
+        return HandleStringReply(reply, replied);
+    }
+
+    bool ret = true; 
+    if (!CheckReplyType(reply, REDIS_REPLY_STRING))
+    {
+        replied = "";
+        ret = false; 
+    }
+    else
+    {
+        ret = codecLayer->Decode(reply->str, reply->len, replied);
+    }
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return ret;
+}
+
+bool MiniRedisClient::HandleMapReply(redisReply* reply, 
+    std::map<std::string, std::string>& replied) const
+{
+    return HandleMapReplyImpl(reply, replied, nullptr);
+}
+
+bool MiniRedisClient::HandleMapReply(redisReply* reply, 
+    std::unordered_map<std::string, std::string>& replied) const
+{
+    return HandleMapReplyImpl(reply, replied, nullptr);
+}
+
+bool MiniRedisClient::HandleDoubleReply(redisReply* reply, double& replied) const
+{
+    replied = 0;
+    return HandleNumberReply(reply, &MiniRedisClient::ParseNumber<double>, &replied);
+}
+
+bool MiniRedisClient::HandleNumberReply(redisReply* reply, NumberParser parser, void* out) const
+{
+    bool ret = false; 
+    if (CheckReplyType(reply, REDIS_REPLY_INTEGER) || CheckReplyType(reply, REDIS_REPLY_BOOL))
+    {
+        ret = parser(nullptr, 0, reply->integer, true, out);
+    }
+    else if (CheckReplyType(reply, REDIS_REPLY_STRING) || CheckReplyType(reply, REDIS_REPLY_DOUBLE))
+    {
+        ret = parser(reply->str, reply->len, 0, false, out);
+    }
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return ret;
+}
+
+redisReply* MiniRedisClient::execute(const std::string& command, ...) const
+{
+    if (!context)
+    {
+        return nullptr;
+    }
+
+    va_list args;
+    va_start(args, command); 
+    redisReply* reply = sampler ? SampledCommand(command.c_str(), args) : 
+        (redisReply*)redisvCommand(context, command.c_str(), args);
+    va_end(args);
+
+    return reply;
+}
+
+redisReply* MiniRedisClient::SampledCommand(const char* format, va_list args) const
+{
+    // Arguments are consumed by hiredis, keep a copy to find the key
+    va_list copy;
+    va_copy(copy, args);
+    auto start = std::chrono::steady_clock::now();
+    redisReply* reply = (redisReply*)redisvCommand(context, format, args);
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    if (sampler->ShouldSample())
+    {
+        va_list keyArgs;
+        va_copy(keyArgs, copy);
+        // Keys longer than this are rare, and counted by the prefix
+        std::vector<std::string> tokens = ExpandFormat(format, keyArgs, 512, 2);
+        va_end(keyArgs);
+        if (tokens.size() > 1)
+        {
+            sampler->RecordKey(tokens[1], tokens[1].size() + ReplyBytes(reply));
+        }
+    }
+    if (sampler->IsSlow(us))
+    {
+        std::vector<std::string> tokens = ExpandFormat(format, copy, 
+            sampler->GetMaxArgLength(), 16);
+        sampler->RecordSlow(us, JoinTokens(tokens));
+    }
+
+    va_end(copy);
+    return reply;
+}
+
+void MiniRedisClient::SampleArgv(const std::vector<std::string_view>& argv, 
+    std::chrono::steady_clock::time_point start, redisReply* reply) const
+{
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    if (sampler->ShouldSample() && (argv.size() > 1))
+    {
+        sampler->RecordKey(argv[1].substr(0, 512), argv[1].size() + ReplyBytes(reply));
+    }
+    if (sampler->IsSlow(us))
+    {
+        std::size_t maxArg = sampler->GetMaxArgLength();
+        std::vector<std::string> tokens;
+        for (std::size_t i = 0; (i < argv.size()) && (i < 16); i++)
+        {
+            tokens.emplace_back(argv[i].substr(0, maxArg));
+            if (argv[i].size() > maxArg)
+            {
+                tokens.back().append("...");
+            }
+        }
+        sampler->RecordSlow(us, JoinTokens(tokens));
+    }
+}
+
+redisReply* MiniRedisClient::execute(const std::string& command,
+    const std::vector<std::string>& args) const
+{
+    if (!context)
+    {
+        return nullptr;
+    }
+
+    // Number of arguments, including command name
+    int argc = args.size() + 1; 
+    const char **argv = (const char**)malloc(sizeof(const char**) * argc);
+    argv[0] = strdup(command.c_str());
+    size_t index = 1;
+    for (auto& iter : args)
+    {
+        argv[index] = strdup(iter.c_str());
+        index++;
+    }
+
+    // Length of each argument
+    size_t *argvLen = (size_t*)malloc(sizeof(size_t) * argc);
+    for (int i = 0; i < argc; i++)
+    {
+        // Use global strlen, instead of Redis strlen
+        MINIREDIS_LOG_TRACE("Argument %d: %s", i, argv[i]);
+        argvLen[i] = ::strlen(argv[i]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    redisReply *reply = (redisReply*)redisCommandArgv(context, argc, argv, argvLen);
+    if (sampler)
+    {
+        std::vector<std::string_view> views;
+        views.emplace_back(command);
+        views.insert(views.end(), args.begin(), args.end());
+        SampleArgv(views, start, reply);
+    }
+
+    // Clean
+    for (int i = 0; i < argc; i++)
+    {
+        free((void*)argv[i]);
+    }
+    free((void*)argv);
+    free((void*)argvLen);
+
+    return reply; 
+}
+
+redisReply* MiniRedisClient::execute(const MiniRedisPreparedCommand& command, 
+    std::initializer_list<std::string_view> args) const
+{
+    if (!context)
+    {
+        return nullptr;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!AppendPrepared(command, args))
     {
         return nullptr;
     }
 
-    // Number of arguments, including command name
-    int argc = args.size() + 1; 
-    const char **argv = (const char**)malloc(sizeof(const char**) * argc);
-    argv[0] = strdup(command.c_str());
-    size_t index = 1;
-    for (auto& iter : args)
+    redisReply* reply = nullptr;
+    if (redisGetReply(context, (void**)&reply) != REDIS_OK)
+    {
+        freeReplyObject(reply);
+        return nullptr;
+    }
+
+    if (sampler)
+    {
+        // Fixed tokens from the format, %b from the arguments
+        std::vector<std::string_view> views;
+        std::string_view format(command.GetFormat());
+        auto arg = args.begin();
+        std::size_t pos = 0;
+        while (pos < format.size())
+        {
+            std::size_t end = std::min(format.find(' ', pos), format.size());
+            if (end > pos)
+            {
+                std::string_view token = format.substr(pos, end - pos);
+                if ((token == "%b") && (arg != args.end()))
+                {
+                    token = *arg++;
+                }
+                views.push_back(token);
+            }
+            pos = end + 1;
+        }
+        SampleArgv(views, start, reply);
+    }
+
+    return reply;
+}
+
+bool MiniRedisClient::append(const std::string& key, const std::string& value, 
+    long long int& replied) const
+{
+    redisReply* reply = execute("APPEND %b %b", 
+        key.c_str(), key.size(), 
+        value.c_str(), value.size());
+    return HandleIntegerReply(reply, replied); 
+}
+
+bool MiniRedisClient::auth(const std::string& password, std::string& replied) const
+{
+    redisReply* reply = execute("AUTH %b", 
+        password.c_str(), password.size()); 
+    return HandleStatusReply(reply, replied);
+}
+
+bool MiniRedisClient::hello(int protover, std::map<std::string, std::string>& replied) const
+{
+    redisReply* reply = execute("HELLO %d", protover);
+    replied.clear();
+    bool ret = (reply != nullptr) && 
+        ((reply->type == REDIS_REPLY_MAP) || (reply->type == REDIS_REPLY_ARRAY)) && 
+        (reply->elements % 2 == 0);
+    for (std::size_t i = 0; ret && (i < reply->elements); i += 2)
+    {
+        // Nested values such as modules are flattened, and joined by blank space
+        std::vector<std::string> values;
+        AppendReplyStrings(reply->element[i + 1], values);
+        std::string val;
+        for (auto& x : values)
+        {
+            val += val.empty() ? x : " " + x;
+        }
+        redisReply* field = reply->element[i];
+        replied.emplace(std::string(field->str, field->len), val);
+    }
+    freeReplyObject(reply);
+    reply = nullptr;
+    return ret;
+}
+
+bool MiniRedisClient::client_getname(std::string& replied) const
+{
+    redisReply* reply = execute("CLIENT GETNAME"); 
+    return HandleStringReply(reply, replied);
+}
+
+bool MiniRedisClient::client_setname(const std::string& name, std::string& replied) const
+{
+    redisReply* reply = execute("CLIENT SETNAME %b", 
+        name.c_str(), name.size()); 
+    return HandleStatusReply(reply, replied);
+}
+
+bool MiniRedisClient::decr(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("DECR %b", 
+        key.c_str(), key.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::decrby(const std::string& key, long long int decrement, 
+    long long int& replied) const
+{
+    redisReply* reply = execute("DECRBY %b %lld", 
+        key.c_str(), key.size(), decrement);
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::del(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("DEL %b",  
+        key.c_str(), key.size());
+    return HandleIntegerReply(reply, replied); 
+}
+
+bool MiniRedisClient::del(const std::vector<std::string>& keys, long long int& replied) const
+{
+    redisReply* reply = execute("DEL", keys);
+    return HandleIntegerReply(reply, replied); 
+}
+
+bool MiniRedisClient::exists(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("EXISTS %b", 
+        key.c_str(), key.size());
+    return HandleIntegerReply(reply, replied); 
+}
+
+bool MiniRedisClient::expire(const std::string& key, uint32_t seconds, 
+    long long int& replied) const
+{
+    redisReply* reply = execute("EXPIRE %b %d", 
+        key.c_str(), key.size(), seconds);
+    return HandleIntegerReply(reply, replied); 
+}
+
+bool MiniRedisClient::get(const std::string& key, std::string& replied) const
+{
+    redisReply* reply = execute("GET %b", 
+        key.c_str(), key.size());
+    return HandleValueReply(reply, replied);
+}
+
+bool MiniRedisClient::get_or_compute(const std::string& key, const ComputeFunc& compute, 
+    const MiniRedisComputeOptions& opts, std::string& replied) const
+{
+    replied.clear();
+    if (!context || !compute)
+    {
+        return false;
+    }
+
+    // Same key on different server is a different flight
+    std::string flightKey = host + ":" + std::to_string(port) + "/" + 
+        std::to_string(options.database) + "/" + key;
+    std::shared_ptr<Flight> flight;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(flightMutex);
+        auto& x = flights[flightKey];
+        if (!x)
+        {
+            x = std::make_shared<Flight>();
+            leader = true;
+        }
+        flight = x;
+    }
+
+    if (!leader)
+    {
+        // Wait for the result of leader
+        std::unique_lock<std::mutex> lock(flight->mtx);
+        flight->cv.wait(lock, [&flight]() { return flight->done; });
+        if (flight->error)
+        {
+            std::rethrow_exception(flight->error);
+        }
+        replied = flight->value;
+        return flight->ok;
+    }
+
+    FlightGuard guard(flightKey, flight);
+    bool ret = false;
+    try
+    {
+        ret = GetOrComputeOnce(key, compute, opts, replied);
+    }
+    catch (...)
+    {
+        guard.SetError(std::current_exception());
+        throw;
+    }
+    guard.SetResult(ret, replied);
+    return ret;
+}
+
+bool MiniRedisClient::GetOrComputeOnce(const std::string& key, const ComputeFunc& compute, 
+    const MiniRedisComputeOptions& opts, std::string& replied) const
+{
+    // Value and its TTL in one round trip
+    if (!PipelineAppend(std::vector<std::string>{"GET", key}) || 
+        !PipelineAppend(std::vector<std::string>{"TTL", key}))
+    {
+        return false;
+    }
+    bool hit = HandleValueReply(PipelineGetReply(), replied);
+    long long int ttlLeft = -2;
+    HandleIntegerReply(PipelineGetReply(), ttlLeft);
+    if (!IsConnected())
+    {
+        return false;
+    }
+
+    bool refresh = !hit;
+    if (hit && (opts.beta > 0) && (ttlLeft > 0))
+    {
+        // XFetch: refresh when now - delta * beta * ln(rand) passes the expiry, 
+        // which gets more likely as TTL runs out, and for values slow to compute
+        double delta = opts.computeMsHint;
+        {
+            std::lock_guard<std::mutex> lock(flightMutex);
+            auto iter = computeMs.find(key);
+            if (iter != computeMs.end())
+            {
+                delta = iter->second;
+            }
+        }
+        thread_local std::mt19937 rng(std::random_device{}());
+        double r = std::uniform_real_distribution<double>(
+            std::numeric_limits<double>::min(), 1.0)(rng);
+        refresh = (-delta * opts.beta * std::log(r) >= ttlLeft * 1000.0);
+    }
+
+    if (!refresh)
+    {
+        return true;
+    }
+
+    std::string lockKey = key + ":lock";
+    std::string token = NewLockToken();
+    std::string lockTtl = std::to_string(opts.lockMs);
+    redisReply* reply = ExecuteArgv({"SET", lockKey, token, "NX", "PX", lockTtl});
+    std::string status;
+    bool locked = HandleStatusReply(reply, status) && (status == "OK");
+    if (locked)
+    {
+        // Release the lock on any exit, also when compute throws
+        struct Unlock
+        {
+            const MiniRedisClient& client;
+            const std::string& lockKey;
+            const std::string& token;
+
+            ~Unlock()
+            {
+                freeReplyObject(client.ExecuteArgv({"EVAL", unlockScript, "1", lockKey, token}));
+            }
+        } unlock{*this, lockKey, token};
+
+        std::string stale;
+        stale.swap(replied);
+        bool ret = ComputeAndSet(key, compute, opts, replied);
+        if (!ret && hit)
+        {
+            // Keep serving the old value if early refresh failed
+            replied.swap(stale);
+            return true;
+        }
+        return ret;
+    }
+
+    if (hit)
+    {
+        // Another process is refreshing it early
+        return true;
+    }
+
+    // Wait for the process holding the lock
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(opts.maxWaitMs);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(opts.waitMs));
+        if (get(key, replied))
+        {
+            return true;
+        }
+        if (!IsConnected())
+        {
+            return false;
+        }
+    }
+
+    // The holder is too slow or died
+    return ComputeAndSet(key, compute, opts, replied);
+}
+
+bool MiniRedisClient::ComputeAndSet(const std::string& key, const ComputeFunc& compute, 
+    const MiniRedisComputeOptions& opts, std::string& replied) const
+{
+    auto start = std::chrono::steady_clock::now();
+    if (!compute(replied))
+    {
+        replied.clear();
+        return false;
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(flightMutex);
+        if (computeMs.size() >= maxComputeMsEntries)
+        {
+            computeMs.clear();
+        }
+        computeMs[key] = ms;
+    }
+
+    std::string status;
+    return set(key, replied, opts.ttlSeconds, status);
+}
+
+bool MiniRedisClient::incr(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("INCR %b", 
+        key.c_str(), key.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::incrby(const std::string& key, long long int increment, 
+    long long int& replied) const
+{
+    redisReply* reply = execute("INCRBY %b %lld", 
+        key.c_str(), key.size(), increment);
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::info(const std::string& section, 
+    std::map<std::string, std::string>& replied) const
+{
+    redisReply* reply = nullptr;
+    if (section.empty())
+    {
+        reply = execute("INFO");
+    }
+    else
+    {
+        reply = execute("INFO %b", section.c_str(), section.size());
+    }
+
+    replied.clear();
+    std::string text;
+    if (!HandleStringReply(reply, text))
+    {
+        return false;
+    }
+
+    // Lines of field:value, section headers start with #
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && (line.back() == '\r'))
+        {
+            line.pop_back();
+        }
+        std::size_t pos = line.find(':');
+        if (line.empty() || (line[0] == '#') || (pos == std::string::npos))
+        {
+            continue;
+        }
+        replied[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+    return true;
+}
+
+bool MiniRedisClient::keys(const std::string& pattern, std::vector<std::string>& replied) const
+{
+    redisReply* reply = execute("KEYS %b", 
+        pattern.c_str(), pattern.size());
+    return HandleArrayReply(reply, replied);
+}
+
+std::string MiniRedisClient::ping(const std::string& msg) const
+{
+    redisReply* reply = nullptr; 
+    int expectedType = REDIS_REPLY_STRING;
+    if (msg.empty())
+    {
+        // Empty ping command is special case
+        // It uses REDIS_REPLY_STATUS, and the return value is saved in reply->str
+        expectedType = REDIS_REPLY_STATUS; 
+        reply = execute("PING");
+    }
+    else
+    {
+        reply = execute("PING %b", msg.c_str(), msg.size());
+    }
+
+    std::string replied; 
+    if (CheckReplyType(reply, expectedType))
     {
-        argv[index] = strdup(iter.c_str());
-        index++;
+        replied = std::string(reply->str, reply->len);
     }
+    
+    freeReplyObject(reply);
+    reply = nullptr; 
+    return replied; 
+}
 
-    // Length of each argument
-    size_t *argvLen = (size_t*)malloc(sizeof(size_t) * argc);
-    for (int i = 0; i < argc; i++)
+bool MiniRedisClient::rename(const std::string& key, const std::string& newKey, 
+    std::string& replied) const
+{
+    redisReply* reply = execute("RENAME %b %b", 
+        key.c_str(), key.size(), 
+        newKey.c_str(), newKey.size());
+    return HandleStatusReply(reply, replied); 
+}
+
+bool MiniRedisClient::scan(unsigned long long& cursor, uint32_t count, 
+    const std::string& pattern, std::vector<std::string>& replied) const
+{
+    redisReply* reply = pattern.empty() ? 
+        execute("SCAN %llu COUNT %u", cursor, count) : 
+        execute("SCAN %llu COUNT %u MATCH %b", cursor, count, pattern.c_str(), pattern.size());
+    // Array of next cursor, and array of keys
+    bool ret = CheckReplyType(reply, REDIS_REPLY_ARRAY) && (reply->elements == 2) && 
+        (reply->element[0]->type == REDIS_REPLY_STRING) && 
+        (reply->element[1]->type == REDIS_REPLY_ARRAY);
+    if (ret)
     {
-        // Use global strlen, instead of Redis strlen
-        std::cout << argv[i] << std::endl;
-        argvLen[i] = ::strlen(argv[i]);
+        cursor = strtoull(reply->element[0]->str, nullptr, 10);
+        redisReply* keys = reply->element[1];
+        for (std::size_t i = 0; i < keys->elements; i++)
+        {
+            replied.emplace_back(keys->element[i]->str, keys->element[i]->len);
+        }
     }
 
-    redisReply *reply = (redisReply*)redisCommandArgv(context, argc, argv, argvLen);
+    freeReplyObject(reply);
+    return ret;
+}
 
-    // Clean
-    for (int i = 0; i < argc; i++)
+bool MiniRedisClient::select(uint32_t dbIndex, std::string& replied) const
+{
+    redisReply* reply = execute("SELECT %d", dbIndex); 
+    //redisReply* reply = (redisReply*)redisCommand(context, "SELECT %d", dbIndex);
+    return HandleStatusReply(reply, replied);
+}
+
+bool MiniRedisClient::set(const std::string& key, const std::string& value, 
+    uint32_t ttl, std::string& replied) const
+{
+    std::string_view stored = EncodeValue(value);
+    redisReply* reply = nullptr;
+    if (ttl > 0)
     {
-        free((void*)argv[i]);
+        reply = execute("SETEX %b %d %b", 
+            key.c_str(), key.size(), ttl, 
+            stored.data(), stored.size()); 
+    }
+    else
+    {
+        reply = execute("SET %b %b", 
+            key.c_str(), key.size(), 
+            stored.data(), stored.size()); 
     }
-    free((void*)argv);
-    free((void*)argvLen);
 
-    return reply; 
+    return HandleStatusReply(reply, replied);
 }
 
-bool MiniRedisClient::append(const std::string& key, const std::string& value, 
-    long long int& replied) const
+bool MiniRedisClient::SetRaw(const std::string& key, const char* value, std::size_t len, 
+    uint32_t ttl, std::string& replied) const
 {
-    redisReply* reply = execute("APPEND %b %b", 
-        key.c_str(), key.size(), 
-        value.c_str(), value.size());
+    redisReply* reply = nullptr;
+    if (ttl > 0)
+    {
+        reply = execute("SETEX %b %d %b", 
+            key.c_str(), key.size(), ttl, value, len); 
+    }
+    else
+    {
+        reply = execute("SET %b %b", 
+            key.c_str(), key.size(), value, len); 
+    }
+    
+    return HandleStatusReply(reply, replied);
+}
+
+bool MiniRedisClient::strlen(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("STRLEN %b", 
+        key.c_str(), key.size());
     return HandleIntegerReply(reply, replied); 
 }
 
-bool MiniRedisClient::auth(const std::string& password, std::string& replied) const
+bool MiniRedisClient::ttl(const std::string& key, long long int& replied) const
 {
-    redisReply* reply = execute("AUTH %b", 
-        password.c_str(), password.size()); 
+    redisReply* reply = execute("TTL %b", 
+        key.c_str(), key.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::type(const std::string& key, std::string& replied) const
+{
+    // TODO: Why %b doesn't work for this command? 
+    //redisReply* reply = execute("TYPE %b %b", key.c_str(), key.size());
+    redisReply* reply = execute("TYPE %s", key.c_str());
     return HandleStatusReply(reply, replied);
 }
 
-bool MiniRedisClient::client_getname(std::string& replied) const
+bool MiniRedisClient::hdel(const std::string& key, const std::string& field,
+     long long int& replied) const
 {
-    redisReply* reply = execute("CLIENT GETNAME"); 
+    redisReply* reply = execute("HDEL %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::hexists(const std::string& key, const std::string& field, 
+    long long int& replied)
+{
+    redisReply* reply = execute("HEXISTS %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::hget(const std::string& key, const std::string& field, 
+    std::string& replied) const
+{
+    redisReply* reply = execute("HGET %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size());
+    return HandleValueReply(reply, replied);
+}
+
+bool MiniRedisClient::hgetall(const std::string& key, std::map<std::string, 
+    std::string>& replied) const
+{
+    redisReply* reply = execute("HGETALL %b", 
+        key.c_str(), key.size());
+    return HandleMapReplyImpl(reply, replied, codecLayer.get());
+}
+
+bool MiniRedisClient::hgetall(const std::string& key, std::unordered_map<std::string, 
+    std::string>& replied) const
+{
+    redisReply* reply = execute("HGETALL %b", 
+        key.c_str(), key.size());
+    return HandleMapReplyImpl(reply, replied, codecLayer.get());
+}
+
+bool MiniRedisClient::hincrby(const std::string& key, const std::string& field, 
+    long long int increment, long long int& replied) const
+{
+    redisReply* reply = execute("HINCRBY %b %b %lld", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size(), increment);
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::hkeys(const std::string& key, std::vector<std::string>& replied) const
+{
+    redisReply* reply = execute("HKEYS %b", 
+        key.c_str(), key.size());
+    return HandleArrayReply(reply, replied);
+}
+
+bool MiniRedisClient::hlen(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("HLEN %b", 
+        key.c_str(), key.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::hscan(const std::string& key, unsigned long long& cursor, 
+    uint32_t count, std::unordered_map<std::string, std::string>& replied) const
+{
+    redisReply* reply = execute("HSCAN %b %llu COUNT %u", 
+        key.c_str(), key.size(), cursor, count);
+    // Array of next cursor, and array of field, value, field, value...
+    bool ret = CheckReplyType(reply, REDIS_REPLY_ARRAY) && (reply->elements == 2) && 
+        (reply->element[0]->type == REDIS_REPLY_STRING) && 
+        (reply->element[1]->type == REDIS_REPLY_ARRAY) && 
+        (reply->element[1]->elements % 2 == 0);
+    if (ret)
+    {
+        cursor = strtoull(reply->element[0]->str, nullptr, 10);
+        redisReply* items = reply->element[1];
+        for (std::size_t i = 0; ret && (i < items->elements); i += 2)
+        {
+            redisReply* field = items->element[i];
+            redisReply* value = items->element[i + 1];
+            std::string& x = replied[std::string(field->str, field->len)];
+            if (codecLayer)
+            {
+                ret = codecLayer->Decode(value->str, value->len, x);
+            }
+            else
+            {
+                x.assign(value->str, value->len);
+            }
+        }
+    }
+
+    freeReplyObject(reply);
+    return ret;
+}
+
+bool MiniRedisClient::hset(const std::string& key, const std::string& field, 
+    const std::string& value, long long int& replied) const
+{
+    std::string_view stored = EncodeValue(value);
+    redisReply* reply = execute("HSET %b %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size(), 
+        stored.data(), stored.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::HSetRaw(const std::string& key, const std::string& field, 
+    const char* value, std::size_t len, long long int& replied) const
+{
+    redisReply* reply = execute("HSET %b %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size(), 
+        value, len);
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::hvals(const std::string& key, std::vector<std::string>& replied) const
+{
+    redisReply* reply = execute("HVALS %b", 
+        key.c_str(), key.size());
+    return HandleArrayReply(reply, replied);
+}
+
+bool MiniRedisClient::lindex(const std::string& key, int32_t index, std::string& replied) const
+{
+    redisReply* reply = execute("LINDEX %b %d", 
+        key.c_str(), key.size(), index);
     return HandleStringReply(reply, replied);
 }
 
-bool MiniRedisClient::client_setname(const std::string& name, std::string& replied) const
+bool MiniRedisClient::linsert_after(const std::string& key, const std::string& pivot, 
+    const std::string& element, long long int& replied) const
 {
-    redisReply* reply = execute("CLIENT SETNAME %b", 
-        name.c_str(), name.size()); 
-    return HandleStatusReply(reply, replied);
+    redisReply* reply = execute("LINSERT %b AFTER %b %b", 
+        key.c_str(), key.size(), 
+        pivot.c_str(), pivot.size(), 
+        element.c_str(), element.size());
+    return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::decr(const std::string& key, long long int& replied) const
+bool MiniRedisClient::linsert_before(const std::string& key, const std::string& pivot, 
+    const std::string& element, long long int& replied) const
 {
-    redisReply* reply = execute("DECR %b", 
+    redisReply* reply = execute("LINSERT %b BEFORE %b %b", 
+        key.c_str(), key.size(), 
+        pivot.c_str(), pivot.size(), 
+        element.c_str(), element.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::llen(const std::string& key, long long int& replied) const
+{
+    redisReply* reply = execute("LLEN %b", 
         key.c_str(), key.size());
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::del(const std::string& key, long long int& replied) const
+bool MiniRedisClient::lpop(const std::string& key, std::string& replied) const
 {
-    redisReply* reply = execute("DEL %b",  
+    redisReply* reply = execute("LPOP %b", 
         key.c_str(), key.size());
-    return HandleIntegerReply(reply, replied); 
+    return HandleStringReply(reply, replied);
+}
+
+bool MiniRedisClient::lpush(const std::string& key, const std::string& element, 
+    long long int& replied) const
+{
+    redisReply* reply = execute("LPUSH %b %b", 
+        key.c_str(), key.size(), 
+        element.c_str(), element.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::lrem(const std::string& key, int32_t count, 
+    const std::string& element, long long int& replied) const
+{
+    redisReply* reply = execute("LREM %b %d %b", 
+        key.c_str(), key.size(), count, 
+        element.c_str(), element.size());
+    return HandleIntegerReply(reply, replied);
+}
+
+bool MiniRedisClient::lset(const std::string& key, int32_t index, 
+    const std::string& element, std::string& replied) const
+{
+    redisReply* reply = execute("LSET %b %d %b", 
+        key.c_str(), key.size(), index, 
+        element.c_str(), element.size());
+    return HandleStatusReply(reply, replied);
 }
 
-bool MiniRedisClient::del(const std::vector<std::string>& keys, long long int& replied) const
+bool MiniRedisClient::sadd(const std::string& key, const std::string& member, 
+    long long int& replied) const
 {
-    redisReply* reply = execute("DEL", keys);
-    return HandleIntegerReply(reply, replied); 
+    redisReply* reply = execute("SADD %b %b", 
+        key.c_str(), key.size(), 
+        member.c_str(), member.size());
+    return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::exists(const std::string& key, long long int& replied) const
+bool MiniRedisClient::scard(const std::string& key, long long int& replied) const
 {
-    redisReply* reply = execute("EXISTS %b", 
+    redisReply* reply = execute("SCARD %b", 
         key.c_str(), key.size());
-    return HandleIntegerReply(reply, replied); 
+    return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::expire(const std::string& key, uint32_t seconds, 
+bool MiniRedisClient::sismember(const std::string& key, const std::string& member, 
     long long int& replied) const
 {
-    redisReply* reply = execute("EXPIRE %b %d", 
-        key.c_str(), key.size(), seconds);
-    return HandleIntegerReply(reply, replied); 
+    redisReply* reply = execute("SISMEMBER %b %b", 
+        key.c_str(), key.size(), 
+        member.c_str(), member.size());
+    return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::get(const std::string& key, std::string& replied) const
+bool MiniRedisClient::smembers(const std::string& key, std::vector<std::string>& replied) const
 {
-    redisReply* reply = execute("GET %b", 
+    redisReply* reply = execute("SMEMBERS %b", 
         key.c_str(), key.size());
-    return HandleStringReply(reply, replied);
+    return HandleArrayReply(reply, replied);
 }
 
-bool MiniRedisClient::incr(const std::string& key, long long int& replied) const
+bool MiniRedisClient::srem(const std::string& key, const std::string& member, 
+    long long int& replied) const
 {
-    redisReply* reply = execute("INCR %b", 
-        key.c_str(), key.size());
+    redisReply* reply = execute("SREM %b %b", 
+        key.c_str(), key.size(), 
+        member.c_str(), member.size());
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::keys(const std::string& pattern, std::vector<std::string>& replied) const
+bool MiniRedisClient::get_chunked(const std::string& key, ChunkCbFunc cb, 
+    std::size_t chunkSize, std::size_t window) const
 {
-    redisReply* reply = execute("KEYS %b", 
-        pattern.c_str(), pattern.size());
-    return HandleArrayReply(reply, replied);
-}
+    if (!context || !cb || !chunkSize)
+    {
+        return false;
+    }
 
-std::string MiniRedisClient::ping(const std::string& msg) const
-{
-    redisReply* reply = nullptr; 
-    int expectedType = REDIS_REPLY_STRING;
-    if (msg.empty())
+    // STRLEN is 0 for both missing key and empty value, so EXISTS in the same round trip
+    if (!AppendPrepared(existsCmd, {key}))
     {
-        // Empty ping command is special case
-        // It uses REDIS_REPLY_STATUS, and the return value is saved in reply->str
-        expectedType = REDIS_REPLY_STATUS; 
-        reply = execute("PING");
+        return false;
     }
-    else
+    if (!AppendPrepared(strlenCmd, {key}))
     {
-        reply = execute("PING %b", msg.c_str(), msg.size());
+        freeReplyObject(PipelineGetReply());
+        return false;
+    }
+    long long int exists = 0;
+    long long int total = 0;
+    bool existsOk = HandleIntegerReply(PipelineGetReply(), exists);
+    bool strlenOk = HandleIntegerReply(PipelineGetReply(), total);
+    if (!existsOk || !strlenOk || !exists)
+    {
+        return false;
     }
 
-    std::string replied; 
-    if (CheckReplyType(reply, expectedType))
+    window = window ? window : 1;
+    std::size_t chunks = ((std::size_t)total + chunkSize - 1) / chunkSize;
+    std::size_t sent = 0;
+    std::size_t received = 0;
+    bool ret = true;
+    while (received < sent || sent < chunks)
     {
-        replied = std::string(reply->str, reply->len);
+        // Keep the window full
+        while ((sent < chunks) && (sent - received < window))
+        {
+            char start[24];
+            char end[24];
+            std::size_t offset = sent * chunkSize;
+            auto startRes = std::to_chars(start, start + sizeof(start), offset);
+            auto endRes = std::to_chars(end, end + sizeof(end), offset + chunkSize - 1);
+            if (!AppendPrepared(getrangeCmd, {key, 
+                std::string_view(start, startRes.ptr - start), 
+                std::string_view(end, endRes.ptr - end)}))
+            {
+                return false;
+            }
+            sent++;
+        }
+
+        redisReply* reply = PipelineGetReply();
+        received++;
+        if (!reply)
+        {
+            // The connection is broken, no more reply
+            return false;
+        }
+
+        // The chunk is passed without copy
+        if (!CheckReplyType(reply, REDIS_REPLY_STRING) || !cb(reply->str, reply->len))
+        {
+            // Stop sending, but the replies in flight have to be drained
+            ret = false;
+            chunks = sent;
+        }
+        freeReplyObject(reply);
     }
-    
-    freeReplyObject(reply);
-    reply = nullptr; 
-    return replied; 
+
+    return ret;
 }
 
-bool MiniRedisClient::rename(const std::string& key, const std::string& newKey, 
-    std::string& replied) const
+bool MiniRedisClient::get_chunked(const std::string& key, char* buf, std::size_t bufSize, 
+    std::size_t& replied, std::size_t chunkSize, std::size_t window) const
 {
-    redisReply* reply = execute("RENAME %b %b", 
-        key.c_str(), key.size(), 
-        newKey.c_str(), newKey.size());
-    return HandleStatusReply(reply, replied); 
+    replied = 0;
+    return get_chunked(key, [&](const char* data, std::size_t len) {
+        if (len > bufSize - replied)
+        {
+            return false;
+        }
+        memcpy(buf + replied, data, len);
+        replied += len;
+        return true;
+    }, chunkSize, window);
 }
 
-bool MiniRedisClient::select(uint32_t dbIndex, std::string& replied) const
+bool MiniRedisClient::get_chunked(const std::string& key, int fd, 
+    std::size_t chunkSize, std::size_t window) const
 {
-    redisReply* reply = execute("SELECT %d", dbIndex); 
-    //redisReply* reply = (redisReply*)redisCommand(context, "SELECT %d", dbIndex);
-    return HandleStatusReply(reply, replied);
+    return get_chunked(key, [fd](const char* data, std::size_t len) {
+        while (len > 0)
+        {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }, chunkSize, window);
 }
 
-bool MiniRedisClient::set(const std::string& key, const std::string& value, 
-    uint32_t ttl, std::string& replied) const
+bool MiniRedisClient::set_chunked(const std::string& key, std::istream& input, uint32_t ttl, 
+    std::size_t chunkSize, std::size_t window) const
 {
-    redisReply* reply = nullptr;
-    if (ttl > 0)
+    if (!chunkSize)
     {
-        reply = execute("SETEX %b %d %b", 
-            key.c_str(), key.size(), ttl, 
-            value.c_str(), value.size()); 
+        return false;
     }
-    else
+
+    // The buffer is reused for each chunk, since the command is copied into the output buffer
+    std::vector<char> buf(chunkSize);
+    bool first = true;
+    return SetChunks(key, [&](const char*& data, std::size_t& len) {
+        if (!input)
+        {
+            return false;
+        }
+        input.read(buf.data(), buf.size());
+        len = (std::size_t)input.gcount();
+        data = buf.data();
+        // Empty input still creates an empty value
+        bool more = (len > 0) || first;
+        first = false;
+        return more;
+    }, ttl, window);
+}
+
+bool MiniRedisClient::set_chunked_file(const std::string& key, const std::string& path, 
+    uint32_t ttl, std::size_t chunkSize, std::size_t window) const
+{
+    if (!chunkSize)
     {
-        reply = execute("SET %b %b", 
-            key.c_str(), key.size(), 
-            value.c_str(), value.size()); 
+        return false;
     }
 
-    return HandleStatusReply(reply, replied);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        MINIREDIS_LOG_ERROR("Failed to open %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    std::size_t size = (std::size_t)st.st_size;
+    const char* mapped = nullptr;
+    if (size > 0)
+    {
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+        mapped = static_cast<const char*>(addr);
+    }
+    ::close(fd);
+
+    std::size_t offset = 0;
+    bool first = true;
+    bool ret = SetChunks(key, [&](const char*& data, std::size_t& len) {
+        if ((offset >= size) && !first)
+        {
+            return false;
+        }
+        first = false;
+        data = mapped + offset;
+        len = std::min(chunkSize, size - offset);
+        offset += len;
+        return true;
+    }, ttl, window);
+
+    if (mapped)
+    {
+        munmap((void*)mapped, size);
+    }
+    return ret;
 }
 
-bool MiniRedisClient::set(const std::string& key, long long int value, 
-    uint32_t ttl, std::string& replied) const
+bool MiniRedisClient::SetChunks(const std::string& key, 
+    const std::function<bool(const char*&, std::size_t&)>& next, 
+    uint32_t ttl, std::size_t window) const
 {
-    redisReply* reply = nullptr;
-    if (ttl > 0)
+    if (!context)
     {
-        reply = execute("SETEX %b %d %d", 
-            key.c_str(), key.size(), ttl, value); 
+        return false;
     }
-    else
+
+    window = window ? window : 1;
+    std::size_t sent = 0;
+    std::size_t received = 0;
+    bool more = true;
+    bool ret = true;
+    while (true)
     {
-        reply = execute("SET %b %d", 
-            key.c_str(), key.size(), value); 
+        // Keep the window full, commands on one connection are executed in order
+        while (more && (sent - received < window))
+        {
+            const char* data = nullptr;
+            std::size_t len = 0;
+            if (!next(data, len))
+            {
+                more = false;
+                break;
+            }
+
+            std::string_view chunk(data ? data : "", len);
+            bool appended = false;
+            if (sent > 0)
+            {
+                appended = AppendPrepared(appendCmd, {key, chunk});
+            }
+            else if (ttl > 0)
+            {
+                // TTL with the first chunk, APPEND keeps it
+                char ms[24];
+                auto res = std::to_chars(ms, ms + sizeof(ms), (uint64_t)ttl * 1000);
+                appended = AppendPrepared(setPxCmd, {key, chunk, std::string_view(ms, res.ptr - ms)});
+            }
+            else
+            {
+                appended = AppendPrepared(setCmd, {key, chunk});
+            }
+            if (!appended)
+            {
+                // Drain the replies in flight, so that the connection stays in sync
+                more = false;
+                ret = false;
+                break;
+            }
+            sent++;
+        }
+
+        if (received == sent)
+        {
+            break;
+        }
+
+        redisReply* reply = PipelineGetReply();
+        int expectedType = (received == 0) ? REDIS_REPLY_STATUS : REDIS_REPLY_INTEGER;
+        received++;
+        if (!reply)
+        {
+            return false;
+        }
+        if (!CheckReplyType(reply, expectedType))
+        {
+            // Stop sending, and drain the replies in flight
+            ret = false;
+            more = false;
+        }
+        freeReplyObject(reply);
     }
-    
-    return HandleStatusReply(reply, replied);
+
+    return ret && (sent > 0);
 }
 
-bool MiniRedisClient::strlen(const std::string& key, long long int& replied) const
+bool MiniRedisClient::subscribe(const std::string& channel) const
 {
-    redisReply* reply = execute("STRLEN %b", 
-        key.c_str(), key.size());
-    return HandleIntegerReply(reply, replied); 
+    return SendPushCommand("SUBSCRIBE", channel);
 }
 
-bool MiniRedisClient::ttl(const std::string& key, long long int& replied) const
+bool MiniRedisClient::unsubscribe(const std::string& channel) const
 {
-    redisReply* reply = execute("TTL %b", 
-        key.c_str(), key.size());
-    return HandleIntegerReply(reply, replied);
+    return SendPushCommand("UNSUBSCRIBE", channel);
 }
 
-bool MiniRedisClient::type(const std::string& key, std::string& replied) const
+bool MiniRedisClient::SendPushCommand(const char* command, const std::string& channel) const
 {
-    // TODO: Why %b doesn't work for this command? 
-    //redisReply* reply = execute("TYPE %b %b", key.c_str(), key.size());
-    redisReply* reply = execute("TYPE %s", key.c_str());
-    return HandleStatusReply(reply, replied);
+    if (!context || (protocol != 3) || channel.empty())
+    {
+        return false;
+    }
+
+    // The confirmation is a push message, 
+    // so don't wait for it, otherwise redisGetReply() blocks for an in-band reply
+    const char* argv[2] = {command, channel.c_str()};
+    size_t argvLen[2] = {::strlen(command), channel.size()};
+    if (redisAppendCommandArgv(context, 2, argv, argvLen) != REDIS_OK)
+    {
+        return false;
+    }
+
+    return PipelineFlush();
 }
 
-bool MiniRedisClient::hdel(const std::string& key, const std::string& field,
-     long long int& replied) const
+int MiniRedisClient::ProcessPush(uint32_t timeoutMs) const
 {
-    redisReply* reply = execute("HDEL %b %b", 
-        key.c_str(), key.size(), 
-        field.c_str(), field.size());
-    return HandleIntegerReply(reply, replied);
+    if (!context)
+    {
+        return -1;
+    }
+
+    int count = 0;
+    pollfd pfd = {context->fd, POLLIN, 0};
+    int ret = poll(&pfd, 1, (int)timeoutMs);
+    if (ret < 0)
+    {
+        return -1;
+    }
+    if ((ret > 0) && (redisBufferRead(context) != REDIS_OK))
+    {
+        return -1;
+    }
+
+    // Deliver every push message buffered by the reader
+    while (true)
+    {
+        redisReply* reply = nullptr;
+        if (redisGetReplyFromReader(context, (void**)&reply) != REDIS_OK)
+        {
+            return -1;
+        }
+        if (!reply)
+        {
+            break;
+        }
+
+        if (reply->type == REDIS_REPLY_PUSH)
+        {
+            count++;
+        }
+        OnPushMsg(context->privdata, reply);
+    }
+
+    return count;
 }
 
-bool MiniRedisClient::hexists(const std::string& key, const std::string& field, 
-    long long int& replied)
+// Callback when push message is received, the reply should be released here
+void MiniRedisClient::OnPushMsg(void* privData, void* replyData)
 {
-    redisReply* reply = execute("HEXISTS %b %b", 
-        key.c_str(), key.size(), 
-        field.c_str(), field.size());
-    return HandleIntegerReply(reply, replied);
+    MiniRedisClient* pThis = reinterpret_cast<MiniRedisClient*>(privData);
+    redisReply* reply = reinterpret_cast<redisReply*>(replyData);
+    if (!pThis || !reply) 
+    {
+        freeReplyObject(reply);
+        return;
+    }
+
+    if (reply->type != REDIS_REPLY_PUSH)
+    {
+        MINIREDIS_LOG_WARN("Unexpected in-band reply while idle: %d", reply->type);
+    }
+    else if (pThis->pushCb)
+    {
+        std::vector<std::string> items;
+        AppendReplyStrings(reply, items);
+        pThis->pushCb(items);
+    }
+    freeReplyObject(reply);
 }
 
-bool MiniRedisClient::hget(const std::string& key, const std::string& field, 
-    std::string& replied) const
+bool MiniRedisClient::zadd(const std::string& key, const std::string& member, double score, 
+    int flags, long long int& replied) const
 {
-    redisReply* reply = execute("HGET %b %b", 
-        key.c_str(), key.size(), 
-        field.c_str(), field.size());
-    return HandleStringReply(reply, replied);
+    std::vector<std::pair<std::string, double>> members = {{member, score}};
+    return zadd(key, members, flags, replied);
 }
 
-bool MiniRedisClient::hgetall(const std::string& key, std::map<std::string, 
-    std::string>& replied) const
+bool MiniRedisClient::zadd(const std::string& key, 
+    const std::vector<std::pair<std::string, double>>& members, 
+    int flags, long long int& replied) const
 {
-    redisReply* reply = execute("HGETALL %b", 
-        key.c_str(), key.size());
-    replied.clear();
-    std::vector<std::string> items; 
-    bool ret = HandleArrayReply(reply, items);
-    if (!ret)
+    if (members.empty())
     {
+        replied = 0;
         return false;
     }
 
-    // Convert vector to map
-    std::size_t sz = items.size(); 
-    for (size_t i = 0; i < sz; )
+    std::vector<std::string_view> argv = {"ZADD", key};
+    if (flags & ZADD_NX)
     {
-        std::string itemKey = items[i];
-        std::string itemVal = items[i+1];
-        replied.emplace(std::make_pair(itemKey, itemVal));
-        i += 2;
+        argv.push_back("NX");
+    }
+    if (flags & ZADD_XX)
+    {
+        argv.push_back("XX");
+    }
+    if (flags & ZADD_GT)
+    {
+        argv.push_back("GT");
+    }
+    if (flags & ZADD_LT)
+    {
+        argv.push_back("LT");
+    }
+    if (flags & ZADD_CH)
+    {
+        argv.push_back("CH");
     }
-    return ret; 
-}
 
-bool MiniRedisClient::hkeys(const std::string& key, std::vector<std::string>& replied) const
-{
-    redisReply* reply = execute("HKEYS %b", 
-        key.c_str(), key.size());
-    return HandleArrayReply(reply, replied);
-}
+    // All scores are encoded into one buffer
+    std::vector<char> scores(members.size() * MiniRedisNumeric::MaxChars);
+    char* pos = scores.data();
+    for (auto& x : members)
+    {
+        std::size_t len = MiniRedisNumeric::ToChars(pos, MiniRedisNumeric::MaxChars, x.second);
+        if (len == 0)
+        {
+            return false;
+        }
+        argv.emplace_back(pos, len);
+        argv.emplace_back(x.first);
+        pos += MiniRedisNumeric::MaxChars;
+    }
 
-bool MiniRedisClient::hlen(const std::string& key, long long int& replied) const
-{
-    redisReply* reply = execute("HLEN %b", 
-        key.c_str(), key.size());
+    redisReply* reply = ExecuteArgv(argv);
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::hset(const std::string& key, const std::string& field, 
-    const std::string& value, long long int& replied) const
+bool MiniRedisClient::zcard(const std::string& key, long long int& replied) const
 {
-    redisReply* reply = execute("HSET %b %b %b", 
-        key.c_str(), key.size(), 
-        field.c_str(), field.size(), 
-        value.c_str(), value.size());
+    redisReply* reply = execute("ZCARD %b", 
+        key.c_str(), key.size());
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::hvals(const std::string& key, std::vector<std::string>& replied) const
+bool MiniRedisClient::zincrby(const std::string& key, double increment, 
+    const std::string& member, double& replied) const
 {
-    redisReply* reply = execute("HVALS %b", 
-        key.c_str(), key.size());
-    return HandleArrayReply(reply, replied);
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), increment);
+    if (len == 0)
+    {
+        return false;
+    }
+    redisReply* reply = execute("ZINCRBY %b %b %b", 
+        key.c_str(), key.size(), 
+        buf, len, 
+        member.c_str(), member.size());
+    return HandleDoubleReply(reply, replied);
 }
 
-bool MiniRedisClient::lindex(const std::string& key, int32_t index, std::string& replied) const
+bool MiniRedisClient::zmscore(const std::string& key, const std::vector<std::string>& members, 
+    std::vector<double>& replied) const
 {
-    redisReply* reply = execute("LINDEX %b %d", 
-        key.c_str(), key.size(), index);
-    return HandleStringReply(reply, replied);
+    replied.clear();
+    if (members.empty())
+    {
+        return false;
+    }
+
+    std::vector<std::string_view> argv = {"ZMSCORE", key};
+    argv.insert(argv.end(), members.begin(), members.end());
+    redisReply* reply = ExecuteArgv(argv);
+    if (!reply || !IsArrayType(reply->type))
+    {
+        freeReplyObject(reply);
+        return false;
+    }
+
+    replied.reserve(reply->elements);
+    for (std::size_t i = 0; i < reply->elements; i++)
+    {
+        double score = std::numeric_limits<double>::quiet_NaN();
+        ReplyToScore(reply->element[i], score);
+        replied.push_back(score);
+    }
+    freeReplyObject(reply);
+    return true;
 }
 
-bool MiniRedisClient::linsert_after(const std::string& key, const std::string& pivot, 
-    const std::string& element, long long int& replied) const
+bool MiniRedisClient::zpopmax(const std::string& key, uint32_t count, 
+    std::vector<std::pair<std::string, double>>& replied) const
 {
-    redisReply* reply = execute("LINSERT %b AFTER %b %b", 
-        key.c_str(), key.size(), 
-        pivot.c_str(), pivot.size(), 
-        element.c_str(), element.size());
-    return HandleIntegerReply(reply, replied);
+    return ZPop("ZPOPMAX", key, count, replied);
 }
 
-bool MiniRedisClient::linsert_before(const std::string& key, const std::string& pivot, 
-    const std::string& element, long long int& replied) const
+bool MiniRedisClient::zpopmin(const std::string& key, uint32_t count, 
+    std::vector<std::pair<std::string, double>>& replied) const
 {
-    redisReply* reply = execute("LINSERT %b BEFORE %b %b", 
-        key.c_str(), key.size(), 
-        pivot.c_str(), pivot.size(), 
-        element.c_str(), element.size());
-    return HandleIntegerReply(reply, replied);
+    return ZPop("ZPOPMIN", key, count, replied);
 }
 
-bool MiniRedisClient::llen(const std::string& key, long long int& replied) const
+bool MiniRedisClient::ZPop(const char* command, const std::string& key, uint32_t count, 
+    std::vector<std::pair<std::string, double>>& replied) const
 {
-    redisReply* reply = execute("LLEN %b", 
-        key.c_str(), key.size());
-    return HandleIntegerReply(reply, replied);
+    replied.clear();
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), count);
+    if (len == 0)
+    {
+        return false;
+    }
+    redisReply* reply = ExecuteArgv({command, key, std::string_view(buf, len)});
+    if (reply && IsArrayType(reply->type))
+    {
+        replied.reserve(reply->elements);
+    }
+    bool ret = ForEachScored(reply, [&replied](std::string_view member, double score) {
+        replied.emplace_back(member, score);
+    });
+    freeReplyObject(reply);
+    return ret;
 }
 
-bool MiniRedisClient::lpop(const std::string& key, std::string& replied) const
+bool MiniRedisClient::zrange(const std::string& key, const std::string& start, 
+    const std::string& stop, std::vector<std::string>& replied, MiniRedisZRangeBy by, 
+    bool rev, long long int offset, long long int count) const
 {
-    redisReply* reply = execute("LPOP %b", 
-        key.c_str(), key.size());
-    return HandleStringReply(reply, replied);
+    redisReply* reply = ExecuteZRange(key, start, stop, by, rev, offset, count, false);
+    return HandleArrayReply(reply, replied);
 }
 
-bool MiniRedisClient::lpush(const std::string& key, const std::string& element, 
-    long long int& replied) const
+bool MiniRedisClient::zrange(const std::string& key, const std::string& start, 
+    const std::string& stop, std::vector<std::pair<std::string, double>>& replied, 
+    MiniRedisZRangeBy by, bool rev, long long int offset, long long int count) const
 {
-    redisReply* reply = execute("LPUSH %b %b", 
-        key.c_str(), key.size(), 
-        element.c_str(), element.size());
-    return HandleIntegerReply(reply, replied);
+    replied.clear();
+    redisReply* reply = ExecuteZRange(key, start, stop, by, rev, offset, count, true);
+    if (reply && IsArrayType(reply->type))
+    {
+        // One allocation for the whole page, members within SSO need no more
+        bool nested = (reply->elements > 0) && (reply->element[0]->type == REDIS_REPLY_ARRAY);
+        replied.reserve(nested ? reply->elements : reply->elements / 2);
+    }
+    bool ret = ForEachScored(reply, [&replied](std::string_view member, double score) {
+        replied.emplace_back(member, score);
+    });
+    freeReplyObject(reply);
+    return ret;
 }
 
-bool MiniRedisClient::lrem(const std::string& key, int32_t count, 
-    const std::string& element, long long int& replied) const
+bool MiniRedisClient::zrange(const std::string& key, const std::string& start, 
+    const std::string& stop, MiniRedisScoredView& replied, MiniRedisZRangeBy by, 
+    bool rev, long long int offset, long long int count) const
 {
-    redisReply* reply = execute("LREM %b %d %b", 
-        key.c_str(), key.size(), count, 
-        element.c_str(), element.size());
-    return HandleIntegerReply(reply, replied);
+    redisReply* reply = ExecuteZRange(key, start, stop, by, rev, offset, count, true);
+    replied.Reset(reply);
+    if (reply && IsArrayType(reply->type))
+    {
+        bool nested = (reply->elements > 0) && (reply->element[0]->type == REDIS_REPLY_ARRAY);
+        replied.items.reserve(nested ? reply->elements : reply->elements / 2);
+    }
+    bool ret = ForEachScored(reply, [&replied](std::string_view member, double score) {
+        replied.items.emplace_back(member, score);
+    });
+    if (!ret)
+    {
+        replied.Reset();
+    }
+    return ret;
 }
 
-bool MiniRedisClient::lset(const std::string& key, int32_t index, 
-    const std::string& element, std::string& replied) const
+redisReply* MiniRedisClient::ExecuteZRange(const std::string& key, const std::string& start, 
+    const std::string& stop, MiniRedisZRangeBy by, bool rev, 
+    long long int offset, long long int count, bool withScores) const
 {
-    redisReply* reply = execute("LSET %b %d %b", 
-        key.c_str(), key.size(), index, 
-        element.c_str(), element.size());
-    return HandleStatusReply(reply, replied);
+    std::vector<std::string_view> argv = {"ZRANGE", key, start, stop};
+    if (by == ZRANGE_BY_SCORE)
+    {
+        argv.push_back("BYSCORE");
+    }
+    else if (by == ZRANGE_BY_LEX)
+    {
+        argv.push_back("BYLEX");
+    }
+    if (rev)
+    {
+        argv.push_back("REV");
+    }
+
+    // LIMIT is only allowed with BYSCORE and BYLEX
+    char offsetBuf[MiniRedisNumeric::MaxChars];
+    char countBuf[MiniRedisNumeric::MaxChars];
+    if ((by != ZRANGE_BY_RANK) && ((offset != 0) || (count >= 0)))
+    {
+        std::size_t offsetLen = MiniRedisNumeric::ToChars(offsetBuf, sizeof(offsetBuf), offset);
+        std::size_t countLen = MiniRedisNumeric::ToChars(countBuf, sizeof(countBuf), count);
+        if ((offsetLen == 0) || (countLen == 0))
+        {
+            return nullptr;
+        }
+        argv.push_back("LIMIT");
+        argv.emplace_back(offsetBuf, offsetLen);
+        argv.emplace_back(countBuf, countLen);
+    }
+    if (withScores)
+    {
+        argv.push_back("WITHSCORES");
+    }
+
+    return ExecuteArgv(argv);
 }
 
-bool MiniRedisClient::sadd(const std::string& key, const std::string& member, 
+bool MiniRedisClient::zrank(const std::string& key, const std::string& member, 
     long long int& replied) const
 {
-    redisReply* reply = execute("SADD %b %b", 
+    redisReply* reply = execute("ZRANK %b %b", 
         key.c_str(), key.size(), 
         member.c_str(), member.size());
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::scard(const std::string& key, long long int& replied) const
+bool MiniRedisClient::zrevrank(const std::string& key, const std::string& member, 
+    long long int& replied) const
 {
-    redisReply* reply = execute("SCARD %b", 
-        key.c_str(), key.size());
+    redisReply* reply = execute("ZREVRANK %b %b", 
+        key.c_str(), key.size(), 
+        member.c_str(), member.size());
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::sismember(const std::string& key, const std::string& member, 
+bool MiniRedisClient::zrem(const std::string& key, const std::string& member, 
     long long int& replied) const
 {
-    redisReply* reply = execute("SISMEMBER %b %b", 
+    redisReply* reply = execute("ZREM %b %b", 
         key.c_str(), key.size(), 
         member.c_str(), member.size());
     return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::smembers(const std::string& key, std::vector<std::string>& replied) const
+bool MiniRedisClient::zrem(const std::string& key, const std::vector<std::string>& members, 
+    long long int& replied) const
 {
-    redisReply* reply = execute("SMEMBERS %b", 
-        key.c_str(), key.size());
-    return HandleArrayReply(reply, replied);
+    std::vector<std::string_view> argv = {"ZREM", key};
+    argv.insert(argv.end(), members.begin(), members.end());
+    redisReply* reply = ExecuteArgv(argv);
+    return HandleIntegerReply(reply, replied);
 }
 
-bool MiniRedisClient::srem(const std::string& key, const std::string& member, 
-    long long int& replied) const
+bool MiniRedisClient::zscore(const std::string& key, const std::string& member, 
+    double& replied) const
 {
-    redisReply* reply = execute("SREM %b %b", 
+    redisReply* reply = execute("ZSCORE %b %b", 
         key.c_str(), key.size(), 
         member.c_str(), member.size());
-    return HandleIntegerReply(reply, replied);
+    return HandleDoubleReply(reply, replied);
 }
 
 bool MiniRedisClient::pipeline(const std::vector<std::string>& commands, 
@@ -656,13 +2536,66 @@ bool MiniRedisClient::pipeline(const std::vector<std::string>& commands,
     }
 
     // Build the batch pipeline
-    for (auto& x : commands)
+    AppendPipeline(commands);
+
+    // Get response for each command
+    GetPipelineReplies(commands.size(), replied);
+    return true;
+}
+
+bool MiniRedisClient::pipeline(const MiniRedisPreparedCommand& command, 
+    const std::vector<std::vector<std::string>>& args, std::vector<std::string>& replied) const
+{
+    replied.clear();
+
+    if (!context || args.empty())
     {
-        redisAppendCommand(context, x.c_str());
+        return false;
     }
 
-    // Get response for each command
-    for (std::size_t i = 0; i < commands.size(); i++)
+    // Validate all before appending any, so that nothing is left unread on failure
+    if (!command.IsValid())
+    {
+        return false;
+    }
+    for (auto& x : args)
+    {
+        if (x.size() != command.GetArgCount())
+        {
+            MINIREDIS_LOG_WARN("Wrong number of args for %s: %zu", command.GetFormat().c_str(), x.size());
+            return false;
+        }
+    }
+
+    // Build the batch pipeline
+    std::vector<std::string_view> views;
+    std::size_t appended = 0;
+    for (auto& x : args)
+    {
+        views.assign(x.begin(), x.end());
+        if (!command.Format(preparedBuf, views.data(), views.size()) || 
+            (redisAppendFormattedCommand(context, preparedBuf.data(), preparedBuf.size()) != REDIS_OK))
+        {
+            break;
+        }
+        appended++;
+    }
+
+    // Get response for each command, and drain the appended ones if stopped early
+    GetPipelineReplies(appended, replied);
+    if (appended != args.size())
+    {
+        replied.clear();
+        return false;
+    }
+    return true;
+}
+
+void MiniRedisClient::GetPipelineReplies(std::size_t count, 
+    std::vector<std::string>& replied) const
+{
+    replied.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
     {
         std::string ans = "";
         redisReply* reply = nullptr;
@@ -674,23 +2607,180 @@ bool MiniRedisClient::pipeline(const std::vector<std::string>& commands,
             continue;
         }
 
-        if ((reply->type == REDIS_REPLY_STATUS) || (reply->type == REDIS_REPLY_STRING))
+        if (IsStringType(reply->type))
         {
             ans = std::string(reply->str, reply->len);
         }
-        else if (reply->type == REDIS_REPLY_INTEGER)
+        else if ((reply->type == REDIS_REPLY_INTEGER) || (reply->type == REDIS_REPLY_BOOL))
         {
             ans = std::to_string(reply->integer);
         }
         else
         {
             // TODO: Handle array replies
-            std::cout << "Unsupported reply type: " << reply->type << std::endl;
+            MINIREDIS_LOG_WARN("Unsupported reply type in pipeline: %d", reply->type);
         }
 
         freeReplyObject(reply);
         replied.push_back(ans);
     }
+}
+
+bool MiniRedisClient::AppendPipeline(const std::vector<std::string>& commands) const
+{
+    if (!context || commands.empty())
+    {
+        return false;
+    }
+
+    for (auto& x : commands)
+    {
+        redisAppendCommand(context, x.c_str());
+    }
+    return true;
+}
+
+bool MiniRedisClient::GetPipelineNumbers(std::size_t count, NumberParser parser, 
+    void* first, std::size_t stride) const
+{
+    bool ret = true;
+    char* out = static_cast<char*>(first);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        redisReply* reply = nullptr;
+        if ((redisGetReply(context, (void**)&reply) != REDIS_OK) || !reply)
+        {
+            freeReplyObject(reply);
+            ret = false;
+            continue;
+        }
+
+        // Decode in place, the value is left as 0 if failed
+        if (!HandleNumberReply(reply, parser, out + i * stride))
+        {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+bool MiniRedisClient::PipelineAppend(const std::string& command) const
+{
+    if (!context)
+    {
+        return false;
+    }
+
+    return redisAppendCommand(context, command.c_str()) == REDIS_OK;
+}
+
+bool MiniRedisClient::PipelineAppend(const std::vector<std::string>& argv) const
+{
+    if (!context || argv.empty())
+    {
+        return false;
+    }
+
+    std::vector<const char*> args;
+    std::vector<size_t> argsLen;
+    args.reserve(argv.size());
+    argsLen.reserve(argv.size());
+    for (auto& x : argv)
+    {
+        args.push_back(x.data());
+        argsLen.push_back(x.size());
+    }
+
+    return redisAppendCommandArgv(context, (int)args.size(), args.data(), argsLen.data()) == REDIS_OK;
+}
+
+bool MiniRedisClient::PipelineAppend(const std::string_view* argv, std::size_t argc) const
+{
+    if (!context || !argv || !argc)
+    {
+        return false;
+    }
+
+    std::vector<const char*> args(argc);
+    std::vector<size_t> argsLen(argc);
+    for (std::size_t i = 0; i < argc; i++)
+    {
+        args[i] = argv[i].data();
+        argsLen[i] = argv[i].size();
+    }
+
+    return redisAppendCommandArgv(context, (int)argc, args.data(), argsLen.data()) == REDIS_OK;
+}
+
+bool MiniRedisClient::PipelineFlush() const
+{
+    if (!context)
+    {
+        return false;
+    }
 
+    int done = 0;
+    while (!done)
+    {
+        if (redisBufferWrite(context, &done) != REDIS_OK)
+        {
+            return false;
+        }
+    }
     return true;
 }
+
+redisReply* MiniRedisClient::PipelineGetReply() const
+{
+    if (!context)
+    {
+        return nullptr;
+    }
+
+    redisReply* reply = nullptr;
+    if (redisGetReply(context, (void**)&reply) != REDIS_OK)
+    {
+        freeReplyObject(reply);
+        return nullptr;
+    }
+    return reply;
+}
+
+bool MiniRedisClient::AppendPrepared(const MiniRedisPreparedCommand& command, 
+    std::initializer_list<std::string_view> args) const
+{
+    if (!context || !command.Format(preparedBuf, args))
+    {
+        return false;
+    }
+
+    return redisAppendFormattedCommand(context, preparedBuf.data(), preparedBuf.size()) == REDIS_OK;
+}
+
+redisReply* MiniRedisClient::ExecuteArgv(const std::vector<std::string_view>& argv) const
+{
+    if (!context || argv.empty())
+    {
+        return nullptr;
+    }
+
+    std::vector<const char*> args;
+    std::vector<size_t> argsLen;
+    args.reserve(argv.size());
+    argsLen.reserve(argv.size());
+    for (auto& x : argv)
+    {
+        args.push_back(x.data());
+        argsLen.push_back(x.size());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    redisReply* reply = (redisReply*)redisCommandArgv(context, (int)args.size(), 
+        args.data(), argsLen.data());
+    if (sampler)
+    {
+        SampleArgv(argv, start, reply);
+    }
+    return reply;
+}
@@ -1,9 +1,11 @@
 // Mini C++ client to access Redis
-// Depends on hiredis: 
+// Depends on hiredis 1.1.0 or later, for RESP3 push messages, connect options
+// and keepalive interval.
+// Ubuntu 24.04 and Debian 13 or later ship such version:
 // sudo apt install -y libhiredis-dev
-// which installs 0.1x version.
+// The 0.1x version of older distributions doesn't work.
 // 
-// If need new version, please build from source https://github.com/redis/hiredis/
+// Otherwise, please build from source https://github.com/redis/hiredis/
 // git clone https://github.com/redis/hiredis
 // cd hiredis
 // make
@@ -15,11 +17,174 @@
 #define MiniRedisClient_INCLUDED
 
 #include <string>
+#include <string_view>
+#include <iosfwd>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <initializer_list>
+#include <chrono>
+#include <cstdarg>
+#include "MiniRedisNumeric.h"
 
 struct redisContext;
 struct redisReply;
+class MiniRedisPreparedCommand;
+class MiniRedisCodec;
+class MiniRedisCodecLayer;
+struct MiniRedisCodecStats;
+class MiniRedisKeySampler;
+
+// Called with out-of-band push messages in RESP3, such as:
+// "message", channel, content
+// "pmessage", pattern, channel, content
+// "invalidate", key...
+using PushCbFunc = std::function<void(const std::vector<std::string>&)>;
+
+// Called with each chunk of large value in order, return false to stop
+using ChunkCbFunc = std::function<bool(const char* data, std::size_t len)>;
+
+// Called by get_or_compute() on cache miss, return false if the value can't be computed
+using ComputeFunc = std::function<bool(std::string& value)>;
+
+// Options of get_or_compute()
+struct MiniRedisComputeOptions
+{
+    // TTL of the computed value
+    uint32_t ttlSeconds = 60;
+    // TTL of the recompute lock, longer than the expected compute time
+    uint32_t lockMs = 5000;
+    // Interval of polling while another process is recomputing
+    uint32_t waitMs = 20;
+    // Give up waiting for another process after this, and compute locally
+    uint32_t maxWaitMs = 2000;
+    // XFetch early refresh: larger beta refreshes earlier, 0 disables it
+    double beta = 1.0;
+    // Compute time used by XFetch before it's measured in this process
+    uint32_t computeMsHint = 100;
+};
+
+// Transport and setup of the connection
+struct MiniRedisConnectionOptions
+{
+    // Path of Unix domain socket, host and port are ignored if set
+    // Preferred for co-located Redis, which saves the TCP stack on both sides
+    std::string unixSocket;
+
+    // TCP only
+    // Send small commands at once, instead of waiting for Nagle's algorithm
+    bool tcpNoDelay = true;
+    // Interval of keepalive probes in seconds, 0 disables keepalive
+    int keepAliveSeconds = 0;
+
+    // Size of kernel socket buffers in bytes, 0 keeps the system default
+    int recvBufferBytes = 0;
+    int sendBufferBytes = 0;
+
+    // Handshake, sent in one pipelined batch after connecting
+    // AUTH, or HELLO with AUTH in RESP3; username requires Redis 6
+    std::string username;
+    std::string password;
+    // SELECT, if not 0
+    int database = 0;
+    // CLIENT SETNAME, or HELLO with SETNAME in RESP3
+    std::string clientName;
+    // CLIENT NO-EVICT on, requires Redis 7
+    bool noEvict = false;
+};
+
+// Error of the connection, after a command failed
+enum MiniRedisError
+{
+    REDIS_ERROR_NONE,
+    REDIS_ERROR_NOT_CONNECTED,
+    // The command didn't complete before the deadline
+    // The connection is closed, because the late reply can't be matched any more
+    REDIS_ERROR_TIMEOUT,
+    REDIS_ERROR_IO,
+    // Server closed the connection
+    REDIS_ERROR_EOF,
+    REDIS_ERROR_PROTOCOL,
+    REDIS_ERROR_OTHER
+};
+
+// Flags of zadd, can be combined by |
+enum MiniRedisZAddFlag
+{
+    ZADD_NONE = 0,
+    // Only add new elements, don't update already existing elements
+    ZADD_NX = 1 << 0,
+    // Only update elements that already exist, don't add new elements
+    ZADD_XX = 1 << 1,
+    // Only update existing elements if the new score is greater than the current score
+    ZADD_GT = 1 << 2,
+    // Only update existing elements if the new score is less than the current score
+    ZADD_LT = 1 << 3,
+    // Reply the number of elements changed, instead of added
+    ZADD_CH = 1 << 4
+};
+
+// Range type of zrange
+enum MiniRedisZRangeBy
+{
+    // start and stop are zero-based indexes, negative means counting from the end
+    ZRANGE_BY_RANK,
+    // start and stop are scores, "(" prefix means exclusive, "-inf" and "+inf" are allowed
+    ZRANGE_BY_SCORE,
+    // start and stop are members, "[" or "(" prefix is required, "-" and "+" are allowed
+    ZRANGE_BY_LEX
+};
+
+// Reply of sorted set with scores, decoded without copying the members
+// The members point into the reply, which is owned and released by this view
+class MiniRedisScoredView
+{
+public:
+    using Item = std::pair<std::string_view, double>;
+
+    MiniRedisScoredView();
+    ~MiniRedisScoredView();
+    MiniRedisScoredView(MiniRedisScoredView&& other) noexcept;
+    MiniRedisScoredView& operator=(MiniRedisScoredView&& other) noexcept;
+    MiniRedisScoredView(const MiniRedisScoredView&) = delete;
+    MiniRedisScoredView& operator=(const MiniRedisScoredView&) = delete;
+
+    std::size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    const Item& operator[](std::size_t i) const { return items[i]; }
+    std::vector<Item>::const_iterator begin() const { return items.begin(); }
+    std::vector<Item>::const_iterator end() const { return items.end(); }
+
+    // Release the reply, and clear the items
+    void Reset(redisReply* newReply = nullptr);
+
+private:
+    friend class MiniRedisClient;
+
+    redisReply* reply;
+    std::vector<Item> items;
+};
+
+class MiniRedisClient;
+
+// Deadline of the commands in the scope, instead of the default command timeout
+//   {
+//       MiniRedisDeadline deadline(client, 20);
+//       client.get(key, value);
+//   }
+class MiniRedisDeadline
+{
+public:
+    MiniRedisDeadline(const MiniRedisClient& client, uint32_t ms);
+    ~MiniRedisDeadline();
+    MiniRedisDeadline(const MiniRedisDeadline&) = delete;
+    MiniRedisDeadline& operator=(const MiniRedisDeadline&) = delete;
+
+private:
+    const MiniRedisClient& client;
+};
 
 class MiniRedisClient
 {
@@ -34,14 +199,54 @@ public:
     uint16_t GetPort() const;
     void SetTimeoutSeconds(uint32_t sec);
     uint32_t GetTimeoutSeconds() const;
+    // Default deadline of each command, 0 means waiting forever
+    // If the reply doesn't arrive in time, the command fails with REDIS_ERROR_TIMEOUT
+    void SetCommandTimeoutMs(uint32_t ms);
+    uint32_t GetCommandTimeoutMs() const;
+
+    // Socket options and handshake, applied on each Connect()
+    void SetConnectionOptions(const MiniRedisConnectionOptions& options);
+    const MiniRedisConnectionOptions& GetConnectionOptions() const;
+
+    // Protocol version, 2 by default
+    // If set to 3, HELLO 3 is sent when connecting, and RESP3 is used on this connection:
+    // maps, doubles and booleans are native, and push messages can be received
+    // RESP3 requires Redis 6 and hiredis 1.0 or later
+    void SetProtocol(int protover);
+    int GetProtocol() const;
+
+    // CB will be called with push messages, RESP3 only
+    // Push messages are delivered while waiting for replies of other commands, 
+    // or by ProcessPush() when the connection is idle
+    void SetPushCb(PushCbFunc cb);
+
+    // Compress values not smaller than threshold with codec in set()/hset(), 
+    // and detect and decompress them in get()/hget()
+    // Pass nullptr to disable the codec layer
+    void SetCodec(std::shared_ptr<MiniRedisCodec> codec, std::size_t threshold = 1024);
+    std::shared_ptr<MiniRedisCodec> GetCodec() const;
+    // Compression ratio and CPU time counters
+    MiniRedisCodecStats GetCodecStats() const;
+
+    // Count keys and log slow commands of execute() and the typed wrappers
+    // The sampler can be shared by clients of all threads, pass nullptr to disable it
+    // The key is the first argument after the command name
+    void SetSampler(std::shared_ptr<MiniRedisKeySampler> sampler);
 
     // Return the raw redisContext pointer to user, and transfer the ownership
+    // Push messages are no longer delivered to this instance, but returned as replies
     // The user should release the pointer
     redisContext* GetRawContext();
 
     // Connect to Redis Server
     bool Connect();
     bool Connect(const std::string& host, uint16_t port = 6379, uint32_t timeoutSec = 3);
+    // Whether the connection is established and not broken
+    bool IsConnected() const;
+    // Why the last command failed, besides error reply from server
+    MiniRedisError GetLastError() const;
+    // Socket of the connection, -1 if not connected
+    int GetFd() const;
 
     //////////////////////////////////////////////////
     // Helper functions
@@ -59,6 +264,17 @@ public:
     bool HandleIntegerReply(redisReply* reply, long long int& replied) const; 
     // Return the array of reply, and release the memory
     bool HandleArrayReply(redisReply* reply, std::vector<std::string>& replied) const; 
+    // Return the map of reply, and release the memory
+    // Both RESP3 map and RESP2 array of field value pairs are accepted
+    bool HandleMapReply(redisReply* reply, std::map<std::string, std::string>& replied) const; 
+    bool HandleMapReply(redisReply* reply, std::unordered_map<std::string, std::string>& replied) const; 
+    // Return the double of reply, and release the memory
+    // Both RESP3 double and RESP2 string are accepted
+    bool HandleDoubleReply(redisReply* reply, double& replied) const; 
+    // Decode the number from integer or string reply without temporary string, 
+    // and release the memory
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool HandleNumberReply(redisReply* reply, T& replied) const;
     //////////////////////////////////////////////////
 
     //////////////////////////////////////////////////
@@ -76,6 +292,11 @@ public:
     // Simple string reply: OK, or an error if the password, or username/password pair, is invalid
     bool auth(const std::string& password, std::string& replied) const; 
 
+    // https://redis.io/commands/hello/
+    // Switch to a different protocol, 2 or 3
+    // Map reply: a list of server properties
+    bool hello(int protover, std::map<std::string, std::string>& replied) const;
+
     // Get client name from Redis server
     bool client_getname(std::string& replied) const;
     // Set client name to Redis server
@@ -87,6 +308,11 @@ public:
     // Decrements the number stored at key by one
     // Integer reply: the value of the key after decrementing it
     bool decr(const std::string& key, long long int& replied) const;
+
+    // https://redis.io/commands/decrby/
+    // Decrements the number stored at key by decrement
+    // Integer reply: the value of the key after decrementing it
+    bool decrby(const std::string& key, long long int decrement, long long int& replied) const;
     
     // https://redis.io/commands/del/
     // Removes the specified key. A key is ignored if it does not exist.
@@ -111,12 +337,41 @@ public:
     // Get the value of key.
     // GET only handles string values.
     bool get(const std::string& key, std::string& replied) const;
+    // Decode the value as integer, floating point, or MiniRedisFixed
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool get(const std::string& key, T& replied) const;
+
+    // Get the value of key, or compute and set it on miss, without stampede:
+    // concurrent calls for the same key in this process share one fetch,
+    // processes serialize recompute by a SET NX PX lock on key + ":lock", 
+    // and the value may be refreshed early before TTL expires, by XFetch with ttl()
+    // Others keep reading the old value during early refresh
+    // If compute throws, the lock is released, and the exception is thrown to this call
+    // and the concurrent calls waiting for it
+    bool get_or_compute(const std::string& key, const ComputeFunc& compute, 
+        const MiniRedisComputeOptions& opts, std::string& replied) const;
 
     // https://redis.io/commands/incr/
     // Increments the number stored at key by one
     // Integer reply: the value of the key after the increment
     bool incr(const std::string& key, long long int& replied) const;
 
+    // https://redis.io/commands/incrby/
+    // Increments the number stored at key by increment
+    // Integer reply: the value of the key after the increment
+    bool incrby(const std::string& key, long long int increment, long long int& replied) const;
+
+    // https://redis.io/commands/incrbyfloat/
+    // Increment the floating point number stored at key by increment
+    // Bulk string reply: the value of the key after the increment
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool incrbyfloat(const std::string& key, T increment, T& replied) const;
+
+    // https://redis.io/commands/info/
+    // Returns information and statistics about the server
+    // Bulk string reply: lines of field:value, which are converted to std::map
+    bool info(const std::string& section, std::map<std::string, std::string>& replied) const;
+
     // https://redis.io/commands/keys/
     // Returns all keys matching pattern
     // Using * to get all keys
@@ -135,6 +390,14 @@ public:
     // Simple string reply: OK
     bool rename(const std::string& key, const std::string& newKey, std::string& replied) const;  
 
+    // https://redis.io/commands/scan/
+    // Incrementally iterates the keys of current database, without blocking the server like KEYS
+    // Start with cursor 0, which is updated by each call, and is 0 again when the iteration is done
+    // count is a hint of keys returned per call, and empty pattern matches all keys
+    // Keys are appended to replied, a key may be returned more than once
+    bool scan(unsigned long long& cursor, uint32_t count, const std::string& pattern, 
+        std::vector<std::string>& replied) const;
+
     // https://redis.io/commands/select/
     // Select the logical database having the specified zero-based numeric index
     // By default, the index is from 0 to 15
@@ -149,7 +412,9 @@ public:
     // ttl = 0 means no limit
     bool set(const std::string& key, const std::string& value, 
         uint32_t ttl, std::string& replied) const;
-    bool set(const std::string& key, long long int value, 
+    // Encode integer, floating point, or MiniRedisFixed value without temporary string
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool set(const std::string& key, T value, 
         uint32_t ttl, std::string& replied) const;
 
     // https://redis.io/commands/strlen/
@@ -190,6 +455,9 @@ public:
     // FIXME: the document says it returns bulk string, while I get normal string
     // Nil reply: If the field is not present in the hash or key does not exist
     bool hget(const std::string& key, const std::string& field, std::string& replied) const;
+    // Decode the value as integer, floating point, or MiniRedisFixed
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool hget(const std::string& key, const std::string& field, T& replied) const;
 
     // https://redis.io/commands/hgetall/
     // Returns all fields and values of the hash stored at key
@@ -199,6 +467,20 @@ public:
     // Array reply: a list of fields and their values stored in the hash, 
     // or an empty list when key does not exist
     bool hgetall(const std::string& key, std::map<std::string, std::string>& replied) const; 
+    bool hgetall(const std::string& key, std::unordered_map<std::string, std::string>& replied) const; 
+
+    // https://redis.io/commands/hincrby/
+    // Increments the number stored at field in the hash stored at key by increment
+    // Integer reply: the value at field after the increment operation
+    bool hincrby(const std::string& key, const std::string& field, 
+        long long int increment, long long int& replied) const;
+
+    // https://redis.io/commands/hincrbyfloat/
+    // Increment the specified field of a hash stored at key by the floating point increment
+    // Bulk string reply: the value of field after the increment
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool hincrbyfloat(const std::string& key, const std::string& field, 
+        T increment, T& replied) const;
 
     // https://redis.io/commands/hkeys/
     // Returns all field names in the hash stored at key
@@ -210,6 +492,14 @@ public:
     // Integer reply: the number of fields in the hash, or 0 when the key does not exist
     bool hlen(const std::string& key, long long int& replied) const;
 
+    // https://redis.io/commands/hscan/
+    // Incrementally iterates fields and values of the hash stored at key
+    // Start with cursor 0, which is updated by each call, and is 0 again when the iteration is done
+    // count is a hint of fields returned per call
+    // Fields and values are added to replied, a field may be returned more than once
+    bool hscan(const std::string& key, unsigned long long& cursor, uint32_t count, 
+        std::unordered_map<std::string, std::string>& replied) const;
+
     // https://redis.io/commands/hset/
     // Sets the specified fields to their respective values in the hash stored at key
     // Overwrites the values of specified fields that exist in the hash
@@ -217,6 +507,10 @@ public:
     // Integer reply: the number of fields that were added
     bool hset(const std::string& key, const std::string& field, 
         const std::string& value, long long int& replied) const;
+    // Encode integer, floating point, or MiniRedisFixed value without temporary string
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool hset(const std::string& key, const std::string& field, 
+        T value, long long int& replied) const;
 
     // https://redis.io/commands/hvals/
     // Returns all values in the hash stored at key
@@ -305,12 +599,150 @@ public:
     // not including non existing members
     bool srem(const std::string& key, const std::string& member, long long int& replied) const;
 
+    // Streaming of large values
+    // The value is transferred in chunks by GETRANGE, or by SET and APPEND, 
+    // with at most window chunks in flight, 
+    // so that memory stays bounded however big the value is
+    // Not atomic: readers may see a partially written value, 
+    // and a value modified during reading may be inconsistent
+    // 
+    // https://redis.io/commands/getrange/
+    // Read the value chunk by chunk, and pass each chunk to callback
+    // Return false if the key doesn't exist, an empty value succeeds without callback
+    bool get_chunked(const std::string& key, ChunkCbFunc cb, 
+        std::size_t chunkSize = 1 << 20, std::size_t window = 4) const;
+    // Read the value into caller buffer, replied is the length of the value
+    // Fail if the value is larger than bufSize
+    bool get_chunked(const std::string& key, char* buf, std::size_t bufSize, std::size_t& replied, 
+        std::size_t chunkSize = 1 << 20, std::size_t window = 4) const;
+    // Write the value to file descriptor
+    bool get_chunked(const std::string& key, int fd, 
+        std::size_t chunkSize = 1 << 20, std::size_t window = 4) const;
+
+    // https://redis.io/commands/append/
+    // Write the value chunk by chunk: SET with the first chunk and PX of ttl, 
+    // and then APPEND the others
+    // ttl = 0 means no limit
+    bool set_chunked(const std::string& key, std::istream& input, uint32_t ttl, 
+        std::size_t chunkSize = 1 << 20, std::size_t window = 4) const;
+    // Write the content of file, which is memory mapped instead of read into a buffer
+    // Each chunk is still copied when formatted as a command, and into the output buffer of hiredis
+    bool set_chunked_file(const std::string& key, const std::string& path, uint32_t ttl, 
+        std::size_t chunkSize = 1 << 20, std::size_t window = 4) const;
+
+    // Pub/Sub related commands
+    // https://redis.io/commands/subscribe/
+    // RESP3 only: with RESP2, the connection can't be used for other commands after subscribing
+    // Confirmations and messages are delivered to the push CB
+    bool subscribe(const std::string& channel) const;
+    bool unsubscribe(const std::string& channel) const;
+
+    // Wait for push messages up to timeoutMs, and deliver them to the push CB
+    // Return the number of push messages delivered, or -1 if the connection is broken
+    int ProcessPush(uint32_t timeoutMs) const;
+
     // Sorted Set related commands
-    // ... ...
+    // Scores are decoded by std::from_chars from RESP2 string, or taken from RESP3 double
+
+    // https://redis.io/commands/zadd/
+    // Adds all the specified members with the specified scores to the sorted set stored at key
+    // flags is combination of MiniRedisZAddFlag
+    // Integer reply: the number of elements added, or changed with ZADD_CH
+    bool zadd(const std::string& key, const std::string& member, double score, 
+        int flags, long long int& replied) const;
+    bool zadd(const std::string& key, const std::vector<std::pair<std::string, double>>& members, 
+        int flags, long long int& replied) const;
+
+    // https://redis.io/commands/zcard/
+    // Returns the number of elements of the sorted set stored at key
+    // Integer reply: the cardinality of the sorted set, or 0 if key does not exist
+    bool zcard(const std::string& key, long long int& replied) const;
+
+    // https://redis.io/commands/zincrby/
+    // Increments the score of member in the sorted set stored at key by increment
+    // Double reply: the new score of member
+    bool zincrby(const std::string& key, double increment, const std::string& member, 
+        double& replied) const;
+
+    // https://redis.io/commands/zmscore/
+    // Returns the scores associated with the specified members
+    // Array reply: the scores in the same order as members, NaN for members not existing
+    bool zmscore(const std::string& key, const std::vector<std::string>& members, 
+        std::vector<double>& replied) const;
+
+    // https://redis.io/commands/zpopmax/
+    // https://redis.io/commands/zpopmin/
+    // Removes and returns up to count members with the highest/lowest scores
+    // Array reply: list of popped elements and scores
+    bool zpopmax(const std::string& key, uint32_t count, 
+        std::vector<std::pair<std::string, double>>& replied) const;
+    bool zpopmin(const std::string& key, uint32_t count, 
+        std::vector<std::pair<std::string, double>>& replied) const;
+
+    // https://redis.io/commands/zrange/
+    // Returns the specified range of elements in the sorted set stored at key
+    // rev reverses the ordering, with elements ordered from highest to lowest score
+    // offset and count limit the result, count < 0 means all, only for BYSCORE and BYLEX
+    // Array reply: list of elements in the specified range
+    bool zrange(const std::string& key, const std::string& start, const std::string& stop, 
+        std::vector<std::string>& replied, MiniRedisZRangeBy by = ZRANGE_BY_RANK, 
+        bool rev = false, long long int offset = 0, long long int count = -1) const;
+    // WITHSCORES, decoded into one contiguous vector
+    bool zrange(const std::string& key, const std::string& start, const std::string& stop, 
+        std::vector<std::pair<std::string, double>>& replied, MiniRedisZRangeBy by = ZRANGE_BY_RANK, 
+        bool rev = false, long long int offset = 0, long long int count = -1) const;
+    // WITHSCORES, decoded as views into the reply, without copying the members
+    bool zrange(const std::string& key, const std::string& start, const std::string& stop, 
+        MiniRedisScoredView& replied, MiniRedisZRangeBy by = ZRANGE_BY_RANK, 
+        bool rev = false, long long int offset = 0, long long int count = -1) const;
+
+    // https://redis.io/commands/zrank/
+    // https://redis.io/commands/zrevrank/
+    // Returns the rank of member in the sorted set stored at key, 
+    // with the scores ordered from low to high, or from high to low
+    // Integer reply: the rank of member
+    // Nil reply: if member does not exist in the sorted set or key does not exist
+    bool zrank(const std::string& key, const std::string& member, long long int& replied) const;
+    bool zrevrank(const std::string& key, const std::string& member, long long int& replied) const;
+
+    // https://redis.io/commands/zrem/
+    // Removes the specified members from the sorted set stored at key
+    // Integer reply: the number of members removed from the sorted set, 
+    // not including non existing members
+    bool zrem(const std::string& key, const std::string& member, long long int& replied) const;
+    bool zrem(const std::string& key, const std::vector<std::string>& members, 
+        long long int& replied) const;
+
+    // https://redis.io/commands/zscore/
+    // Returns the score of member in the sorted set at key
+    // Double reply: the score of member
+    // Nil reply: if member does not exist in the sorted set, or key does not exist
+    bool zscore(const std::string& key, const std::string& member, double& replied) const;
 
     // https://redis.io/docs/manual/pipelining/
     // Use pipeline to improve performance by batch operation
     bool pipeline(const std::vector<std::string>& commands, std::vector<std::string>& replied) const;
+    // Decode each reply as integer, floating point, or MiniRedisFixed
+    // Reply which can't be decoded is set to 0, and false is returned
+    template <typename T, MiniRedisNumeric::EnableIfNumber<T> = 0>
+    bool pipeline(const std::vector<std::string>& commands, std::vector<T>& replied) const;
+    // Pipeline the same prepared command with each set of variable arguments
+    bool pipeline(const MiniRedisPreparedCommand& command, 
+        const std::vector<std::vector<std::string>>& args, std::vector<std::string>& replied) const;
+
+    // Pipeline in separate stages, so that several connections can be in flight at the same time: 
+    // append commands on each connection, flush all of them, and then read the replies
+    // Append command in the same format as pipeline(), without sending it
+    bool PipelineAppend(const std::string& command) const;
+    // Append command with list of arguments, binary safe
+    bool PipelineAppend(const std::vector<std::string>& argv) const;
+    // Same as above, without copying the arguments into strings
+    bool PipelineAppend(const std::string_view* argv, std::size_t argc) const;
+    // Send all appended commands
+    bool PipelineFlush() const;
+    // Read the reply of next appended command
+    // User should parse and free the redisReply by freeReplyObject()
+    redisReply* PipelineGetReply() const;
 
     // Raw command interface
     // https://redis.io/commands/
@@ -320,18 +752,212 @@ public:
     redisReply* execute(const std::string& command, ...) const;
     // Execute command with list of arguments
     redisReply* execute(const std::string& command, const std::vector<std::string>& args) const;
+    // Execute prepared command, only the variable arguments are encoded on each call
+    // The number of args should match the %b placeholders of the prepared command
+    redisReply* execute(const MiniRedisPreparedCommand& command, 
+        std::initializer_list<std::string_view> args) const;
     //////////////////////////////////////////////////
 
 private:
+    friend class MiniRedisDeadline;
+
     void Init();
     void Clean();
+    // Set the socket timeout of the connection
+    void ApplyTimeout(uint32_t ms) const;
+    // get_or_compute() of the leader of concurrent calls in this process
+    bool GetOrComputeOnce(const std::string& key, const ComputeFunc& compute, 
+        const MiniRedisComputeOptions& opts, std::string& replied) const;
+    // Compute, set the value, and measure the compute time
+    bool ComputeAndSet(const std::string& key, const ComputeFunc& compute, 
+        const MiniRedisComputeOptions& opts, std::string& replied) const;
+
+    // Run the command and feed the sampler
+    redisReply* SampledCommand(const char* format, va_list args) const;
+    void SampleArgv(const std::vector<std::string_view>& argv, 
+        std::chrono::steady_clock::time_point start, redisReply* reply) const;
+
+    // Set socket options of the connection
+    bool ApplySocketOptions();
+    // Send the setup commands in one batch, and check all replies
+    bool Handshake();
+
+    // Return the value to be written, compressed if codec layer is set
+    std::string_view EncodeValue(const std::string& value) const;
+    // Same as HandleStringReply(), and decompress the value if needed
+    bool HandleValueReply(redisReply* reply, std::string& replied) const;
+
+    // Send command without waiting for its reply, the reply comes as push message
+    bool SendPushCommand(const char* command, const std::string& channel) const;
+    // Called by hiredis with push messages
+    static void OnPushMsg(void* privData, void* replyData);
+
+    // Execute command with arguments of any length, binary safe
+    redisReply* ExecuteArgv(const std::vector<std::string_view>& argv) const;
+    // Send ZRANGE with the options, and return the raw reply
+    redisReply* ExecuteZRange(const std::string& key, const std::string& start, 
+        const std::string& stop, MiniRedisZRangeBy by, bool rev, 
+        long long int offset, long long int count, bool withScores) const;
+    // Send ZPOPMIN or ZPOPMAX
+    bool ZPop(const char* command, const std::string& key, uint32_t count, 
+        std::vector<std::pair<std::string, double>>& replied) const;
+
+    // Append prepared command to the output buffer, without sending it
+    bool AppendPrepared(const MiniRedisPreparedCommand& command, 
+        std::initializer_list<std::string_view> args) const;
+    // Write chunks given by next() in pipeline, next() returns false when no more chunk
+    bool SetChunks(const std::string& key, 
+        const std::function<bool(const char*&, std::size_t&)>& next, 
+        uint32_t ttl, std::size_t window) const;
+
+    // Read count replies of pipeline, and convert them to string
+    void GetPipelineReplies(std::size_t count, std::vector<std::string>& replied) const;
+    // Append the raw commands to the pipeline
+    bool AppendPipeline(const std::vector<std::string>& commands) const;
+
+    // Decode number from integer reply, or from the string of reply
+    // out points to the typed value
+    using NumberParser = bool (*)(const char* str, std::size_t len, 
+        long long int integer, bool isInteger, void* out);
+    template <typename T>
+    static bool ParseNumber(const char* str, std::size_t len, 
+        long long int integer, bool isInteger, void* out);
+    // Non-template parts of the typed commands, so that hiredis is not exposed in header
+    bool HandleNumberReply(redisReply* reply, NumberParser parser, void* out) const;
+    bool GetPipelineNumbers(std::size_t count, NumberParser parser, 
+        void* first, std::size_t stride) const;
+    bool SetRaw(const std::string& key, const char* value, std::size_t len, 
+        uint32_t ttl, std::string& replied) const;
+    bool HSetRaw(const std::string& key, const std::string& field, 
+        const char* value, std::size_t len, long long int& replied) const;
 
 private:
     std::string host;
     uint16_t port;
     // Timeout when connecting
     uint32_t timeoutSeconds; 
+    // Timeout of each command
+    uint32_t commandTimeoutMs;
+    MiniRedisConnectionOptions options;
     redisContext* context;
+    // RESP2 or RESP3
+    int protocol;
+    PushCbFunc pushCb;
+    // Compress values if set
+    std::shared_ptr<MiniRedisCodecLayer> codecLayer;
+    // Hot keys and slow log if set
+    std::shared_ptr<MiniRedisKeySampler> sampler;
 };
 
+template <typename T>
+bool MiniRedisClient::ParseNumber(const char* str, std::size_t len, 
+    long long int integer, bool isInteger, void* out)
+{
+    T& value = *static_cast<T*>(out);
+    bool ret = isInteger ? MiniRedisNumeric::FromInteger(integer, value) : 
+        MiniRedisNumeric::FromChars(str, len, value);
+    if (!ret)
+    {
+        value = T();
+    }
+    return ret;
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::HandleNumberReply(redisReply* reply, T& replied) const
+{
+    replied = T();
+    return HandleNumberReply(reply, &MiniRedisClient::ParseNumber<T>, &replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::get(const std::string& key, T& replied) const
+{
+    redisReply* reply = execute("GET %b", 
+        key.c_str(), key.size());
+    return HandleNumberReply(reply, replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::incrbyfloat(const std::string& key, T increment, T& replied) const
+{
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), increment);
+    if (len == 0)
+    {
+        return false;
+    }
+    redisReply* reply = execute("INCRBYFLOAT %b %b", 
+        key.c_str(), key.size(), 
+        buf, len);
+    return HandleNumberReply(reply, replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::set(const std::string& key, T value, 
+    uint32_t ttl, std::string& replied) const
+{
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), value);
+    if (len == 0)
+    {
+        return false;
+    }
+    return SetRaw(key, buf, len, ttl, replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::hget(const std::string& key, const std::string& field, T& replied) const
+{
+    redisReply* reply = execute("HGET %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size());
+    return HandleNumberReply(reply, replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::hincrbyfloat(const std::string& key, const std::string& field, 
+    T increment, T& replied) const
+{
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), increment);
+    if (len == 0)
+    {
+        return false;
+    }
+    redisReply* reply = execute("HINCRBYFLOAT %b %b %b", 
+        key.c_str(), key.size(), 
+        field.c_str(), field.size(), 
+        buf, len);
+    return HandleNumberReply(reply, replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::hset(const std::string& key, const std::string& field, 
+    T value, long long int& replied) const
+{
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), value);
+    if (len == 0)
+    {
+        return false;
+    }
+    return HSetRaw(key, field, buf, len, replied);
+}
+
+template <typename T, MiniRedisNumeric::EnableIfNumber<T>>
+bool MiniRedisClient::pipeline(const std::vector<std::string>& commands, 
+    std::vector<T>& replied) const
+{
+    replied.assign(commands.size(), T());
+    if (!AppendPipeline(commands))
+    {
+        replied.clear();
+        return false;
+    }
+
+    return GetPipelineNumbers(commands.size(), &MiniRedisClient::ParseNumber<T>, 
+        replied.data(), sizeof(T));
+}
+
 #endif // MiniRedisClient_INCLUDED
@@ -0,0 +1,416 @@
+// Value codec layer for MiniRedisClient
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include "MiniRedisCodec.h"
+
+namespace
+{
+    const char headerMagic[3] = {'\0', 'M', 'Z'};
+    const std::size_t headerSize = 8;
+
+    // Parameters of LZ block
+    const std::size_t minMatch = 4;
+    // The last bytes are always literals
+    const std::size_t lastLiterals = 5;
+    const std::size_t matchSearchLimit = 12;
+    const std::size_t maxOffset = 65535;
+    const int hashLog = 12;
+
+    // Buffers reused by each thread
+    thread_local std::string encodeBuf;
+    thread_local std::string decodeBuf;
+    thread_local std::vector<uint32_t> hashTable;
+
+    uint32_t Read32(const char* p)
+    {
+        uint32_t val;
+        memcpy(&val, p, sizeof(val));
+        return val;
+    }
+
+    uint32_t Hash(uint32_t seq)
+    {
+        return (seq * 2654435761U) >> (32 - hashLog);
+    }
+
+    // Length above 15 continues in the following bytes, 255 means more bytes
+    void AppendLength(std::string& dst, std::size_t len)
+    {
+        while (len >= 255)
+        {
+            dst.push_back((char)255);
+            len -= 255;
+        }
+        dst.push_back((char)len);
+    }
+
+    bool ReadLength(const unsigned char* src, std::size_t len, std::size_t& pos, std::size_t& value)
+    {
+        unsigned char b = 0;
+        do
+        {
+            if (pos >= len)
+            {
+                return false;
+            }
+            b = src[pos++];
+            value += b;
+        } while (b == 255);
+        return true;
+    }
+
+    void AppendSequence(std::string& dst, const char* literals, std::size_t litLen,
+        std::size_t offset, std::size_t matchLen)
+    {
+        std::size_t matchCode = matchLen ? (matchLen - minMatch) : 0;
+        unsigned char token = (unsigned char)(((litLen < 15 ? litLen : 15) << 4)
+            | (matchCode < 15 ? matchCode : 15));
+        dst.push_back((char)token);
+        if (litLen >= 15)
+        {
+            AppendLength(dst, litLen - 15);
+        }
+        dst.append(literals, litLen);
+
+        // The last sequence has no match
+        if (!matchLen)
+        {
+            return;
+        }
+        dst.push_back((char)(offset & 0xFF));
+        dst.push_back((char)(offset >> 8));
+        if (matchCode >= 15)
+        {
+            AppendLength(dst, matchCode - 15);
+        }
+    }
+
+    uint64_t NanosSince(std::chrono::steady_clock::time_point start)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+}
+
+uint8_t MiniRedisLZCodec::GetId() const
+{
+    return Id;
+}
+
+std::string MiniRedisLZCodec::GetName() const
+{
+    return "lz";
+}
+
+bool MiniRedisLZCodec::Compress(const char* src, std::size_t len, std::string& dst) const
+{
+    if (len < matchSearchLimit + 1)
+    {
+        return false;
+    }
+
+    hashTable.assign(1 << hashLog, 0);
+    std::size_t start = dst.size();
+    std::size_t anchor = 0;
+    std::size_t pos = 0;
+    std::size_t searchEnd = len - matchSearchLimit;
+    std::size_t matchEnd = len - lastLiterals;
+    while (pos < searchEnd)
+    {
+        uint32_t seq = Read32(src + pos);
+        uint32_t h = Hash(seq);
+        std::size_t ref = hashTable[h];
+        hashTable[h] = (uint32_t)pos;
+
+        if ((ref < pos) && (pos - ref <= maxOffset) && (Read32(src + ref) == seq))
+        {
+            std::size_t matchLen = minMatch;
+            while ((pos + matchLen < matchEnd) && (src[ref + matchLen] == src[pos + matchLen]))
+            {
+                matchLen++;
+            }
+
+            AppendSequence(dst, src + anchor, pos - anchor, pos - ref, matchLen);
+            pos += matchLen;
+            anchor = pos;
+        }
+        else
+        {
+            // Skip faster through data which doesn't compress
+            pos += 1 + ((pos - anchor) >> 6);
+        }
+    }
+    AppendSequence(dst, src + anchor, len - anchor, 0, 0);
+
+    return (dst.size() - start < len);
+}
+
+bool MiniRedisLZCodec::Decompress(const char* src, std::size_t len,
+    char* dst, std::size_t rawLen) const
+{
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+    std::size_t ip = 0;
+    std::size_t op = 0;
+    while (ip < len)
+    {
+        unsigned char token = in[ip++];
+        std::size_t litLen = token >> 4;
+        if ((litLen == 15) && !ReadLength(in, len, ip, litLen))
+        {
+            return false;
+        }
+        if ((litLen > len - ip) || (litLen > rawLen - op))
+        {
+            return false;
+        }
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        // The last sequence has only literals
+        if (ip == len)
+        {
+            break;
+        }
+
+        if (ip + 2 > len)
+        {
+            return false;
+        }
+        std::size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > op))
+        {
+            return false;
+        }
+
+        std::size_t matchLen = token & 0x0F;
+        if ((matchLen == 15) && !ReadLength(in, len, ip, matchLen))
+        {
+            return false;
+        }
+        matchLen += minMatch;
+        if (matchLen > rawLen - op)
+        {
+            return false;
+        }
+
+        // Overlapped copy repeats the pattern, so it has to go byte by byte
+        const char* ref = dst + op - offset;
+        if (offset >= matchLen)
+        {
+            memcpy(dst + op, ref, matchLen);
+        }
+        else
+        {
+            for (std::size_t i = 0; i < matchLen; i++)
+            {
+                dst[op + i] = ref[i];
+            }
+        }
+        op += matchLen;
+    }
+
+    return (op == rawLen);
+}
+
+double MiniRedisCodecStats::GetRatio() const
+{
+    if (!compressedBytes)
+    {
+        return 1.0;
+    }
+
+    return (double)rawBytes / (double)compressedBytes;
+}
+
+MiniRedisCodecLayer::MiniRedisCodecLayer(std::shared_ptr<MiniRedisCodec> codec,
+    std::size_t threshold)
+{
+    this->codec = codec;
+    this->threshold = threshold;
+    ResetStats();
+}
+
+std::shared_ptr<MiniRedisCodec> MiniRedisCodecLayer::GetCodec() const
+{
+    return codec;
+}
+
+std::size_t MiniRedisCodecLayer::GetThreshold() const
+{
+    return threshold;
+}
+
+std::string_view MiniRedisCodecLayer::Encode(std::string_view value)
+{
+    bool tagged = (value.size() >= sizeof(headerMagic)) &&
+        (memcmp(value.data(), headerMagic, sizeof(headerMagic)) == 0);
+    bool large = (value.size() >= threshold) && (value.size() <= UINT32_MAX);
+    if (!tagged && (!codec || !large))
+    {
+        skipCount++;
+        return value;
+    }
+
+    // Reserve the header, and fill it after compression
+    encodeBuf.assign(headerSize, '\0');
+    memcpy(&encodeBuf[0], headerMagic, sizeof(headerMagic));
+    uint32_t rawLen = (uint32_t)value.size();
+    for (int i = 0; i < 4; i++)
+    {
+        encodeBuf[4 + i] = (char)((rawLen >> (8 * i)) & 0xFF);
+    }
+
+    if (codec && large)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = codec->Compress(value.data(), value.size(), encodeBuf);
+        compressNanos += NanosSince(start);
+        if (ok && (encodeBuf.size() < value.size()))
+        {
+            encodeBuf[3] = (char)codec->GetId();
+            compressCount++;
+            rawBytes += value.size();
+            compressedBytes += encodeBuf.size();
+            return encodeBuf;
+        }
+        encodeBuf.resize(headerSize);
+    }
+
+    // Value which looks like a tagged one has to be escaped, otherwise reads are confused
+    skipCount++;
+    if (!tagged)
+    {
+        return value;
+    }
+    encodeBuf[3] = 0;
+    encodeBuf.append(value.data(), value.size());
+    return encodeBuf;
+}
+
+bool MiniRedisCodecLayer::Decode(const char* data, std::size_t len, std::string& replied)
+{
+    uint8_t id = 0;
+    std::size_t rawLen = 0;
+    if (!ParseHeader(data, len, id, rawLen))
+    {
+        replied.assign(data, len);
+        return true;
+    }
+
+    // Decompress directly into replied, so that its capacity is reused
+    replied.resize(rawLen);
+    if (!DecodeTo(data, len, id, &replied[0], rawLen))
+    {
+        replied.clear();
+        return false;
+    }
+    return true;
+}
+
+bool MiniRedisCodecLayer::DecodeView(const char* data, std::size_t len, std::string_view& replied)
+{
+    uint8_t id = 0;
+    std::size_t rawLen = 0;
+    if (!ParseHeader(data, len, id, rawLen))
+    {
+        replied = std::string_view(data, len);
+        return true;
+    }
+
+    decodeBuf.resize(rawLen);
+    if (!DecodeTo(data, len, id, &decodeBuf[0], rawLen))
+    {
+        replied = std::string_view();
+        return false;
+    }
+    replied = std::string_view(decodeBuf.data(), rawLen);
+    return true;
+}
+
+MiniRedisCodecStats MiniRedisCodecLayer::GetStats() const
+{
+    MiniRedisCodecStats stats;
+    stats.compressCount = compressCount;
+    stats.skipCount = skipCount;
+    stats.rawBytes = rawBytes;
+    stats.compressedBytes = compressedBytes;
+    stats.compressNanos = compressNanos;
+    stats.decompressCount = decompressCount;
+    stats.decompressNanos = decompressNanos;
+    return stats;
+}
+
+void MiniRedisCodecLayer::ResetStats()
+{
+    compressCount = 0;
+    skipCount = 0;
+    rawBytes = 0;
+    compressedBytes = 0;
+    compressNanos = 0;
+    decompressCount = 0;
+    decompressNanos = 0;
+}
+
+const MiniRedisCodec* MiniRedisCodecLayer::FindCodec(uint8_t id) const
+{
+    if (codec && (codec->GetId() == id))
+    {
+        return codec.get();
+    }
+    if (builtin.GetId() == id)
+    {
+        return &builtin;
+    }
+
+    return nullptr;
+}
+
+bool MiniRedisCodecLayer::ParseHeader(const char* data, std::size_t len,
+    uint8_t& id, std::size_t& rawLen) const
+{
+    if (!data || (len < headerSize) || (memcmp(data, headerMagic, sizeof(headerMagic)) != 0))
+    {
+        return false;
+    }
+
+    id = (uint8_t)data[3];
+    rawLen = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        rawLen |= (std::size_t)(uint8_t)data[4 + i] << (8 * i);
+    }
+    return true;
+}
+
+bool MiniRedisCodecLayer::DecodeTo(const char* data, std::size_t len, uint8_t id,
+    char* dst, std::size_t rawLen)
+{
+    const char* payload = data + headerSize;
+    std::size_t payloadLen = len - headerSize;
+    if (id == 0)
+    {
+        // Escaped value, stored as is
+        if (payloadLen != rawLen)
+        {
+            return false;
+        }
+        memcpy(dst, payload, rawLen);
+        return true;
+    }
+
+    const MiniRedisCodec* decoder = FindCodec(id);
+    if (!decoder)
+    {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = decoder->Decompress(payload, payloadLen, dst, rawLen);
+    decompressNanos += NanosSince(start);
+    decompressCount++;
+    return ok;
+}
@@ -0,0 +1,121 @@
+// Value codec layer for MiniRedisClient
+// Values larger than the threshold are compressed before being written by set()/hset(),
+// and tagged with a small header, so that get()/hget() can detect and decompress them.
+//
+// Header of tagged value, 8 bytes:
+//   byte 0-2: magic "\0MZ"
+//   byte 3:   codec id, 0 means the value is stored as is
+//   byte 4-7: original size, little endian
+//
+// A built-in LZ codec without external dependency is provided.
+// Other codecs can be plugged in by implementing MiniRedisCodec.
+//
+
+#ifndef MiniRedisCodec_INCLUDED
+#define MiniRedisCodec_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+// Interface of compressor
+class MiniRedisCodec
+{
+public:
+    virtual ~MiniRedisCodec() = default;
+
+    // Written into the header, so that reads can pick the right codec
+    // 0 is reserved for values stored as is
+    virtual uint8_t GetId() const = 0;
+    virtual std::string GetName() const = 0;
+
+    // Compress src and append the result to dst
+    // Return false if failed, or the data can't be compressed
+    virtual bool Compress(const char* src, std::size_t len, std::string& dst) const = 0;
+    // Decompress src into dst, which has exactly rawLen bytes
+    // Return false if src is corrupted
+    virtual bool Decompress(const char* src, std::size_t len, char* dst, std::size_t rawLen) const = 0;
+};
+
+// Built-in LZ77 codec, in the byte oriented format of LZ4 block
+// Favors speed over ratio
+class MiniRedisLZCodec : public MiniRedisCodec
+{
+public:
+    static const uint8_t Id = 1;
+
+    uint8_t GetId() const override;
+    std::string GetName() const override;
+    bool Compress(const char* src, std::size_t len, std::string& dst) const override;
+    bool Decompress(const char* src, std::size_t len, char* dst, std::size_t rawLen) const override;
+};
+
+// Counters of codec layer
+struct MiniRedisCodecStats
+{
+    // Number of values compressed
+    uint64_t compressCount;
+    // Number of values written as is, below threshold or not compressible
+    uint64_t skipCount;
+    // Size of the compressed values before and after compression, including header
+    uint64_t rawBytes;
+    uint64_t compressedBytes;
+    // CPU time spent in compression
+    uint64_t compressNanos;
+    // Number of values decompressed, and the CPU time spent
+    uint64_t decompressCount;
+    uint64_t decompressNanos;
+
+    // rawBytes / compressedBytes, 1.0 if nothing is compressed
+    double GetRatio() const;
+};
+
+class MiniRedisCodecLayer
+{
+public:
+    MiniRedisCodecLayer(std::shared_ptr<MiniRedisCodec> codec, std::size_t threshold);
+
+    std::shared_ptr<MiniRedisCodec> GetCodec() const;
+    std::size_t GetThreshold() const;
+
+    // Return the value to be written
+    // It is either value itself, or points to a buffer reused by the calling thread
+    // The returned view is valid until next Encode() in the same thread
+    std::string_view Encode(std::string_view value);
+
+    // Decode value read from Redis into replied
+    // Untagged values are copied as is
+    // Return false if the value is tagged but corrupted, or the codec is unknown
+    bool Decode(const char* data, std::size_t len, std::string& replied);
+    // Decode into a buffer reused by the calling thread
+    // The returned view is valid until next DecodeView() in the same thread
+    bool DecodeView(const char* data, std::size_t len, std::string_view& replied);
+
+    MiniRedisCodecStats GetStats() const;
+    void ResetStats();
+
+private:
+    // Return the codec by id, or nullptr if unknown
+    const MiniRedisCodec* FindCodec(uint8_t id) const;
+    // Check header, and return the codec id and original size
+    bool ParseHeader(const char* data, std::size_t len, uint8_t& id, std::size_t& rawLen) const;
+    bool DecodeTo(const char* data, std::size_t len, uint8_t id, char* dst, std::size_t rawLen);
+
+private:
+    std::shared_ptr<MiniRedisCodec> codec;
+    // The built-in codec can always be decoded, even if another codec is used for writing
+    MiniRedisLZCodec builtin;
+    std::size_t threshold;
+
+    std::atomic<uint64_t> compressCount;
+    std::atomic<uint64_t> skipCount;
+    std::atomic<uint64_t> rawBytes;
+    std::atomic<uint64_t> compressedBytes;
+    std::atomic<uint64_t> compressNanos;
+    std::atomic<uint64_t> decompressCount;
+    std::atomic<uint64_t> decompressNanos;
+};
+
+#endif // MiniRedisCodec_INCLUDED
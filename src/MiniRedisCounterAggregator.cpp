@@ -0,0 +1,335 @@
+// Write-behind aggregator of counters
+
+#include <algorithm>
+#include <limits>
+#include <hiredis/hiredis.h>
+#include "MiniRedisCounterAggregator.h"
+#include "MiniRedisLogger.h"
+
+MiniRedisCounterAggregator::MiniRedisCounterAggregator()
+    : pending(0), flushIntervalMs(1000), maxPending(10000), running(false),
+      events(0), commands(0), flushes(0), failures(0)
+{
+}
+
+MiniRedisCounterAggregator::~MiniRedisCounterAggregator()
+{
+    Stop();
+}
+
+void MiniRedisCounterAggregator::SetFlushIntervalMs(uint32_t ms)
+{
+    flushIntervalMs = ms ? ms : 1;
+}
+
+void MiniRedisCounterAggregator::SetMaxPending(std::size_t count)
+{
+    maxPending = count ? count : 1;
+}
+
+bool MiniRedisCounterAggregator::Connect(const std::string& host, uint16_t port, uint32_t timeoutSec)
+{
+    std::lock_guard<std::mutex> lock(flushMutex);
+    return client.Connect(host, port, timeoutSec);
+}
+
+void MiniRedisCounterAggregator::Start()
+{
+    std::lock_guard<std::mutex> lock(threadMutex);
+    if (running)
+    {
+        return;
+    }
+
+    running = true;
+    flushThread = std::thread(&MiniRedisCounterAggregator::ThreadRoutine, this);
+}
+
+void MiniRedisCounterAggregator::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        running = false;
+    }
+
+    cv.notify_all();
+    if (flushThread.joinable())
+    {
+        flushThread.join();
+    }
+
+    // Also when the thread was never started
+    Flush();
+}
+
+void MiniRedisCounterAggregator::ThreadRoutine()
+{
+    std::unique_lock<std::mutex> lock(threadMutex);
+    while (running)
+    {
+        cv.wait_for(lock, std::chrono::milliseconds(flushIntervalMs), [this]() {
+            return !running || (pending >= maxPending);
+        });
+
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+std::string MiniRedisCounterAggregator::MapKey(const std::string& key, const std::string* field,
+    bool isFloat)
+{
+    // Type tag first, so that the same key counted as integer and float don't mix
+    std::string mapKey;
+    mapKey.reserve(key.size() + (field ? field->size() : 0) + 3);
+    mapKey.push_back(field ? 'h' : 'k');
+    mapKey.push_back(isFloat ? 'f' : 'i');
+    mapKey.append(key);
+    if (field)
+    {
+        mapKey.push_back('\0');
+        mapKey.append(*field);
+    }
+    return mapKey;
+}
+
+void MiniRedisCounterAggregator::Add(const std::string& key, const std::string* field,
+    long long int intDelta, double floatDelta, bool isFloat)
+{
+    std::string mapKey = MapKey(key, field, isFloat);
+    Shard& shard = shards[std::hash<std::string>()(mapKey) % shardCount];
+    bool added = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto iter = shard.entries.find(mapKey);
+        if (iter == shard.entries.end())
+        {
+            Entry entry;
+            entry.key = key;
+            if (field)
+            {
+                entry.field = *field;
+                entry.isHash = true;
+            }
+            entry.isFloat = isFloat;
+            iter = shard.entries.emplace(std::move(mapKey), std::move(entry)).first;
+            added = true;
+        }
+        iter->second.intDelta += intDelta;
+        iter->second.floatDelta += floatDelta;
+    }
+
+    events++;
+    if (added && (++pending == maxPending))
+    {
+        cv.notify_one();
+    }
+}
+
+void MiniRedisCounterAggregator::Merge(Entry& entry)
+{
+    std::string mapKey = MapKey(entry.key, entry.isHash ? &entry.field : nullptr, entry.isFloat);
+    Shard& shard = shards[std::hash<std::string>()(mapKey) % shardCount];
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto iter = shard.entries.find(mapKey);
+    if (iter == shard.entries.end())
+    {
+        shard.entries.emplace(std::move(mapKey), std::move(entry));
+        pending++;
+        return;
+    }
+
+    iter->second.intDelta += entry.intDelta;
+    iter->second.floatDelta += entry.floatDelta;
+}
+
+void MiniRedisCounterAggregator::incrby(const std::string& key, long long int increment)
+{
+    Add(key, nullptr, increment, 0, false);
+}
+
+void MiniRedisCounterAggregator::decrby(const std::string& key, long long int decrement)
+{
+    // Can't be negated, and DECRBY of Redis rejects it too
+    if (decrement == std::numeric_limits<long long int>::min())
+    {
+        MINIREDIS_LOG_WARN("Decrement of %s would overflow", key.c_str());
+        failures++;
+        return;
+    }
+
+    Add(key, nullptr, -decrement, 0, false);
+}
+
+void MiniRedisCounterAggregator::incrbyfloat(const std::string& key, double increment)
+{
+    Add(key, nullptr, 0, increment, true);
+}
+
+void MiniRedisCounterAggregator::hincrby(const std::string& key, const std::string& field,
+    long long int increment)
+{
+    Add(key, &field, increment, 0, false);
+}
+
+void MiniRedisCounterAggregator::hincrbyfloat(const std::string& key, const std::string& field,
+    double increment)
+{
+    Add(key, &field, 0, increment, true);
+}
+
+bool MiniRedisCounterAggregator::ToCommand(const Entry& entry, std::vector<std::string>& command)
+{
+    std::string delta;
+    if (entry.isFloat)
+    {
+        char buf[MiniRedisNumeric::MaxChars];
+        std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), entry.floatDelta);
+        if (len == 0)
+        {
+            return false;
+        }
+        delta.assign(buf, len);
+    }
+    else
+    {
+        delta = std::to_string(entry.intDelta);
+    }
+
+    if (entry.isHash)
+    {
+        command = {GetCommandName(entry), entry.key, entry.field, delta};
+    }
+    else
+    {
+        command = {GetCommandName(entry), entry.key, delta};
+    }
+    return true;
+}
+
+const char* MiniRedisCounterAggregator::GetCommandName(const Entry& entry)
+{
+    if (entry.isHash)
+    {
+        return entry.isFloat ? "HINCRBYFLOAT" : "HINCRBY";
+    }
+    return entry.isFloat ? "INCRBYFLOAT" : "INCRBY";
+}
+
+bool MiniRedisCounterAggregator::Flush()
+{
+    std::lock_guard<std::mutex> flushLock(flushMutex);
+
+    // Take all entries, so that counting continues on empty maps during flush
+    std::vector<Entry> batch;
+    for (auto& shard : shards)
+    {
+        EntryMap entries;
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            entries.swap(shard.entries);
+        }
+        pending -= entries.size();
+        for (auto& x : entries)
+        {
+            if ((x.second.intDelta != 0) || (x.second.floatDelta != 0))
+            {
+                batch.push_back(std::move(x.second));
+            }
+        }
+    }
+    if (batch.empty())
+    {
+        return true;
+    }
+
+    if (!client.IsConnected() && !client.Connect())
+    {
+        for (auto& x : batch)
+        {
+            Merge(x);
+        }
+        failures += batch.size();
+        return false;
+    }
+
+    flushes++;
+    bool ret = true;
+    for (std::size_t start = 0; start < batch.size(); start += batchSize)
+    {
+        std::size_t end = std::min(batch.size(), start + batchSize);
+        std::size_t appended = start;
+        std::vector<bool> encoded(end - start, true);
+        for (; appended < end; appended++)
+        {
+            std::vector<std::string> command;
+            if (!ToCommand(batch[appended], command))
+            {
+                encoded[appended - start] = false;
+                continue;
+            }
+            if (!client.PipelineAppend(command))
+            {
+                break;
+            }
+        }
+
+        for (std::size_t i = start; i < end; i++)
+        {
+            if ((i < appended) && !encoded[i - start])
+            {
+                // Not sent, and retrying doesn't help
+                MINIREDIS_LOG_ERROR("Failed to encode delta of %s %s", GetCommandName(batch[i]), 
+                    batch[i].key.c_str());
+                failures++;
+                ret = false;
+                continue;
+            }
+
+            redisReply* reply = (i < appended) ? client.PipelineGetReply() : nullptr;
+            if (!reply)
+            {
+                // Not sure whether it was applied if the connection broke,
+                // keep it for next flush, which may count it twice
+                Merge(batch[i]);
+                failures++;
+                ret = false;
+                continue;
+            }
+
+            if (reply->type == REDIS_REPLY_ERROR)
+            {
+                // Such as WRONGTYPE, retrying doesn't help
+                MINIREDIS_LOG_WARN("Failed to %s %s: %s", GetCommandName(batch[i]), 
+                    batch[i].key.c_str(), reply->str);
+                failures++;
+                ret = false;
+            }
+            commands++;
+            freeReplyObject(reply);
+        }
+
+        if (!client.IsConnected())
+        {
+            // The rest are kept for next flush
+            for (std::size_t i = end; i < batch.size(); i++)
+            {
+                Merge(batch[i]);
+            }
+            break;
+        }
+    }
+
+    return ret;
+}
+
+MiniRedisCounterStats MiniRedisCounterAggregator::GetStats() const
+{
+    MiniRedisCounterStats x;
+    x.events = events;
+    x.commands = commands;
+    x.flushes = flushes;
+    x.failures = failures;
+    return x;
+}
@@ -0,0 +1,127 @@
+// Write-behind aggregator of counters
+// Increments are accumulated in memory per key, and per hash field,
+// and flushed periodically, or when too many keys are pending,
+// as one pipelined batch of INCRBY, HINCRBY, INCRBYFLOAT and HINCRBYFLOAT.
+// So the traffic to Redis depends on the number of distinct keys per interval,
+// instead of the number of events.
+//
+// The map is split into shards, each with its own lock, so that threads
+// counting different keys don't contend.
+// Pending increments are flushed by Stop() and the destructor.
+// Increments not flushed are lost if the process crashes.
+//
+// One instance can be shared by threads of the process.
+//
+
+#ifndef MiniRedisCounterAggregator_INCLUDED
+#define MiniRedisCounterAggregator_INCLUDED
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include "MiniRedisClient.h"
+
+struct MiniRedisCounterStats
+{
+    // Increments accumulated
+    uint64_t events;
+    // Commands sent
+    uint64_t commands;
+    uint64_t flushes;
+    // Commands failed and kept for next flush, or increments dropped as invalid
+    uint64_t failures;
+};
+
+class MiniRedisCounterAggregator
+{
+public:
+    MiniRedisCounterAggregator();
+    ~MiniRedisCounterAggregator();
+
+    MiniRedisCounterAggregator(const MiniRedisCounterAggregator&) = delete;
+    MiniRedisCounterAggregator& operator=(const MiniRedisCounterAggregator&) = delete;
+
+    // Before Start()
+    void SetFlushIntervalMs(uint32_t ms);
+    // Flush at once when this number of distinct keys are pending
+    void SetMaxPending(std::size_t count);
+
+    bool Connect(const std::string& host, uint16_t port = 6379, uint32_t timeoutSec = 3);
+    // Start the flush thread
+    void Start();
+    // Flush the pending increments and stop the flush thread
+    void Stop();
+
+    // Send all pending increments now
+    bool Flush();
+
+    // Accumulate the increments
+    void incrby(const std::string& key, long long int increment);
+    // LLONG_MIN is dropped and counted as a failure, as it can't be negated
+    void decrby(const std::string& key, long long int decrement);
+    void incrbyfloat(const std::string& key, double increment);
+    void hincrby(const std::string& key, const std::string& field, long long int increment);
+    void hincrbyfloat(const std::string& key, const std::string& field, double increment);
+
+    MiniRedisCounterStats GetStats() const;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        // Empty for string keys
+        std::string field;
+        bool isHash = false;
+        bool isFloat = false;
+        long long int intDelta = 0;
+        double floatDelta = 0;
+    };
+
+    using EntryMap = std::unordered_map<std::string, Entry>;
+
+    struct Shard
+    {
+        std::mutex mtx;
+        EntryMap entries;
+    };
+
+    void Add(const std::string& key, const std::string* field, long long int intDelta,
+        double floatDelta, bool isFloat);
+    // Put back the entries not flushed
+    void Merge(Entry& entry);
+    // Build the command of one entry, false if the delta can't be encoded
+    static bool ToCommand(const Entry& entry, std::vector<std::string>& command);
+    static const char* GetCommandName(const Entry& entry);
+    static std::string MapKey(const std::string& key, const std::string* field, bool isFloat);
+    void ThreadRoutine();
+
+private:
+    static const std::size_t shardCount = 16;
+    // Commands sent in one pipeline at most, and the replies are read before next batch
+    static const std::size_t batchSize = 1000;
+
+    Shard shards[shardCount];
+    std::atomic<std::size_t> pending;
+
+    // Used by flush only
+    MiniRedisClient client;
+    std::mutex flushMutex;
+
+    uint32_t flushIntervalMs;
+    std::size_t maxPending;
+    std::thread flushThread;
+    std::mutex threadMutex;
+    std::condition_variable cv;
+    bool running;
+
+    std::atomic<uint64_t> events;
+    std::atomic<uint64_t> commands;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> failures;
+};
+
+#endif // MiniRedisCounterAggregator_INCLUDED
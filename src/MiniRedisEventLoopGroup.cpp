@@ -0,0 +1,276 @@
+// Fixed group of libevent loop threads, shared by many async connections
+
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <future>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <event2/event.h>
+#include "MiniRedisEventLoopGroup.h"
+#include "MiniRedisLogger.h"
+
+MiniRedisEventLoopGroup::MiniRedisEventLoopGroup(uint32_t count)
+    : count(count ? count : std::max(1u, std::thread::hardware_concurrency())),
+      policy(LOOP_ROUND_ROBIN), next(0), running(false)
+{
+}
+
+MiniRedisEventLoopGroup::~MiniRedisEventLoopGroup()
+{
+    Stop();
+}
+
+void MiniRedisEventLoopGroup::SetPolicy(MiniRedisLoopPolicy policy)
+{
+    this->policy = policy;
+}
+
+bool MiniRedisEventLoopGroup::Start()
+{
+    if (running)
+    {
+        return true;
+    }
+
+    // Loops of last run
+    loops.clear();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto loop = std::make_shared<Loop>();
+        loop->base = event_base_new();
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!loop->base || (loop->wakeFd < 0))
+        {
+            MINIREDIS_LOG_ERROR("Failed to create event loop");
+            loops.clear();
+            return false;
+        }
+
+        // The persistent wakeup event also keeps the loop running without connections
+        loop->wakeEvent = event_new(loop->base, loop->wakeFd, EV_READ | EV_PERSIST,
+            OnWakeup, loop.get());
+        event_add(loop->wakeEvent, nullptr);
+        loops.push_back(std::move(loop));
+    }
+
+    running = true;
+    for (auto& loop : loops)
+    {
+        loop->thread = std::thread(ThreadRoutine, loop);
+    }
+
+    return true;
+}
+
+void MiniRedisEventLoopGroup::Stop()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    running = false;
+    for (auto& loop : loops)
+    {
+        // Queued after the pending tasks, so they are run before the loop breaks,
+        // and no task can be queued after it
+        event_base* base = loop->base;
+        {
+            std::lock_guard<std::mutex> lock(loop->mtx);
+            loop->stopped = true;
+            loop->tasks.push_back([base]() { event_base_loopbreak(base); });
+        }
+        uint64_t one = 1;
+        if (write(loop->wakeFd, &one, sizeof(one)) < 0)
+        {
+            MINIREDIS_LOG_ERROR("Failed to wake up event loop: %s", strerror(errno));
+        }
+    }
+
+    for (auto& loop : loops)
+    {
+        if (loop->threadId == std::this_thread::get_id())
+        {
+            // Called by a task of this loop, which can't join itself
+            loop->thread.detach();
+        }
+        else if (loop->thread.joinable())
+        {
+            loop->thread.join();
+        }
+    }
+}
+
+MiniRedisEventLoopGroup::Loop::~Loop()
+{
+    if (wakeEvent)
+    {
+        event_free(wakeEvent);
+    }
+    if (base)
+    {
+        event_base_free(base);
+    }
+    if (wakeFd >= 0)
+    {
+        close(wakeFd);
+    }
+}
+
+bool MiniRedisEventLoopGroup::IsRunning() const
+{
+    return running;
+}
+
+std::size_t MiniRedisEventLoopGroup::GetLoopCount() const
+{
+    return running ? loops.size() : 0;
+}
+
+std::size_t MiniRedisEventLoopGroup::Acquire()
+{
+    if (!running || loops.empty())
+    {
+        return 0;
+    }
+
+    std::size_t index = 0;
+    if (policy == LOOP_LEAST_LOADED)
+    {
+        for (std::size_t i = 1; i < loops.size(); i++)
+        {
+            if (loops[i]->load < loops[index]->load)
+            {
+                index = i;
+            }
+        }
+    }
+    else
+    {
+        index = next++ % loops.size();
+    }
+
+    loops[index]->load++;
+    return index;
+}
+
+void MiniRedisEventLoopGroup::Release(std::size_t index)
+{
+    if ((index < loops.size()) && (loops[index]->load > 0))
+    {
+        loops[index]->load--;
+    }
+}
+
+uint32_t MiniRedisEventLoopGroup::GetLoad(std::size_t index) const
+{
+    return (index < loops.size()) ? loops[index]->load.load() : 0;
+}
+
+event_base* MiniRedisEventLoopGroup::GetBase(std::size_t index) const
+{
+    return (index < loops.size()) ? loops[index]->base : nullptr;
+}
+
+bool MiniRedisEventLoopGroup::IsInLoopThread(std::size_t index) const
+{
+    return (index < loops.size()) && (loops[index]->threadId == std::this_thread::get_id());
+}
+
+bool MiniRedisEventLoopGroup::RunInLoop(std::size_t index, std::function<void()> task)
+{
+    if (!running || (index >= loops.size()) || !task)
+    {
+        return false;
+    }
+
+    if (IsInLoopThread(index))
+    {
+        task();
+        return true;
+    }
+
+    Loop* loop = loops[index].get();
+    bool wakeup = false;
+    {
+        std::lock_guard<std::mutex> lock(loop->mtx);
+        // Stop() may have begun after the check of running
+        if (loop->stopped)
+        {
+            return false;
+        }
+        // Only the first task needs to wake up the loop
+        wakeup = loop->tasks.empty();
+        loop->tasks.push_back(std::move(task));
+    }
+
+    if (wakeup)
+    {
+        uint64_t one = 1;
+        if (write(loop->wakeFd, &one, sizeof(one)) < 0)
+        {
+            MINIREDIS_LOG_ERROR("Failed to wake up event loop: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MiniRedisEventLoopGroup::RunInLoopSync(std::size_t index, const std::function<void()>& task)
+{
+    if (IsInLoopThread(index))
+    {
+        task();
+        return true;
+    }
+
+    std::promise<void> done;
+    std::future<void> result = done.get_future();
+    bool ret = RunInLoop(index, [&task, &done]() {
+        task();
+        done.set_value();
+    });
+    if (!ret)
+    {
+        return false;
+    }
+
+    result.wait();
+    return true;
+}
+
+void MiniRedisEventLoopGroup::ThreadRoutine(std::shared_ptr<Loop> loop)
+{
+    loop->threadId = std::this_thread::get_id();
+    event_base_dispatch(loop->base);
+    // Tasks posted while breaking
+    RunTasks(loop.get());
+}
+
+void MiniRedisEventLoopGroup::OnWakeup(int fd, short, void* arg)
+{
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) < 0)
+    {
+        // Nothing to read, the tasks were run by previous wakeup
+    }
+
+    RunTasks(reinterpret_cast<Loop*>(arg));
+}
+
+void MiniRedisEventLoopGroup::RunTasks(Loop* loop)
+{
+    // Swap out, so that tasks can post new tasks without deadlock
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(loop->mtx);
+        tasks.swap(loop->tasks);
+    }
+
+    for (auto& task : tasks)
+    {
+        task();
+    }
+}
@@ -0,0 +1,106 @@
+// Fixed group of libevent loop threads, shared by many async connections
+// Instead of one event_base and one thread per MiniRedisPubSub,
+// connections are assigned to a few loops, one per core for example.
+// Each connection stays on its loop, so its callbacks are always called
+// by the same thread, in the order of the replies.
+//
+// hiredis async context is not thread safe, so all operations on a connection
+// are posted to its loop thread by RunInLoop().
+//
+// Connections should be disconnected before the group is stopped.
+// Stop() runs the pending tasks, breaks the loops and joins the threads.
+// Tasks posted once Stop() has begun are rejected, so RunInLoopSync() never waits forever.
+// Stop() may also be called by a task, then the thread of that loop is not joined,
+// but exits after the task, and frees its loop by itself.
+//
+
+#ifndef MiniRedisEventLoopGroup_INCLUDED
+#define MiniRedisEventLoopGroup_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+struct event_base;
+struct event;
+
+// How to assign new connection to loop
+enum MiniRedisLoopPolicy
+{
+    LOOP_ROUND_ROBIN,
+    // The loop with fewest connections
+    LOOP_LEAST_LOADED
+};
+
+class MiniRedisEventLoopGroup
+{
+public:
+    // 0 means one loop per core
+    explicit MiniRedisEventLoopGroup(uint32_t count = 0);
+    ~MiniRedisEventLoopGroup();
+
+    MiniRedisEventLoopGroup(const MiniRedisEventLoopGroup&) = delete;
+    MiniRedisEventLoopGroup& operator=(const MiniRedisEventLoopGroup&) = delete;
+
+    void SetPolicy(MiniRedisLoopPolicy policy);
+
+    // Create the loops and start their threads
+    bool Start();
+    // Run pending tasks, then stop and join all loop threads
+    void Stop();
+    bool IsRunning() const;
+
+    std::size_t GetLoopCount() const;
+    // Choose the loop for new connection, by the policy
+    std::size_t Acquire();
+    // The connection on the loop is closed
+    void Release(std::size_t index);
+    // Number of connections on the loop
+    uint32_t GetLoad(std::size_t index) const;
+
+    event_base* GetBase(std::size_t index) const;
+    bool IsInLoopThread(std::size_t index) const;
+
+    // Run the task in the loop thread, at once if already in it
+    bool RunInLoop(std::size_t index, std::function<void()> task);
+    // Same as RunInLoop(), and wait until the task is done
+    bool RunInLoopSync(std::size_t index, const std::function<void()>& task);
+
+private:
+    struct Loop
+    {
+        ~Loop();
+
+        event_base* base = nullptr;
+        // Wake up the loop when tasks are posted
+        event* wakeEvent = nullptr;
+        int wakeFd = -1;
+        std::thread thread;
+        std::atomic<std::thread::id> threadId;
+        // Guard of tasks and stopped
+        std::mutex mtx;
+        std::vector<std::function<void()>> tasks;
+        // No more tasks are accepted
+        bool stopped = false;
+        std::atomic<uint32_t> load{0};
+    };
+
+    // The thread shares the loop, which outlives the group if stopped by its own task
+    static void ThreadRoutine(std::shared_ptr<Loop> loop);
+    static void OnWakeup(int fd, short what, void* arg);
+    static void RunTasks(Loop* loop);
+
+private:
+    // Kept after Stop(), so that late RunInLoop() finds the loop stopped, until next Start()
+    std::vector<std::shared_ptr<Loop>> loops;
+    uint32_t count;
+    MiniRedisLoopPolicy policy;
+    std::atomic<std::size_t> next;
+    std::atomic<bool> running;
+};
+
+#endif // MiniRedisEventLoopGroup_INCLUDED
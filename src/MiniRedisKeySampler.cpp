@@ -0,0 +1,281 @@
+// Client side hot key detector and slow command log
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include "MiniRedisKeySampler.h"
+
+namespace
+{
+    uint64_t Mix(uint64_t h)
+    {
+        // Finalizer of MurmurHash3
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+MiniRedisKeySampler::MiniRedisKeySampler(uint32_t width, uint32_t depth, uint32_t topK)
+    : width(width ? width : 1), depth(depth ? depth : 1), topK(topK ? topK : 1),
+      sampleRate(100), slowThresholdUs(10000), maxArgLength(32), commands(0), sampled(0),
+      slowLogSize(128), slowNext(0), dumping(false)
+{
+    countSketch.assign((std::size_t)this->width * this->depth, 0);
+    bytesSketch.assign((std::size_t)this->width * this->depth, 0);
+}
+
+MiniRedisKeySampler::~MiniRedisKeySampler()
+{
+    StopDump();
+}
+
+void MiniRedisKeySampler::SetSampleRate(uint32_t oneInN)
+{
+    sampleRate = oneInN ? oneInN : 1;
+}
+
+void MiniRedisKeySampler::SetSlowThresholdUs(uint64_t us)
+{
+    slowThresholdUs = us;
+}
+
+void MiniRedisKeySampler::SetSlowLogSize(std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    slowLogSize = size;
+    slowLog.clear();
+    slowNext = 0;
+}
+
+void MiniRedisKeySampler::SetMaxArgLength(std::size_t len)
+{
+    maxArgLength = len;
+}
+
+std::size_t MiniRedisKeySampler::GetMaxArgLength() const
+{
+    return maxArgLength;
+}
+
+bool MiniRedisKeySampler::ShouldSample()
+{
+    commands++;
+    // Per thread counter, so that sampling doesn't contend
+    thread_local uint32_t counter = 0;
+    if (++counter < sampleRate)
+    {
+        return false;
+    }
+
+    counter = 0;
+    sampled++;
+    return true;
+}
+
+bool MiniRedisKeySampler::IsSlow(uint64_t latencyUs) const
+{
+    uint64_t threshold = slowThresholdUs;
+    return threshold && (latencyUs >= threshold);
+}
+
+uint64_t MiniRedisKeySampler::AddToSketch(std::vector<uint64_t>& sketch, uint64_t h1, uint64_t h2,
+    uint64_t value)
+{
+    // Double hashing gives depth independent enough rows
+    uint64_t estimate = UINT64_MAX;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        uint64_t& counter = sketch[(std::size_t)i * width + (h1 + i * h2) % width];
+        counter += value;
+        estimate = std::min(estimate, counter);
+    }
+    return estimate;
+}
+
+void MiniRedisKeySampler::RecordKey(std::string_view key, std::size_t bytes)
+{
+    if (key.empty())
+    {
+        return;
+    }
+
+    uint64_t h1 = std::hash<std::string_view>()(key);
+    uint64_t h2 = Mix(h1) | 1;
+    std::lock_guard<std::mutex> lock(mtx);
+    topByCount.Update(key, AddToSketch(countSketch, h1, h2, 1), topK);
+    topByBytes.Update(key, AddToSketch(bytesSketch, h1, h2, bytes), topK);
+}
+
+void MiniRedisKeySampler::RecordSlow(uint64_t latencyUs, std::string command)
+{
+    MiniRedisSlowEntry entry;
+    entry.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    entry.latencyUs = latencyUs;
+    entry.command = std::move(command);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!slowLogSize)
+    {
+        return;
+    }
+    if (slowLog.size() < slowLogSize)
+    {
+        slowLog.push_back(std::move(entry));
+    }
+    else
+    {
+        slowLog[slowNext] = std::move(entry);
+    }
+    slowNext = (slowNext + 1) % slowLogSize;
+}
+
+void MiniRedisKeySampler::TopK::Update(std::string_view key, uint64_t estimate, std::size_t k)
+{
+    auto greater = [](const std::pair<uint64_t, std::string>& a,
+        const std::pair<uint64_t, std::string>& b) { return a.first > b.first; };
+
+    for (auto& x : heap)
+    {
+        if (x.second == key)
+        {
+            // K is small, rebuilding is cheaper than tracking positions
+            x.first = estimate;
+            std::make_heap(heap.begin(), heap.end(), greater);
+            return;
+        }
+    }
+
+    if (heap.size() < k)
+    {
+        heap.emplace_back(estimate, std::string(key));
+        std::push_heap(heap.begin(), heap.end(), greater);
+    }
+    else if (!heap.empty() && (estimate > heap.front().first))
+    {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        heap.back() = std::make_pair(estimate, std::string(key));
+        std::push_heap(heap.begin(), heap.end(), greater);
+    }
+}
+
+std::vector<std::pair<std::string, uint64_t>> MiniRedisKeySampler::TopK::Sorted() const
+{
+    std::vector<std::pair<std::string, uint64_t>> ans;
+    for (auto& x : heap)
+    {
+        ans.emplace_back(x.second, x.first);
+    }
+    std::sort(ans.begin(), ans.end(), [](const std::pair<std::string, uint64_t>& a,
+        const std::pair<std::string, uint64_t>& b) { return a.second > b.second; });
+    return ans;
+}
+
+MiniRedisSamplerSnapshot MiniRedisKeySampler::Snapshot(bool reset)
+{
+    MiniRedisSamplerSnapshot snapshot;
+    std::lock_guard<std::mutex> lock(mtx);
+    snapshot.hotByCount = topByCount.Sorted();
+    snapshot.hotByBytes = topByBytes.Sorted();
+
+    // Oldest first
+    if (slowLog.size() < slowLogSize)
+    {
+        snapshot.slowLog = slowLog;
+    }
+    else
+    {
+        snapshot.slowLog.assign(slowLog.begin() + slowNext, slowLog.end());
+        snapshot.slowLog.insert(snapshot.slowLog.end(), slowLog.begin(), slowLog.begin() + slowNext);
+    }
+    snapshot.commands = commands;
+    snapshot.sampled = sampled;
+
+    if (reset)
+    {
+        std::fill(countSketch.begin(), countSketch.end(), 0);
+        std::fill(bytesSketch.begin(), bytesSketch.end(), 0);
+        topByCount.heap.clear();
+        topByBytes.heap.clear();
+        slowLog.clear();
+        slowNext = 0;
+        commands = 0;
+        sampled = 0;
+    }
+
+    return snapshot;
+}
+
+void MiniRedisKeySampler::Print(const MiniRedisSamplerSnapshot& snapshot, std::ostream& os)
+{
+    os << "Commands: " << snapshot.commands << ", sampled: " << snapshot.sampled << std::endl;
+    os << "Hot keys by count:" << std::endl;
+    for (auto& x : snapshot.hotByCount)
+    {
+        os << "  " << x.first << ": " << x.second << std::endl;
+    }
+    os << "Hot keys by bytes:" << std::endl;
+    for (auto& x : snapshot.hotByBytes)
+    {
+        os << "  " << x.first << ": " << x.second << std::endl;
+    }
+    os << "Slow commands:" << std::endl;
+    for (auto& x : snapshot.slowLog)
+    {
+        os << "  " << x.latencyUs << " us: " << x.command << std::endl;
+    }
+}
+
+void MiniRedisKeySampler::StartDump(uint32_t intervalMs, SamplerDumpCbFunc cb)
+{
+    std::lock_guard<std::mutex> lock(dumpMutex);
+    if (dumping)
+    {
+        return;
+    }
+
+    dumping = true;
+    dumpThread = std::thread(&MiniRedisKeySampler::ThreadRoutine, this, intervalMs ? intervalMs : 1, cb);
+}
+
+void MiniRedisKeySampler::StopDump()
+{
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        dumping = false;
+    }
+
+    dumpCv.notify_all();
+    if (dumpThread.joinable())
+    {
+        dumpThread.join();
+    }
+}
+
+void MiniRedisKeySampler::ThreadRoutine(uint32_t intervalMs, SamplerDumpCbFunc cb)
+{
+    std::unique_lock<std::mutex> lock(dumpMutex);
+    while (dumping)
+    {
+        if (dumpCv.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return !dumping; }))
+        {
+            break;
+        }
+
+        lock.unlock();
+        MiniRedisSamplerSnapshot snapshot = Snapshot(true);
+        if (cb)
+        {
+            cb(snapshot);
+        }
+        else
+        {
+            Print(snapshot, std::cout);
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,127 @@
+// Client side hot key detector and slow command log
+// Attached to MiniRedisClient by SetSampler(), and shared by the clients of all threads.
+//
+// One in N commands is sampled. Its key is counted in two Count-Min sketches,
+// by frequency and by bytes transferred, and the top K keys of each are kept in min-heaps.
+// Count-Min never underestimates, and overestimates by about total / width
+// with probability 1 - 1 / e^depth.
+//
+// Every command slower than the threshold is kept in a bounded ring,
+// with its arguments truncated.
+//
+// Hot keys can be found without running MONITOR on the server,
+// by Snapshot(), or by the periodic dump.
+//
+
+#ifndef MiniRedisKeySampler_INCLUDED
+#define MiniRedisKeySampler_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iosfwd>
+
+// Command slower than the threshold
+struct MiniRedisSlowEntry
+{
+    // Microseconds since epoch
+    uint64_t timestampUs;
+    uint64_t latencyUs;
+    // Command with truncated arguments
+    std::string command;
+};
+
+struct MiniRedisSamplerSnapshot
+{
+    // Estimated count and bytes of the hottest keys, in descending order
+    std::vector<std::pair<std::string, uint64_t>> hotByCount;
+    std::vector<std::pair<std::string, uint64_t>> hotByBytes;
+    // Oldest first
+    std::vector<MiniRedisSlowEntry> slowLog;
+    // Commands seen and sampled
+    uint64_t commands;
+    uint64_t sampled;
+};
+
+using SamplerDumpCbFunc = std::function<void(const MiniRedisSamplerSnapshot&)>;
+
+class MiniRedisKeySampler
+{
+public:
+    // width and depth of sketches, and K of top K
+    MiniRedisKeySampler(uint32_t width = 2048, uint32_t depth = 4, uint32_t topK = 16);
+    ~MiniRedisKeySampler();
+
+    MiniRedisKeySampler(const MiniRedisKeySampler&) = delete;
+    MiniRedisKeySampler& operator=(const MiniRedisKeySampler&) = delete;
+
+    // Sample one in N commands, 1 samples all
+    void SetSampleRate(uint32_t oneInN);
+    // Commands slower than this are logged, 0 disables the slow log
+    void SetSlowThresholdUs(uint64_t us);
+    // Number of slow commands kept
+    void SetSlowLogSize(std::size_t size);
+    // Arguments longer than this are truncated in slow log
+    void SetMaxArgLength(std::size_t len);
+    std::size_t GetMaxArgLength() const;
+
+    // Called by client for each command
+    bool ShouldSample();
+    bool IsSlow(uint64_t latencyUs) const;
+    void RecordKey(std::string_view key, std::size_t bytes);
+    void RecordSlow(uint64_t latencyUs, std::string command);
+
+    // Copy of current state
+    // If reset, the sketches and the slow log are cleared, so that next snapshot shows a new window
+    MiniRedisSamplerSnapshot Snapshot(bool reset = false);
+    static void Print(const MiniRedisSamplerSnapshot& snapshot, std::ostream& os);
+
+    // Take snapshot with reset periodically, and pass it to cb, or print it if cb is not set
+    void StartDump(uint32_t intervalMs, SamplerDumpCbFunc cb = nullptr);
+    void StopDump();
+
+private:
+    struct TopK
+    {
+        // Min-heap by estimate
+        std::vector<std::pair<uint64_t, std::string>> heap;
+        void Update(std::string_view key, uint64_t estimate, std::size_t k);
+        std::vector<std::pair<std::string, uint64_t>> Sorted() const;
+    };
+
+    // Add to sketch, and return the new estimate
+    uint64_t AddToSketch(std::vector<uint64_t>& sketch, uint64_t h1, uint64_t h2, uint64_t value);
+    void ThreadRoutine(uint32_t intervalMs, SamplerDumpCbFunc cb);
+
+private:
+    uint32_t width;
+    uint32_t depth;
+    uint32_t topK;
+    std::atomic<uint32_t> sampleRate;
+    std::atomic<uint64_t> slowThresholdUs;
+    std::atomic<std::size_t> maxArgLength;
+    std::atomic<uint64_t> commands;
+    std::atomic<uint64_t> sampled;
+
+    std::mutex mtx;
+    // depth rows of width counters
+    std::vector<uint64_t> countSketch;
+    std::vector<uint64_t> bytesSketch;
+    TopK topByCount;
+    TopK topByBytes;
+    std::vector<MiniRedisSlowEntry> slowLog;
+    std::size_t slowLogSize;
+    std::size_t slowNext;
+
+    std::thread dumpThread;
+    std::mutex dumpMutex;
+    std::condition_variable dumpCv;
+    bool dumping;
+};
+
+#endif // MiniRedisKeySampler_INCLUDED
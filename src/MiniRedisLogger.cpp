@@ -0,0 +1,264 @@
+// Asynchronous leveled logger for the diagnostics of the client
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include "MiniRedisLogger.h"
+
+MiniRedisLogger& MiniRedisLogger::Instance()
+{
+    // Never destroyed, so that it can be used by destructors of other static objects
+    // The ring is drained at exit instead
+    static MiniRedisLogger* logger = []() {
+        MiniRedisLogger* x = new MiniRedisLogger();
+        std::atexit([]() { MiniRedisLogger::Instance().Shutdown(); });
+        return x;
+    }();
+    return *logger;
+}
+
+MiniRedisLogger::MiniRedisLogger()
+    : slots(capacity), head(0), tail(0), dropped(0), level(REDIS_LOG_INFO),
+      sleeping(false), running(true)
+{
+    for (std::size_t i = 0; i < capacity; i++)
+    {
+        slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    thread = std::thread(&MiniRedisLogger::ThreadRoutine, this);
+}
+
+MiniRedisLogger::~MiniRedisLogger()
+{
+    Shutdown();
+}
+
+void MiniRedisLogger::SetLevel(MiniRedisLogLevel level)
+{
+    this->level = level;
+}
+
+MiniRedisLogLevel MiniRedisLogger::GetLevel() const
+{
+    return (MiniRedisLogLevel)level.load(std::memory_order_relaxed);
+}
+
+bool MiniRedisLogger::IsEnabled(MiniRedisLogLevel level) const
+{
+    return (level >= this->level.load(std::memory_order_relaxed)) && (level < REDIS_LOG_OFF);
+}
+
+void MiniRedisLogger::SetSink(LogSinkFunc sink)
+{
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    this->sink = sink;
+}
+
+uint64_t MiniRedisLogger::GetDropped() const
+{
+    return dropped;
+}
+
+const char* MiniRedisLogger::LevelName(MiniRedisLogLevel level)
+{
+    switch (level)
+    {
+    case REDIS_LOG_TRACE:
+        return "TRACE";
+    case REDIS_LOG_DEBUG:
+        return "DEBUG";
+    case REDIS_LOG_INFO:
+        return "INFO";
+    case REDIS_LOG_WARN:
+        return "WARN";
+    case REDIS_LOG_ERROR:
+        return "ERROR";
+    default:
+        return "OFF";
+    }
+}
+
+void MiniRedisLogger::Log(MiniRedisLogLevel level, const char* format, ...)
+{
+    thread_local uint64_t threadId = (uint64_t)syscall(SYS_gettid);
+    uint64_t timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    if (!running)
+    {
+        // After shutdown, write directly
+        char text[maxMessage];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        if (len < 0)
+        {
+            return;
+        }
+
+        MiniRedisLogRecord record;
+        record.level = level;
+        record.timestampUs = timestampUs;
+        record.threadId = threadId;
+        record.message = std::string_view(text, std::min<std::size_t>(len, sizeof(text) - 1));
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        Write(record);
+        return;
+    }
+
+    // Bounded MPMC queue of Dmitry Vyukov, with one consumer
+    std::size_t pos = head.load(std::memory_order_relaxed);
+    Slot* slot = nullptr;
+    while (true)
+    {
+        slot = &slots[pos & (capacity - 1)];
+        std::size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Full
+            dropped++;
+            return;
+        }
+        else
+        {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+    slot->len = (len < 0) ? 0 : std::min<uint32_t>(len, sizeof(slot->text) - 1);
+    slot->level = level;
+    slot->timestampUs = timestampUs;
+    slot->threadId = threadId;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    if (sleeping.load(std::memory_order_acquire))
+    {
+        cv.notify_one();
+    }
+}
+
+std::size_t MiniRedisLogger::Drain()
+{
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    std::size_t count = 0;
+    std::size_t pos = tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot& slot = slots[pos & (capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+        {
+            break;
+        }
+
+        MiniRedisLogRecord record;
+        record.level = slot.level;
+        record.timestampUs = slot.timestampUs;
+        record.threadId = slot.threadId;
+        record.message = std::string_view(slot.text, slot.len);
+        Write(record);
+
+        // Free for the round after next
+        slot.seq.store(pos + capacity, std::memory_order_release);
+        pos++;
+        count++;
+    }
+
+    tail.store(pos, std::memory_order_release);
+    if (count && !sink)
+    {
+        fflush(stderr);
+    }
+    return count;
+}
+
+void MiniRedisLogger::Write(const MiniRedisLogRecord& record)
+{
+    if (sink)
+    {
+        sink(record);
+        return;
+    }
+
+    std::string line = Format(record);
+    line.push_back('\n');
+    fwrite(line.data(), 1, line.size(), stderr);
+}
+
+std::string MiniRedisLogger::Format(const MiniRedisLogRecord& record)
+{
+    time_t seconds = (time_t)(record.timestampUs / 1000000);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+
+    char prefix[96];
+    int len = snprintf(prefix, sizeof(prefix), "%04d-%02d-%02d %02d:%02d:%02d.%06u %s [%llu] ",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+        (unsigned)(record.timestampUs % 1000000), LevelName(record.level),
+        (unsigned long long)record.threadId);
+
+    std::string line(prefix, (len > 0) ? std::min<std::size_t>(len, sizeof(prefix) - 1) : 0);
+    line.append(record.message);
+    return line;
+}
+
+void MiniRedisLogger::ThreadRoutine()
+{
+    while (running)
+    {
+        if (Drain())
+        {
+            continue;
+        }
+
+        // Producers only notify while sleeping, the timeout covers a missed notification
+        std::unique_lock<std::mutex> lock(mtx);
+        sleeping.store(true, std::memory_order_release);
+        cv.wait_for(lock, std::chrono::milliseconds(10));
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    Drain();
+}
+
+void MiniRedisLogger::Flush()
+{
+    std::size_t target = head.load(std::memory_order_acquire);
+    while (running && (tail.load(std::memory_order_acquire) < target))
+    {
+        cv.notify_one();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void MiniRedisLogger::Shutdown()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+
+    cv.notify_one();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
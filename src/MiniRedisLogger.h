@@ -0,0 +1,180 @@
+// Asynchronous leveled logger for the diagnostics of the client
+// The calling thread only formats the message into a slot of a lock-free ring,
+// and a background thread adds timestamp, level and thread id,
+// and writes to stderr, or passes the record to the sink set by SetSink().
+// So no console I/O or lock is done in the middle of the request flow.
+//
+// When the ring is full, the record is dropped and counted, instead of blocking.
+// Messages longer than the slot are truncated.
+//
+// Log statements below MINIREDIS_LOG_LEVEL are removed at compile time,
+// so that their arguments are not even evaluated.
+// Build with -DMINIREDIS_LOG_LEVEL=0 to keep the trace logs.
+// SetLevel() filters the rest at run time.
+//
+
+#ifndef MiniRedisLogger_INCLUDED
+#define MiniRedisLogger_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+// Not LOG_INFO and so on, which are macros of syslog.h
+enum MiniRedisLogLevel
+{
+    REDIS_LOG_TRACE = 0,
+    REDIS_LOG_DEBUG = 1,
+    REDIS_LOG_INFO = 2,
+    REDIS_LOG_WARN = 3,
+    REDIS_LOG_ERROR = 4,
+    REDIS_LOG_OFF = 5
+};
+
+struct MiniRedisLogRecord
+{
+    MiniRedisLogLevel level;
+    // Microseconds since epoch
+    uint64_t timestampUs;
+    // Kernel thread id of the caller
+    uint64_t threadId;
+    // Valid during the sink call only
+    std::string_view message;
+};
+
+// Called by the background thread, one record at a time
+using LogSinkFunc = std::function<void(const MiniRedisLogRecord&)>;
+
+class MiniRedisLogger
+{
+public:
+    // The logger of the process
+    static MiniRedisLogger& Instance();
+
+    MiniRedisLogger(const MiniRedisLogger&) = delete;
+    MiniRedisLogger& operator=(const MiniRedisLogger&) = delete;
+
+    // Records below this level are discarded, INFO by default
+    void SetLevel(MiniRedisLogLevel level);
+    MiniRedisLogLevel GetLevel() const;
+    bool IsEnabled(MiniRedisLogLevel level) const;
+
+    // Route the records into another logger, nullptr restores stderr
+    void SetSink(LogSinkFunc sink);
+
+    // Use the macros below instead, which check the level before the arguments are evaluated
+    void Log(MiniRedisLogLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+    // Wait until the records logged before are written
+    void Flush();
+    // Records dropped because the ring was full
+    uint64_t GetDropped() const;
+
+    static const char* LevelName(MiniRedisLogLevel level);
+    // Default format: 2026-01-01 12:00:00.000000 ERROR [tid] message
+    static std::string Format(const MiniRedisLogRecord& record);
+
+private:
+    MiniRedisLogger();
+    ~MiniRedisLogger();
+
+    // Drain the ring, and stop the thread at exit
+    void Shutdown();
+    void ThreadRoutine();
+    // Pass the records in the ring to the sink, return the count
+    std::size_t Drain();
+    void Write(const MiniRedisLogRecord& record);
+
+private:
+    static const std::size_t capacity = 4096;
+    static const std::size_t maxMessage = 256;
+
+    struct Slot
+    {
+        // Equal to position when free, position + 1 when filled
+        std::atomic<std::size_t> seq;
+        MiniRedisLogLevel level;
+        uint64_t timestampUs;
+        uint64_t threadId;
+        uint32_t len;
+        char text[maxMessage];
+    };
+
+    std::vector<Slot> slots;
+    // Next position to fill, shared by producers
+    alignas(64) std::atomic<std::size_t> head;
+    // Next position to drain, by the background thread only
+    alignas(64) std::atomic<std::size_t> tail;
+    std::atomic<uint64_t> dropped;
+    std::atomic<int> level;
+
+    std::mutex sinkMutex;
+    LogSinkFunc sink;
+
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    // Set while the thread waits, so that producers only notify when needed
+    std::atomic<bool> sleeping;
+    std::atomic<bool> running;
+};
+
+#ifndef MINIREDIS_LOG_LEVEL
+#define MINIREDIS_LOG_LEVEL 1
+#endif
+
+#define MINIREDIS_LOG(level, ...) \
+    do \
+    { \
+        if (MiniRedisLogger::Instance().IsEnabled(level)) \
+        { \
+            MiniRedisLogger::Instance().Log(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+// Never evaluated, but still checked by the compiler
+#define MINIREDIS_LOG_NONE(...) \
+    do \
+    { \
+        if (false) \
+        { \
+            MiniRedisLogger::Instance().Log(REDIS_LOG_OFF, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if MINIREDIS_LOG_LEVEL <= 0
+#define MINIREDIS_LOG_TRACE(...) MINIREDIS_LOG(REDIS_LOG_TRACE, __VA_ARGS__)
+#else
+#define MINIREDIS_LOG_TRACE(...) MINIREDIS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if MINIREDIS_LOG_LEVEL <= 1
+#define MINIREDIS_LOG_DEBUG(...) MINIREDIS_LOG(REDIS_LOG_DEBUG, __VA_ARGS__)
+#else
+#define MINIREDIS_LOG_DEBUG(...) MINIREDIS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if MINIREDIS_LOG_LEVEL <= 2
+#define MINIREDIS_LOG_INFO(...) MINIREDIS_LOG(REDIS_LOG_INFO, __VA_ARGS__)
+#else
+#define MINIREDIS_LOG_INFO(...) MINIREDIS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if MINIREDIS_LOG_LEVEL <= 3
+#define MINIREDIS_LOG_WARN(...) MINIREDIS_LOG(REDIS_LOG_WARN, __VA_ARGS__)
+#else
+#define MINIREDIS_LOG_WARN(...) MINIREDIS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if MINIREDIS_LOG_LEVEL <= 4
+#define MINIREDIS_LOG_ERROR(...) MINIREDIS_LOG(REDIS_LOG_ERROR, __VA_ARGS__)
+#else
+#define MINIREDIS_LOG_ERROR(...) MINIREDIS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#endif // MiniRedisLogger_INCLUDED
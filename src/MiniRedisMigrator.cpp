@@ -0,0 +1,431 @@
+// Copy keys between Redis instances by DUMP and RESTORE
+
+#include <thread>
+#include <algorithm>
+#include <hiredis/hiredis.h>
+#include "MiniRedisMigrator.h"
+#include "MiniRedisLogger.h"
+
+MiniRedisMigrator::MiniRedisMigrator(const std::string& sourceHost, uint16_t sourcePort,
+    const std::string& targetHost, uint16_t targetPort)
+    : sourceHost(sourceHost), sourcePort(sourcePort), targetHost(targetHost), targetPort(targetPort),
+      scanDone(false), inFlightBytes(0), cancelled(false),
+      startTicks(std::chrono::steady_clock::now().time_since_epoch().count()),
+      scanned(0), migrated(0), skipped(0), failed(0), dumpedBytes(0), done(false)
+{
+}
+
+MiniRedisMigrator::~MiniRedisMigrator()
+{
+}
+
+void MiniRedisMigrator::SetOptions(const MiniRedisMigrationOptions& options)
+{
+    this->options = options;
+    this->options.threads = std::max(options.threads, 1u);
+    this->options.scanCount = std::max(options.scanCount, 1u);
+    this->options.batchKeys = std::max(options.batchKeys, 1u);
+    this->options.maxInFlightBytes = std::max<std::size_t>(options.maxInFlightBytes, 1);
+}
+
+void MiniRedisMigrator::SetSourceConnectionOptions(const MiniRedisConnectionOptions& options)
+{
+    sourceOptions = options;
+}
+
+void MiniRedisMigrator::SetTargetConnectionOptions(const MiniRedisConnectionOptions& options)
+{
+    targetOptions = options;
+}
+
+void MiniRedisMigrator::SetProgressCb(MigrationProgressCbFunc cb)
+{
+    progressCb = cb;
+}
+
+bool MiniRedisMigrator::ConnectSource(MiniRedisClient& client) const
+{
+    client.SetConnectionOptions(sourceOptions);
+    return client.Connect(sourceHost, sourcePort);
+}
+
+bool MiniRedisMigrator::ConnectTarget(MiniRedisClient& client) const
+{
+    client.SetConnectionOptions(targetOptions);
+    return client.Connect(targetHost, targetPort);
+}
+
+bool MiniRedisMigrator::Run()
+{
+    MiniRedisClient scanner;
+    if (!ConnectSource(scanner))
+    {
+        return false;
+    }
+
+    scanDone = false;
+    cancelled = false;
+    done = false;
+    scanned = migrated = skipped = failed = dumpedBytes = 0;
+    startTicks = std::chrono::steady_clock::now().time_since_epoch().count();
+    nextSlot = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < options.threads; i++)
+    {
+        workers.emplace_back(&MiniRedisMigrator::WorkerRoutine, this);
+    }
+
+    // The scan is sequential, and cheap compared with DUMP and RESTORE
+    bool scanOk = true;
+    unsigned long long cursor = 0;
+    std::vector<std::string> keys;
+    auto nextReport = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.progressIntervalMs);
+    do
+    {
+        if (!scanner.scan(cursor, options.scanCount, options.match, keys))
+        {
+            MINIREDIS_LOG_ERROR("Failed to scan source %s:%u", sourceHost.c_str(), sourcePort);
+            scanOk = false;
+            break;
+        }
+
+        while (keys.size() >= options.batchKeys)
+        {
+            std::vector<std::string> batch(std::make_move_iterator(keys.begin()),
+                std::make_move_iterator(keys.begin() + options.batchKeys));
+            keys.erase(keys.begin(), keys.begin() + options.batchKeys);
+            scanned += batch.size();
+            Enqueue(std::move(batch));
+        }
+
+        if (std::chrono::steady_clock::now() >= nextReport)
+        {
+            ReportProgress(false);
+            nextReport = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.progressIntervalMs);
+        }
+    } while ((cursor != 0) && !cancelled);
+
+    if (!keys.empty() && scanOk && !cancelled)
+    {
+        scanned += keys.size();
+        Enqueue(std::move(keys));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        scanDone = true;
+    }
+    queueCv.notify_all();
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+
+    done = true;
+    ReportProgress(true);
+    return scanOk && !cancelled && (failed == 0);
+}
+
+void MiniRedisMigrator::Cancel()
+{
+    cancelled = true;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        batches.clear();
+    }
+    queueCv.notify_all();
+    bytesCv.notify_all();
+}
+
+void MiniRedisMigrator::Enqueue(std::vector<std::string>&& keys)
+{
+    // A few batches per worker, so that the scan doesn't run far ahead
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueCv.wait(lock, [this]() {
+        return cancelled || (batches.size() < options.threads * 2);
+    });
+    if (cancelled)
+    {
+        return;
+    }
+
+    batches.push_back(std::move(keys));
+    lock.unlock();
+    queueCv.notify_all();
+}
+
+bool MiniRedisMigrator::Dequeue(std::vector<std::string>& keys)
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueCv.wait(lock, [this]() {
+        return cancelled || scanDone || !batches.empty();
+    });
+    if (cancelled || batches.empty())
+    {
+        return false;
+    }
+
+    keys = std::move(batches.front());
+    batches.pop_front();
+    lock.unlock();
+    queueCv.notify_all();
+    return true;
+}
+
+void MiniRedisMigrator::WorkerRoutine()
+{
+    MiniRedisClient source;
+    MiniRedisClient target;
+    bool connected = ConnectSource(source) && ConnectTarget(target);
+    if (!connected)
+    {
+        MINIREDIS_LOG_ERROR("Migration worker failed to connect");
+    }
+
+    std::vector<std::string> keys;
+    while (Dequeue(keys))
+    {
+        // Reconnect once per batch after a broken connection
+        if (!source.IsConnected() && !ConnectSource(source))
+        {
+            failed += keys.size();
+            continue;
+        }
+        if (!target.IsConnected() && !ConnectTarget(target))
+        {
+            failed += keys.size();
+            continue;
+        }
+
+        MigrateBatch(source, target, keys);
+    }
+}
+
+bool MiniRedisMigrator::MigrateBatch(MiniRedisClient& source, MiniRedisClient& target,
+    const std::vector<std::string>& keys)
+{
+    Throttle(keys.size(), 0);
+    std::size_t reserved = EstimateBytes(keys.size());
+    AcquireBytes(reserved);
+
+    // DUMP and PTTL of all keys in one round trip
+    std::size_t appended = 0;
+    // DUMP appended without its PTTL, whose reply is drained after the pairs
+    bool orphan = false;
+    for (; appended < keys.size(); appended++)
+    {
+        if (!source.PipelineAppend({"DUMP", keys[appended]}))
+        {
+            break;
+        }
+        if (!source.PipelineAppend({"PTTL", keys[appended]}))
+        {
+            orphan = true;
+            break;
+        }
+    }
+
+    struct Dumped
+    {
+        const std::string* key;
+        std::string payload;
+        // Remaining TTL in ms, 0 for no expiry
+        long long ttl;
+    };
+    std::vector<Dumped> dumped;
+    dumped.reserve(keys.size());
+    std::size_t payloadBytes = 0;
+    for (std::size_t i = 0; i < appended; i++)
+    {
+        redisReply* dump = source.PipelineGetReply();
+        redisReply* pttl = dump ? source.PipelineGetReply() : nullptr;
+        if (!dump || !pttl)
+        {
+            // The connection is broken, the rest are counted as failed below
+            freeReplyObject(dump);
+            appended = i;
+            orphan = false;
+            break;
+        }
+
+        if ((dump->type == REDIS_REPLY_ERROR) || (pttl->type == REDIS_REPLY_ERROR))
+        {
+            MINIREDIS_LOG_WARN("Failed to dump %s: %s", keys[i].c_str(),
+                (dump->type == REDIS_REPLY_ERROR) ? dump->str : pttl->str);
+            failed++;
+        }
+        else if ((dump->type != REDIS_REPLY_STRING) || (pttl->type != REDIS_REPLY_INTEGER) || (pttl->integer == -2))
+        {
+            // Expired or deleted since the scan
+            skipped++;
+        }
+        else
+        {
+            Dumped x;
+            x.key = &keys[i];
+            x.payload.assign(dump->str, dump->len);
+            // 0 means no expiry to RESTORE, so a key about to expire keeps 1 ms
+            x.ttl = (pttl->integer >= 0) ? std::max(1LL, (long long)pttl->integer) : 0;
+            payloadBytes += x.payload.size();
+            dumped.push_back(std::move(x));
+        }
+        freeReplyObject(dump);
+        freeReplyObject(pttl);
+    }
+    if (orphan)
+    {
+        freeReplyObject(source.PipelineGetReply());
+    }
+    failed += keys.size() - appended;
+
+    // Correct the estimate, the payloads are already held so more bytes don't wait
+    if (payloadBytes > reserved)
+    {
+        std::lock_guard<std::mutex> lock(bytesMutex);
+        inFlightBytes += payloadBytes - reserved;
+    }
+    else
+    {
+        ReleaseBytes(reserved - payloadBytes);
+    }
+    if (dumped.empty())
+    {
+        return appended == keys.size();
+    }
+
+    Throttle(0, payloadBytes);
+
+    bool ret = true;
+    std::size_t restored = 0;
+    for (; restored < dumped.size(); restored++)
+    {
+        auto& x = dumped[restored];
+        std::vector<std::string> argv = {"RESTORE", *x.key, std::to_string(x.ttl), x.payload};
+        if (options.replace)
+        {
+            argv.push_back("REPLACE");
+        }
+        if (!target.PipelineAppend(argv))
+        {
+            break;
+        }
+    }
+
+    for (std::size_t i = 0; i < restored; i++)
+    {
+        redisReply* reply = target.PipelineGetReply();
+        if (!reply)
+        {
+            failed += restored - i;
+            ret = false;
+            break;
+        }
+
+        if (reply->type == REDIS_REPLY_ERROR)
+        {
+            // Such as BUSYKEY, or payload of a newer server version
+            MINIREDIS_LOG_WARN("Failed to restore %s: %s", dumped[i].key->c_str(), reply->str);
+            failed++;
+            ret = false;
+        }
+        else
+        {
+            migrated++;
+            dumpedBytes += dumped[i].payload.size();
+        }
+        freeReplyObject(reply);
+    }
+    failed += dumped.size() - restored;
+
+    ReleaseBytes(payloadBytes);
+    return ret && (restored == dumped.size());
+}
+
+void MiniRedisMigrator::AcquireBytes(std::size_t count)
+{
+    // A batch larger than the limit still runs, alone
+    std::unique_lock<std::mutex> lock(bytesMutex);
+    bytesCv.wait(lock, [this, count]() {
+        return cancelled || (inFlightBytes == 0) || (inFlightBytes + count <= options.maxInFlightBytes);
+    });
+    inFlightBytes += count;
+}
+
+std::size_t MiniRedisMigrator::EstimateBytes(std::size_t keys) const
+{
+    // 1 KB per key until the first keys are copied
+    uint64_t count = migrated;
+    uint64_t bytes = dumpedBytes;
+    std::size_t perKey = count ? (std::size_t)(bytes / count) + 1 : 1024;
+    return std::min(keys * perKey, options.maxInFlightBytes);
+}
+
+void MiniRedisMigrator::ReleaseBytes(std::size_t count)
+{
+    {
+        std::lock_guard<std::mutex> lock(bytesMutex);
+        inFlightBytes -= count;
+    }
+    bytesCv.notify_all();
+}
+
+void MiniRedisMigrator::Throttle(std::size_t keys, std::size_t count)
+{
+    double seconds = 0;
+    if (options.maxKeysPerSec > 0)
+    {
+        seconds = std::max(seconds, keys / options.maxKeysPerSec);
+    }
+    if (options.maxBytesPerSec > 0)
+    {
+        seconds = std::max(seconds, count / options.maxBytesPerSec);
+    }
+    if (seconds <= 0)
+    {
+        return;
+    }
+
+    // Each caller reserves the next slot, so that the workers together keep the rate
+    std::chrono::steady_clock::time_point start;
+    {
+        std::lock_guard<std::mutex> lock(throttleMutex);
+        start = std::max(nextSlot, std::chrono::steady_clock::now());
+        nextSlot = start + std::chrono::microseconds((long long)(seconds * 1000000));
+    }
+    std::this_thread::sleep_until(start);
+}
+
+MiniRedisMigrationProgress MiniRedisMigrator::GetProgress() const
+{
+    MiniRedisMigrationProgress x;
+    x.scanned = scanned;
+    x.migrated = migrated;
+    x.skipped = skipped;
+    x.failed = failed;
+    x.bytes = dumpedBytes;
+    auto start = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(startTicks));
+    x.elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    x.keysPerSec = x.elapsedMs ? x.migrated * 1000.0 / x.elapsedMs : 0;
+    x.bytesPerSec = x.elapsedMs ? x.bytes * 1000.0 / x.elapsedMs : 0;
+    x.done = done;
+    return x;
+}
+
+void MiniRedisMigrator::ReportProgress(bool finished)
+{
+    MiniRedisMigrationProgress x = GetProgress();
+    x.done = finished;
+    if (progressCb)
+    {
+        progressCb(x);
+        return;
+    }
+
+    MINIREDIS_LOG_INFO("Migration %s: scanned %llu, migrated %llu, skipped %llu, failed %llu, "
+        "%.0f keys/s, %.1f MB/s", finished ? "done" : "in progress",
+        (unsigned long long)x.scanned, (unsigned long long)x.migrated,
+        (unsigned long long)x.skipped, (unsigned long long)x.failed,
+        x.keysPerSec, x.bytesPerSec / (1024 * 1024));
+}
@@ -0,0 +1,158 @@
+// Copy keys between Redis instances by DUMP and RESTORE
+// Types, values and TTLs are kept, instead of KEYS + GET + SET.
+//
+// One thread iterates the source by SCAN, which doesn't block the server like KEYS,
+// and hands batches of keys to N workers. SCAN cursors can't be split into ranges,
+// since the server may resize its table meanwhile, so the scan itself is sequential,
+// and the DUMP and RESTORE work is parallel.
+// Each worker has its own connections to source and target. It pipelines DUMP and PTTL
+// of a batch on the source, and RESTORE ... REPLACE with the remaining TTL on the target.
+// The TTL is relative, so that it doesn't depend on the clocks of this host and the target,
+// and a key lives longer on the target by its time in transit, usually a few milliseconds.
+//
+// Bytes are reserved within maxInFlightBytes before each DUMP, estimated by the average
+// payload of the keys copied so far, and corrected to the real size when the payloads arrive.
+// So payloads held by workers stay around maxInFlightBytes, and may exceed it by a batch of
+// keys much larger than the average.
+// The copy can be throttled by keys and bytes per second to limit the load of the source.
+//
+// SCAN may return a key more than once, which is restored again, and keys changed during
+// the migration may or may not be copied with their latest value.
+//
+
+#ifndef MiniRedisMigrator_INCLUDED
+#define MiniRedisMigrator_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include "MiniRedisClient.h"
+
+struct MiniRedisMigrationOptions
+{
+    // Worker threads, each with one connection to source and one to target
+    uint32_t threads = 4;
+    // COUNT hint of SCAN
+    uint32_t scanCount = 1000;
+    // MATCH pattern of SCAN, empty for all keys
+    std::string match;
+    // Keys in one pipeline
+    uint32_t batchKeys = 100;
+    // Dumped bytes held by all workers, as estimated before DUMP
+    std::size_t maxInFlightBytes = 64 * 1024 * 1024;
+    // 0 means no limit
+    double maxKeysPerSec = 0;
+    double maxBytesPerSec = 0;
+    // Overwrite the existing keys of target, otherwise they fail with BUSYKEY
+    bool replace = true;
+    // How often progress is reported
+    uint32_t progressIntervalMs = 1000;
+};
+
+struct MiniRedisMigrationProgress
+{
+    uint64_t scanned;
+    uint64_t migrated;
+    // Expired or deleted before DUMP
+    uint64_t skipped;
+    uint64_t failed;
+    // Bytes of DUMP payloads
+    uint64_t bytes;
+    uint64_t elapsedMs;
+    double keysPerSec;
+    double bytesPerSec;
+    bool done;
+};
+
+// Called periodically by the scan thread, and once when done
+using MigrationProgressCbFunc = std::function<void(const MiniRedisMigrationProgress&)>;
+
+class MiniRedisMigrator
+{
+public:
+    MiniRedisMigrator(const std::string& sourceHost, uint16_t sourcePort,
+        const std::string& targetHost, uint16_t targetPort);
+    ~MiniRedisMigrator();
+
+    MiniRedisMigrator(const MiniRedisMigrator&) = delete;
+    MiniRedisMigrator& operator=(const MiniRedisMigrator&) = delete;
+
+    // Before Run()
+    void SetOptions(const MiniRedisMigrationOptions& options);
+    // Database, authentication and so on of each side
+    void SetSourceConnectionOptions(const MiniRedisConnectionOptions& options);
+    void SetTargetConnectionOptions(const MiniRedisConnectionOptions& options);
+    // Progress is logged if not set
+    void SetProgressCb(MigrationProgressCbFunc cb);
+
+    // Copy all keys, and return when done or cancelled
+    // Return false if any key failed, or the scan didn't complete
+    bool Run();
+    // Stop Run() from another thread, the keys copied are kept
+    void Cancel();
+
+    MiniRedisMigrationProgress GetProgress() const;
+
+private:
+    bool ConnectSource(MiniRedisClient& client) const;
+    bool ConnectTarget(MiniRedisClient& client) const;
+
+    void WorkerRoutine();
+    // DUMP and RESTORE one batch of keys
+    bool MigrateBatch(MiniRedisClient& source, MiniRedisClient& target,
+        const std::vector<std::string>& keys);
+
+    // Put batch in the queue of workers, wait if it is full
+    void Enqueue(std::vector<std::string>&& keys);
+    bool Dequeue(std::vector<std::string>& keys);
+
+    // Wait until the bytes can be held within maxInFlightBytes
+    void AcquireBytes(std::size_t bytes);
+    void ReleaseBytes(std::size_t bytes);
+    // Estimated payload of a batch, before DUMP
+    std::size_t EstimateBytes(std::size_t keys) const;
+    // Wait for the turn of keys and bytes under the rate limits
+    void Throttle(std::size_t keys, std::size_t bytes);
+
+    void ReportProgress(bool done);
+
+private:
+    std::string sourceHost;
+    uint16_t sourcePort;
+    std::string targetHost;
+    uint16_t targetPort;
+    MiniRedisConnectionOptions sourceOptions;
+    MiniRedisConnectionOptions targetOptions;
+    MiniRedisMigrationOptions options;
+    MigrationProgressCbFunc progressCb;
+
+    // Batches from scan thread to workers
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    std::deque<std::vector<std::string>> batches;
+    bool scanDone;
+
+    std::mutex bytesMutex;
+    std::condition_variable bytesCv;
+    std::size_t inFlightBytes;
+
+    std::mutex throttleMutex;
+    std::chrono::steady_clock::time_point nextSlot;
+
+    std::atomic<bool> cancelled;
+    // steady_clock ticks, read by GetProgress() from other threads
+    std::atomic<std::chrono::steady_clock::rep> startTicks;
+    std::atomic<uint64_t> scanned;
+    std::atomic<uint64_t> migrated;
+    std::atomic<uint64_t> skipped;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> dumpedBytes;
+    std::atomic<bool> done;
+};
+
+#endif // MiniRedisMigrator_INCLUDED
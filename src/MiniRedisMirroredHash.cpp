@@ -0,0 +1,430 @@
+// Local mirror of one Redis hash, kept in sync by keyspace notifications
+
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <hiredis/hiredis.h>
+#include "MiniRedisMirroredHash.h"
+#include "MiniRedisLogger.h"
+
+MiniRedisMirroredHash::MiniRedisMirroredHash(const std::string& key)
+    : key(key), port(6379), scanCount(1000), resyncIntervalMs(60000),
+      current(new Snapshot()), eventSeq(0), scans(0), gaps(0),
+      running(false), dirty(false), subscribed(false), disconnected(false)
+{
+}
+
+MiniRedisMirroredHash::~MiniRedisMirroredHash()
+{
+    Stop();
+
+    // No reader is left
+    delete current.load();
+    for (auto x : retired)
+    {
+        delete x;
+    }
+}
+
+void MiniRedisMirroredHash::SetScanCount(uint32_t count)
+{
+    scanCount = count ? count : 1;
+}
+
+void MiniRedisMirroredHash::SetResyncIntervalMs(uint32_t ms)
+{
+    resyncIntervalMs = ms;
+}
+
+MiniRedisClient& MiniRedisMirroredHash::GetClient()
+{
+    return client;
+}
+
+bool MiniRedisMirroredHash::Start(const std::string& host, uint16_t port)
+{
+    if (running)
+    {
+        return true;
+    }
+
+    this->host = host;
+    this->port = port;
+    if (!client.Connect(host, port))
+    {
+        return false;
+    }
+    CheckNotifyConfig();
+
+    channel = "__keyspace@" + std::to_string(client.GetConnectionOptions().database) + "__:" + key;
+    sub.SetSubscribeViewCb([this](std::string_view, std::string_view event) {
+        OnEvent(event);
+    });
+    sub.SetSubscribeAckCb([this](std::string_view) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            subscribed = true;
+        }
+        cv.notify_all();
+    });
+    sub.SetConnectionCb([this](bool connected) {
+        if (!connected)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                disconnected = true;
+            }
+            cv.notify_all();
+        }
+    });
+
+    // Subscribe before the first scan, so that no change is missed between them
+    if (!Subscribe())
+    {
+        MINIREDIS_LOG_WARN("Failed to subscribe to %s, changes are seen by resync only", channel.c_str());
+    }
+    if (!Refresh())
+    {
+        sub.Disconnect();
+        return false;
+    }
+
+    running = true;
+    refreshThread = std::thread(&MiniRedisMirroredHash::ThreadRoutine, this);
+    return true;
+}
+
+void MiniRedisMirroredHash::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!running)
+        {
+            return;
+        }
+        running = false;
+    }
+
+    cv.notify_all();
+    if (refreshThread.joinable())
+    {
+        refreshThread.join();
+    }
+    sub.Disconnect();
+}
+
+bool MiniRedisMirroredHash::Subscribe()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        subscribed = false;
+        disconnected = false;
+    }
+
+    if (!sub.Connect(host, port) || !sub.Subscribe(channel))
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        disconnected = true;
+        return false;
+    }
+
+    // Wait for the ACK, after which every change is notified
+    std::unique_lock<std::mutex> lock(mtx);
+    return cv.wait_for(lock, std::chrono::seconds(3), [this]() {
+        return subscribed || disconnected;
+    }) && subscribed;
+}
+
+void MiniRedisMirroredHash::CheckNotifyConfig()
+{
+    // May be disabled or renamed by managed services
+    std::map<std::string, std::string> config;
+    redisReply* reply = client.execute("CONFIG GET notify-keyspace-events");
+    if (!client.HandleMapReply(reply, config) || config.empty())
+    {
+        MINIREDIS_LOG_WARN("Can't check notify-keyspace-events of server");
+        return;
+    }
+
+    const std::string& flags = config.begin()->second;
+    bool keyspace = (flags.find('K') != std::string::npos);
+    bool all = (flags.find('A') != std::string::npos);
+    bool hash = all || (flags.find('h') != std::string::npos);
+    bool generic = all || (flags.find('g') != std::string::npos);
+    bool expired = all || (flags.find('x') != std::string::npos);
+    bool evicted = all || (flags.find('e') != std::string::npos);
+    if (!keyspace || !hash || !generic || !expired || !evicted)
+    {
+        MINIREDIS_LOG_WARN("notify-keyspace-events is '%s' instead of including 'Khgxe', "
+            "changes of %s are seen by resync only", flags.c_str(), key.c_str());
+    }
+}
+
+void MiniRedisMirroredHash::OnEvent(std::string_view event)
+{
+    // Called on the thread of the event loop
+    MINIREDIS_LOG_DEBUG("Keyspace event %.*s of %s", (int)event.size(), event.data(), key.c_str());
+    eventSeq++;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        dirty = true;
+    }
+    cv.notify_all();
+}
+
+bool MiniRedisMirroredHash::Scan(FieldMap& fields)
+{
+    scans++;
+    unsigned long long cursor = 0;
+    do
+    {
+        if (!client.hscan(key, cursor, scanCount, fields))
+        {
+            MINIREDIS_LOG_WARN("Failed to scan %s", key.c_str());
+            return false;
+        }
+    } while (cursor != 0);
+
+    return true;
+}
+
+bool MiniRedisMirroredHash::Refresh()
+{
+    std::lock_guard<std::mutex> refreshLock(refreshMutex);
+    if (!client.IsConnected() && !client.Connect())
+    {
+        return false;
+    }
+
+    // HSCAN is not atomic, a field changed during the scan may be missed or stale
+    // Scan again if any event arrived meanwhile, a few times at most for a hash changing all the time
+    const int maxPasses = 3;
+    std::unique_ptr<Snapshot> snapshot;
+    for (int pass = 0; pass < maxPasses; pass++)
+    {
+        uint64_t seq = eventSeq;
+        snapshot.reset(new Snapshot());
+        if (!Scan(snapshot->fields))
+        {
+            return false;
+        }
+        if (eventSeq == seq)
+        {
+            break;
+        }
+        gaps++;
+    }
+
+    snapshot->version = current.load()->version + 1;
+    Publish(snapshot.release());
+    return true;
+}
+
+void MiniRedisMirroredHash::ThreadRoutine()
+{
+    auto lastScan = std::chrono::steady_clock::now();
+    // Reconnecting failed, retry after one second
+    bool retrying = false;
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running)
+    {
+        uint32_t waitMs = retrying ? 1000 : (resyncIntervalMs ? resyncIntervalMs : UINT32_MAX);
+        cv.wait_until(lock, lastScan + std::chrono::milliseconds(waitMs), [this, retrying]() {
+            return !running || dirty || (disconnected && !retrying);
+        });
+        if (!running)
+        {
+            break;
+        }
+
+        bool reconnect = disconnected;
+        dirty = false;
+        lock.unlock();
+
+        if (reconnect)
+        {
+            // Changes during disconnection are not notified, the scan below covers them
+            gaps++;
+            sub.Disconnect();
+            retrying = !Subscribe();
+        }
+        if (!Refresh())
+        {
+            // Keep serving the last snapshot, and retry after the interval
+            MINIREDIS_LOG_WARN("Failed to refresh mirror of %s", key.c_str());
+        }
+        lastScan = std::chrono::steady_clock::now();
+
+        lock.lock();
+    }
+}
+
+const MiniRedisMirroredHash::Snapshot* MiniRedisMirroredHash::Acquire(std::size_t& slot) const
+{
+    // Start from the slot used last time, which is usually free
+    thread_local std::size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (std::size_t i = hint; i < hint + readerSlots; i++)
+    {
+        ReaderSlot& reader = readers[i % readerSlots];
+        const Snapshot* expected = nullptr;
+        const Snapshot* snapshot = current.load();
+        if (reader.snapshot.load(std::memory_order_relaxed) ||
+            !reader.snapshot.compare_exchange_strong(expected, snapshot))
+        {
+            continue;
+        }
+
+        // Valid only if not swapped out before it was published in the slot
+        const Snapshot* latest = current.load();
+        while (latest != snapshot)
+        {
+            snapshot = latest;
+            reader.snapshot.store(snapshot);
+            latest = current.load();
+        }
+
+        slot = i % readerSlots;
+        hint = slot;
+        return snapshot;
+    }
+
+    // All slots are held, the current snapshot is not swapped out under the lock
+    publishMutex.lock();
+    slot = readerSlots;
+    return current.load();
+}
+
+void MiniRedisMirroredHash::Release(std::size_t slot) const
+{
+    if (slot == readerSlots)
+    {
+        publishMutex.unlock();
+        return;
+    }
+    readers[slot].snapshot.store(nullptr, std::memory_order_release);
+}
+
+void MiniRedisMirroredHash::Publish(Snapshot* snapshot)
+{
+    std::lock_guard<std::mutex> lock(publishMutex);
+    retired.push_back(current.exchange(snapshot));
+    Reclaim();
+}
+
+void MiniRedisMirroredHash::Reclaim()
+{
+    std::vector<const Snapshot*> held;
+    for (auto& x : readers)
+    {
+        const Snapshot* snapshot = x.snapshot.load();
+        if (snapshot)
+        {
+            held.push_back(snapshot);
+        }
+    }
+
+    // Still held ones are freed by next publish
+    std::vector<const Snapshot*> left;
+    for (auto x : retired)
+    {
+        if (std::find(held.begin(), held.end(), x) != held.end())
+        {
+            left.push_back(x);
+        }
+        else
+        {
+            delete x;
+        }
+    }
+    retired.swap(left);
+}
+
+bool MiniRedisMirroredHash::hget(const std::string& field, std::string& replied) const
+{
+    std::size_t slot = 0;
+    const Snapshot* snapshot = Acquire(slot);
+    auto iter = snapshot->fields.find(field);
+    bool ret = (iter != snapshot->fields.end());
+    if (ret)
+    {
+        replied = iter->second;
+    }
+    else
+    {
+        replied.clear();
+    }
+    Release(slot);
+    return ret;
+}
+
+bool MiniRedisMirroredHash::hexists(const std::string& field) const
+{
+    std::size_t slot = 0;
+    const Snapshot* snapshot = Acquire(slot);
+    bool ret = (snapshot->fields.find(field) != snapshot->fields.end());
+    Release(slot);
+    return ret;
+}
+
+std::size_t MiniRedisMirroredHash::hlen() const
+{
+    std::size_t slot = 0;
+    std::size_t ret = Acquire(slot)->fields.size();
+    Release(slot);
+    return ret;
+}
+
+void MiniRedisMirroredHash::hgetall(FieldMap& replied) const
+{
+    std::size_t slot = 0;
+    replied = Acquire(slot)->fields;
+    Release(slot);
+}
+
+void MiniRedisMirroredHash::Read(const std::function<void(const FieldMap&)>& fn) const
+{
+    std::size_t slot = 0;
+    const Snapshot* snapshot = Acquire(slot);
+    if (slot == readerSlots)
+    {
+        // Don't hold the publish lock during fn, which may take long
+        FieldMap fields = snapshot->fields;
+        Release(slot);
+        fn(fields);
+        return;
+    }
+
+    try
+    {
+        fn(snapshot->fields);
+    }
+    catch (...)
+    {
+        Release(slot);
+        throw;
+    }
+    Release(slot);
+}
+
+uint64_t MiniRedisMirroredHash::GetVersion() const
+{
+    std::size_t slot = 0;
+    uint64_t ret = Acquire(slot)->version;
+    Release(slot);
+    return ret;
+}
+
+MiniRedisMirroredHashStats MiniRedisMirroredHash::GetStats() const
+{
+    MiniRedisMirroredHashStats x;
+    std::size_t slot = 0;
+    const Snapshot* snapshot = Acquire(slot);
+    x.version = snapshot->version;
+    x.fields = snapshot->fields.size();
+    Release(slot);
+    x.events = eventSeq;
+    x.scans = scans;
+    x.gaps = gaps;
+    return x;
+}
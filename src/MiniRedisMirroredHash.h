@@ -0,0 +1,151 @@
+// Local mirror of one Redis hash, kept in sync by keyspace notifications
+// For large hashes read much more often than they change, such as configuration and routing.
+//
+// The hash is copied with HSCAN into an immutable snapshot, and the snapshot is
+// refreshed when __keyspace@<db>__:<key> reports a change.
+// Notifications don't carry the changed field, so each refresh scans the hash again,
+// and the events arriving during one scan are coalesced into the next.
+// Pub/sub is at most once, so the hash is also scanned again after reconnecting,
+// and periodically by the resync interval.
+//
+// Reads are served from local memory without lock.
+// Each reader publishes the snapshot it uses in a hazard slot, and the refresh thread
+// swaps in the new snapshot and frees the old one after no reader holds it.
+// There are 64 slots, when all are held at once, such as by long Read() callbacks,
+// further readers take the publish lock instead, and Read() calls fn on a copy.
+//
+// Server should have keyspace notifications of hash, generic, expired and evicted events:
+//   CONFIG SET notify-keyspace-events Khgxe
+// Otherwise the changes, or the key expiring or being evicted, are seen by the periodic resync only.
+//
+
+#ifndef MiniRedisMirroredHash_INCLUDED
+#define MiniRedisMirroredHash_INCLUDED
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include "MiniRedisClient.h"
+#include "MiniRedisPubSub.h"
+
+struct MiniRedisMirroredHashStats
+{
+    // Version of the current snapshot, increased by each refresh
+    uint64_t version;
+    // Fields in the current snapshot
+    std::size_t fields;
+    // Keyspace events received
+    uint64_t events;
+    // Scans of the hash
+    uint64_t scans;
+    // Scans repeated because of events during the scan, or reconnection
+    uint64_t gaps;
+};
+
+class MiniRedisMirroredHash
+{
+public:
+    using FieldMap = std::unordered_map<std::string, std::string>;
+
+    explicit MiniRedisMirroredHash(const std::string& key);
+    ~MiniRedisMirroredHash();
+
+    MiniRedisMirroredHash(const MiniRedisMirroredHash&) = delete;
+    MiniRedisMirroredHash& operator=(const MiniRedisMirroredHash&) = delete;
+
+    // Before Start()
+    // COUNT hint of HSCAN
+    void SetScanCount(uint32_t count);
+    // Scan again periodically, in case a notification is lost, 0 disables
+    void SetResyncIntervalMs(uint32_t ms);
+    // Client of the scans, to set codec and connection options
+    // The database of the connection options selects the keyspace channel
+    MiniRedisClient& GetClient();
+
+    // Subscribe to the keyspace channel, take the first snapshot and start the refresh thread
+    bool Start(const std::string& host, uint16_t port = 6379);
+    void Stop();
+
+    // Read from the local snapshot, never block
+    // Return false if field doesn't exist
+    bool hget(const std::string& field, std::string& replied) const;
+    bool hexists(const std::string& field) const;
+    std::size_t hlen() const;
+    void hgetall(FieldMap& replied) const;
+    // Call fn with the current snapshot, without copying
+    // The map must not be referenced after fn returns
+    void Read(const std::function<void(const FieldMap&)>& fn) const;
+
+    uint64_t GetVersion() const;
+    MiniRedisMirroredHashStats GetStats() const;
+
+private:
+    struct Snapshot
+    {
+        FieldMap fields;
+        uint64_t version = 0;
+    };
+
+    // Hold the current snapshot in a hazard slot, until Release()
+    // If all slots are held, slot is readerSlots, and the publish lock is held instead
+    const Snapshot* Acquire(std::size_t& slot) const;
+    void Release(std::size_t slot) const;
+    // Swap in the new snapshot, and free the retired ones not held by readers
+    void Publish(Snapshot* snapshot);
+    void Reclaim();
+
+    // Scan the hash until no event arrives during the scan
+    bool Refresh();
+    bool Scan(FieldMap& fields);
+    bool Subscribe();
+    void CheckNotifyConfig();
+    void OnEvent(std::string_view event);
+    void ThreadRoutine();
+
+private:
+    static const std::size_t readerSlots = 64;
+
+    struct alignas(64) ReaderSlot
+    {
+        // nullptr when free
+        std::atomic<const Snapshot*> snapshot{nullptr};
+    };
+
+    std::string key;
+    std::string channel;
+    std::string host;
+    uint16_t port;
+    uint32_t scanCount;
+    uint32_t resyncIntervalMs;
+
+    std::atomic<const Snapshot*> current;
+    mutable ReaderSlot readers[readerSlots];
+    // Used by the refresh side only
+    std::vector<const Snapshot*> retired;
+    std::mutex refreshMutex;
+    // Held while swapping snapshots, and by readers finding no free slot
+    mutable std::mutex publishMutex;
+
+    std::atomic<uint64_t> eventSeq;
+    std::atomic<uint64_t> scans;
+    std::atomic<uint64_t> gaps;
+
+    std::thread refreshThread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool running;
+    bool dirty;
+    bool subscribed;
+    bool disconnected;
+
+    MiniRedisClient client;
+    // Last, so that it is disconnected before the members used by its callbacks are destroyed
+    MiniRedisPubSub sub;
+};
+
+#endif // MiniRedisMirroredHash_INCLUDED
@@ -0,0 +1,1647 @@
+// In-process RESP server for tests and benchmarks, Linux only
+
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <chrono>
+#include <charconv>
+#include <algorithm>
+#include <limits>
+#include "MiniRedisMockServer.h"
+#include "MiniRedisLogger.h"
+
+namespace
+{
+    const std::size_t databaseCount = 16;
+    // Larger requests are a protocol error, as proto-max-bulk-len of Redis
+    const long long maxBulkBytes = 512LL * 1024 * 1024;
+
+    // Steady clock, for scheduling replies
+    int64_t NowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Wall clock, for expiry
+    int64_t UnixMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string ToUpper(const std::string& str)
+    {
+        std::string ret(str);
+        std::transform(ret.begin(), ret.end(), ret.begin(), ::toupper);
+        return ret;
+    }
+
+    std::string ToLower(const std::string& str)
+    {
+        std::string ret(str);
+        std::transform(ret.begin(), ret.end(), ret.begin(), ::tolower);
+        return ret;
+    }
+
+    bool ParseInt(const std::string& str, long long& value)
+    {
+        const char* end = str.data() + str.size();
+        auto [p, ec] = std::from_chars(str.data(), end, value);
+        return !str.empty() && (ec == std::errc()) && (p == end);
+    }
+
+    bool SetNonBlocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return (flags >= 0) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0);
+    }
+
+    void AppendStatus(std::string& out, const char* status)
+    {
+        out.append("+").append(status).append("\r\n");
+    }
+
+    void AppendError(std::string& out, const std::string& msg)
+    {
+        out.append("-").append(msg).append("\r\n");
+    }
+
+    void AppendInt(std::string& out, long long value)
+    {
+        out.append(":").append(std::to_string(value)).append("\r\n");
+    }
+
+    void AppendBulk(std::string& out, const std::string& value)
+    {
+        out.append("$").append(std::to_string(value.size())).append("\r\n");
+        out.append(value).append("\r\n");
+    }
+
+    void AppendNil(std::string& out)
+    {
+        out.append("$-1\r\n");
+    }
+
+    void AppendArray(std::string& out, std::size_t count)
+    {
+        out.append("*").append(std::to_string(count)).append("\r\n");
+    }
+
+    const char* wrongType = "WRONGTYPE Operation against a key holding the wrong kind of value";
+    const char* notInteger = "ERR value is not an integer or out of range";
+    const char* overflow = "ERR increment or decrement would overflow";
+
+    // Return false if the sum overflows, same as Redis
+    bool AddInt(long long value, long long delta, long long& sum)
+    {
+        if ((delta > 0) ? (value > std::numeric_limits<long long>::max() - delta) :
+            (value < std::numeric_limits<long long>::min() - delta))
+        {
+            return false;
+        }
+        sum = value + delta;
+        return true;
+    }
+
+    // Unix time in ms after ttl in seconds or ms, return false if it overflows
+    bool ToExpireAt(long long ttl, bool seconds, int64_t& expireAt)
+    {
+        const long long maxValue = std::numeric_limits<long long>::max();
+        const long long minValue = std::numeric_limits<long long>::min();
+        if (seconds && ((ttl > maxValue / 1000) || (ttl < minValue / 1000)))
+        {
+            return false;
+        }
+
+        long long at = 0;
+        if (!AddInt(UnixMs(), seconds ? ttl * 1000 : ttl, at))
+        {
+            return false;
+        }
+        expireAt = at;
+        return true;
+    }
+}
+
+MiniRedisMockServer::MiniRedisMockServer()
+    : listenFd(-1), epollFd(-1), wakeFd(-1), port(0), running(false), disconnectAll(false),
+      databases(databaseCount), flushAll(false), bandwidth(0), fragmentBytes(0), fragmentPauseMs(0),
+      connectionCount(0), connectionsAccepted(0), commands(0), faultsInjected(0), bytesIn(0), bytesOut(0)
+{
+    // Arity as Redis, exact if positive, and at least if negative, including the name
+    handlers = {
+        {"PING", {&MiniRedisMockServer::CmdPing, -1}},
+        {"ECHO", {&MiniRedisMockServer::CmdEcho, 2}},
+        {"AUTH", {&MiniRedisMockServer::CmdOk, -2}},
+        {"HELLO", {&MiniRedisMockServer::CmdHello, -1}},
+        {"SELECT", {&MiniRedisMockServer::CmdSelect, 2}},
+        {"CLIENT", {&MiniRedisMockServer::CmdClient, -2}},
+        {"DEL", {&MiniRedisMockServer::CmdDel, -2}},
+        {"EXISTS", {&MiniRedisMockServer::CmdExists, -2}},
+        {"TYPE", {&MiniRedisMockServer::CmdType, 2}},
+        {"KEYS", {&MiniRedisMockServer::CmdKeys, 2}},
+        {"DBSIZE", {&MiniRedisMockServer::CmdDbSize, 1}},
+        {"FLUSHDB", {&MiniRedisMockServer::CmdFlushDb, -1}},
+        {"FLUSHALL", {&MiniRedisMockServer::CmdFlushAll, -1}},
+        {"EXPIRE", {&MiniRedisMockServer::CmdExpire, 3}},
+        {"PEXPIRE", {&MiniRedisMockServer::CmdExpire, 3}},
+        {"TTL", {&MiniRedisMockServer::CmdTtl, 2}},
+        {"PTTL", {&MiniRedisMockServer::CmdTtl, 2}},
+        {"GET", {&MiniRedisMockServer::CmdGet, 2}},
+        {"SET", {&MiniRedisMockServer::CmdSet, -3}},
+        {"MGET", {&MiniRedisMockServer::CmdMGet, -2}},
+        {"MSET", {&MiniRedisMockServer::CmdMSet, -3}},
+        {"INCR", {&MiniRedisMockServer::CmdIncrBy, 2}},
+        {"DECR", {&MiniRedisMockServer::CmdIncrBy, 2}},
+        {"INCRBY", {&MiniRedisMockServer::CmdIncrBy, 3}},
+        {"DECRBY", {&MiniRedisMockServer::CmdIncrBy, 3}},
+        {"APPEND", {&MiniRedisMockServer::CmdAppend, 3}},
+        {"STRLEN", {&MiniRedisMockServer::CmdStrLen, 2}},
+        {"HSET", {&MiniRedisMockServer::CmdHSet, -4}},
+        {"HGET", {&MiniRedisMockServer::CmdHGet, 3}},
+        {"HMGET", {&MiniRedisMockServer::CmdHMGet, -3}},
+        {"HGETALL", {&MiniRedisMockServer::CmdHGetAll, 2}},
+        {"HDEL", {&MiniRedisMockServer::CmdHDel, -3}},
+        {"HLEN", {&MiniRedisMockServer::CmdHLen, 2}},
+        {"HEXISTS", {&MiniRedisMockServer::CmdHExists, 3}},
+        {"HINCRBY", {&MiniRedisMockServer::CmdHIncrBy, 4}},
+        {"LPUSH", {&MiniRedisMockServer::CmdPush, -3}},
+        {"RPUSH", {&MiniRedisMockServer::CmdPush, -3}},
+        {"LPOP", {&MiniRedisMockServer::CmdPop, -2}},
+        {"RPOP", {&MiniRedisMockServer::CmdPop, -2}},
+        {"LLEN", {&MiniRedisMockServer::CmdLLen, 2}},
+        {"LRANGE", {&MiniRedisMockServer::CmdLRange, 4}},
+        {"SADD", {&MiniRedisMockServer::CmdSAdd, -3}},
+        {"SREM", {&MiniRedisMockServer::CmdSRem, -3}},
+        {"SMEMBERS", {&MiniRedisMockServer::CmdSMembers, 2}},
+        {"SISMEMBER", {&MiniRedisMockServer::CmdSIsMember, 3}},
+        {"SCARD", {&MiniRedisMockServer::CmdSCard, 2}},
+        {"SUBSCRIBE", {&MiniRedisMockServer::CmdSubscribe, -2}},
+        {"UNSUBSCRIBE", {&MiniRedisMockServer::CmdUnsubscribe, -1}},
+        {"PUBLISH", {&MiniRedisMockServer::CmdPublish, 3}},
+        {"MOCK.BLOB", {&MiniRedisMockServer::CmdBlob, 2}},
+    };
+}
+
+MiniRedisMockServer::~MiniRedisMockServer()
+{
+    Stop();
+}
+
+bool MiniRedisMockServer::Start(uint16_t port)
+{
+    if (running)
+    {
+        return true;
+    }
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    bool ok = (listenFd >= 0) &&
+        (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0) &&
+        (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == 0) &&
+        (listen(listenFd, 512) == 0) &&
+        (getsockname(listenFd, (sockaddr*)&addr, &addrLen) == 0) &&
+        SetNonBlocking(listenFd);
+    if (ok)
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event listenEv = {};
+        listenEv.events = EPOLLIN;
+        listenEv.data.fd = listenFd;
+        epoll_event wakeEv = {};
+        wakeEv.events = EPOLLIN;
+        wakeEv.data.fd = wakeFd;
+        ok = (epollFd >= 0) && (wakeFd >= 0) &&
+            (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEv) == 0) &&
+            (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEv) == 0);
+    }
+
+    if (!ok)
+    {
+        MINIREDIS_LOG_ERROR("Failed to start mock server on port %u: %s", port, strerror(errno));
+        for (int* fd : {&listenFd, &epollFd, &wakeFd})
+        {
+            if (*fd >= 0)
+            {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+        return false;
+    }
+
+    this->port = ntohs(addr.sin_port);
+    running = true;
+    thread = std::thread(&MiniRedisMockServer::ThreadRoutine, this);
+    return true;
+}
+
+void MiniRedisMockServer::Stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0)
+    {
+        MINIREDIS_LOG_WARN("Failed to wake up mock server: %s", strerror(errno));
+    }
+    thread.join();
+
+    std::vector<int> fds;
+    for (auto& x : connections)
+    {
+        fds.push_back(x.first);
+    }
+    for (int fd : fds)
+    {
+        Close(fd, false);
+    }
+    close(listenFd);
+    close(epollFd);
+    close(wakeFd);
+    listenFd = epollFd = wakeFd = -1;
+}
+
+uint16_t MiniRedisMockServer::GetPort() const
+{
+    return port;
+}
+
+void MiniRedisMockServer::SetLatencyMs(const std::string& command, uint32_t ms)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    latencyMs[ToUpper(command)] = ms;
+}
+
+void MiniRedisMockServer::SetBandwidth(uint64_t bytesPerSec)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    bandwidth = bytesPerSec;
+}
+
+void MiniRedisMockServer::SetFragment(uint32_t bytes, uint32_t pauseMs)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    fragmentBytes = bytes;
+    fragmentPauseMs = pauseMs;
+}
+
+void MiniRedisMockServer::InjectFault(const std::string& command, MiniRedisMockFault fault, uint32_t count)
+{
+    // Otherwise the count would wrap when taken, and the fault would never end
+    if (count == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(configMutex);
+    faults.push_back({ToUpper(command), fault, count});
+}
+
+void MiniRedisMockServer::ClearFaults()
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    latencyMs.clear();
+    bandwidth = 0;
+    fragmentBytes = 0;
+    fragmentPauseMs = 0;
+    faults.clear();
+}
+
+void MiniRedisMockServer::DisconnectAll()
+{
+    disconnectAll = true;
+    uint64_t one = 1;
+    if ((wakeFd >= 0) && (write(wakeFd, &one, sizeof(one)) < 0))
+    {
+        MINIREDIS_LOG_WARN("Failed to wake up mock server: %s", strerror(errno));
+    }
+}
+
+void MiniRedisMockServer::FlushAll()
+{
+    flushAll = true;
+    uint64_t one = 1;
+    if ((wakeFd >= 0) && (write(wakeFd, &one, sizeof(one)) < 0))
+    {
+        MINIREDIS_LOG_WARN("Failed to wake up mock server: %s", strerror(errno));
+    }
+}
+
+std::size_t MiniRedisMockServer::GetConnectionCount() const
+{
+    return connectionCount;
+}
+
+MiniRedisMockStats MiniRedisMockServer::GetStats() const
+{
+    MiniRedisMockStats x;
+    x.connections = connectionsAccepted;
+    x.commands = commands;
+    x.faults = faultsInjected;
+    x.bytesIn = bytesIn;
+    x.bytesOut = bytesOut;
+    return x;
+}
+
+void MiniRedisMockServer::ThreadRoutine()
+{
+    epoll_event events[64];
+    while (running)
+    {
+        int64_t wakeup = NextWakeup();
+        int timeoutMs = -1;
+        if (wakeup >= 0)
+        {
+            timeoutMs = (int)std::max<int64_t>(0, (wakeup - NowUs() + 999) / 1000);
+        }
+
+        int count = epoll_wait(epollFd, events, 64, timeoutMs);
+        if ((count < 0) && (errno != EINTR))
+        {
+            MINIREDIS_LOG_ERROR("Mock server epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        std::vector<int> closing;
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listenFd)
+            {
+                Accept();
+                continue;
+            }
+            if (fd == wakeFd)
+            {
+                uint64_t value = 0;
+                if (read(wakeFd, &value, sizeof(value)) < 0)
+                {
+                    MINIREDIS_LOG_TRACE("Mock server wake fd: %s", strerror(errno));
+                }
+                continue;
+            }
+
+            auto iter = connections.find(fd);
+            if (iter == connections.end())
+            {
+                continue;
+            }
+            Connection& conn = *iter->second;
+            if ((events[i].events & EPOLLOUT) && conn.wantWrite)
+            {
+                SetWantWrite(conn, false);
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !OnReadable(conn))
+            {
+                closing.push_back(fd);
+            }
+        }
+        for (int fd : closing)
+        {
+            Close(fd, false);
+        }
+
+        if (disconnectAll.exchange(false))
+        {
+            std::vector<int> fds;
+            for (auto& x : connections)
+            {
+                fds.push_back(x.first);
+            }
+            for (int fd : fds)
+            {
+                Close(fd, false);
+            }
+        }
+        if (flushAll.exchange(false))
+        {
+            for (auto& db : databases)
+            {
+                db.clear();
+            }
+        }
+
+        // Write what is due on every connection
+        int64_t now = NowUs();
+        std::vector<std::pair<int, bool>> done;
+        for (auto& x : connections)
+        {
+            if (!Flush(*x.second, now))
+            {
+                done.emplace_back(x.first, x.second->resetAfterWrite);
+            }
+        }
+        for (auto& x : done)
+        {
+            Close(x.first, x.second);
+        }
+    }
+}
+
+void MiniRedisMockServer::Accept()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                MINIREDIS_LOG_WARN("Mock server accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        std::unique_ptr<Connection> conn(new Connection());
+        conn->fd = fd;
+        connections[fd] = std::move(conn);
+        connectionCount++;
+        connectionsAccepted++;
+    }
+}
+
+void MiniRedisMockServer::Close(int fd, bool reset)
+{
+    if (reset)
+    {
+        // Zero linger time sends RST
+        linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    if (connections.erase(fd))
+    {
+        connectionCount--;
+    }
+}
+
+bool MiniRedisMockServer::OnReadable(Connection& conn)
+{
+    char buf[16 * 1024];
+    while (true)
+    {
+        ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+        if (n == 0)
+        {
+            return false;
+        }
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        bytesIn += n;
+        if (!conn.hung)
+        {
+            conn.input.append(buf, n);
+        }
+    }
+
+    std::vector<Args> parsed;
+    if (!ParseCommands(conn, parsed))
+    {
+        std::string out;
+        AppendError(out, "ERR Protocol error");
+        AddReply(conn, NowUs(), std::move(out), true);
+        conn.hung = true;
+        return true;
+    }
+
+    for (auto& args : parsed)
+    {
+        if (conn.hung)
+        {
+            break;
+        }
+        Execute(conn, args);
+    }
+    return true;
+}
+
+bool MiniRedisMockServer::ParseCommands(Connection& conn, std::vector<Args>& parsed)
+{
+    const std::string& in = conn.input;
+    std::size_t pos = 0;
+    while (pos < in.size())
+    {
+        std::size_t eol = in.find("\r\n", pos);
+        if (eol == std::string::npos)
+        {
+            break;
+        }
+
+        if (in[pos] != '*')
+        {
+            // Inline command, such as typed in telnet
+            Args args;
+            std::size_t start = pos;
+            while (start < eol)
+            {
+                std::size_t space = in.find(' ', start);
+                std::size_t end = std::min(space, eol);
+                if (end > start)
+                {
+                    args.emplace_back(in, start, end - start);
+                }
+                start = end + 1;
+            }
+            if (!args.empty())
+            {
+                parsed.push_back(std::move(args));
+            }
+            pos = eol + 2;
+            continue;
+        }
+
+        long long count = 0;
+        if (!ParseInt(in.substr(pos + 1, eol - pos - 1), count) || (count > 1024 * 1024))
+        {
+            return false;
+        }
+
+        Args args;
+        std::size_t p = eol + 2;
+        bool complete = true;
+        for (long long i = 0; i < count; i++)
+        {
+            std::size_t end = in.find("\r\n", p);
+            if (end == std::string::npos)
+            {
+                complete = false;
+                break;
+            }
+
+            long long len = 0;
+            if ((in[p] != '$') || !ParseInt(in.substr(p + 1, end - p - 1), len) ||
+                (len < 0) || (len > maxBulkBytes))
+            {
+                return false;
+            }
+            if (end + 2 + len + 2 > in.size())
+            {
+                complete = false;
+                break;
+            }
+            args.emplace_back(in, end + 2, len);
+            p = end + 2 + len + 2;
+        }
+        if (!complete)
+        {
+            break;
+        }
+
+        if (!args.empty())
+        {
+            parsed.push_back(std::move(args));
+        }
+        pos = p;
+    }
+
+    conn.input.erase(0, pos);
+    return true;
+}
+
+void MiniRedisMockServer::Execute(Connection& conn, const Args& args)
+{
+    commands++;
+    std::string name = ToUpper(args[0]);
+    int64_t readyAt = NowUs() + (int64_t)GetLatencyMs(name) * 1000;
+    MiniRedisMockFault fault = TakeFault(name);
+    std::string out;
+    switch (fault)
+    {
+    case MOCK_FAULT_HANG:
+        conn.hung = true;
+        return;
+    case MOCK_FAULT_CLOSE:
+    case MOCK_FAULT_RESET:
+        // Replies queued before are still written
+        AddReply(conn, readyAt, std::string(), true, fault == MOCK_FAULT_RESET);
+        conn.hung = true;
+        return;
+    case MOCK_FAULT_ERROR:
+        AppendError(out, "ERR injected fault");
+        AddReply(conn, readyAt, std::move(out));
+        return;
+    default:
+        break;
+    }
+
+    auto iter = handlers.find(name);
+    int argc = (int)args.size();
+    if (name == "QUIT")
+    {
+        AppendStatus(out, "OK");
+        AddReply(conn, readyAt, std::move(out), true);
+        conn.hung = true;
+        return;
+    }
+    else if (iter == handlers.end())
+    {
+        AppendError(out, "ERR unknown command '" + args[0] + "'");
+    }
+    else if ((iter->second.second > 0) ? (argc != iter->second.second) : (argc < -iter->second.second))
+    {
+        AppendError(out, "ERR wrong number of arguments for '" + ToLower(name) + "' command");
+    }
+    else if (!conn.channels.empty() && (name != "SUBSCRIBE") && (name != "UNSUBSCRIBE") && (name != "PING"))
+    {
+        AppendError(out, "ERR Can't execute '" + ToLower(name) +
+            "': only SUBSCRIBE / UNSUBSCRIBE / PING / QUIT are allowed in this context");
+    }
+    else
+    {
+        (this->*(iter->second.first))(conn, args, out);
+    }
+
+    if (fault == MOCK_FAULT_TRUNCATE)
+    {
+        out.resize(out.size() / 2);
+        AddReply(conn, readyAt, std::move(out), true);
+        conn.hung = true;
+        return;
+    }
+    AddReply(conn, readyAt, std::move(out));
+}
+
+void MiniRedisMockServer::AddReply(Connection& conn, int64_t readyAt, std::string&& data, bool close, bool reset)
+{
+    if (!conn.pending.empty())
+    {
+        readyAt = std::max(readyAt, conn.pending.back().readyAt);
+    }
+    conn.pending.push_back({readyAt, std::move(data), close, reset});
+}
+
+void MiniRedisMockServer::SetWantWrite(Connection& conn, bool want)
+{
+    epoll_event ev = {};
+    ev.events = want ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.wantWrite = want;
+}
+
+bool MiniRedisMockServer::Flush(Connection& conn, int64_t now)
+{
+    // Due replies in order, and nothing after a closing one
+    while (!conn.pending.empty() && (conn.pending.front().readyAt <= now) && !conn.closeAfterWrite)
+    {
+        PendingReply& reply = conn.pending.front();
+        if (conn.written == conn.output.size())
+        {
+            conn.output.clear();
+            conn.written = 0;
+        }
+        conn.output.append(reply.data);
+        conn.closeAfterWrite = reply.close;
+        conn.resetAfterWrite = reply.reset;
+        conn.pending.pop_front();
+    }
+
+    uint64_t bytesPerSec = 0;
+    uint32_t fragment = 0;
+    uint32_t pauseMs = 0;
+    {
+        std::lock_guard<std::mutex> lock(configMutex);
+        bytesPerSec = bandwidth;
+        fragment = fragmentBytes;
+        pauseMs = fragmentPauseMs;
+    }
+
+    while ((conn.written < conn.output.size()) && !conn.wantWrite && (conn.nextWriteAt <= now))
+    {
+        std::size_t len = conn.output.size() - conn.written;
+        if (fragment)
+        {
+            len = std::min<std::size_t>(len, fragment);
+        }
+        if (bytesPerSec)
+        {
+            // Slices of 10 ms at most, so that the rate is smooth
+            len = std::min<std::size_t>(len, std::max<uint64_t>(1, bytesPerSec / 100));
+        }
+
+        ssize_t n = send(conn.fd, conn.output.data() + conn.written, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                SetWantWrite(conn, true);
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        conn.written += n;
+        bytesOut += n;
+        if (bytesPerSec)
+        {
+            conn.nextWriteAt = now + (int64_t)((uint64_t)n * 1000000 / bytesPerSec);
+        }
+        if (fragment && pauseMs && (conn.written < conn.output.size()))
+        {
+            conn.nextWriteAt = std::max(conn.nextWriteAt, now + (int64_t)pauseMs * 1000);
+        }
+    }
+
+    return !(conn.closeAfterWrite && (conn.written == conn.output.size()));
+}
+
+int64_t MiniRedisMockServer::NextWakeup() const
+{
+    int64_t ret = -1;
+    for (auto& x : connections)
+    {
+        const Connection& conn = *x.second;
+        int64_t at = -1;
+        if ((conn.written < conn.output.size()) || conn.closeAfterWrite)
+        {
+            // Waiting for EPOLLOUT needs no timer
+            if (!conn.wantWrite)
+            {
+                at = conn.nextWriteAt;
+            }
+        }
+        else if (!conn.pending.empty())
+        {
+            at = conn.pending.front().readyAt;
+        }
+
+        if ((at >= 0) && ((ret < 0) || (at < ret)))
+        {
+            ret = at;
+        }
+    }
+    return ret;
+}
+
+uint32_t MiniRedisMockServer::GetLatencyMs(const std::string& command) const
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    auto iter = latencyMs.find(command);
+    if (iter == latencyMs.end())
+    {
+        iter = latencyMs.find("*");
+    }
+    return (iter == latencyMs.end()) ? 0 : iter->second;
+}
+
+MiniRedisMockFault MiniRedisMockServer::TakeFault(const std::string& command)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    for (auto iter = faults.begin(); iter != faults.end(); ++iter)
+    {
+        if ((iter->command == command) || (iter->command == "*"))
+        {
+            MiniRedisMockFault fault = iter->fault;
+            if (--iter->count == 0)
+            {
+                faults.erase(iter);
+            }
+            faultsInjected++;
+            return fault;
+        }
+    }
+    return MOCK_FAULT_NONE;
+}
+
+MiniRedisMockServer::Value* MiniRedisMockServer::Find(Connection& conn, const std::string& key)
+{
+    Database& db = databases[conn.db];
+    auto iter = db.find(key);
+    if (iter == db.end())
+    {
+        return nullptr;
+    }
+    if (iter->second.expireAt && (iter->second.expireAt <= UnixMs()))
+    {
+        db.erase(iter);
+        return nullptr;
+    }
+    return &iter->second;
+}
+
+MiniRedisMockServer::Value* MiniRedisMockServer::FindTyped(Connection& conn, const std::string& key,
+    ValueType type, std::string& out)
+{
+    Value* value = Find(conn, key);
+    if (value && (value->type != type))
+    {
+        AppendError(out, wrongType);
+        return nullptr;
+    }
+    return value;
+}
+
+MiniRedisMockServer::Value* MiniRedisMockServer::FindOrCreate(Connection& conn, const std::string& key,
+    ValueType type, std::string& out)
+{
+    Value* value = FindTyped(conn, key, type, out);
+    if (!value && out.empty())
+    {
+        value = &databases[conn.db][key];
+        value->type = type;
+    }
+    return value;
+}
+
+void MiniRedisMockServer::RemoveIfEmpty(Connection& conn, const std::string& key, const Value& value)
+{
+    if (value.hash.empty() && value.list.empty() && value.set.empty() && (value.type != TYPE_STRING))
+    {
+        databases[conn.db].erase(key);
+    }
+}
+
+const std::string* MiniRedisMockServer::FindField(const Value& value, const std::string& field)
+{
+    auto iter = value.hash.find(field);
+    return (iter == value.hash.end()) ? nullptr : &iter->second;
+}
+
+void MiniRedisMockServer::CmdPing(Connection& conn, const Args& args, std::string& out)
+{
+    if (!conn.channels.empty())
+    {
+        // Reply of subscribed connection is an array
+        AppendArray(out, 2);
+        AppendBulk(out, "pong");
+        AppendBulk(out, (args.size() > 1) ? args[1] : std::string());
+    }
+    else if (args.size() > 1)
+    {
+        AppendBulk(out, args[1]);
+    }
+    else
+    {
+        AppendStatus(out, "PONG");
+    }
+}
+
+void MiniRedisMockServer::CmdEcho(Connection&, const Args& args, std::string& out)
+{
+    AppendBulk(out, args[1]);
+}
+
+void MiniRedisMockServer::CmdOk(Connection&, const Args&, std::string& out)
+{
+    AppendStatus(out, "OK");
+}
+
+void MiniRedisMockServer::CmdHello(Connection&, const Args&, std::string& out)
+{
+    AppendError(out, "NOPROTO sorry, this protocol version is not supported");
+}
+
+void MiniRedisMockServer::CmdSelect(Connection& conn, const Args& args, std::string& out)
+{
+    long long index = 0;
+    if (!ParseInt(args[1], index) || (index < 0) || (index >= (long long)databaseCount))
+    {
+        AppendError(out, "ERR DB index is out of range");
+        return;
+    }
+    conn.db = index;
+    AppendStatus(out, "OK");
+}
+
+void MiniRedisMockServer::CmdClient(Connection& conn, const Args& args, std::string& out)
+{
+    std::string sub = ToUpper(args[1]);
+    if ((sub == "SETNAME") && (args.size() == 3))
+    {
+        conn.name = args[2];
+        AppendStatus(out, "OK");
+    }
+    else if (sub == "GETNAME")
+    {
+        conn.name.empty() ? AppendNil(out) : AppendBulk(out, conn.name);
+    }
+    else if (sub == "ID")
+    {
+        AppendInt(out, conn.fd);
+    }
+    else
+    {
+        // NO-EVICT, REPLY and so on are accepted and ignored
+        AppendStatus(out, "OK");
+    }
+}
+
+void MiniRedisMockServer::CmdDel(Connection& conn, const Args& args, std::string& out)
+{
+    long long count = 0;
+    for (std::size_t i = 1; i < args.size(); i++)
+    {
+        if (Find(conn, args[i]))
+        {
+            databases[conn.db].erase(args[i]);
+            count++;
+        }
+    }
+    AppendInt(out, count);
+}
+
+void MiniRedisMockServer::CmdExists(Connection& conn, const Args& args, std::string& out)
+{
+    long long count = 0;
+    for (std::size_t i = 1; i < args.size(); i++)
+    {
+        count += Find(conn, args[i]) ? 1 : 0;
+    }
+    AppendInt(out, count);
+}
+
+void MiniRedisMockServer::CmdType(Connection& conn, const Args& args, std::string& out)
+{
+    static const char* names[] = {"string", "hash", "list", "set"};
+    Value* value = Find(conn, args[1]);
+    AppendStatus(out, value ? names[value->type] : "none");
+}
+
+void MiniRedisMockServer::CmdKeys(Connection& conn, const Args& args, std::string& out)
+{
+    int64_t now = UnixMs();
+    std::vector<const std::string*> keys;
+    for (auto& x : databases[conn.db])
+    {
+        if ((!x.second.expireAt || (x.second.expireAt > now)) &&
+            (fnmatch(args[1].c_str(), x.first.c_str(), 0) == 0))
+        {
+            keys.push_back(&x.first);
+        }
+    }
+
+    AppendArray(out, keys.size());
+    for (auto key : keys)
+    {
+        AppendBulk(out, *key);
+    }
+}
+
+void MiniRedisMockServer::CmdDbSize(Connection& conn, const Args&, std::string& out)
+{
+    AppendInt(out, databases[conn.db].size());
+}
+
+void MiniRedisMockServer::CmdFlushDb(Connection& conn, const Args&, std::string& out)
+{
+    databases[conn.db].clear();
+    AppendStatus(out, "OK");
+}
+
+void MiniRedisMockServer::CmdFlushAll(Connection&, const Args&, std::string& out)
+{
+    for (auto& db : databases)
+    {
+        db.clear();
+    }
+    AppendStatus(out, "OK");
+}
+
+void MiniRedisMockServer::CmdExpire(Connection& conn, const Args& args, std::string& out)
+{
+    long long ttl = 0;
+    if (!ParseInt(args[2], ttl))
+    {
+        AppendError(out, notInteger);
+        return;
+    }
+
+    int64_t expireAt = 0;
+    if (!ToExpireAt(ttl, ToUpper(args[0]) != "PEXPIRE", expireAt))
+    {
+        AppendError(out, "ERR invalid expire time in '" + ToLower(args[0]) + "' command");
+        return;
+    }
+
+    Value* value = Find(conn, args[1]);
+    if (!value)
+    {
+        AppendInt(out, 0);
+        return;
+    }
+    if (expireAt <= UnixMs())
+    {
+        databases[conn.db].erase(args[1]);
+    }
+    else
+    {
+        value->expireAt = expireAt;
+    }
+    AppendInt(out, 1);
+}
+
+void MiniRedisMockServer::CmdTtl(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = Find(conn, args[1]);
+    if (!value)
+    {
+        AppendInt(out, -2);
+    }
+    else if (!value->expireAt)
+    {
+        AppendInt(out, -1);
+    }
+    else
+    {
+        long long ms = value->expireAt - UnixMs();
+        AppendInt(out, (ToUpper(args[0]) == "PTTL") ? ms : (ms + 500) / 1000);
+    }
+}
+
+void MiniRedisMockServer::CmdGet(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_STRING, out);
+    if (value)
+    {
+        AppendBulk(out, value->str);
+    }
+    else if (out.empty())
+    {
+        AppendNil(out);
+    }
+}
+
+void MiniRedisMockServer::CmdSet(Connection& conn, const Args& args, std::string& out)
+{
+    bool nx = false;
+    bool xx = false;
+    bool keepTtl = false;
+    int64_t expireAtOption = 0;
+    for (std::size_t i = 3; i < args.size(); i++)
+    {
+        std::string option = ToUpper(args[i]);
+        long long ttl = 0;
+        if (((option == "EX") || (option == "PX")) && (i + 1 < args.size()))
+        {
+            if (!ParseInt(args[++i], ttl) || (ttl <= 0) || 
+                !ToExpireAt(ttl, option == "EX", expireAtOption))
+            {
+                AppendError(out, "ERR invalid expire time in 'set' command");
+                return;
+            }
+        }
+        else if (option == "NX")
+        {
+            nx = true;
+        }
+        else if (option == "XX")
+        {
+            xx = true;
+        }
+        else if (option == "KEEPTTL")
+        {
+            keepTtl = true;
+        }
+        else
+        {
+            AppendError(out, "ERR syntax error");
+            return;
+        }
+    }
+
+    Value* existing = Find(conn, args[1]);
+    if ((nx && existing) || (xx && !existing))
+    {
+        AppendNil(out);
+        return;
+    }
+
+    int64_t expireAt = (keepTtl && existing) ? existing->expireAt : 0;
+    Value& value = databases[conn.db][args[1]];
+    value = Value();
+    value.str = args[2];
+    value.expireAt = expireAtOption ? expireAtOption : expireAt;
+    AppendStatus(out, "OK");
+}
+
+void MiniRedisMockServer::CmdMGet(Connection& conn, const Args& args, std::string& out)
+{
+    AppendArray(out, args.size() - 1);
+    for (std::size_t i = 1; i < args.size(); i++)
+    {
+        Value* value = Find(conn, args[i]);
+        if (value && (value->type == TYPE_STRING))
+        {
+            AppendBulk(out, value->str);
+        }
+        else
+        {
+            AppendNil(out);
+        }
+    }
+}
+
+void MiniRedisMockServer::CmdMSet(Connection& conn, const Args& args, std::string& out)
+{
+    if (args.size() % 2 == 0)
+    {
+        AppendError(out, "ERR wrong number of arguments for 'mset' command");
+        return;
+    }
+
+    for (std::size_t i = 1; i + 1 < args.size(); i += 2)
+    {
+        Value& value = databases[conn.db][args[i]];
+        value = Value();
+        value.str = args[i + 1];
+    }
+    AppendStatus(out, "OK");
+}
+
+void MiniRedisMockServer::CmdIncrBy(Connection& conn, const Args& args, std::string& out)
+{
+    std::string name = ToUpper(args[0]);
+    long long delta = 1;
+    if ((args.size() == 3) && !ParseInt(args[2], delta))
+    {
+        AppendError(out, notInteger);
+        return;
+    }
+    if ((name == "DECR") || (name == "DECRBY"))
+    {
+        if (delta == std::numeric_limits<long long>::min())
+        {
+            AppendError(out, "ERR decrement would overflow");
+            return;
+        }
+        delta = -delta;
+    }
+
+    Value* value = FindOrCreate(conn, args[1], TYPE_STRING, out);
+    if (!value)
+    {
+        return;
+    }
+
+    long long current = 0;
+    if (!value->str.empty() && !ParseInt(value->str, current))
+    {
+        AppendError(out, notInteger);
+        return;
+    }
+    if (!AddInt(current, delta, current))
+    {
+        AppendError(out, overflow);
+        return;
+    }
+    value->str = std::to_string(current);
+    AppendInt(out, current);
+}
+
+void MiniRedisMockServer::CmdAppend(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindOrCreate(conn, args[1], TYPE_STRING, out);
+    if (value)
+    {
+        value->str.append(args[2]);
+        AppendInt(out, value->str.size());
+    }
+}
+
+void MiniRedisMockServer::CmdStrLen(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_STRING, out);
+    if (out.empty())
+    {
+        AppendInt(out, value ? value->str.size() : 0);
+    }
+}
+
+void MiniRedisMockServer::CmdHSet(Connection& conn, const Args& args, std::string& out)
+{
+    if (args.size() % 2 != 0)
+    {
+        AppendError(out, "ERR wrong number of arguments for 'hset' command");
+        return;
+    }
+
+    Value* value = FindOrCreate(conn, args[1], TYPE_HASH, out);
+    if (!value)
+    {
+        return;
+    }
+
+    long long added = 0;
+    for (std::size_t i = 2; i + 1 < args.size(); i += 2)
+    {
+        added += value->hash.insert_or_assign(args[i], args[i + 1]).second ? 1 : 0;
+    }
+    AppendInt(out, added);
+}
+
+void MiniRedisMockServer::CmdHGet(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_HASH, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    const std::string* field = value ? FindField(*value, args[2]) : nullptr;
+    if (field)
+    {
+        AppendBulk(out, *field);
+    }
+    else
+    {
+        AppendNil(out);
+    }
+}
+
+void MiniRedisMockServer::CmdHMGet(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_HASH, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    AppendArray(out, args.size() - 2);
+    for (std::size_t i = 2; i < args.size(); i++)
+    {
+        const std::string* field = value ? FindField(*value, args[i]) : nullptr;
+        if (field)
+        {
+            AppendBulk(out, *field);
+        }
+        else
+        {
+            AppendNil(out);
+        }
+    }
+}
+
+void MiniRedisMockServer::CmdHGetAll(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_HASH, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    AppendArray(out, value ? value->hash.size() * 2 : 0);
+    if (value)
+    {
+        for (auto& x : value->hash)
+        {
+            AppendBulk(out, x.first);
+            AppendBulk(out, x.second);
+        }
+    }
+}
+
+void MiniRedisMockServer::CmdHDel(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_HASH, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    long long count = 0;
+    if (value)
+    {
+        for (std::size_t i = 2; i < args.size(); i++)
+        {
+            count += value->hash.erase(args[i]);
+        }
+        RemoveIfEmpty(conn, args[1], *value);
+    }
+    AppendInt(out, count);
+}
+
+void MiniRedisMockServer::CmdHLen(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_HASH, out);
+    if (out.empty())
+    {
+        AppendInt(out, value ? value->hash.size() : 0);
+    }
+}
+
+void MiniRedisMockServer::CmdHExists(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_HASH, out);
+    if (out.empty())
+    {
+        AppendInt(out, (value && value->hash.count(args[2])) ? 1 : 0);
+    }
+}
+
+void MiniRedisMockServer::CmdHIncrBy(Connection& conn, const Args& args, std::string& out)
+{
+    long long delta = 0;
+    if (!ParseInt(args[3], delta))
+    {
+        AppendError(out, notInteger);
+        return;
+    }
+
+    Value* value = FindOrCreate(conn, args[1], TYPE_HASH, out);
+    if (!value)
+    {
+        return;
+    }
+
+    std::string& field = value->hash[args[2]];
+    long long current = 0;
+    if (!field.empty() && !ParseInt(field, current))
+    {
+        AppendError(out, "ERR hash value is not an integer");
+        return;
+    }
+    if (!AddInt(current, delta, current))
+    {
+        AppendError(out, overflow);
+        return;
+    }
+    field = std::to_string(current);
+    AppendInt(out, current);
+}
+
+void MiniRedisMockServer::CmdPush(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindOrCreate(conn, args[1], TYPE_LIST, out);
+    if (!value)
+    {
+        return;
+    }
+
+    bool left = (ToUpper(args[0]) == "LPUSH");
+    for (std::size_t i = 2; i < args.size(); i++)
+    {
+        left ? value->list.push_front(args[i]) : value->list.push_back(args[i]);
+    }
+    AppendInt(out, value->list.size());
+}
+
+void MiniRedisMockServer::CmdPop(Connection& conn, const Args& args, std::string& out)
+{
+    long long count = 1;
+    bool hasCount = (args.size() > 2);
+    if (hasCount && (!ParseInt(args[2], count) || (count < 0)))
+    {
+        AppendError(out, "ERR value is out of range, must be positive");
+        return;
+    }
+
+    Value* value = FindTyped(conn, args[1], TYPE_LIST, out);
+    if (!out.empty())
+    {
+        return;
+    }
+    if (!value)
+    {
+        if (hasCount)
+        {
+            out.append("*-1\r\n");
+        }
+        else
+        {
+            AppendNil(out);
+        }
+        return;
+    }
+
+    bool left = (ToUpper(args[0]) == "LPOP");
+    std::size_t n = std::min<std::size_t>(count, value->list.size());
+    if (hasCount)
+    {
+        AppendArray(out, n);
+    }
+    for (std::size_t i = 0; i < n; i++)
+    {
+        AppendBulk(out, left ? value->list.front() : value->list.back());
+        left ? value->list.pop_front() : value->list.pop_back();
+    }
+    RemoveIfEmpty(conn, args[1], *value);
+}
+
+void MiniRedisMockServer::CmdLLen(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_LIST, out);
+    if (out.empty())
+    {
+        AppendInt(out, value ? value->list.size() : 0);
+    }
+}
+
+void MiniRedisMockServer::CmdLRange(Connection& conn, const Args& args, std::string& out)
+{
+    long long start = 0;
+    long long stop = 0;
+    if (!ParseInt(args[2], start) || !ParseInt(args[3], stop))
+    {
+        AppendError(out, notInteger);
+        return;
+    }
+
+    Value* value = FindTyped(conn, args[1], TYPE_LIST, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    long long size = value ? value->list.size() : 0;
+    start = (start < 0) ? std::max(0LL, size + start) : start;
+    stop = (stop < 0) ? size + stop : std::min(stop, size - 1);
+    if (start > stop)
+    {
+        AppendArray(out, 0);
+        return;
+    }
+
+    AppendArray(out, stop - start + 1);
+    for (long long i = start; i <= stop; i++)
+    {
+        AppendBulk(out, value->list[i]);
+    }
+}
+
+void MiniRedisMockServer::CmdSAdd(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindOrCreate(conn, args[1], TYPE_SET, out);
+    if (!value)
+    {
+        return;
+    }
+
+    long long added = 0;
+    for (std::size_t i = 2; i < args.size(); i++)
+    {
+        added += value->set.insert(args[i]).second ? 1 : 0;
+    }
+    AppendInt(out, added);
+}
+
+void MiniRedisMockServer::CmdSRem(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_SET, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    long long count = 0;
+    if (value)
+    {
+        for (std::size_t i = 2; i < args.size(); i++)
+        {
+            count += value->set.erase(args[i]);
+        }
+        RemoveIfEmpty(conn, args[1], *value);
+    }
+    AppendInt(out, count);
+}
+
+void MiniRedisMockServer::CmdSMembers(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_SET, out);
+    if (!out.empty())
+    {
+        return;
+    }
+
+    AppendArray(out, value ? value->set.size() : 0);
+    if (value)
+    {
+        for (auto& x : value->set)
+        {
+            AppendBulk(out, x);
+        }
+    }
+}
+
+void MiniRedisMockServer::CmdSIsMember(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_SET, out);
+    if (out.empty())
+    {
+        AppendInt(out, (value && value->set.count(args[2])) ? 1 : 0);
+    }
+}
+
+void MiniRedisMockServer::CmdSCard(Connection& conn, const Args& args, std::string& out)
+{
+    Value* value = FindTyped(conn, args[1], TYPE_SET, out);
+    if (out.empty())
+    {
+        AppendInt(out, value ? value->set.size() : 0);
+    }
+}
+
+void MiniRedisMockServer::CmdSubscribe(Connection& conn, const Args& args, std::string& out)
+{
+    for (std::size_t i = 1; i < args.size(); i++)
+    {
+        conn.channels.insert(args[i]);
+        AppendArray(out, 3);
+        AppendBulk(out, "subscribe");
+        AppendBulk(out, args[i]);
+        AppendInt(out, conn.channels.size());
+    }
+}
+
+void MiniRedisMockServer::CmdUnsubscribe(Connection& conn, const Args& args, std::string& out)
+{
+    std::vector<std::string> channels(args.begin() + 1, args.end());
+    if (channels.empty())
+    {
+        channels.assign(conn.channels.begin(), conn.channels.end());
+    }
+    if (channels.empty())
+    {
+        AppendArray(out, 3);
+        AppendBulk(out, "unsubscribe");
+        AppendNil(out);
+        AppendInt(out, 0);
+        return;
+    }
+
+    for (auto& channel : channels)
+    {
+        conn.channels.erase(channel);
+        AppendArray(out, 3);
+        AppendBulk(out, "unsubscribe");
+        AppendBulk(out, channel);
+        AppendInt(out, conn.channels.size());
+    }
+}
+
+void MiniRedisMockServer::CmdPublish(Connection&, const Args& args, std::string& out)
+{
+    std::string message;
+    AppendArray(message, 3);
+    AppendBulk(message, "message");
+    AppendBulk(message, args[1]);
+    AppendBulk(message, args[2]);
+
+    // Messages are not delayed by latency, only ordered after pending replies
+    int64_t now = NowUs();
+    long long receivers = 0;
+    for (auto& x : connections)
+    {
+        Connection& sub = *x.second;
+        if (!sub.hung && sub.channels.count(args[1]))
+        {
+            AddReply(sub, now, std::string(message));
+            receivers++;
+        }
+    }
+    AppendInt(out, receivers);
+}
+
+void MiniRedisMockServer::CmdBlob(Connection&, const Args& args, std::string& out)
+{
+    long long size = 0;
+    if (!ParseInt(args[1], size) || (size < 0) || (size > maxBulkBytes))
+    {
+        AppendError(out, notInteger);
+        return;
+    }
+    AppendBulk(out, std::string(size, 'x'));
+}
@@ -0,0 +1,261 @@
+// In-process RESP server for tests and benchmarks, Linux only
+// Serves an in-memory subset of Redis on 127.0.0.1 from one epoll thread:
+//   connection  PING ECHO AUTH SELECT CLIENT QUIT
+//   keys        DEL EXISTS TYPE KEYS DBSIZE FLUSHDB FLUSHALL EXPIRE PEXPIRE TTL PTTL
+//   strings     GET SET (EX PX NX XX) MGET MSET INCR INCRBY DECR DECRBY APPEND STRLEN
+//   hashes      HSET HGET HMGET HGETALL HDEL HLEN HEXISTS HINCRBY
+//   lists       LPUSH RPUSH LPOP RPOP LLEN LRANGE
+//   sets        SADD SREM SMEMBERS SISMEMBER SCARD
+//   pub/sub     SUBSCRIBE UNSUBSCRIBE PUBLISH
+//   MOCK.BLOB <bytes>, a bulk string of the size, for huge replies
+// RESP2 only, HELLO is rejected as by Redis 5. Keys expire lazily, when accessed.
+//
+// Faults, changeable at any time from any thread:
+//   latency     replies of a command are held for the time, in order per connection
+//   bandwidth   bytes per second written to each connection
+//   fragments   replies are written in pieces of the size, with an optional pause between,
+//               so that the client sees partial reads
+//   faults      the next N matching commands close or reset the connection, truncate
+//               the reply, hang, or fail with an error
+//   DisconnectAll() closes every client connection, to test reconnection
+//
+
+#ifndef MiniRedisMockServer_INCLUDED
+#define MiniRedisMockServer_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+
+enum MiniRedisMockFault
+{
+    MOCK_FAULT_NONE,
+    // Close the connection instead of replying
+    MOCK_FAULT_CLOSE,
+    // Same as close, with RST instead of FIN
+    MOCK_FAULT_RESET,
+    // Send the first half of the reply, then close
+    MOCK_FAULT_TRUNCATE,
+    // Never reply, and ignore the later commands of the connection
+    MOCK_FAULT_HANG,
+    // Reply -ERR instead of executing the command
+    MOCK_FAULT_ERROR
+};
+
+struct MiniRedisMockStats
+{
+    uint64_t connections;
+    uint64_t commands;
+    uint64_t faults;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+};
+
+class MiniRedisMockServer
+{
+public:
+    MiniRedisMockServer();
+    ~MiniRedisMockServer();
+
+    MiniRedisMockServer(const MiniRedisMockServer&) = delete;
+    MiniRedisMockServer& operator=(const MiniRedisMockServer&) = delete;
+
+    // Listen on 127.0.0.1, 0 picks a free port
+    bool Start(uint16_t port = 0);
+    void Stop();
+    uint16_t GetPort() const;
+
+    // Command name in any case, "*" for all commands without own setting
+    void SetLatencyMs(const std::string& command, uint32_t ms);
+    // 0 means unlimited
+    void SetBandwidth(uint64_t bytesPerSec);
+    // Write at most bytes per write(), 0 disables fragmenting
+    void SetFragment(uint32_t bytes, uint32_t pauseMs = 0);
+    // Apply the fault to the next count matching commands of any connection, 0 injects nothing
+    void InjectFault(const std::string& command, MiniRedisMockFault fault, uint32_t count = 1);
+    // Remove latency, bandwidth, fragment and fault settings
+    void ClearFaults();
+    // Close all client connections, served by the loop thread
+    void DisconnectAll();
+    // Remove all keys of all databases
+    void FlushAll();
+
+    std::size_t GetConnectionCount() const;
+    MiniRedisMockStats GetStats() const;
+
+private:
+    enum ValueType
+    {
+        TYPE_STRING,
+        TYPE_HASH,
+        TYPE_LIST,
+        TYPE_SET
+    };
+
+    struct Value
+    {
+        ValueType type = TYPE_STRING;
+        std::string str;
+        std::unordered_map<std::string, std::string> hash;
+        std::deque<std::string> list;
+        std::unordered_set<std::string> set;
+        // Unix time in ms, 0 for no expiry
+        int64_t expireAt = 0;
+    };
+
+    using Database = std::unordered_map<std::string, Value>;
+
+    // Reply waiting for its latency
+    struct PendingReply
+    {
+        int64_t readyAt;
+        std::string data;
+        // Close after it is written, with RST if reset
+        bool close;
+        bool reset;
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        std::string input;
+        std::deque<PendingReply> pending;
+        // Being written
+        std::string output;
+        std::size_t written = 0;
+        bool closeAfterWrite = false;
+        bool resetAfterWrite = false;
+        // Fragment pause, or bandwidth wait
+        int64_t nextWriteAt = 0;
+        bool wantWrite = false;
+        // Later commands are ignored, after a fault
+        bool hung = false;
+        std::size_t db = 0;
+        std::string name;
+        std::unordered_set<std::string> channels;
+    };
+
+    struct FaultRule
+    {
+        std::string command;
+        MiniRedisMockFault fault;
+        uint32_t count;
+    };
+
+    using Args = std::vector<std::string>;
+    using Handler = void (MiniRedisMockServer::*)(Connection&, const Args&, std::string&);
+
+    void ThreadRoutine();
+    void Accept();
+    // Read and execute commands, false if the connection should be closed
+    bool OnReadable(Connection& conn);
+    // Parse complete commands from input, false if protocol error
+    bool ParseCommands(Connection& conn, std::vector<Args>& commands);
+    void Execute(Connection& conn, const Args& args);
+    // Write due replies within bandwidth and fragment limits, false if the connection should be closed
+    bool Flush(Connection& conn, int64_t now);
+    void SetWantWrite(Connection& conn, bool want);
+    // Queue reply after the earlier ones, and not before readyAt
+    void AddReply(Connection& conn, int64_t readyAt, std::string&& data, bool close = false, bool reset = false);
+    void Close(int fd, bool reset);
+    // Earliest time in us any connection has something to write, or -1
+    int64_t NextWakeup() const;
+
+    // Settings of the command, under configMutex
+    uint32_t GetLatencyMs(const std::string& command) const;
+    MiniRedisMockFault TakeFault(const std::string& command);
+
+    // Live value of key, nullptr if missing or expired
+    Value* Find(Connection& conn, const std::string& key);
+    // Live value of the type, nullptr if missing, or with WRONGTYPE error appended to out
+    Value* FindTyped(Connection& conn, const std::string& key, ValueType type, std::string& out);
+    // Same as FindTyped(), and create an empty one if missing
+    Value* FindOrCreate(Connection& conn, const std::string& key, ValueType type, std::string& out);
+    // Empty collections are removed, as Redis does
+    void RemoveIfEmpty(Connection& conn, const std::string& key, const Value& value);
+    // Field of hash, nullptr if missing
+    static const std::string* FindField(const Value& value, const std::string& field);
+
+    void CmdPing(Connection& conn, const Args& args, std::string& out);
+    void CmdEcho(Connection& conn, const Args& args, std::string& out);
+    void CmdOk(Connection& conn, const Args& args, std::string& out);
+    void CmdHello(Connection& conn, const Args& args, std::string& out);
+    void CmdSelect(Connection& conn, const Args& args, std::string& out);
+    void CmdClient(Connection& conn, const Args& args, std::string& out);
+    void CmdDel(Connection& conn, const Args& args, std::string& out);
+    void CmdExists(Connection& conn, const Args& args, std::string& out);
+    void CmdType(Connection& conn, const Args& args, std::string& out);
+    void CmdKeys(Connection& conn, const Args& args, std::string& out);
+    void CmdDbSize(Connection& conn, const Args& args, std::string& out);
+    void CmdFlushDb(Connection& conn, const Args& args, std::string& out);
+    void CmdFlushAll(Connection& conn, const Args& args, std::string& out);
+    void CmdExpire(Connection& conn, const Args& args, std::string& out);
+    void CmdTtl(Connection& conn, const Args& args, std::string& out);
+    void CmdGet(Connection& conn, const Args& args, std::string& out);
+    void CmdSet(Connection& conn, const Args& args, std::string& out);
+    void CmdMGet(Connection& conn, const Args& args, std::string& out);
+    void CmdMSet(Connection& conn, const Args& args, std::string& out);
+    void CmdIncrBy(Connection& conn, const Args& args, std::string& out);
+    void CmdAppend(Connection& conn, const Args& args, std::string& out);
+    void CmdStrLen(Connection& conn, const Args& args, std::string& out);
+    void CmdHSet(Connection& conn, const Args& args, std::string& out);
+    void CmdHGet(Connection& conn, const Args& args, std::string& out);
+    void CmdHMGet(Connection& conn, const Args& args, std::string& out);
+    void CmdHGetAll(Connection& conn, const Args& args, std::string& out);
+    void CmdHDel(Connection& conn, const Args& args, std::string& out);
+    void CmdHLen(Connection& conn, const Args& args, std::string& out);
+    void CmdHExists(Connection& conn, const Args& args, std::string& out);
+    void CmdHIncrBy(Connection& conn, const Args& args, std::string& out);
+    void CmdPush(Connection& conn, const Args& args, std::string& out);
+    void CmdPop(Connection& conn, const Args& args, std::string& out);
+    void CmdLLen(Connection& conn, const Args& args, std::string& out);
+    void CmdLRange(Connection& conn, const Args& args, std::string& out);
+    void CmdSAdd(Connection& conn, const Args& args, std::string& out);
+    void CmdSRem(Connection& conn, const Args& args, std::string& out);
+    void CmdSMembers(Connection& conn, const Args& args, std::string& out);
+    void CmdSIsMember(Connection& conn, const Args& args, std::string& out);
+    void CmdSCard(Connection& conn, const Args& args, std::string& out);
+    void CmdSubscribe(Connection& conn, const Args& args, std::string& out);
+    void CmdUnsubscribe(Connection& conn, const Args& args, std::string& out);
+    void CmdPublish(Connection& conn, const Args& args, std::string& out);
+    void CmdBlob(Connection& conn, const Args& args, std::string& out);
+
+private:
+    int listenFd;
+    int epollFd;
+    // Wakes up the loop for Stop() and DisconnectAll()
+    int wakeFd;
+    uint16_t port;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<bool> disconnectAll;
+
+    // Owned by the loop thread
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::vector<Database> databases;
+    std::unordered_map<std::string, std::pair<Handler, int>> handlers;
+    // FlushAll() from other threads, served by the loop
+    std::atomic<bool> flushAll;
+
+    mutable std::mutex configMutex;
+    std::unordered_map<std::string, uint32_t> latencyMs;
+    uint64_t bandwidth;
+    uint32_t fragmentBytes;
+    uint32_t fragmentPauseMs;
+    std::vector<FaultRule> faults;
+
+    std::atomic<std::size_t> connectionCount;
+    std::atomic<uint64_t> connectionsAccepted;
+    std::atomic<uint64_t> commands;
+    std::atomic<uint64_t> faultsInjected;
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+};
+
+#endif // MiniRedisMockServer_INCLUDED
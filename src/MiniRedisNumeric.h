@@ -0,0 +1,234 @@
+// Numeric encoding and decoding for MiniRedisClient
+// Numbers are encoded by std::to_chars into stack buffer,
+// and decoded by std::from_chars directly from the reply,
+// so that no temporary std::string is allocated.
+//
+// Supported types: integers, floating points, and MiniRedisFixed
+// std::from_chars of floating point requires gcc 11 or later
+//
+
+#ifndef MiniRedisNumeric_INCLUDED
+#define MiniRedisNumeric_INCLUDED
+
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <system_error>
+
+// Fixed-point value with Decimals digits after the point
+// Stored as integer scaled by 10^Decimals, e.g. MiniRedisFixed<2> of "12.34" has raw 1234
+template <int Decimals>
+struct MiniRedisFixed
+{
+    static_assert((Decimals >= 0) && (Decimals <= 18), "Decimals should be within [0, 18]");
+
+    static constexpr long long GetScale()
+    {
+        long long scale = 1;
+        for (int i = 0; i < Decimals; i++)
+        {
+            scale *= 10;
+        }
+        return scale;
+    }
+
+    static constexpr long long Scale = GetScale();
+    static constexpr int DecimalDigits = Decimals;
+
+    long long raw = 0;
+
+    MiniRedisFixed() = default;
+    explicit MiniRedisFixed(long long raw) : raw(raw) {}
+
+    double ToDouble() const
+    {
+        return (double)raw / (double)Scale;
+    }
+};
+
+namespace MiniRedisNumeric
+{
+    // Enough for any integer, shortest double, and fixed-point
+    const std::size_t MaxChars = 32;
+
+    template <typename T>
+    struct IsFixed : std::false_type {};
+    template <int Decimals>
+    struct IsFixed<MiniRedisFixed<Decimals>> : std::true_type {};
+
+    // bool and char are excluded, since they are more likely to be text than number
+    template <typename T>
+    struct IsNumber : std::integral_constant<bool,
+        (std::is_arithmetic<T>::value && !std::is_same<T, bool>::value &&
+            !std::is_same<T, char>::value) || IsFixed<T>::value> {};
+
+    template <typename T>
+    using EnableIfNumber = typename std::enable_if<IsNumber<T>::value, int>::type;
+
+    // Encode value into buf, and return the length
+    // Return 0 if buf is too small
+    template <typename T>
+    std::size_t ToChars(char* buf, std::size_t size, T value)
+    {
+        char* last = buf + size;
+        if constexpr (IsFixed<T>::value)
+        {
+            // Integer part, then the fraction padded with leading zeros
+            long long intPart = value.raw / T::Scale;
+            long long frac = value.raw % T::Scale;
+            char* pos = buf;
+            if ((value.raw < 0) && (intPart == 0))
+            {
+                if (pos == last)
+                {
+                    return 0;
+                }
+                *pos++ = '-';
+            }
+            auto res = std::to_chars(pos, last, intPart);
+            if (res.ec != std::errc())
+            {
+                return 0;
+            }
+            pos = res.ptr;
+            if (T::Scale == 1)
+            {
+                return pos - buf;
+            }
+
+            unsigned long long fracAbs = (frac < 0) ?
+                (unsigned long long)(-(frac + 1)) + 1 : (unsigned long long)frac;
+            if (last - pos < 1 + T::DecimalDigits)
+            {
+                return 0;
+            }
+            *pos++ = '.';
+            for (long long div = T::Scale / 10; div > 0; div /= 10)
+            {
+                *pos++ = (char)('0' + (fracAbs / div) % 10);
+            }
+            return pos - buf;
+        }
+        else
+        {
+            auto res = std::to_chars(buf, last, value);
+            if (res.ec != std::errc())
+            {
+                return 0;
+            }
+            return res.ptr - buf;
+        }
+    }
+
+    // Decode value from str, the whole str should be consumed
+    template <typename T>
+    bool FromChars(const char* str, std::size_t len, T& value)
+    {
+        if (!str || !len)
+        {
+            return false;
+        }
+
+        const char* last = str + len;
+        if constexpr (IsFixed<T>::value)
+        {
+            const char* pos = str;
+            bool negative = (*pos == '-');
+            if (negative)
+            {
+                pos++;
+            }
+
+            // Integer part
+            unsigned long long intPart = 0;
+            auto res = std::from_chars(pos, last, intPart);
+            if ((res.ec != std::errc()) || (res.ptr == pos))
+            {
+                return false;
+            }
+            pos = res.ptr;
+
+            // Fraction part, digits beyond Decimals are truncated
+            unsigned long long frac = 0;
+            long long div = T::Scale;
+            if ((pos != last) && (*pos == '.'))
+            {
+                pos++;
+                for (; pos != last; pos++)
+                {
+                    if ((*pos < '0') || (*pos > '9'))
+                    {
+                        return false;
+                    }
+                    if (div > 1)
+                    {
+                        div /= 10;
+                        frac += (*pos - '0') * div;
+                    }
+                }
+            }
+            if (pos != last)
+            {
+                return false;
+            }
+
+            const unsigned long long maxRaw = std::numeric_limits<long long>::max();
+            if (intPart > (maxRaw - frac) / T::Scale)
+            {
+                return false;
+            }
+            long long raw = (long long)(intPart * T::Scale + frac);
+            value.raw = negative ? -raw : raw;
+            return true;
+        }
+        else
+        {
+            auto res = std::from_chars(str, last, value);
+            return (res.ec == std::errc()) && (res.ptr == last);
+        }
+    }
+
+    // Convert the integer reply to value
+    template <typename T>
+    bool FromInteger(long long integer, T& value)
+    {
+        if constexpr (IsFixed<T>::value)
+        {
+            if ((integer > std::numeric_limits<long long>::max() / T::Scale) ||
+                (integer < std::numeric_limits<long long>::min() / T::Scale))
+            {
+                return false;
+            }
+            value.raw = integer * T::Scale;
+            return true;
+        }
+        else if constexpr (std::is_floating_point<T>::value)
+        {
+            value = (T)integer;
+            return true;
+        }
+        else if constexpr (std::is_signed<T>::value)
+        {
+            if ((integer < (long long)std::numeric_limits<T>::min()) ||
+                (integer > (long long)std::numeric_limits<T>::max()))
+            {
+                return false;
+            }
+            value = (T)integer;
+            return true;
+        }
+        else
+        {
+            if ((integer < 0) ||
+                ((unsigned long long)integer > (unsigned long long)std::numeric_limits<T>::max()))
+            {
+                return false;
+            }
+            value = (T)integer;
+            return true;
+        }
+    }
+}
+
+#endif // MiniRedisNumeric_INCLUDED
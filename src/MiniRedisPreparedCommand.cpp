@@ -0,0 +1,142 @@
+// Prepared command for MiniRedisClient
+
+#include <charconv>
+#include "MiniRedisPreparedCommand.h"
+
+namespace
+{
+    // Append the RESP bulk string header: $len\r\n
+    void AppendBulkHeader(std::string& buf, std::size_t len)
+    {
+        char digits[24];
+        auto res = std::to_chars(digits, digits + sizeof(digits), len);
+        buf.push_back('$');
+        buf.append(digits, res.ptr - digits);
+        buf.append("\r\n", 2);
+    }
+
+    void AppendBulk(std::string& buf, std::string_view arg)
+    {
+        AppendBulkHeader(buf, arg.size());
+        buf.append(arg.data(), arg.size());
+        buf.append("\r\n", 2);
+    }
+}
+
+MiniRedisPreparedCommand::MiniRedisPreparedCommand(const std::string& format)
+    : format(format)
+{
+    argCount = 0;
+    tokenCount = 0;
+    constSize = 0;
+    valid = true;
+
+    // Split the format into tokens
+    std::vector<std::string_view> tokens;
+    std::string_view fmt(format);
+    std::size_t pos = 0;
+    while (pos < fmt.size())
+    {
+        if (fmt[pos] == ' ')
+        {
+            pos++;
+            continue;
+        }
+
+        std::size_t end = fmt.find(' ', pos);
+        if (end == std::string_view::npos)
+        {
+            end = fmt.size();
+        }
+        tokens.push_back(fmt.substr(pos, end - pos));
+        pos = end;
+    }
+
+    if (tokens.empty())
+    {
+        valid = false;
+        return;
+    }
+
+    // The header is constant, since the number of tokens is fixed
+    tokenCount = tokens.size();
+    std::string current = "*" + std::to_string(tokenCount) + "\r\n";
+    for (auto& token : tokens)
+    {
+        if (token == "%b")
+        {
+            segments.push_back(current);
+            current.clear();
+            argCount++;
+        }
+        else if (token.find('%') != std::string_view::npos)
+        {
+            valid = false;
+            segments.clear();
+            return;
+        }
+        else
+        {
+            AppendBulk(current, token);
+        }
+    }
+    segments.push_back(current);
+
+    for (auto& seg : segments)
+    {
+        constSize += seg.size();
+    }
+}
+
+bool MiniRedisPreparedCommand::IsValid() const
+{
+    return valid;
+}
+
+std::size_t MiniRedisPreparedCommand::GetArgCount() const
+{
+    return argCount;
+}
+
+std::size_t MiniRedisPreparedCommand::GetTokenCount() const
+{
+    return tokenCount;
+}
+
+const std::string& MiniRedisPreparedCommand::GetFormat() const
+{
+    return format;
+}
+
+bool MiniRedisPreparedCommand::Format(std::string& buf,
+    const std::string_view* args, std::size_t count) const
+{
+    buf.clear();
+    if (!valid || count != argCount)
+    {
+        return false;
+    }
+
+    // Reserve once: constant parts, arguments, and up to 24 bytes of header per argument
+    std::size_t total = constSize;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        total += args[i].size() + 24;
+    }
+    buf.reserve(total);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        buf.append(segments[i]);
+        AppendBulk(buf, args[i]);
+    }
+    buf.append(segments[count]);
+
+    return true;
+}
+
+bool MiniRedisPreparedCommand::Format(std::string& buf,
+    std::initializer_list<std::string_view> args) const
+{
+    return Format(buf, args.begin(), args.size());
+}
@@ -0,0 +1,52 @@
+// Prepared command for MiniRedisClient
+// The RESP frame of a command with fixed shape is pre-encoded once:
+// the *N header, the command name and the fixed arguments.
+// Only the variable arguments are spliced in on each call.
+//
+// The format uses the same %b placeholder as MiniRedisClient::execute():
+//   MiniRedisPreparedCommand hincrby("HINCRBY %b %b 1");
+//   MiniRedisPreparedCommand setex("SETEX %b 3600 %b");
+//
+
+#ifndef MiniRedisPreparedCommand_INCLUDED
+#define MiniRedisPreparedCommand_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <initializer_list>
+
+class MiniRedisPreparedCommand
+{
+public:
+    // Tokens are separated by blank spaces, %b marks one variable argument
+    // Any other % conversion is not supported, and makes the command invalid
+    explicit MiniRedisPreparedCommand(const std::string& format);
+
+    // Whether the format was parsed successfully
+    bool IsValid() const;
+    // Number of variable arguments, which should be provided on each call
+    std::size_t GetArgCount() const;
+    // Number of all arguments, including command name
+    std::size_t GetTokenCount() const;
+    const std::string& GetFormat() const;
+
+    // Encode the whole RESP frame into buf, the previous content of buf is discarded
+    // The capacity of buf is kept, so that the same buf can be reused by the caller
+    // Return false if the number of args doesn't match the placeholders
+    bool Format(std::string& buf, const std::string_view* args, std::size_t count) const;
+    bool Format(std::string& buf, std::initializer_list<std::string_view> args) const;
+
+private:
+    std::string format;
+    // Pre-encoded constant parts between the variable arguments
+    // segments.size() == argCount + 1 when valid
+    std::vector<std::string> segments;
+    std::size_t argCount;
+    std::size_t tokenCount;
+    // Total size of all segments
+    std::size_t constSize;
+    bool valid;
+};
+
+#endif // MiniRedisPreparedCommand_INCLUDED
@@ -3,11 +3,12 @@
 #include <iostream>
 #include <sstream>
 #include <string.h>
-#include <thread>
 #include <hiredis/hiredis.h>
 #include <hiredis/async.h>
 #include <hiredis/adapters/libevent.h>
 #include "MiniRedisPubSub.h"
+#include "MiniRedisEventLoopGroup.h"
+#include "MiniRedisLogger.h"
 
 MiniRedisPubSub::MiniRedisPubSub()
 {
@@ -17,15 +18,24 @@ MiniRedisPubSub::MiniRedisPubSub()
 MiniRedisPubSub::~MiniRedisPubSub()
 {
     Disconnect();
+    // A connection still closing gracefully is dropped with its loop
+    ownLoop.reset();
 }
 
 void MiniRedisPubSub::Init()
 {
     host = "127.0.0.1";
     port = 6379;
+    commandTimeoutMs = 0;
     asyncContext = nullptr;
     evt = nullptr;
+    loopGroup = nullptr;
+    loopIndex = 0;
+    holdingLoop = false;
     subCb = nullptr; 
+    subViewCb = nullptr; 
+    subBatchCb = nullptr; 
+    batchEvent = nullptr;
 }
 
 void MiniRedisPubSub::SetHost(const std::string& host)
@@ -48,13 +58,83 @@ uint16_t MiniRedisPubSub::GetPort() const
     return port;
 }
 
+void MiniRedisPubSub::SetCommandTimeoutMs(uint32_t ms)
+{
+    commandTimeoutMs = ms;
+}
+
 // Will be called when data is received from subscribed channels
 void MiniRedisPubSub::SetSubscribeCb(SubscribeCbFunc cb)
 {
     subCb = cb; 
 }
 
+void MiniRedisPubSub::SetSubscribeViewCb(SubscribeViewCbFunc cb)
+{
+    subViewCb = cb; 
+}
+
+void MiniRedisPubSub::SetSubscribeBatchCb(SubscribeBatchCbFunc cb)
+{
+    subBatchCb = cb; 
+}
+
+void MiniRedisPubSub::SetSubscribeAckCb(SubscribeAckCbFunc cb)
+{
+    subAckCb = cb;
+}
+
+void MiniRedisPubSub::SetConnectionCb(ConnectionCbFunc cb)
+{
+    connCb = cb;
+}
+
+void MiniRedisPubSub::SetEventLoopGroup(MiniRedisEventLoopGroup* group)
+{
+    loopGroup = group;
+}
+
+MiniRedisEventLoopGroup* MiniRedisPubSub::GetLoop() const
+{
+    return loopGroup ? loopGroup : ownLoop.get();
+}
+
 bool MiniRedisPubSub::Connect()
+{
+    // Clean up the previous connection, closed or dropped
+    Disconnect();
+
+    if (!loopGroup && !ownLoop)
+    {
+        // Own loop thread, which lives until destruction, so that reconnecting
+        // always runs on it instead of racing with an old dispatch
+        ownLoop = std::make_unique<MiniRedisEventLoopGroup>(1);
+        if (!ownLoop->Start())
+        {
+            ownLoop.reset();
+            return false;
+        }
+    }
+
+    // Stay on the chosen loop, so that callbacks are in order
+    MiniRedisEventLoopGroup* group = GetLoop();
+    loopIndex = group->Acquire();
+    holdingLoop = true;
+    evt = group->GetBase(loopIndex);
+    bool ret = false;
+    if (!evt || !group->RunInLoopSync(loopIndex, [this, &ret]() { ret = ConnectInLoop(); }))
+    {
+        MINIREDIS_LOG_ERROR("Event loop group is not started");
+    }
+    if (!ret)
+    {
+        ReleaseLoop();
+        evt = nullptr;
+    }
+    return ret;
+}
+
+bool MiniRedisPubSub::ConnectInLoop()
 {
     // Async Connect will return at once, need to check result at OnConnect callback
     asyncContext = redisAsyncConnect(host.c_str(), port); 
@@ -62,34 +142,36 @@ bool MiniRedisPubSub::Connect()
     {
         if (asyncContext)
         {
-            std::cerr << "Failed to connect to Redis server: " << asyncContext->errstr << std::endl;
+            MINIREDIS_LOG_ERROR("Failed to connect to Redis server: %s", asyncContext->errstr);
+            redisAsyncFree(asyncContext);
+            asyncContext = nullptr;
         }
         else
         {
-            std::cerr << "Can't allocate redis context" << std::endl;
+            MINIREDIS_LOG_ERROR("Can't allocate redis context");
         }
 
         return false;
     }
 
-    // Attach libevent to context
-    if (!evt)
+    redisLibeventAttach(asyncContext, evt);
+    if (commandTimeoutMs)
     {
-        evt = event_base_new(); 
+        // Timer of libevent, armed while replies are pending
+        timeval tv = {(time_t)(commandTimeoutMs / 1000), (suseconds_t)((commandTimeoutMs % 1000) * 1000)};
+        redisAsyncSetTimeout(asyncContext, tv);
     }
-    redisLibeventAttach(asyncContext, evt);
 
+    // Activated by the first message of a batch, 
+    // and run by libevent after the read callback returns
+    // Bound to the loop of this connection, which may differ from the previous one
+    batchEvent = event_new(evt, -1, 0, OnBatchFlush, this);
+
+    // All callbacks find this instance by data, which is cleared on deliberate teardown
+    asyncContext->data = this;
     redisAsyncSetConnectCallback(asyncContext, OnConnect);  
     redisAsyncSetDisconnectCallback(asyncContext, OnDisconnect); 
 
-    // Create event loop thread
-    std::thread t(ThreadRoutine, this);
-    if (t.joinable())
-    {
-        // Let libevent to handle it
-        t.detach();
-    } 
-
     return true;
 }
 
@@ -103,21 +185,63 @@ bool MiniRedisPubSub::Connect(const std::string& host, uint16_t port)
 
 bool MiniRedisPubSub::Disconnect()
 {
-    if (!asyncContext)
+    // Connection may have dropped already, the loop still needs to be cleaned up
+    if (!evt)
     {
         return false;
     }
 
-    // This function will free context
-    redisAsyncDisconnect(asyncContext);
+    MiniRedisEventLoopGroup* group = GetLoop();
+    if (!group->RunInLoopSync(loopIndex, [this]() { DisconnectInLoop(); }))
+    {
+        MINIREDIS_LOG_ERROR("Event loop group is stopped before disconnecting");
+    }
+    ReleaseLoop();
+    evt = nullptr;
+    return true;
+}
+
+void MiniRedisPubSub::DisconnectInLoop()
+{
+    if (asyncContext)
+    {
+        // Replies still pending are waited for before closing, 
+        // and their callbacks must not reach this instance, which may be destroyed by then
+        asyncContext->data = nullptr;
+        redisAsyncDisconnect(asyncContext);
+        asyncContext = nullptr;
+    }
+
+    FreeBatchEvent();
+}
+
+void MiniRedisPubSub::OnClosed()
+{
+    // Called on the loop thread, context is freed by hiredis after the callback
     asyncContext = nullptr;
+    FreeBatchEvent();
+    ReleaseLoop();
+}
 
-    // Break event thread loop
-    event_base_loopbreak(evt);
-    event_base_free(evt);
-    evt = nullptr; 
+void MiniRedisPubSub::FreeBatchEvent()
+{
+    if (batchEvent)
+    {
+        event_free(batchEvent);
+        batchEvent = nullptr;
+    }
+    batchArena.clear();
+    batchOffsets.clear();
+    batchMsgs.clear();
+}
 
-    return true; 
+void MiniRedisPubSub::ReleaseLoop()
+{
+    // Either the drop on the loop thread or Disconnect() releases it, once
+    if (holdingLoop.exchange(false))
+    {
+        GetLoop()->Release(loopIndex);
+    }
 }
 
 bool MiniRedisPubSub::Publish(const std::string& channel, const std::string& content)
@@ -127,17 +251,7 @@ bool MiniRedisPubSub::Publish(const std::string& channel, const std::string& con
         return false;
     }
 
-    int ret = redisAsyncCommand(asyncContext, OnPublishMsg, this, 
-        "PUBLISH %b %b", 
-        channel.c_str(), channel.size(), 
-        content.c_str(), content.size());
-    if (ret == REDIS_ERR)
-    {
-        std::cerr << "Failed to publish to " << channel << std::endl; 
-        return false; 
-    }
-
-    return true; 
+    return AsyncCommand(OnPublishMsg, "PUBLISH", channel, content); 
 }
 
 bool MiniRedisPubSub::Subscribe(const std::string& channel)
@@ -147,16 +261,7 @@ bool MiniRedisPubSub::Subscribe(const std::string& channel)
         return false;
     }
 
-    int ret = redisAsyncCommand(asyncContext, OnSubscribeMsg, this, 
-        "SUBSCRIBE %b", 
-        channel.c_str(), channel.size());
-    if (ret == REDIS_ERR)
-    {
-        std::cerr << "Failed to subscribe from " << channel << std::endl; 
-        return false; 
-    }
-
-    return true; 
+    return AsyncCommand(OnSubscribeMsg, "SUBSCRIBE", channel); 
 }
 
 bool MiniRedisPubSub::Unsubscribe(const std::string& channel)
@@ -167,67 +272,103 @@ bool MiniRedisPubSub::Unsubscribe(const std::string& channel)
     }
 
     // Use the same callback as subscribe
-    int ret = redisAsyncCommand(asyncContext, OnSubscribeMsg, this, 
-        "UNSUBSCRIBE %b", 
-        channel.c_str(), channel.size());
-    if (ret == REDIS_ERR)
+    return AsyncCommand(OnSubscribeMsg, "UNSUBSCRIBE", channel); 
+}
+
+bool MiniRedisPubSub::AsyncCommand(CallbackFunc fn, const char* name, 
+    const std::string& channel, const std::string& content)
+{
+    MiniRedisEventLoopGroup* group = GetLoop();
+    if (group && !group->IsInLoopThread(loopIndex))
     {
-        std::cerr << "Failed to unsubscribe from " << channel << std::endl; 
-        return false; 
+        // hiredis async context is not thread safe, send it on the loop thread
+        return group->RunInLoop(loopIndex, [this, fn, name, channel, content]() {
+            AsyncCommand(fn, name, channel, content);
+        });
     }
 
-    return true; 
-}
+    if (!asyncContext)
+    {
+        return false;
+    }
 
-void MiniRedisPubSub::ThreadRoutine(void* arg)
-{
-    MiniRedisPubSub* pThis = reinterpret_cast<MiniRedisPubSub*>(arg);
-    if (!pThis)
+    const char* argv[3] = {name, channel.c_str(), content.c_str()};
+    size_t argvlen[3] = {strlen(name), channel.size(), content.size()};
+    int argc = content.empty() ? 2 : 3;
+    int ret = redisAsyncCommandArgv(asyncContext, fn, nullptr, argc, argv, argvlen);
+    if (ret == REDIS_ERR)
     {
-        return; 
+        MINIREDIS_LOG_ERROR("Failed to send %s to %s", name, channel.c_str());
+        return false; 
     }
 
-    // Run the libevent loop inside thread
-    event_base_dispatch(pThis->evt); 
-    //std::cout << "libevent thread ends" << std::endl; 
+    return true; 
 }
 
 void MiniRedisPubSub::OnConnect(const redisAsyncContext* ac, int status) 
 { 
+    MiniRedisPubSub* pThis = reinterpret_cast<MiniRedisPubSub*>(ac->data);
     if (status != REDIS_OK) 
     { 
-        std::cerr << "Failed to connect to Redis. Error: " << status << ", description: " << ac->errstr << std::endl; 
+        MINIREDIS_LOG_ERROR("Failed to connect to Redis. Error: %d, description: %s", status, ac->errstr);
+        if (pThis)
+        {
+            pThis->OnClosed();
+        }
     }
     else
     {
-        std::cout << "Redis async connected" << std::endl; 
+        MINIREDIS_LOG_INFO("Redis async connected");
+    }
+
+    if (pThis && pThis->connCb)
+    {
+        pThis->connCb(status == REDIS_OK);
     }
 }
 
 void MiniRedisPubSub::OnDisconnect(const redisAsyncContext *ac, int status) 
 {
+    MiniRedisPubSub* pThis = reinterpret_cast<MiniRedisPubSub*>(ac->data);
     // Can reconnect here
     if (status != REDIS_OK) 
     {  
-        std::cerr << "Redis disconnected abnormally. Error: " << status << ", description: " << ac->errstr << std::endl; 
+        MINIREDIS_LOG_ERROR("Redis disconnected abnormally. Error: %d, description: %s", status, ac->errstr);
     }
     else
     {
-        std::cout << "Redis disconnected" << std::endl; 
+        MINIREDIS_LOG_INFO("Redis disconnected");
+    }
+
+    if (pThis)
+    {
+        // So that Connect() can be called again
+        pThis->OnClosed();
+        if (pThis->connCb)
+        {
+            pThis->connCb(false);
+        }
     }
 } 
 
 // Callback when the data is published
-void MiniRedisPubSub::OnPublishMsg(redisAsyncContext*, void*, void*)
+void MiniRedisPubSub::OnPublishMsg(redisAsyncContext* ac, void* replyData, void*)
 {
-    //std::cout << "Message published" << std::endl; 
+    if (!replyData && ac && (ac->err == REDIS_ERR_TIMEOUT))
+    {
+        MINIREDIS_LOG_WARN("Publish timed out");
+        return; 
+    }
+
+    MINIREDIS_LOG_TRACE("Message published");
     return; 
 }
 
 // Callback when: subscribe channel, unsubscribe channel, receive data from channel
-void MiniRedisPubSub::OnSubscribeMsg(redisAsyncContext*, void* replyData, void* privData)
+void MiniRedisPubSub::OnSubscribeMsg(redisAsyncContext* ac, void* replyData, void*)
 {
-    MiniRedisPubSub* pThis = reinterpret_cast<MiniRedisPubSub*>(privData);
+    // Not privdata, which can't be cleared when this instance goes away
+    MiniRedisPubSub* pThis = ac ? reinterpret_cast<MiniRedisPubSub*>(ac->data) : nullptr;
     redisReply* reply = reinterpret_cast<redisReply*>(replyData);
     if (!pThis || !reply) 
     {
@@ -240,39 +381,124 @@ void MiniRedisPubSub::OnSubscribeMsg(redisAsyncContext*, void* replyData, void*
     // element 2: the content published
     if (reply->type != REDIS_REPLY_ARRAY)
     {
-        std::cerr << "Expecting array while receiving " << reply->type << std::endl;
+        MINIREDIS_LOG_ERROR("Expecting array while receiving %d", reply->type);
         return;
     }
     if (reply->elements != 3)
     {
-        std::cerr << "Expecting 3 elements in array while receiving " << reply->elements << std::endl;
+        MINIREDIS_LOG_ERROR("Expecting 3 elements in array while receiving %zu", reply->elements);
         return;
     }
 
     // Get type of the reply: message, subscribe ACK, or unsubscribe ACK
     redisReply* elem = reply->element[0]; 
-    std::string replyType(elem->str, elem->len);
-    if (replyType == "subscribe")
+    ReplyKind kind = ClassifyReply(elem->str, elem->len);
+    if (kind == REPLY_SUBSCRIBE)
     {
-        std::cout << "Subscribe ACK" << std::endl;
+        MINIREDIS_LOG_DEBUG("Subscribe ACK");
+        if (pThis->subAckCb && reply->element[1]->str)
+        {
+            pThis->subAckCb(std::string_view(reply->element[1]->str, reply->element[1]->len));
+        }
     }
-    else if (replyType == "unsubscribe")
+    else if (kind == REPLY_UNSUBSCRIBE)
     {
-        std::cout << "Unsubscribe ACK" << std::endl;
+        MINIREDIS_LOG_DEBUG("Unsubscribe ACK");
     }
-    else
+    else if (kind == REPLY_MESSAGE)
     {
         redisReply* elemChannel = reply->element[1]; 
-        std::string channel(elemChannel->str, elemChannel->len);
         redisReply* elemContent = reply->element[2]; 
-        std::string content(elemContent->str, elemContent->len);
-        if (pThis->subCb)
+        std::string_view channel(elemChannel->str, elemChannel->len);
+        std::string_view content(elemContent->str, elemContent->len);
+        if (pThis->subBatchCb)
+        {
+            pThis->AddToBatch(channel, content);
+        }
+        else if (pThis->subViewCb)
         {
-            pThis->subCb(channel, content);
+            pThis->subViewCb(channel, content);
+        }
+        else if (pThis->subCb)
+        {
+            pThis->subCb(std::string(channel), std::string(content));
         }
         else
         {
-            std::cout << "Subscribe channel: " << channel << ", content: " << content << std::endl; 
+            MINIREDIS_LOG_DEBUG("Subscribe channel: %.*s, content: %.*s", (int)channel.size(), channel.data(), 
+                (int)content.size(), content.data());
         }
     }
 }
+
+MiniRedisPubSub::ReplyKind MiniRedisPubSub::ClassifyReply(const char* str, std::size_t len)
+{
+    if (!str || !len)
+    {
+        return REPLY_UNKNOWN;
+    }
+
+    // The lengths are unique except for "message" and "pmessage"
+    switch (len)
+    {
+    case 7:
+        return (str[0] == 'm') ? REPLY_MESSAGE : REPLY_UNKNOWN;
+    case 8:
+        return (str[0] == 'p') ? REPLY_PMESSAGE : REPLY_UNKNOWN;
+    case 9:
+        return (str[0] == 's') ? REPLY_SUBSCRIBE : REPLY_UNKNOWN;
+    case 10:
+        return (str[0] == 'p') ? REPLY_PSUBSCRIBE : REPLY_UNKNOWN;
+    case 11:
+        return (str[0] == 'u') ? REPLY_UNSUBSCRIBE : REPLY_UNKNOWN;
+    case 12:
+        return (str[0] == 'p') ? REPLY_PUNSUBSCRIBE : REPLY_UNKNOWN;
+    default:
+        return REPLY_UNKNOWN;
+    }
+}
+
+void MiniRedisPubSub::AddToBatch(std::string_view channel, std::string_view content)
+{
+    if (batchOffsets.empty() && batchEvent)
+    {
+        event_active(batchEvent, 0, 0);
+    }
+
+    batchOffsets.push_back(batchArena.size());
+    batchOffsets.push_back(channel.size());
+    batchArena.append(channel.data(), channel.size());
+    batchOffsets.push_back(batchArena.size());
+    batchOffsets.push_back(content.size());
+    batchArena.append(content.data(), content.size());
+}
+
+void MiniRedisPubSub::OnBatchFlush(int, short, void* arg)
+{
+    MiniRedisPubSub* pThis = reinterpret_cast<MiniRedisPubSub*>(arg);
+    if (!pThis || pThis->batchOffsets.empty())
+    {
+        return;
+    }
+
+    // The arena doesn't grow any more, so the views are stable
+    const char* base = pThis->batchArena.data();
+    std::vector<std::size_t>& offsets = pThis->batchOffsets;
+    pThis->batchMsgs.clear();
+    for (std::size_t i = 0; i < offsets.size(); i += 4)
+    {
+        MiniRedisPubSubMessage msg;
+        msg.channel = std::string_view(base + offsets[i], offsets[i + 1]);
+        msg.content = std::string_view(base + offsets[i + 2], offsets[i + 3]);
+        pThis->batchMsgs.push_back(msg);
+    }
+
+    if (pThis->subBatchCb)
+    {
+        pThis->subBatchCb(pThis->batchMsgs.data(), pThis->batchMsgs.size());
+    }
+
+    pThis->batchArena.clear();
+    offsets.clear();
+    pThis->batchMsgs.clear();
+}
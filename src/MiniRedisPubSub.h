@@ -1,9 +1,9 @@
 // Mini Redis C++ publisher and subscriber
-// Depends on hiredis: 
+// Depends on hiredis 1.1.0 or later, same as MiniRedisClient:
 //   sudo apt install -y libhiredis-dev
-// which installs 0.1x version.
+// on Ubuntu 24.04, Debian 13 or later. The 0.1x version of older distributions doesn't work.
 // 
-// If need new version, please build from source https://github.com/redis/hiredis/
+// Otherwise, please build from source https://github.com/redis/hiredis/
 //   git clone https://github.com/redis/hiredis
 //   cd hiredis
 //   make
@@ -19,13 +19,37 @@
 #define MiniRedisPubSub_INCLUDED
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include <functional>
+#include <memory>
+#include <atomic>
 
 struct redisAsyncContext;
 struct redisReply;
 struct event_base;
+struct event;
+class MiniRedisEventLoopGroup;
+
+// Message received from subscribed channel
+// The views are valid only during the callback
+struct MiniRedisPubSubMessage
+{
+    std::string_view channel;
+    std::string_view content;
+};
 
 using SubscribeCbFunc = std::function<void(const std::string&, const std::string&)>;
+// Same as SubscribeCbFunc, without constructing strings
+// channel and content point into the reply, and are valid only during the callback
+using SubscribeViewCbFunc = std::function<void(std::string_view, std::string_view)>;
+// Called once with all messages parsed from one socket read
+using SubscribeBatchCbFunc = std::function<void(const MiniRedisPubSubMessage*, std::size_t)>;
+// Called when the server confirms the subscription of channel
+using SubscribeAckCbFunc = std::function<void(std::string_view)>;
+// Called when connected, or failed to connect, or disconnected
+// Messages published while disconnected are lost, and the channels should be subscribed again
+using ConnectionCbFunc = std::function<void(bool)>;
 
 class MiniRedisPubSub
 {
@@ -38,11 +62,26 @@ public:
     std::string GetHost() const;
     void SetPort(uint16_t port);
     uint16_t GetPort() const;
+    // Deadline of each command, 0 means waiting forever
+    // Idle subscriptions are not affected
+    // When it expires, the callback gets no reply and the connection is closed
+    void SetCommandTimeoutMs(uint32_t ms);
 
     // CB will be called when data is received from subscribed channels
+    // If more than one CB are set, only one is called, in the order of: batch, view, string
     void SetSubscribeCb(SubscribeCbFunc cb); 
+    void SetSubscribeViewCb(SubscribeViewCbFunc cb); 
+    void SetSubscribeBatchCb(SubscribeBatchCbFunc cb); 
+    // Called on the thread of the event loop, as the callbacks above
+    void SetSubscribeAckCb(SubscribeAckCbFunc cb); 
+    void SetConnectionCb(ConnectionCbFunc cb); 
 
-    // Connect to Redis Server
+    // Run on the shared loop of group, instead of own loop thread
+    // Should be set before Connect(), and the group should be started
+    void SetEventLoopGroup(MiniRedisEventLoopGroup* group);
+
+    // Connect to Redis Server, closing the previous connection if any
+    // Can be called again after the connection dropped
     bool Connect();
     bool Connect(const std::string& host, uint16_t port = 6379);
     bool Disconnect(); 
@@ -54,21 +93,75 @@ public:
 private:
     void Init();
 
-    static void ThreadRoutine(void* arg);
+    using CallbackFunc = void (*)(redisAsyncContext*, void*, void*);
+
+    // Shared group, or own group of one loop
+    MiniRedisEventLoopGroup* GetLoop() const;
+    // Connect and disconnect on the thread running evt
+    bool ConnectInLoop();
+    void DisconnectInLoop();
+    // Connection dropped or failed, on the loop thread
+    void OnClosed();
+    void FreeBatchEvent();
+    void ReleaseLoop();
+    // Send the command on the thread of the loop
+    bool AsyncCommand(CallbackFunc fn, const char* name, 
+        const std::string& channel, const std::string& content = std::string());
+
     static void OnConnect(const redisAsyncContext *ac, int status) ;
     static void OnDisconnect(const redisAsyncContext *ac, int status);
     static void OnPublishMsg(redisAsyncContext* ac, void* replyData, void* privData); 
     static void OnSubscribeMsg(redisAsyncContext* ac, void* replyData, void* privData); 
+    // Called by libevent after the replies of one socket read are processed
+    static void OnBatchFlush(int fd, short what, void* arg);
+
+    // Kind of reply, by its first element
+    enum ReplyKind
+    {
+        REPLY_MESSAGE,
+        REPLY_PMESSAGE,
+        REPLY_SUBSCRIBE,
+        REPLY_UNSUBSCRIBE,
+        REPLY_PSUBSCRIBE,
+        REPLY_PUNSUBSCRIBE,
+        REPLY_UNKNOWN
+    };
+    // Classify by length and first byte, without constructing string
+    static ReplyKind ClassifyReply(const char* str, std::size_t len);
+
+    // Keep the message until the end of current socket read
+    void AddToBatch(std::string_view channel, std::string_view content);
 
 private:
     std::string host;
     uint16_t port;
+    uint32_t commandTimeoutMs;
     redisAsyncContext* asyncContext;
 
-    // libevent
+    // libevent, owned by the loop group
     event_base* evt; 
+    // Shared loop, evt belongs to it if set
+    MiniRedisEventLoopGroup* loopGroup;
+    // Otherwise a loop thread of this instance, kept across reconnections
+    std::unique_ptr<MiniRedisEventLoopGroup> ownLoop;
+    std::size_t loopIndex;
+    // Load of the loop is taken by Connect(), and given back once by disconnect or drop
+    std::atomic<bool> holdingLoop;
     // Callback function when receiving data from subscribed channels
     SubscribeCbFunc subCb; 
+    SubscribeViewCbFunc subViewCb; 
+    SubscribeBatchCbFunc subBatchCb; 
+    SubscribeAckCbFunc subAckCb; 
+    ConnectionCbFunc connCb; 
+
+    // Batch of messages in current socket read
+    // Replies are released after each callback, so the messages are copied into one arena, 
+    // and the capacity is kept for next batch
+    event* batchEvent;
+    std::string batchArena;
+    // Offset and length of channel and content in the arena
+    std::vector<std::size_t> batchOffsets;
+    std::vector<MiniRedisPubSubMessage> batchMsgs;
 };
 
 #endif // MiniRedisPubSub_INCLUDED
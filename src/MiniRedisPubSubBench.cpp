@@ -0,0 +1,415 @@
+// End-to-end benchmark of MiniRedisPubSub
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <algorithm>
+#include <hiredis/hiredis.h>
+#include "MiniRedisPubSubBench.h"
+#include "MiniRedisPubSub.h"
+#include "MiniRedisClient.h"
+#include "MiniRedisEventLoopGroup.h"
+#include "MiniRedisLogger.h"
+
+namespace
+{
+    uint64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Log-linear histogram of nanoseconds, 16 buckets per power of 2, within 6.25%
+    class LatencyHistogram
+    {
+    public:
+        void Add(uint64_t ns)
+        {
+            counts[Index(ns)]++;
+            total++;
+            sum += ns;
+            maxNs = std::max(maxNs, ns);
+        }
+
+        void Merge(const LatencyHistogram& other)
+        {
+            for (std::size_t i = 0; i < buckets; i++)
+            {
+                counts[i] += other.counts[i];
+            }
+            total += other.total;
+            sum += other.sum;
+            maxNs = std::max(maxNs, other.maxNs);
+        }
+
+        // Middle of the bucket holding the quantile
+        uint64_t Percentile(double q) const
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+
+            uint64_t rank = std::max<uint64_t>(1, (uint64_t)(q * total + 0.5));
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < buckets; i++)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                {
+                    return std::min(Middle(i), maxNs);
+                }
+            }
+            return maxNs;
+        }
+
+        double Mean() const
+        {
+            return total ? (double)sum / total : 0;
+        }
+
+        uint64_t Max() const
+        {
+            return maxNs;
+        }
+
+    private:
+        static std::size_t Index(uint64_t ns)
+        {
+            if (ns < 16)
+            {
+                return ns;
+            }
+            int exp = 63 - __builtin_clzll(ns);
+            return 16 + (exp - 4) * 16 + ((ns >> (exp - 4)) - 16);
+        }
+
+        static uint64_t Middle(std::size_t index)
+        {
+            if (index < 16)
+            {
+                return index;
+            }
+            int exp = (index - 16) / 16 + 4;
+            uint64_t width = 1ULL << (exp - 4);
+            return (16 + (index - 16) % 16) * width + width / 2;
+        }
+
+        static const std::size_t buckets = 16 + 60 * 16;
+        uint64_t counts[buckets] = {};
+        uint64_t total = 0;
+        uint64_t sum = 0;
+        uint64_t maxNs = 0;
+    };
+
+    // Touched by the loop thread of the subscriber only, until it is disconnected
+    struct Subscriber
+    {
+        MiniRedisPubSub sub;
+        // Highest sequence seen per publisher, and 0 if none yet
+        std::vector<uint64_t> lastSeq;
+        LatencyHistogram latency;
+        uint64_t reordered = 0;
+        uint64_t malformed = 0;
+        // Read by the sampler
+        std::atomic<uint64_t> delivered{0};
+        std::atomic<uint32_t> acks{0};
+
+        void OnMessage(std::string_view content)
+        {
+            uint64_t now = NowNs();
+            // <publisher>:<sequence>:<ns>:
+            uint64_t fields[3] = {};
+            const char* p = content.data();
+            const char* end = content.data() + content.size();
+            for (auto& x : fields)
+            {
+                auto [next, ec] = std::from_chars(p, end, x);
+                if ((ec != std::errc()) || (next == end) || (*next != ':'))
+                {
+                    malformed++;
+                    return;
+                }
+                p = next + 1;
+            }
+
+            uint64_t publisher = fields[0];
+            uint64_t seq = fields[1];
+            if (publisher >= lastSeq.size())
+            {
+                malformed++;
+                return;
+            }
+
+            if (seq <= lastSeq[publisher])
+            {
+                reordered++;
+            }
+            else
+            {
+                lastSeq[publisher] = seq;
+            }
+            latency.Add((now > fields[2]) ? now - fields[2] : 0);
+            delivered++;
+        }
+    };
+
+    // Sum of omem of pubsub connections, 0 if unknown
+    uint64_t GetServerOutputBytes(MiniRedisClient& client)
+    {
+        std::string list;
+        redisReply* reply = client.execute("CLIENT LIST TYPE pubsub");
+        if (!client.HandleStringReply(reply, list))
+        {
+            return 0;
+        }
+
+        uint64_t bytes = 0;
+        std::size_t pos = 0;
+        while ((pos = list.find(" omem=", pos)) != std::string::npos)
+        {
+            pos += 6;
+            bytes += strtoull(list.c_str() + pos, nullptr, 10);
+        }
+        return bytes;
+    }
+}
+
+MiniRedisPubSubBench::MiniRedisPubSubBench(const MiniRedisPubSubBenchOptions& options)
+    : options(options)
+{
+    this->options.publishers = std::max(options.publishers, 1u);
+    this->options.subscribers = std::max(options.subscribers, 1u);
+    this->options.channels = std::max(options.channels, 1u);
+    this->options.sampleIntervalMs = std::max(options.sampleIntervalMs, 1u);
+}
+
+bool MiniRedisPubSubBench::Run(MiniRedisPubSubBenchResult& result)
+{
+    result = MiniRedisPubSubBenchResult();
+    MiniRedisEventLoopGroup group(options.loopThreads);
+    if (!group.Start())
+    {
+        return false;
+    }
+
+    std::vector<std::string> channels;
+    for (uint32_t i = 0; i < options.channels; i++)
+    {
+        channels.push_back(options.channelPrefix + std::to_string(i));
+    }
+
+    // Subscribe all before publishing
+    bool ok = true;
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    for (uint32_t i = 0; i < options.subscribers && ok; i++)
+    {
+        subscribers.push_back(std::make_unique<Subscriber>());
+        Subscriber* s = subscribers.back().get();
+        s->lastSeq.assign(options.publishers, 0);
+        s->sub.SetEventLoopGroup(&group);
+        s->sub.SetSubscribeViewCb([s](std::string_view, std::string_view content) {
+            s->OnMessage(content);
+        });
+        s->sub.SetSubscribeAckCb([s](std::string_view) {
+            s->acks++;
+        });
+        ok = s->sub.Connect(options.host, options.port);
+        for (auto& channel : channels)
+        {
+            ok = ok && s->sub.Subscribe(channel);
+        }
+    }
+
+    auto ackDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (ok)
+    {
+        bool acked = std::all_of(subscribers.begin(), subscribers.end(), [this](const std::unique_ptr<Subscriber>& s) {
+            return s->acks >= options.channels;
+        });
+        if (acked)
+        {
+            break;
+        }
+        if (std::chrono::steady_clock::now() > ackDeadline)
+        {
+            MINIREDIS_LOG_ERROR("Subscriptions of benchmark are not confirmed");
+            ok = false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::vector<std::unique_ptr<MiniRedisPubSub>> publishers;
+    for (uint32_t i = 0; i < options.publishers && ok; i++)
+    {
+        publishers.push_back(std::make_unique<MiniRedisPubSub>());
+        publishers.back()->SetEventLoopGroup(&group);
+        ok = publishers.back()->Connect(options.host, options.port);
+    }
+
+    MiniRedisClient monitor;
+    if (!ok || !monitor.Connect(options.host, options.port))
+    {
+        for (auto& s : subscribers)
+        {
+            s->sub.Disconnect();
+        }
+        for (auto& p : publishers)
+        {
+            p->Disconnect();
+        }
+        group.Stop();
+        return false;
+    }
+
+    // Publish on own threads, paced by the rate
+    std::atomic<uint64_t> published(0);
+    std::atomic<bool> publishing(true);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < options.publishers; i++)
+    {
+        threads.emplace_back([this, i, start, &publishers, &channels, &published, &publishing]() {
+            MiniRedisPubSub& pub = *publishers[i];
+            std::string content;
+            uint64_t seq = 0;
+            while (publishing)
+            {
+                uint64_t target = UINT64_MAX;
+                if (options.messagesPerSec)
+                {
+                    auto elapsed = std::chrono::steady_clock::now() - start;
+                    target = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() *
+                        options.messagesPerSec / 1000000;
+                    if (seq >= target)
+                    {
+                        std::this_thread::sleep_for(std::chrono::microseconds(200));
+                        continue;
+                    }
+                }
+
+                // Catch up in a burst, then check the flag again
+                for (int n = 0; (n < 1000) && (seq < target) && publishing; n++)
+                {
+                    seq++;
+                    content = std::to_string(i) + ":" + std::to_string(seq) + ":" + std::to_string(NowNs()) + ":";
+                    if (content.size() < options.payloadBytes)
+                    {
+                        content.append(options.payloadBytes - content.size(), 'x');
+                    }
+                    if (pub.Publish(channels[seq % channels.size()], content))
+                    {
+                        published++;
+                    }
+                }
+            }
+        });
+    }
+
+    // Sample the backlog until the end of publishing, and during the drain
+    auto delivered = [&subscribers]() {
+        uint64_t sum = 0;
+        uint64_t least = UINT64_MAX;
+        for (auto& s : subscribers)
+        {
+            uint64_t x = s->delivered;
+            sum += x;
+            least = std::min(least, x);
+        }
+        return std::make_pair(sum, least);
+    };
+    auto sample = [&]() {
+        uint64_t slowest = delivered().second;
+        uint64_t sent = published;
+        result.maxBacklogMessages = std::max(result.maxBacklogMessages, (sent > slowest) ? sent - slowest : 0);
+        result.maxServerOutputBytes = std::max(result.maxServerOutputBytes, GetServerOutputBytes(monitor));
+    };
+
+    auto stop = start + std::chrono::milliseconds(options.durationMs);
+    while (std::chrono::steady_clock::now() < stop)
+    {
+        auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.sampleIntervalMs);
+        std::this_thread::sleep_until(std::min(next, stop));
+        sample();
+    }
+    publishing = false;
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    auto publishEnd = std::chrono::steady_clock::now();
+
+    auto drainDeadline = publishEnd + std::chrono::milliseconds(options.drainMs);
+    uint64_t expected = published * options.subscribers;
+    while ((delivered().first < expected) && (std::chrono::steady_clock::now() < drainDeadline))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.sampleIntervalMs));
+        sample();
+    }
+    auto deliverEnd = std::chrono::steady_clock::now();
+
+    // Disconnect runs on the loop threads and waits, after which the states can be read here
+    for (auto& p : publishers)
+    {
+        p->Disconnect();
+    }
+    for (auto& s : subscribers)
+    {
+        s->sub.Disconnect();
+    }
+    group.Stop();
+
+    LatencyHistogram latency;
+    for (auto& s : subscribers)
+    {
+        latency.Merge(s->latency);
+        result.delivered += s->delivered;
+        result.reordered += s->reordered;
+        result.malformed += s->malformed;
+    }
+
+    double publishSec = std::chrono::duration<double>(publishEnd - start).count();
+    double deliverSec = std::chrono::duration<double>(deliverEnd - start).count();
+    result.published = published;
+    result.expected = expected;
+    // Pub/sub doesn't duplicate, so reordered messages are late but not lost
+    result.lost = (expected > result.delivered) ? expected - result.delivered : 0;
+    result.publishRate = publishSec > 0 ? result.published / publishSec : 0;
+    result.deliveryRate = deliverSec > 0 ? result.delivered / deliverSec : 0;
+    result.latencyMeanUs = latency.Mean() / 1000;
+    result.latencyP50Us = latency.Percentile(0.5) / 1000.0;
+    result.latencyP90Us = latency.Percentile(0.9) / 1000.0;
+    result.latencyP99Us = latency.Percentile(0.99) / 1000.0;
+    result.latencyP999Us = latency.Percentile(0.999) / 1000.0;
+    result.latencyMaxUs = latency.Max() / 1000.0;
+    result.elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(publishEnd - start).count();
+    return true;
+}
+
+std::string MiniRedisPubSubBench::ToJson(const MiniRedisPubSubBenchResult& result) const
+{
+    char buf[2048];
+    snprintf(buf, sizeof(buf),
+        "{\"options\":{\"publishers\":%u,\"subscribers\":%u,\"channels\":%u,\"messagesPerSec\":%u,"
+        "\"payloadBytes\":%u,\"durationMs\":%u,\"loopThreads\":%u},"
+        "\"published\":%llu,\"expected\":%llu,\"delivered\":%llu,\"lost\":%llu,\"reordered\":%llu,"
+        "\"malformed\":%llu,\"publishRate\":%.1f,\"deliveryRate\":%.1f,"
+        "\"latencyUs\":{\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+        "\"maxBacklogMessages\":%llu,\"maxServerOutputBytes\":%llu,\"elapsedMs\":%llu}",
+        options.publishers, options.subscribers, options.channels, options.messagesPerSec,
+        options.payloadBytes, options.durationMs, options.loopThreads,
+        (unsigned long long)result.published, (unsigned long long)result.expected,
+        (unsigned long long)result.delivered, (unsigned long long)result.lost,
+        (unsigned long long)result.reordered, (unsigned long long)result.malformed,
+        result.publishRate, result.deliveryRate,
+        result.latencyMeanUs, result.latencyP50Us, result.latencyP90Us,
+        result.latencyP99Us, result.latencyP999Us, result.latencyMaxUs,
+        (unsigned long long)result.maxBacklogMessages, (unsigned long long)result.maxServerOutputBytes,
+        (unsigned long long)result.elapsedMs);
+    return buf;
+}
@@ -0,0 +1,88 @@
+// End-to-end benchmark of MiniRedisPubSub
+// N publishers publish to C channels, and each of M subscribers subscribes to all of them,
+// so every message is expected M times. All instances run on one MiniRedisEventLoopGroup.
+//
+// Content of each message: "<publisher>:<sequence>:<steady clock ns>:" and padding.
+// Publishers and subscribers are in one process, so the monotonic clock is comparable.
+// Each publisher has one connection, which keeps its messages in order across channels,
+// so a sequence lower than one already seen from the same publisher is reordered,
+// and messages never seen are lost.
+//
+// Backlog is sampled during the run: messages published and not yet delivered to the
+// slowest subscriber, and output buffer of the subscriber connections on the server
+// (omem of CLIENT LIST), which grows when the callbacks can't keep up.
+//
+// Result is printed as JSON by ToJson(), to be compared between builds.
+//
+
+#ifndef MiniRedisPubSubBench_INCLUDED
+#define MiniRedisPubSubBench_INCLUDED
+
+#include <string>
+#include <cstdint>
+
+struct MiniRedisPubSubBenchOptions
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 6379;
+    uint32_t publishers = 1;
+    uint32_t subscribers = 1;
+    uint32_t channels = 1;
+    // Channel names are prefix + index
+    std::string channelPrefix = "bench:pubsub:";
+    // Messages per second of each publisher, 0 means as fast as possible
+    uint32_t messagesPerSec = 10000;
+    // Content length, at least the header
+    uint32_t payloadBytes = 64;
+    uint32_t durationMs = 10000;
+    // How long to wait for the messages in flight after publishing stopped
+    uint32_t drainMs = 2000;
+    // Backlog sampling
+    uint32_t sampleIntervalMs = 100;
+    // Loop threads shared by all instances, 0 means one per core
+    uint32_t loopThreads = 0;
+};
+
+struct MiniRedisPubSubBenchResult
+{
+    uint64_t published;
+    // published * subscribers
+    uint64_t expected;
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t reordered;
+    // Content not in the format of the benchmark
+    uint64_t malformed;
+    // Per second, over the publishing duration
+    double publishRate;
+    double deliveryRate;
+    // End-to-end latency in microseconds
+    double latencyMeanUs;
+    double latencyP50Us;
+    double latencyP90Us;
+    double latencyP99Us;
+    double latencyP999Us;
+    double latencyMaxUs;
+    // Largest backlog seen by the sampler
+    uint64_t maxBacklogMessages;
+    uint64_t maxServerOutputBytes;
+    // Publish duration actually measured
+    uint64_t elapsedMs;
+};
+
+class MiniRedisPubSubBench
+{
+public:
+    explicit MiniRedisPubSubBench(const MiniRedisPubSubBenchOptions& options);
+
+    // Block for duration + drain, return false if failed to connect or subscribe
+    bool Run(MiniRedisPubSubBenchResult& result);
+
+    // Options and result as one JSON object
+    std::string ToJson(const MiniRedisPubSubBenchResult& result) const;
+
+private:
+    MiniRedisPubSubBenchOptions options;
+};
+
+#endif // MiniRedisPubSubBench_INCLUDED
@@ -0,0 +1,193 @@
+// Token bucket rate limiter shared across processes, with locally leased permits
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <hiredis/hiredis.h>
+#include "MiniRedisRateLimiter.h"
+
+namespace
+{
+    // KEYS[1]: bucket
+    // ARGV[1]: rate per second, ARGV[2]: burst, ARGV[3]: wanted, ARGV[4]: given back
+    // Return the permits granted
+    const char* bucketScript =
+        "local rate = tonumber(ARGV[1]) "
+        "local burst = tonumber(ARGV[2]) "
+        "local want = tonumber(ARGV[3]) "
+        "local back = tonumber(ARGV[4]) "
+        "local t = redis.call('TIME') "
+        "local now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000) "
+        "local b = redis.call('HMGET', KEYS[1], 'tokens', 'ts') "
+        "local tokens = tonumber(b[1]) or burst "
+        "local ts = tonumber(b[2]) or now "
+        "tokens = math.min(burst, tokens + math.max(0, now - ts) * rate / 1000 + back) "
+        "local granted = math.max(0, math.min(want, math.floor(tokens))) "
+        "tokens = tokens - granted "
+        "redis.call('HSET', KEYS[1], 'tokens', tostring(tokens), 'ts', now) "
+        "redis.call('PEXPIRE', KEYS[1], math.ceil(burst * 1000 / rate) + 1000) "
+        "return granted";
+}
+
+MiniRedisRateLimiter::MiniRedisRateLimiter(const std::string& key, double ratePerSec, double burst)
+    : key(key), ratePerSec(ratePerSec > 0 ? ratePerSec : 1), burst(std::max(burst, 1.0))
+{
+    maxLease = std::max(1u, (uint32_t)(this->burst / 10));
+    leaseTtlMs = 100;
+    localTokens = 0;
+    leaseSize = 1;
+    stats = MiniRedisRateLimiterStats();
+}
+
+MiniRedisRateLimiter::~MiniRedisRateLimiter()
+{
+    // Give back the unused permits
+    std::lock_guard<std::mutex> lock(mtx);
+    if ((localTokens > 0) && client.IsConnected())
+    {
+        Lease(0, localTokens);
+    }
+}
+
+void MiniRedisRateLimiter::SetMaxLease(uint32_t permits)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    maxLease = permits ? permits : 1;
+    leaseSize = std::min(leaseSize, maxLease);
+}
+
+void MiniRedisRateLimiter::SetLeaseTtlMs(uint32_t ms)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    leaseTtlMs = ms;
+}
+
+bool MiniRedisRateLimiter::Connect(const std::string& host, uint16_t port, uint32_t timeoutSec)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return client.Connect(host, port, timeoutSec) && LoadScript();
+}
+
+MiniRedisClient& MiniRedisRateLimiter::GetClient()
+{
+    return client;
+}
+
+bool MiniRedisRateLimiter::LoadScript()
+{
+    redisReply* reply = client.execute("SCRIPT LOAD %s", bucketScript);
+    return client.HandleStringReply(reply, scriptSha) && !scriptSha.empty();
+}
+
+long long MiniRedisRateLimiter::Lease(long long want, long long returned)
+{
+    std::string args[4] = {
+        std::to_string(ratePerSec), std::to_string(burst),
+        std::to_string(want), std::to_string(returned)
+    };
+
+    stats.leases++;
+    redisReply* reply = client.execute("EVALSHA %b 1 %b %b %b %b %b",
+        scriptSha.c_str(), scriptSha.size(),
+        key.c_str(), key.size(),
+        args[0].c_str(), args[0].size(),
+        args[1].c_str(), args[1].size(),
+        args[2].c_str(), args[2].size(),
+        args[3].c_str(), args[3].size());
+    if (reply && (reply->type == REDIS_REPLY_ERROR) &&
+        (strncmp(reply->str, "NOSCRIPT", 8) == 0))
+    {
+        // Script cache was flushed, or failover to a server without it
+        // EVAL caches it again for next EVALSHA
+        freeReplyObject(reply);
+        reply = client.execute("EVAL %s 1 %b %b %b %b %b",
+            bucketScript,
+            key.c_str(), key.size(),
+            args[0].c_str(), args[0].size(),
+            args[1].c_str(), args[1].size(),
+            args[2].c_str(), args[2].size(),
+            args[3].c_str(), args[3].size());
+    }
+
+    long long granted = 0;
+    if (!client.HandleIntegerReply(reply, granted))
+    {
+        return -1;
+    }
+
+    stats.returned += returned;
+    return granted;
+}
+
+bool MiniRedisRateLimiter::TryAcquire(uint32_t permits)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+    bool expired = (now >= leaseExpiry);
+    if (!expired && (localTokens >= permits))
+    {
+        localTokens -= permits;
+        stats.acquired += permits;
+        return true;
+    }
+
+    if (now < retryAfter)
+    {
+        stats.rejected += permits;
+        return false;
+    }
+
+    // Lease used up in time means high demand, and left over means low demand
+    long long returned = 0;
+    if (expired && (localTokens > 0))
+    {
+        returned = localTokens;
+        localTokens = 0;
+        leaseSize = std::max(1u, leaseSize / 2);
+    }
+    else if (!expired)
+    {
+        leaseSize = std::min(maxLease, leaseSize * 2);
+    }
+
+    long long want = std::max<long long>(permits, leaseSize) - localTokens;
+    long long granted = Lease(want, returned);
+    if (granted < 0)
+    {
+        // Redis is unreachable, reject instead of letting all requests through
+        stats.rejected += permits;
+        return false;
+    }
+
+    if (granted < want)
+    {
+        // Contended, take smaller share next time
+        leaseSize = std::max(1u, leaseSize / 2);
+    }
+    if (granted == 0)
+    {
+        // Wait for the bucket to refill the permits
+        auto waitUs = (long long)std::ceil(permits * 1000000.0 / ratePerSec);
+        retryAfter = now + std::chrono::microseconds(waitUs);
+    }
+
+    localTokens += granted;
+    leaseExpiry = now + std::chrono::milliseconds(leaseTtlMs);
+    if (localTokens >= permits)
+    {
+        localTokens -= permits;
+        stats.acquired += permits;
+        return true;
+    }
+
+    stats.rejected += permits;
+    return false;
+}
+
+MiniRedisRateLimiterStats MiniRedisRateLimiter::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    MiniRedisRateLimiterStats x = stats;
+    x.leaseSize = leaseSize;
+    return x;
+}
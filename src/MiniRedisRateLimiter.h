@@ -0,0 +1,83 @@
+// Token bucket rate limiter shared across processes, with locally leased permits
+// The bucket is kept in a Redis hash, and refilled and taken atomically by a Lua script,
+// using the server TIME, so that all processes see the same limit.
+//
+// Instead of one round trip per request, each limiter leases a batch of permits,
+// and spends them locally. The batch grows while the leases are used up in time,
+// and shrinks when the bucket can't grant it, or permits are left unused.
+// Unused permits are given back when the lease expires, so that idle processes
+// don't hold the permits needed by others.
+// The batch is capped by SetMaxLease(), so that each process gets a fair share
+// of the burst when the bucket runs low.
+//
+// One instance can be shared by threads of the process.
+//
+
+#ifndef MiniRedisRateLimiter_INCLUDED
+#define MiniRedisRateLimiter_INCLUDED
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include "MiniRedisClient.h"
+
+struct MiniRedisRateLimiterStats
+{
+    // Permits acquired and rejected locally
+    uint64_t acquired;
+    uint64_t rejected;
+    // Round trips to Redis
+    uint64_t leases;
+    // Permits given back at lease expiry
+    uint64_t returned;
+    // Current batch size
+    uint32_t leaseSize;
+};
+
+class MiniRedisRateLimiter
+{
+public:
+    // ratePerSec permits are added per second, and up to burst permits can be kept
+    MiniRedisRateLimiter(const std::string& key, double ratePerSec, double burst);
+    ~MiniRedisRateLimiter();
+
+    // Largest batch leased at once, 1/10 of burst by default
+    void SetMaxLease(uint32_t permits);
+    // Unused permits are given back after this
+    void SetLeaseTtlMs(uint32_t ms);
+
+    bool Connect(const std::string& host, uint16_t port = 6379, uint32_t timeoutSec = 3);
+    MiniRedisClient& GetClient();
+
+    // Take permits if allowed, without waiting
+    bool TryAcquire(uint32_t permits = 1);
+
+    MiniRedisRateLimiterStats GetStats() const;
+
+private:
+    // Take up to want permits from the bucket and give back returned ones, in one script call
+    // Return the permits granted, or -1 on failure
+    long long Lease(long long want, long long returned);
+    // Load the script, and remember its SHA1 for EVALSHA
+    bool LoadScript();
+
+private:
+    MiniRedisClient client;
+    std::string key;
+    double ratePerSec;
+    double burst;
+    uint32_t maxLease;
+    uint32_t leaseTtlMs;
+    std::string scriptSha;
+
+    mutable std::mutex mtx;
+    // Permits of current lease
+    long long localTokens;
+    std::chrono::steady_clock::time_point leaseExpiry;
+    // Don't ask the empty bucket again before this
+    std::chrono::steady_clock::time_point retryAfter;
+    uint32_t leaseSize;
+    MiniRedisRateLimiterStats stats;
+};
+
+#endif // MiniRedisRateLimiter_INCLUDED
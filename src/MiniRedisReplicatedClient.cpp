@@ -0,0 +1,759 @@
+// Topology aware client of one primary and its replicas
+
+#include <iostream>
+#include <algorithm>
+#include <set>
+#include <cmath>
+#include <poll.h>
+#include <hiredis/hiredis.h>
+#include "MiniRedisReplicatedClient.h"
+
+MiniRedisReplicatedClient::MiniRedisReplicatedClient()
+{
+    Init();
+}
+
+MiniRedisReplicatedClient::~MiniRedisReplicatedClient()
+{
+    Stop();
+}
+
+void MiniRedisReplicatedClient::Init()
+{
+    primary = std::make_unique<MiniRedisClient>();
+    timeoutSeconds = 3;
+    maxLagBytes = 1024 * 1024;
+    ewmaAlpha = 0.2;
+    refreshIntervalMs = 1000;
+    running = false;
+    requested = 0;
+    completed = 0;
+    refreshes = 0;
+    applied = 0;
+    rng.seed(std::random_device()());
+    commandTimeoutMs = 0;
+    hedgePercentile = 0;
+    samples.assign(256, 0);
+    sampleNext = 0;
+    sampleCount = 0;
+    hedgeDelayUs = 0;
+    hedges = 0;
+    lastError = REDIS_ERROR_NONE;
+}
+
+void MiniRedisReplicatedClient::SetPrimary(const std::string& host, uint16_t port)
+{
+    primary->SetHost(host);
+    primary->SetPort(port);
+}
+
+void MiniRedisReplicatedClient::AddReplica(const std::string& host, uint16_t port)
+{
+    Node node;
+    node.client = std::make_unique<MiniRedisClient>();
+    node.client->SetHost(host);
+    node.client->SetPort(port);
+    node.client->SetCommandTimeoutMs(commandTimeoutMs);
+    replicas.push_back(std::move(node));
+}
+
+void MiniRedisReplicatedClient::SetTimeoutSeconds(uint32_t sec)
+{
+    timeoutSeconds = sec;
+}
+
+void MiniRedisReplicatedClient::SetMaxLagBytes(long long maxLagBytes)
+{
+    this->maxLagBytes = maxLagBytes;
+}
+
+void MiniRedisReplicatedClient::SetEwmaAlpha(double alpha)
+{
+    if ((alpha > 0) && (alpha <= 1))
+    {
+        ewmaAlpha = alpha;
+    }
+}
+
+void MiniRedisReplicatedClient::SetRefreshIntervalMs(uint32_t ms)
+{
+    std::lock_guard<std::mutex> lock(refreshMutex);
+    refreshIntervalMs = ms;
+}
+
+void MiniRedisReplicatedClient::SetCommandTimeoutMs(uint32_t ms)
+{
+    {
+        // Also read by the refresh thread for new connections
+        std::lock_guard<std::mutex> lock(refreshMutex);
+        commandTimeoutMs = ms;
+    }
+    primary->SetCommandTimeoutMs(ms);
+    for (auto& node : replicas)
+    {
+        node.client->SetCommandTimeoutMs(ms);
+    }
+}
+
+void MiniRedisReplicatedClient::SetHedgePercentile(double percentile)
+{
+    hedgePercentile = ((percentile > 0) && (percentile < 1)) ? percentile : 0;
+}
+
+double MiniRedisReplicatedClient::GetHedgeDelayUs() const
+{
+    return hedgeDelayUs;
+}
+
+uint64_t MiniRedisReplicatedClient::GetHedgeCount() const
+{
+    return hedges;
+}
+
+bool MiniRedisReplicatedClient::Connect()
+{
+    Stop();
+
+    primary->SetTimeoutSeconds(timeoutSeconds);
+    if (!primary->Connect())
+    {
+        return false;
+    }
+
+    primaryMonitor = NewClient(primary->GetHost(), primary->GetPort());
+    monitors.clear();
+    for (auto& node : replicas)
+    {
+        node.client->SetTimeoutSeconds(timeoutSeconds);
+        node.up = node.client->Connect();
+        node.ewmaUs = 0;
+        node.pending = 0;
+
+        auto monitor = std::make_unique<Monitor>();
+        monitor->client = NewClient(node.client->GetHost(), node.client->GetPort());
+        monitors.push_back(std::move(monitor));
+    }
+
+    // First round here, so that the lag is known before the first read
+    RefreshOnce();
+    ApplyRefresh();
+
+    std::lock_guard<std::mutex> lock(refreshMutex);
+    running = true;
+    refreshThread = std::thread(&MiniRedisReplicatedClient::ThreadRoutine, this);
+    return true;
+}
+
+void MiniRedisReplicatedClient::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(refreshMutex);
+        running = false;
+    }
+
+    refreshCv.notify_all();
+    if (refreshThread.joinable())
+    {
+        refreshThread.join();
+    }
+}
+
+std::unique_ptr<MiniRedisClient> MiniRedisReplicatedClient::NewClient(const std::string& host,
+    uint16_t port)
+{
+    auto client = std::make_unique<MiniRedisClient>();
+    client->SetHost(host);
+    client->SetPort(port);
+    client->SetTimeoutSeconds(timeoutSeconds);
+    std::lock_guard<std::mutex> lock(refreshMutex);
+    client->SetCommandTimeoutMs(commandTimeoutMs);
+    return client;
+}
+
+void MiniRedisReplicatedClient::RefreshReplication()
+{
+    {
+        std::unique_lock<std::mutex> lock(refreshMutex);
+        if (!running)
+        {
+            return;
+        }
+
+        uint64_t target = ++requested;
+        refreshCv.notify_all();
+        refreshCv.wait(lock, [this, target]() { return !running || (completed >= target); });
+    }
+
+    ApplyRefresh();
+}
+
+void MiniRedisReplicatedClient::ThreadRoutine()
+{
+    std::unique_lock<std::mutex> lock(refreshMutex);
+    while (running)
+    {
+        refreshCv.wait_for(lock, std::chrono::milliseconds(std::max(1u, refreshIntervalMs)), [this]() {
+            return !running || (requested > completed);
+        });
+        if (!running)
+        {
+            break;
+        }
+
+        uint64_t serving = requested;
+        lock.unlock();
+        RefreshOnce();
+        lock.lock();
+        completed = serving;
+        refreshCv.notify_all();
+    }
+}
+
+void MiniRedisReplicatedClient::RefreshOnce()
+{
+    std::map<std::string, std::string> props;
+    long long primaryOffset = -1;
+    if ((primaryMonitor->IsConnected() || primaryMonitor->Connect()) &&
+        primaryMonitor->info("replication", props) && props.count("master_repl_offset"))
+    {
+        primaryOffset = std::atoll(props["master_repl_offset"].c_str());
+    }
+
+    for (auto& monitor : monitors)
+    {
+        // A broken replica costs up to the connect timeout here, instead of on reads
+        MiniRedisClient& client = *monitor->client;
+        if (!client.IsConnected() && !client.Connect())
+        {
+            monitor->lagBytes = -1;
+            continue;
+        }
+
+        // Replica reports slave_repl_offset, and whether its link to primary is up
+        props.clear();
+        if (!client.info("replication", props))
+        {
+            monitor->lagBytes = -1;
+            continue;
+        }
+        long long offset = props.count("slave_repl_offset") ?
+            std::atoll(props["slave_repl_offset"].c_str()) : -1;
+        bool linked = (props["master_link_status"] == "up");
+        if (!linked || (offset < 0) || (primaryOffset < 0))
+        {
+            monitor->lagBytes = linked ? 0 : -1;
+        }
+        else
+        {
+            monitor->lagBytes = std::max(0LL, primaryOffset - offset);
+        }
+
+        // The replica answers again, so reconnect the reading connection for the reading thread
+        {
+            std::lock_guard<std::mutex> lock(monitor->mtx);
+            if (!monitor->broken)
+            {
+                continue;
+            }
+        }
+        auto reconnected = NewClient(client.GetHost(), client.GetPort());
+        if (reconnected->Connect())
+        {
+            std::lock_guard<std::mutex> lock(monitor->mtx);
+            monitor->reconnected = std::move(reconnected);
+            monitor->broken = false;
+        }
+    }
+
+    refreshes++;
+}
+
+void MiniRedisReplicatedClient::ApplyRefresh()
+{
+    uint64_t current = refreshes;
+    if ((current == applied) || (monitors.size() != replicas.size()))
+    {
+        return;
+    }
+
+    applied = current;
+    for (std::size_t i = 0; i < replicas.size(); i++)
+    {
+        Node& node = replicas[i];
+        Monitor& monitor = *monitors[i];
+        node.lagBytes = monitor.lagBytes;
+        if (node.up && node.client->IsConnected())
+        {
+            continue;
+        }
+
+        node.up = false;
+        std::unique_ptr<MiniRedisClient> reconnected;
+        {
+            std::lock_guard<std::mutex> lock(monitor.mtx);
+            reconnected = std::move(monitor.reconnected);
+            monitor.broken = !reconnected;
+        }
+        if (reconnected)
+        {
+            node.client = std::move(reconnected);
+            node.up = true;
+            node.ewmaUs = 0;
+            node.pending = 0;
+        }
+    }
+}
+
+MiniRedisClient& MiniRedisReplicatedClient::GetPrimary()
+{
+    return *primary;
+}
+
+MiniRedisClient& MiniRedisReplicatedClient::GetReader()
+{
+    ApplyRefresh();
+    int index = ChooseReplica();
+    if (index < 0)
+    {
+        return *primary;
+    }
+
+    DrainPending(index);
+    replicas[index].reads++;
+    return *replicas[index].client;
+}
+
+std::vector<MiniRedisReplicaStats> MiniRedisReplicatedClient::GetReplicaStats() const
+{
+    std::vector<MiniRedisReplicaStats> stats;
+    for (auto& node : replicas)
+    {
+        MiniRedisReplicaStats x;
+        x.host = node.client->GetHost();
+        x.port = node.client->GetPort();
+        x.up = node.up;
+        x.fresh = IsUsable(node);
+        x.latencyUs = node.ewmaUs;
+        x.lagBytes = node.lagBytes;
+        x.reads = node.reads;
+        x.hedgeWins = node.hedgeWins;
+        stats.push_back(x);
+    }
+    return stats;
+}
+
+bool MiniRedisReplicatedClient::IsUsable(const Node& node) const
+{
+    if (!node.up)
+    {
+        return false;
+    }
+
+    // Unknown lag, because the replica lost its link to primary
+    if (node.lagBytes < 0)
+    {
+        return false;
+    }
+
+    return (maxLagBytes < 0) || (node.lagBytes <= maxLagBytes);
+}
+
+int MiniRedisReplicatedClient::ChooseReplica()
+{
+    std::vector<int> candidates;
+    for (std::size_t i = 0; i < replicas.size(); i++)
+    {
+        if (IsUsable(replicas[i]))
+        {
+            candidates.push_back((int)i);
+        }
+    }
+
+    if (candidates.empty())
+    {
+        return -1;
+    }
+    if (candidates.size() == 1)
+    {
+        return candidates[0];
+    }
+
+    // Power of two choices
+    std::size_t a = rng() % candidates.size();
+    std::size_t b = rng() % (candidates.size() - 1);
+    if (b >= a)
+    {
+        b++;
+    }
+    const Node& nodeA = replicas[candidates[a]];
+    const Node& nodeB = replicas[candidates[b]];
+    return (nodeA.ewmaUs <= nodeB.ewmaUs) ? candidates[a] : candidates[b];
+}
+
+void MiniRedisReplicatedClient::RecordLatency(Node& node,
+    std::chrono::steady_clock::duration elapsed)
+{
+    double us = std::chrono::duration<double, std::micro>(elapsed).count();
+    RecordSample(us);
+    if (node.ewmaUs <= 0)
+    {
+        node.ewmaUs = us;
+        return;
+    }
+
+    node.ewmaUs = ewmaAlpha * us + (1 - ewmaAlpha) * node.ewmaUs;
+}
+
+void MiniRedisReplicatedClient::RecordSample(double us)
+{
+    samples[sampleNext] = us;
+    sampleNext = (sampleNext + 1) % samples.size();
+    sampleCount++;
+
+    // Recompute the percentile every 32 samples, after the ring is warmed up
+    if ((hedgePercentile <= 0) || (sampleCount < 32) || (sampleCount % 32 != 0))
+    {
+        return;
+    }
+
+    std::size_t count = std::min<uint64_t>(sampleCount, samples.size());
+    std::vector<double> sorted(samples.begin(), samples.begin() + count);
+    std::size_t nth = std::min(count - 1, (std::size_t)(hedgePercentile * count));
+    std::nth_element(sorted.begin(), sorted.begin() + nth, sorted.end());
+    hedgeDelayUs = sorted[nth];
+}
+
+void MiniRedisReplicatedClient::DrainPending(int index)
+{
+    if ((index < 0) || ((std::size_t)index >= replicas.size()))
+    {
+        return;
+    }
+
+    Node& node = replicas[index];
+    while (node.pending > 0)
+    {
+        redisReply* reply = node.client->PipelineGetReply();
+        if (!reply)
+        {
+            // The connection is broken, nothing to drain after reconnecting
+            node.up = false;
+            node.pending = 0;
+            break;
+        }
+        freeReplyObject(reply);
+        node.pending--;
+    }
+}
+
+int MiniRedisReplicatedClient::ChooseOther(int except)
+{
+    std::vector<int> candidates;
+    for (std::size_t i = 0; i < replicas.size(); i++)
+    {
+        if (((int)i != except) && IsUsable(replicas[i]))
+        {
+            candidates.push_back((int)i);
+        }
+    }
+
+    if (candidates.empty())
+    {
+        return -1;
+    }
+
+    // The fastest one, since it's already late
+    int best = candidates[0];
+    for (auto i : candidates)
+    {
+        if (replicas[i].ewmaUs < replicas[best].ewmaUs)
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+redisReply* MiniRedisReplicatedClient::ExecuteHedged(const std::vector<std::string>& argv,
+    bool& timedOut)
+{
+    timedOut = false;
+    ApplyRefresh();
+    int first = ChooseReplica();
+    if (first < 0)
+    {
+        return nullptr;
+    }
+
+    DrainPending(first);
+    Node& nodeA = replicas[first];
+    auto start = std::chrono::steady_clock::now();
+    if (!nodeA.client->PipelineAppend(argv) || !nodeA.client->PipelineFlush())
+    {
+        nodeA.up = false;
+        return nullptr;
+    }
+
+    // Wait for the first replica until the hedge delay
+    pollfd fds[2] = {{nodeA.client->GetFd(), POLLIN, 0}, {-1, POLLIN, 0}};
+    timespec delay = {(time_t)(hedgeDelayUs / 1000000), (long)(std::fmod(hedgeDelayUs, 1000000) * 1000)};
+    int ready = ppoll(fds, 1, &delay, nullptr);
+    int second = -1;
+    auto hedgeStart = start;
+    if (ready == 0)
+    {
+        second = ChooseOther(first);
+        if (second >= 0)
+        {
+            DrainPending(second);
+            Node& nodeB = replicas[second];
+            if (nodeB.client->PipelineAppend(argv) && nodeB.client->PipelineFlush())
+            {
+                fds[1].fd = nodeB.client->GetFd();
+                hedgeStart = std::chrono::steady_clock::now();
+                hedges++;
+            }
+            else
+            {
+                nodeB.up = false;
+                second = -1;
+            }
+        }
+
+        // Then wait for any of them, within the command timeout
+        int timeoutMs = commandTimeoutMs ? (int)commandTimeoutMs : -1;
+        ready = poll(fds, (second >= 0) ? 2 : 1, timeoutMs);
+    }
+
+    if (ready <= 0)
+    {
+        // Both replies are late, drain them before next use
+        nodeA.pending++;
+        if (second >= 0)
+        {
+            replicas[second].pending++;
+        }
+        timedOut = (ready == 0);
+        return nullptr;
+    }
+
+    int winner = first;
+    int loser = second;
+    if ((second >= 0) && !(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+    {
+        winner = second;
+        loser = first;
+    }
+    if (loser >= 0)
+    {
+        replicas[loser].pending++;
+    }
+
+    Node& node = replicas[winner];
+    redisReply* reply = node.client->PipelineGetReply();
+    if (!reply)
+    {
+        node.up = false;
+        return nullptr;
+    }
+
+    RecordLatency(node, std::chrono::steady_clock::now() - ((winner == first) ? start : hedgeStart));
+    node.reads++;
+    if (winner == second)
+    {
+        node.hedgeWins++;
+    }
+    return reply;
+}
+
+bool MiniRedisReplicatedClient::IsReadOnlyCommand(const std::string& command)
+{
+    static const std::set<std::string> readOnly = {
+        "BITCOUNT", "BITPOS", "DBSIZE", "DUMP", "EXISTS", "GEODIST", "GEOHASH", "GEOPOS",
+        "GEOSEARCH", "GET", "GETBIT", "GETRANGE", "HEXISTS", "HGET", "HGETALL", "HKEYS",
+        "HLEN", "HMGET", "HRANDFIELD", "HSCAN", "HSTRLEN", "HVALS", "KEYS", "LINDEX",
+        "LLEN", "LPOS", "LRANGE", "MGET", "PFCOUNT", "PTTL", "RANDOMKEY", "SCAN", "SCARD",
+        "SDIFF", "SINTER", "SISMEMBER", "SMEMBERS", "SMISMEMBER", "SRANDMEMBER", "SSCAN",
+        "STRLEN", "SUBSTR", "SUNION", "TTL", "TYPE", "XLEN", "XRANGE", "XREVRANGE",
+        "ZCARD", "ZCOUNT", "ZLEXCOUNT", "ZMSCORE", "ZRANDMEMBER", "ZRANGE",
+        "ZRANGEBYLEX", "ZRANGEBYSCORE", "ZRANK", "ZREVRANGE", "ZREVRANGEBYLEX",
+        "ZREVRANGEBYSCORE", "ZREVRANK", "ZSCAN", "ZSCORE"
+    };
+
+    std::string name(command);
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    return readOnly.count(name) > 0;
+}
+
+redisReply* MiniRedisReplicatedClient::execute(const std::string& command,
+    const std::vector<std::string>& args)
+{
+    lastError = REDIS_ERROR_NONE;
+    redisReply* reply = nullptr;
+    if (!IsReadOnlyCommand(command))
+    {
+        reply = primary->execute(command, args);
+        if (!reply)
+        {
+            lastError = primary->GetLastError();
+        }
+        return reply;
+    }
+
+    if ((hedgePercentile > 0) && (hedgeDelayUs > 0))
+    {
+        std::vector<std::string> argv;
+        argv.reserve(args.size() + 1);
+        argv.push_back(command);
+        argv.insert(argv.end(), args.begin(), args.end());
+        bool timedOut = false;
+        reply = ExecuteHedged(argv, timedOut);
+        if (reply)
+        {
+            return reply;
+        }
+        if (timedOut)
+        {
+            // Already waited for the deadline, so don't send it again
+            lastError = REDIS_ERROR_TIMEOUT;
+            return nullptr;
+        }
+    }
+
+    Read([&](MiniRedisClient& c) {
+        freeReplyObject(reply);
+        reply = c.execute(command, args);
+        lastError = reply ? REDIS_ERROR_NONE : c.GetLastError();
+        return reply != nullptr;
+    });
+    return reply;
+}
+
+MiniRedisError MiniRedisReplicatedClient::GetLastError() const
+{
+    return lastError;
+}
+
+bool MiniRedisReplicatedClient::exists(const std::string& key, long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.exists(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::hexists(const std::string& key, const std::string& field,
+    long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.hexists(key, field, replied); });
+}
+
+bool MiniRedisReplicatedClient::hgetall(const std::string& key,
+    std::map<std::string, std::string>& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.hgetall(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::hkeys(const std::string& key, std::vector<std::string>& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.hkeys(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::hlen(const std::string& key, long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.hlen(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::hvals(const std::string& key, std::vector<std::string>& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.hvals(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::lindex(const std::string& key, int32_t index, std::string& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.lindex(key, index, replied); });
+}
+
+bool MiniRedisReplicatedClient::llen(const std::string& key, long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.llen(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::scard(const std::string& key, long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.scard(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::sismember(const std::string& key, const std::string& member,
+    long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.sismember(key, member, replied); });
+}
+
+bool MiniRedisReplicatedClient::smembers(const std::string& key, std::vector<std::string>& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.smembers(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::strlen(const std::string& key, long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.strlen(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::ttl(const std::string& key, long long int& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.ttl(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::type(const std::string& key, std::string& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.type(key, replied); });
+}
+
+bool MiniRedisReplicatedClient::del(const std::string& key, long long int& replied)
+{
+    return primary->del(key, replied);
+}
+
+bool MiniRedisReplicatedClient::expire(const std::string& key, uint32_t seconds,
+    long long int& replied)
+{
+    return primary->expire(key, seconds, replied);
+}
+
+bool MiniRedisReplicatedClient::hdel(const std::string& key, const std::string& field,
+    long long int& replied)
+{
+    return primary->hdel(key, field, replied);
+}
+
+bool MiniRedisReplicatedClient::hset(const std::string& key, const std::string& field,
+    const std::string& value, long long int& replied)
+{
+    return primary->hset(key, field, value, replied);
+}
+
+bool MiniRedisReplicatedClient::incr(const std::string& key, long long int& replied)
+{
+    return primary->incr(key, replied);
+}
+
+bool MiniRedisReplicatedClient::decr(const std::string& key, long long int& replied)
+{
+    return primary->decr(key, replied);
+}
+
+bool MiniRedisReplicatedClient::sadd(const std::string& key, const std::string& member,
+    long long int& replied)
+{
+    return primary->sadd(key, member, replied);
+}
+
+bool MiniRedisReplicatedClient::set(const std::string& key, const std::string& value,
+    uint32_t ttl, std::string& replied)
+{
+    return primary->set(key, value, ttl, replied);
+}
+
+bool MiniRedisReplicatedClient::srem(const std::string& key, const std::string& member,
+    long long int& replied)
+{
+    return primary->srem(key, member, replied);
+}
@@ -0,0 +1,285 @@
+// Topology aware client of one primary and its replicas
+// Writes are sent to the primary, and read-only commands are routed to replicas.
+//
+// The replica is chosen by power of two choices:
+// two healthy replicas are picked randomly, and the one with lower EWMA latency wins,
+// so that the load is spread across replicas while slow ones are avoided.
+// Replicas lagging behind the primary by more than the allowed replication offset,
+// from INFO replication, are not used until they catch up.
+// If no replica is usable, reads fall back to the primary.
+//
+// Hedged reads are opt-in for execute() of read-only commands:
+// if the reply hasn't arrived by the configured percentile of recent latency,
+// the same command is sent to another usable replica, and the first reply wins.
+// Duplicates are never sent to the primary, to keep the extra load off it.
+// The late reply is drained before the losing replica is used again.
+//
+// INFO replication is queried by a background thread every refresh interval, on its own
+// connection to each node, and the thread also reconnects broken replicas. The new connection
+// is swapped in by the next read, so reads never wait for INFO or a connect timeout.
+//
+// Same as MiniRedisClient, one instance should be used by one thread only,
+// besides the refresh thread which is internal.
+//
+
+#ifndef MiniRedisReplicatedClient_INCLUDED
+#define MiniRedisReplicatedClient_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "MiniRedisClient.h"
+
+// Status of each replica
+struct MiniRedisReplicaStats
+{
+    std::string host;
+    uint16_t port;
+    // Connected
+    bool up;
+    // Replication lag is within the allowed range
+    bool fresh;
+    // EWMA of read latency in microseconds
+    double latencyUs;
+    // Replication offset behind the primary, in bytes
+    long long lagBytes;
+    // Number of reads served
+    uint64_t reads;
+    // Number of hedged reads won by this replica
+    uint64_t hedgeWins;
+};
+
+class MiniRedisReplicatedClient
+{
+public:
+    MiniRedisReplicatedClient();
+    ~MiniRedisReplicatedClient();
+
+    // Setup of topology, before Connect()
+    void SetPrimary(const std::string& host, uint16_t port = 6379);
+    void AddReplica(const std::string& host, uint16_t port = 6379);
+    void SetTimeoutSeconds(uint32_t sec);
+
+    // Replicas behind the primary by more than maxLagBytes are not used for reads
+    // Negative value disables the staleness guard
+    void SetMaxLagBytes(long long maxLagBytes);
+    // Weight of the newest latency sample in EWMA, within (0, 1]
+    void SetEwmaAlpha(double alpha);
+    // Interval to refresh INFO replication, and to reconnect broken replicas, in background
+    void SetRefreshIntervalMs(uint32_t ms);
+    // Default deadline of each command on all connections, see MiniRedisClient
+    void SetCommandTimeoutMs(uint32_t ms);
+    // Send the duplicate read if no reply after this percentile of recent read latency
+    // percentile within (0, 1), e.g. 0.95; 0 disables hedging
+    void SetHedgePercentile(double percentile);
+    // Current delay before hedging, 0 if not enough samples yet
+    double GetHedgeDelayUs() const;
+    // Number of duplicate reads sent
+    uint64_t GetHedgeCount() const;
+
+    // Connect to primary and all replicas, query the lag once, and start the refresh thread
+    // Return false if the primary can't be connected, broken replicas are retried later
+    bool Connect();
+
+    // Wait for the refresh thread to query INFO replication of primary and replicas,
+    // and update the lag, instead of waiting for the interval
+    void RefreshReplication();
+
+    // Primary, for commands not wrapped here
+    MiniRedisClient& GetPrimary();
+    // Choose the client for one read, the primary if no replica is usable
+    // A replica client is valid until the next call of this client, which may replace it
+    // with a reconnected one
+    MiniRedisClient& GetReader();
+
+    std::vector<MiniRedisReplicaStats> GetReplicaStats() const;
+
+    // Route any read-only operation to a replica, and record its latency
+    // fn is called as bool fn(MiniRedisClient&)
+    // If the replica connection breaks during the read, the read is retried on the primary
+    template <typename F>
+    bool Read(F fn);
+
+    //////////////////////////////////////////////////
+    // Read-only commands, routed to replicas
+    //////////////////////////////////////////////////
+    bool exists(const std::string& key, long long int& replied);
+    template <typename T>
+    bool get(const std::string& key, T& replied);
+    template <typename T>
+    bool hget(const std::string& key, const std::string& field, T& replied);
+    bool hexists(const std::string& key, const std::string& field, long long int& replied);
+    bool hgetall(const std::string& key, std::map<std::string, std::string>& replied);
+    bool hkeys(const std::string& key, std::vector<std::string>& replied);
+    bool hlen(const std::string& key, long long int& replied);
+    bool hvals(const std::string& key, std::vector<std::string>& replied);
+    bool lindex(const std::string& key, int32_t index, std::string& replied);
+    bool llen(const std::string& key, long long int& replied);
+    bool scard(const std::string& key, long long int& replied);
+    bool sismember(const std::string& key, const std::string& member, long long int& replied);
+    bool smembers(const std::string& key, std::vector<std::string>& replied);
+    bool strlen(const std::string& key, long long int& replied);
+    bool ttl(const std::string& key, long long int& replied);
+    bool type(const std::string& key, std::string& replied);
+
+    //////////////////////////////////////////////////
+    // Write commands, sent to primary
+    //////////////////////////////////////////////////
+    bool del(const std::string& key, long long int& replied);
+    bool expire(const std::string& key, uint32_t seconds, long long int& replied);
+    bool hdel(const std::string& key, const std::string& field, long long int& replied);
+    bool hset(const std::string& key, const std::string& field,
+        const std::string& value, long long int& replied);
+    bool incr(const std::string& key, long long int& replied);
+    bool decr(const std::string& key, long long int& replied);
+    bool sadd(const std::string& key, const std::string& member, long long int& replied);
+    bool set(const std::string& key, const std::string& value,
+        uint32_t ttl, std::string& replied);
+    bool srem(const std::string& key, const std::string& member, long long int& replied);
+
+    // Raw command interface, read-only commands such as GET, HMGET, ZRANGE are routed to replicas
+    // and hedged if enabled
+    // User should parse and free the redisReply by freeReplyObject()
+    // A hedged read that gets no reply within the command timeout returns nullptr,
+    // with REDIS_ERROR_TIMEOUT, instead of being sent again
+    redisReply* execute(const std::string& command, const std::vector<std::string>& args);
+    // Error of the last execute() which returned nullptr
+    MiniRedisError GetLastError() const;
+
+    // Whether the command never writes, and can be served by replica
+    static bool IsReadOnlyCommand(const std::string& command);
+
+private:
+    struct Node
+    {
+        std::unique_ptr<MiniRedisClient> client;
+        bool up = false;
+        long long lagBytes = 0;
+        double ewmaUs = 0;
+        uint64_t reads = 0;
+        uint64_t hedgeWins = 0;
+        // Replies of lost hedged reads, to be drained
+        uint32_t pending = 0;
+    };
+
+    // Shared with the refresh thread, one per replica
+    struct Monitor
+    {
+        // Connection for INFO, used by the refresh thread only
+        std::unique_ptr<MiniRedisClient> client;
+        // -1 if unknown
+        std::atomic<long long> lagBytes{-1};
+
+        // Guard of below
+        std::mutex mtx;
+        // The reading connection is broken, and should be reconnected by the refresh thread
+        bool broken = false;
+        // New connection, swapped in by the reading thread
+        std::unique_ptr<MiniRedisClient> reconnected;
+    };
+
+    void Init();
+    bool IsUsable(const Node& node) const;
+    // Index of the replica chosen for next read, or -1 to use primary
+    int ChooseReplica();
+    void RecordLatency(Node& node, std::chrono::steady_clock::duration elapsed);
+    std::unique_ptr<MiniRedisClient> NewClient(const std::string& host, uint16_t port);
+    // Take the lag and reconnected replicas from the refresh thread, if it finished a round since
+    // last time, without blocking
+    void ApplyRefresh();
+    // One round of INFO and reconnecting, on the refresh thread
+    void RefreshOnce();
+    void ThreadRoutine();
+    void Stop();
+
+    // Read and drop the replies of lost hedged reads
+    void DrainPending(int index);
+    // Usable replica other than except, or -1 if none
+    int ChooseOther(int except);
+    // Recent latency for the hedge delay
+    void RecordSample(double us);
+    // timedOut is set if the command was sent but no reply arrived within the command timeout
+    redisReply* ExecuteHedged(const std::vector<std::string>& argv, bool& timedOut);
+
+private:
+    std::unique_ptr<MiniRedisClient> primary;
+    std::vector<Node> replicas;
+    uint32_t timeoutSeconds;
+    long long maxLagBytes;
+    double ewmaAlpha;
+    uint32_t refreshIntervalMs;
+    std::minstd_rand rng;
+
+    std::unique_ptr<MiniRedisClient> primaryMonitor;
+    std::vector<std::unique_ptr<Monitor>> monitors;
+    std::thread refreshThread;
+    // Guard of running, requested and completed, and the settings read by the refresh thread
+    std::mutex refreshMutex;
+    std::condition_variable refreshCv;
+    bool running;
+    // Rounds requested by RefreshReplication(), and the latest one completed
+    uint64_t requested;
+    uint64_t completed;
+    // Rounds finished by the refresh thread, and the last one applied by the reading thread
+    std::atomic<uint64_t> refreshes;
+    uint64_t applied;
+
+    uint32_t commandTimeoutMs;
+    double hedgePercentile;
+    // Ring of recent read latency in microseconds
+    std::vector<double> samples;
+    std::size_t sampleNext;
+    uint64_t sampleCount;
+    // Recomputed from the ring periodically, instead of sorting on each read
+    double hedgeDelayUs;
+    uint64_t hedges;
+    MiniRedisError lastError;
+};
+
+template <typename F>
+bool MiniRedisReplicatedClient::Read(F fn)
+{
+    ApplyRefresh();
+
+    int index = ChooseReplica();
+    if (index < 0)
+    {
+        return fn(*primary);
+    }
+
+    DrainPending(index);
+    Node& node = replicas[index];
+    auto start = std::chrono::steady_clock::now();
+    bool ret = fn(*node.client);
+    if (!node.client->IsConnected())
+    {
+        // Retry on primary, and the refresh thread reconnects the replica
+        node.up = false;
+        return fn(*primary);
+    }
+
+    RecordLatency(node, std::chrono::steady_clock::now() - start);
+    node.reads++;
+    return ret;
+}
+
+template <typename T>
+bool MiniRedisReplicatedClient::get(const std::string& key, T& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.get(key, replied); });
+}
+
+template <typename T>
+bool MiniRedisReplicatedClient::hget(const std::string& key, const std::string& field, T& replied)
+{
+    return Read([&](MiniRedisClient& c) { return c.hget(key, field, replied); });
+}
+
+#endif // MiniRedisReplicatedClient_INCLUDED
@@ -0,0 +1,615 @@
+// Standalone RESP2/RESP3 codec, independent of hiredis
+
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include "MiniRedisRespCodec.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MINIREDIS_RESP_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // memchr of libc is vectorized on most platforms, but costs a call for each short line
+    const char* FindCrScalar(const char* begin, const char* end)
+    {
+        return (const char*)memchr(begin, '\r', end - begin);
+    }
+
+    bool ParseDigitsScalar(const char* str, std::size_t len, const char*, uint64_t& value)
+    {
+        uint64_t result = 0;
+        for (std::size_t i = 0; i < len; i++)
+        {
+            unsigned digit = (unsigned char)str[i] - '0';
+            if (digit > 9)
+            {
+                return false;
+            }
+            result = result * 10 + digit;
+        }
+        value = result;
+        return true;
+    }
+
+#ifdef MINIREDIS_RESP_X86
+    __attribute__((target("sse2")))
+    const char* FindCrSse2(const char* begin, const char* end)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const char* p = begin;
+        for (; p + 16 <= end; p += 16)
+        {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), cr));
+            if (mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        for (; p < end; p++)
+        {
+            if (*p == '\r')
+            {
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    __attribute__((target("avx2")))
+    const char* FindCrAvx2(const char* begin, const char* end)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const char* p = begin;
+        for (; p + 32 <= end; p += 32)
+        {
+            unsigned mask = (unsigned)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), cr));
+            if (mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        // Lines are mostly short, so the tail is still worth one 16 bytes step
+        if (p + 16 <= end)
+        {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p),
+                _mm_set1_epi8('\r')));
+            if (mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+            p += 16;
+        }
+        for (; p < end; p++)
+        {
+            if (*p == '\r')
+            {
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    // Shuffle masks moving len digits to the right end of 16 bytes, and zeroing the rest
+    struct DigitShuffles
+    {
+        alignas(16) int8_t masks[17][16];
+
+        constexpr DigitShuffles() : masks()
+        {
+            for (int len = 0; len <= 16; len++)
+            {
+                for (int i = 0; i < 16; i++)
+                {
+                    int src = i - (16 - len);
+                    masks[len][i] = (src < 0) ? (int8_t)0x80 : (int8_t)src;
+                }
+            }
+        }
+    };
+
+    constexpr DigitShuffles digitShuffles;
+
+    // Up to 16 digits are loaded at once, right aligned, and combined pairwise:
+    // 16 digits -> 8 of 2 digits -> 4 of 4 digits -> 2 of 8 digits
+    __attribute__((target("avx2")))
+    bool ParseDigitsAvx2(const char* str, std::size_t len, const char* limit, uint64_t& value)
+    {
+        if ((len > 16) || (str + 16 > limit))
+        {
+            return ParseDigitsScalar(str, len, limit, value);
+        }
+
+        __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)str), _mm_set1_epi8('0'));
+        // Bytes out of 0 - 9, including those below '0' which wrap around
+        unsigned valid = (unsigned)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_max_epu8(digits, _mm_set1_epi8(9)), _mm_set1_epi8(9)));
+        unsigned needed = (1u << len) - 1;
+        if ((valid & needed) != needed)
+        {
+            return false;
+        }
+
+        digits = _mm_shuffle_epi8(digits, _mm_load_si128((const __m128i*)digitShuffles.masks[len]));
+        __m128i pairs = _mm_maddubs_epi16(digits, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1,
+            10, 1, 10, 1, 10, 1, 10, 1));
+        __m128i quads = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+        quads = _mm_packus_epi32(quads, quads);
+        __m128i octs = _mm_madd_epi16(quads, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+        uint64_t high = (uint32_t)_mm_cvtsi128_si32(octs);
+        uint64_t low = (uint32_t)_mm_extract_epi32(octs, 1);
+        value = high * 100000000 + low;
+        return true;
+    }
+#endif
+
+    enum SimdLevel
+    {
+        SIMD_SCALAR,
+        SIMD_SSE2,
+        SIMD_AVX2
+    };
+
+    SimdLevel DetectSimdLevel()
+    {
+#ifdef MINIREDIS_RESP_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return SIMD_AVX2;
+        }
+        if (__builtin_cpu_supports("sse2"))
+        {
+            return SIMD_SSE2;
+        }
+#endif
+        return SIMD_SCALAR;
+    }
+
+    SimdLevel GetSimdLevel()
+    {
+        static const SimdLevel level = DetectSimdLevel();
+        return level;
+    }
+
+    // Append unsigned decimal, most lengths are a single digit
+    char* WriteDecimal(char* p, std::size_t n)
+    {
+        if (n < 10)
+        {
+            *p = (char)('0' + n);
+            return p + 1;
+        }
+        return std::to_chars(p, p + 20, n).ptr;
+    }
+
+    // Array of bulk strings, T is std::string or std::string_view
+    template <typename T>
+    void AppendArgs(std::string& buf, const T* argv, std::size_t argc)
+    {
+        std::size_t size = 1 + 20 + 2;
+        for (std::size_t i = 0; i < argc; i++)
+        {
+            size += 1 + 20 + 2 + argv[i].size() + 2;
+        }
+        buf.reserve(buf.size() + size);
+
+        // The \r\n after each argument goes out with the next header
+        char header[64];
+        header[0] = '*';
+        char* p = WriteDecimal(header + 1, argc);
+        for (std::size_t i = 0; i < argc; i++)
+        {
+            *p++ = '\r';
+            *p++ = '\n';
+            *p++ = '$';
+            p = WriteDecimal(p, argv[i].size());
+            *p++ = '\r';
+            *p++ = '\n';
+            buf.append(header, p - header);
+            buf.append(argv[i].data(), argv[i].size());
+            p = header;
+        }
+        buf.append(header, p - header);
+        buf.append("\r\n", 2);
+    }
+}
+
+bool MiniRedisRespReply::GetStrings(std::size_t index, std::vector<std::string>& replied) const
+{
+    replied.clear();
+    if (index >= nodes.size())
+    {
+        return false;
+    }
+
+    const MiniRedisRespNode& parent = nodes[index];
+    if ((parent.type != RESP_TYPE_ARRAY) && (parent.type != RESP_TYPE_MAP) &&
+        (parent.type != RESP_TYPE_SET) && (parent.type != RESP_TYPE_PUSH))
+    {
+        return false;
+    }
+
+    replied.reserve((std::size_t)parent.value);
+    for (std::size_t i = index + 1; i < parent.next; i = nodes[i].next)
+    {
+        const MiniRedisRespNode& node = nodes[i];
+        switch (node.type)
+        {
+        case RESP_TYPE_NIL:
+            replied.emplace_back();
+            break;
+        case RESP_TYPE_INTEGER:
+        case RESP_TYPE_BOOL:
+            replied.push_back(std::to_string(node.value));
+            break;
+        case RESP_TYPE_ARRAY:
+        case RESP_TYPE_MAP:
+        case RESP_TYPE_SET:
+        case RESP_TYPE_PUSH:
+            replied.clear();
+            return false;
+        default:
+            replied.emplace_back(payload.data() + node.offset, (std::size_t)node.value);
+            break;
+        }
+    }
+    return true;
+}
+
+MiniRedisRespDecoder::MiniRedisRespDecoder(bool useSimd, std::size_t maxDepth)
+    : maxDepth(maxDepth)
+{
+    findCr = FindCrScalar;
+    parseDigits = ParseDigitsScalar;
+#ifdef MINIREDIS_RESP_X86
+    if (useSimd)
+    {
+        SimdLevel level = ::GetSimdLevel();
+        if (level == SIMD_AVX2)
+        {
+            findCr = FindCrAvx2;
+            parseDigits = ParseDigitsAvx2;
+        }
+        else if (level == SIMD_SSE2)
+        {
+            findCr = FindCrSse2;
+        }
+    }
+#else
+    (void)useSimd;
+#endif
+
+    start = 0;
+    pos = 0;
+    scanned = 0;
+    failed = false;
+}
+
+void MiniRedisRespDecoder::Feed(const char* data, std::size_t len)
+{
+    // Drop the replies already returned, keep the partial one
+    if (start > 0)
+    {
+        buf.erase(0, start);
+        pos -= start;
+        scanned = (scanned > start) ? (scanned - start) : 0;
+        start = 0;
+    }
+    buf.append(data, len);
+}
+
+MiniRedisRespResult MiniRedisRespDecoder::GetReply(MiniRedisRespReply& replied)
+{
+    if (failed)
+    {
+        return RESP_DECODE_ERROR;
+    }
+
+    while (true)
+    {
+        const char* data = buf.data();
+        const char* end = data + buf.size();
+        if (pos + 1 > buf.size())
+        {
+            return RESP_DECODE_INCOMPLETE;
+        }
+
+        const char* cr = findCr(data + std::max(pos + 1, scanned), end);
+        if (!cr)
+        {
+            scanned = buf.size();
+            return RESP_DECODE_INCOMPLETE;
+        }
+        if (cr + 1 == end)
+        {
+            scanned = cr - data;
+            return RESP_DECODE_INCOMPLETE;
+        }
+        if (cr[1] != '\n')
+        {
+            return Fail("Protocol error, expected \\n after \\r");
+        }
+
+        if (nodes.size() >= std::numeric_limits<uint32_t>::max())
+        {
+            return Fail("Protocol error, too many elements");
+        }
+
+        char type = data[pos];
+        const char* line = data + pos + 1;
+        std::size_t next = cr + 2 - data;
+        MiniRedisRespNode node;
+        node.offset = line - data - start;
+        node.value = cr - line;
+        node.next = 0;
+        node.type = (MiniRedisRespType)type;
+        bool attribute = false;
+
+        switch (type)
+        {
+        case '+':
+        case '-':
+        case ',':
+        case '(':
+            break;
+        case ':':
+            if (!ParseInteger(line, cr, end, node.value))
+            {
+                return Fail("Protocol error, bad integer");
+            }
+            break;
+        case '#':
+            if ((cr - line != 1) || ((line[0] != 't') && (line[0] != 'f')))
+            {
+                return Fail("Protocol error, bad bool");
+            }
+            node.value = (line[0] == 't');
+            break;
+        case '_':
+            if (cr != line)
+            {
+                return Fail("Protocol error, bad null");
+            }
+            node.value = 0;
+            break;
+        case '$':
+        case '!':
+        case '=':
+        {
+            int64_t len = 0;
+            if (!ParseInteger(line, cr, end, len) || (len < -1) || ((len == -1) && (type != '$')))
+            {
+                return Fail("Protocol error, bad bulk length");
+            }
+            if (len == -1)
+            {
+                node.type = RESP_TYPE_NIL;
+                node.value = 0;
+                break;
+            }
+            // Header is parsed again when the body arrives, which is cheap
+            if (buf.size() - next < (uint64_t)len + 2)
+            {
+                return RESP_DECODE_INCOMPLETE;
+            }
+            if ((data[next + len] != '\r') || (data[next + len + 1] != '\n'))
+            {
+                return Fail("Protocol error, bad bulk string end");
+            }
+
+            node.offset = next - start;
+            node.value = len;
+            if (type == '!')
+            {
+                node.type = RESP_TYPE_ERROR;
+            }
+            else if (type == '=')
+            {
+                if ((len < 4) || (data[next + 3] != ':'))
+                {
+                    return Fail("Protocol error, bad verbatim string");
+                }
+                node.offset += 4;
+                node.value -= 4;
+            }
+            next += len + 2;
+            break;
+        }
+        case '*':
+        case '~':
+        case '>':
+        case '%':
+        case '|':
+        {
+            int64_t count = 0;
+            if (!ParseInteger(line, cr, end, count) || (count < -1) || ((count == -1) && (type != '*')) ||
+                (count > std::numeric_limits<int32_t>::max()))
+            {
+                return Fail("Protocol error, bad aggregate length");
+            }
+            if (count == -1)
+            {
+                node.type = RESP_TYPE_NIL;
+                node.value = 0;
+                break;
+            }
+            if ((type == '%') || (type == '|'))
+            {
+                count *= 2;
+            }
+            attribute = (type == '|');
+            node.value = count;
+            if (count == 0)
+            {
+                break;
+            }
+            if (stack.size() >= maxDepth)
+            {
+                return Fail("Protocol error, nested too deep");
+            }
+
+            // Each child takes 3 bytes at least, so a bogus count can't reserve much
+            std::size_t index = nodes.size();
+            std::size_t needed = index + 1 + std::min<std::size_t>(count, (buf.size() - next) / 3);
+            if (needed > nodes.capacity())
+            {
+                nodes.reserve(std::max(needed, nodes.capacity() * 2));
+            }
+            nodes.push_back(node);
+            stack.push_back({index, count, attribute});
+            pos = next;
+            continue;
+        }
+        default:
+            return Fail("Protocol error, unknown type");
+        }
+
+        pos = next;
+        std::size_t index = nodes.size();
+        nodes.push_back(node);
+        if (!Complete(index, attribute))
+        {
+            continue;
+        }
+
+        replied.nodes.swap(nodes);
+        nodes.clear();
+        stack.clear();
+        if ((start == 0) && (pos == buf.size()))
+        {
+            // The whole buffer is the reply, which is common for large replies
+            replied.payload.swap(buf);
+            buf.clear();
+            pos = 0;
+        }
+        else
+        {
+            replied.payload.assign(data + start, pos - start);
+            start = pos;
+        }
+        scanned = 0;
+        return RESP_DECODE_OK;
+    }
+}
+
+bool MiniRedisRespDecoder::Complete(std::size_t index, bool attribute)
+{
+    while (true)
+    {
+        // Attributes are dropped, and not counted in the parent
+        if (attribute)
+        {
+            nodes.resize(index);
+            return false;
+        }
+
+        nodes[index].next = (uint32_t)nodes.size();
+        if (stack.empty())
+        {
+            return true;
+        }
+
+        Frame& top = stack.back();
+        if (--top.remaining > 0)
+        {
+            return false;
+        }
+        index = top.index;
+        attribute = top.attribute;
+        stack.pop_back();
+    }
+}
+
+bool MiniRedisRespDecoder::ParseInteger(const char* begin, const char* end, const char* limit, 
+    int64_t& value) const
+{
+    std::size_t len = end - begin;
+    if ((len == 0) || (len > 20))
+    {
+        return false;
+    }
+
+    bool negative = (begin[0] == '-');
+    std::size_t digits = len - negative;
+    if ((digits == 0) || (digits > 16))
+    {
+        // Near the limit of int64_t, from_chars checks overflow
+        auto res = std::from_chars(begin, end, value);
+        return (res.ec == std::errc()) && (res.ptr == end);
+    }
+
+    uint64_t result = 0;
+    bool ok = (digits >= 9) ? parseDigits(begin + negative, digits, limit, result) :
+        ParseDigitsScalar(begin + negative, digits, limit, result);
+    if (!ok)
+    {
+        return false;
+    }
+    value = negative ? -(int64_t)result : (int64_t)result;
+    return true;
+}
+
+MiniRedisRespResult MiniRedisRespDecoder::Fail(const char* error)
+{
+    failed = true;
+    this->error = error;
+    return RESP_DECODE_ERROR;
+}
+
+void MiniRedisRespDecoder::Reset()
+{
+    buf.clear();
+    start = 0;
+    pos = 0;
+    scanned = 0;
+    nodes.clear();
+    stack.clear();
+    failed = false;
+    error.clear();
+}
+
+const std::string& MiniRedisRespDecoder::GetError() const
+{
+    return error;
+}
+
+std::size_t MiniRedisRespDecoder::GetBuffered() const
+{
+    return buf.size() - start;
+}
+
+const char* MiniRedisRespDecoder::GetSimdLevel()
+{
+    switch (::GetSimdLevel())
+    {
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+namespace MiniRedisResp
+{
+    void AppendCommand(std::string& buf, const std::string_view* argv, std::size_t argc)
+    {
+        AppendArgs(buf, argv, argc);
+    }
+
+    void AppendCommand(std::string& buf, std::initializer_list<std::string_view> argv)
+    {
+        AppendArgs(buf, argv.begin(), argv.size());
+    }
+
+    void AppendCommand(std::string& buf, const std::vector<std::string>& argv)
+    {
+        AppendArgs(buf, argv.data(), argv.size());
+    }
+}
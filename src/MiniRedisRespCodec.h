@@ -0,0 +1,152 @@
+// Standalone RESP2/RESP3 codec, independent of hiredis
+// Replies are decoded into a flat layout, instead of a tree of redisReply:
+//   nodes    one array of MiniRedisRespNode in pre-order, children follow their aggregate
+//   payload  raw bytes of the reply, strings are offsets into it
+// so a reply of any size takes two buffers, which are reused when the same reply object
+// is passed again, and walking a large array reads memory in order.
+//
+// Lines are scanned for \r 16 or 32 bytes at a time by SSE2 or AVX2, and integers of 9 digits
+// or more are parsed by SIMD multiply-add. The CPU is checked once at runtime, and other CPUs,
+// or decoders created with useSimd false, use scalar code.
+//
+//   MiniRedisRespDecoder decoder;
+//   decoder.Feed(buf, len);
+//   MiniRedisRespReply reply;
+//   while (decoder.GetReply(reply) == RESP_DECODE_OK)
+//   {
+//       const MiniRedisRespNode& root = reply.nodes[0];
+//       // Children of aggregate i start at i + 1, and each is followed by nodes[child].next
+//   }
+//
+// RESP3 attributes are parsed and dropped, streamed strings and aggregates are not supported.
+//
+
+#ifndef MiniRedisRespCodec_INCLUDED
+#define MiniRedisRespCodec_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <initializer_list>
+
+// Type byte of the protocol, blob error is decoded as error, and null of any form as nil
+enum MiniRedisRespType : uint8_t
+{
+    RESP_TYPE_STRING = '$',
+    RESP_TYPE_STATUS = '+',
+    RESP_TYPE_ERROR = '-',
+    RESP_TYPE_INTEGER = ':',
+    RESP_TYPE_NIL = '_',
+    RESP_TYPE_ARRAY = '*',
+    RESP_TYPE_MAP = '%',
+    RESP_TYPE_SET = '~',
+    RESP_TYPE_PUSH = '>',
+    RESP_TYPE_BOOL = '#',
+    RESP_TYPE_DOUBLE = ',',
+    RESP_TYPE_BIGNUM = '(',
+    // Content without the 3 bytes format and ':'
+    RESP_TYPE_VERBATIM = '='
+};
+
+struct MiniRedisRespNode
+{
+    // Content in payload, for string, status, error, double, bignum and verbatim
+    uint64_t offset;
+    // Length of content, integer, 1 or 0 of bool,
+    // or number of children of aggregate, 2 per entry of map
+    int64_t value;
+    // Index of the node after this one and all its children
+    uint32_t next;
+    MiniRedisRespType type;
+};
+
+struct MiniRedisRespReply
+{
+    std::vector<MiniRedisRespNode> nodes;
+    std::string payload;
+
+    std::string_view GetString(const MiniRedisRespNode& node) const
+    {
+        return std::string_view(payload.data() + node.offset, (std::size_t)node.value);
+    }
+
+    // Content of the direct children of aggregate at index, nil as empty string
+    // Return false if it is not an aggregate, or any child is an aggregate
+    bool GetStrings(std::size_t index, std::vector<std::string>& replied) const;
+};
+
+enum MiniRedisRespResult
+{
+    RESP_DECODE_OK,
+    // Need more input
+    RESP_DECODE_INCOMPLETE,
+    // Protocol error, the decoder should be reset with the connection
+    RESP_DECODE_ERROR
+};
+
+class MiniRedisRespDecoder
+{
+public:
+    // Deeper nesting than maxDepth is a protocol error
+    explicit MiniRedisRespDecoder(bool useSimd = true, std::size_t maxDepth = 64);
+
+    // Append input, the data is copied
+    void Feed(const char* data, std::size_t len);
+    // Decode the next reply into replied, whose buffers are reused
+    MiniRedisRespResult GetReply(MiniRedisRespReply& replied);
+    // Discard input and partial reply, and clear the error
+    void Reset();
+
+    const std::string& GetError() const;
+    // Bytes fed and not yet returned as reply
+    std::size_t GetBuffered() const;
+
+    // "avx2", "sse2" or "scalar", as selected for this CPU
+    static const char* GetSimdLevel();
+
+private:
+    struct Frame
+    {
+        std::size_t index;
+        int64_t remaining;
+        bool attribute;
+    };
+
+    using FindCrFunc = const char* (*)(const char* begin, const char* end);
+    // limit is the end of readable memory, which may be past the digits
+    using ParseDigitsFunc = bool (*)(const char* str, std::size_t len, const char* limit, uint64_t& value);
+
+    MiniRedisRespResult Fail(const char* error);
+    bool ParseInteger(const char* begin, const char* end, const char* limit, int64_t& value) const;
+    // Link the finished node to its parent, return true if the reply is complete
+    bool Complete(std::size_t index, bool attribute);
+
+private:
+    FindCrFunc findCr;
+    ParseDigitsFunc parseDigits;
+    std::size_t maxDepth;
+
+    std::string buf;
+    // Start of the current reply in buf
+    std::size_t start;
+    // Next line to parse
+    std::size_t pos;
+    // Scanned without \r from pos up to here, so that a long line is not scanned again
+    std::size_t scanned;
+    // Partial reply
+    std::vector<MiniRedisRespNode> nodes;
+    std::vector<Frame> stack;
+    bool failed;
+    std::string error;
+};
+
+namespace MiniRedisResp
+{
+    // Append the command as an array of bulk strings, same as redisFormatCommandArgv()
+    void AppendCommand(std::string& buf, const std::string_view* argv, std::size_t argc);
+    void AppendCommand(std::string& buf, std::initializer_list<std::string_view> argv);
+    void AppendCommand(std::string& buf, const std::vector<std::string>& argv);
+}
+
+#endif // MiniRedisRespCodec_INCLUDED
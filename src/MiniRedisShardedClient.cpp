@@ -0,0 +1,466 @@
+// Client-side sharding across standalone Redis instances
+
+#include <algorithm>
+#include <hiredis/hiredis.h>
+#include "MiniRedisShardedClient.h"
+#include "MiniRedisLogger.h"
+
+MiniRedisShardedClient::MiniRedisShardedClient()
+{
+    Init();
+}
+
+MiniRedisShardedClient::~MiniRedisShardedClient()
+{
+}
+
+void MiniRedisShardedClient::Init()
+{
+    // Same as ketama
+    virtualNodes = 160;
+    timeoutSeconds = 3;
+    connected = false;
+}
+
+bool MiniRedisShardedClient::AddShard(const std::string& host, uint16_t port, uint32_t weight)
+{
+    Shard shard;
+    shard.client = std::make_unique<MiniRedisClient>();
+    shard.client->SetHost(host);
+    shard.client->SetPort(port);
+    shard.client->SetTimeoutSeconds(timeoutSeconds);
+    shard.weight = weight ? weight : 1;
+
+    bool ret = true;
+    if (connected)
+    {
+        ret = shard.client->Connect();
+    }
+
+    shards.push_back(std::move(shard));
+    BuildRing();
+    return ret;
+}
+
+void MiniRedisShardedClient::SetVirtualNodes(uint32_t count)
+{
+    virtualNodes = count ? count : 1;
+    BuildRing();
+}
+
+void MiniRedisShardedClient::SetTimeoutSeconds(uint32_t sec)
+{
+    timeoutSeconds = sec;
+}
+
+bool MiniRedisShardedClient::Connect()
+{
+    bool ret = !shards.empty();
+    for (auto& shard : shards)
+    {
+        shard.client->SetTimeoutSeconds(timeoutSeconds);
+        if (!shard.client->Connect())
+        {
+            ret = false;
+        }
+    }
+
+    connected = true;
+    return ret;
+}
+
+std::size_t MiniRedisShardedClient::GetShardCount() const
+{
+    return shards.size();
+}
+
+std::string_view MiniRedisShardedClient::GetHashTag(const std::string& key)
+{
+    std::size_t start = key.find('{');
+    if (start != std::string::npos)
+    {
+        std::size_t end = key.find('}', start + 1);
+        if ((end != std::string::npos) && (end > start + 1))
+        {
+            return std::string_view(key).substr(start + 1, end - start - 1);
+        }
+    }
+
+    return key;
+}
+
+std::size_t MiniRedisShardedClient::GetShardIndex(const std::string& key) const
+{
+    if (ring.empty())
+    {
+        return 0;
+    }
+
+    uint64_t h = Hash(GetHashTag(key));
+    auto iter = std::lower_bound(ring.begin(), ring.end(), std::make_pair(h, (uint32_t)0));
+    if (iter == ring.end())
+    {
+        // Wrap around the ring
+        iter = ring.begin();
+    }
+    return iter->second;
+}
+
+MiniRedisClient& MiniRedisShardedClient::GetShard(const std::string& key)
+{
+    return GetShardByIndex(GetShardIndex(key));
+}
+
+MiniRedisClient& MiniRedisShardedClient::GetShardByIndex(std::size_t index)
+{
+    if (index >= shards.size())
+    {
+        MINIREDIS_LOG_ERROR("No Redis instance %zu of %zu", index, shards.size());
+        return noShard;
+    }
+    return *shards[index].client;
+}
+
+void MiniRedisShardedClient::BuildRing()
+{
+    // Positions of virtual nodes depend on host:port only,
+    // so that they are stable when other instances are added
+    ring.clear();
+    for (std::size_t i = 0; i < shards.size(); i++)
+    {
+        const MiniRedisClient& client = *shards[i].client;
+        std::string name = client.GetHost() + ":" + std::to_string(client.GetPort());
+        uint32_t count = virtualNodes * shards[i].weight;
+        for (uint32_t v = 0; v < count; v++)
+        {
+            std::string node = name + "-" + std::to_string(v);
+            ring.emplace_back(Hash(node), (uint32_t)i);
+        }
+    }
+
+    std::sort(ring.begin(), ring.end());
+}
+
+uint64_t MiniRedisShardedClient::Hash(std::string_view data)
+{
+    // FNV-1a, with the finalizer of MurmurHash3 to spread the bits
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : data)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+std::vector<std::vector<std::size_t>> MiniRedisShardedClient::GroupByShard(
+    const std::vector<std::string>& keys) const
+{
+    std::vector<std::vector<std::size_t>> groups(shards.size());
+    for (std::size_t i = 0; i < keys.size(); i++)
+    {
+        groups[GetShardIndex(keys[i])].push_back(i);
+    }
+    return groups;
+}
+
+std::string MiniRedisShardedClient::ReplyToString(redisReply* reply)
+{
+    std::string ans;
+    if (!reply)
+    {
+        return ans;
+    }
+
+    if ((reply->type == REDIS_REPLY_STATUS) || (reply->type == REDIS_REPLY_STRING) ||
+        (reply->type == REDIS_REPLY_VERB) || (reply->type == REDIS_REPLY_DOUBLE))
+    {
+        ans = std::string(reply->str, reply->len);
+    }
+    else if ((reply->type == REDIS_REPLY_INTEGER) || (reply->type == REDIS_REPLY_BOOL))
+    {
+        ans = std::to_string(reply->integer);
+    }
+    freeReplyObject(reply);
+    return ans;
+}
+
+bool MiniRedisShardedClient::del(const std::string& key, long long int& replied)
+{
+    return GetShard(key).del(key, replied);
+}
+
+bool MiniRedisShardedClient::exists(const std::string& key, long long int& replied)
+{
+    return GetShard(key).exists(key, replied);
+}
+
+bool MiniRedisShardedClient::expire(const std::string& key, uint32_t seconds,
+    long long int& replied)
+{
+    return GetShard(key).expire(key, seconds, replied);
+}
+
+bool MiniRedisShardedClient::hdel(const std::string& key, const std::string& field,
+    long long int& replied)
+{
+    return GetShard(key).hdel(key, field, replied);
+}
+
+bool MiniRedisShardedClient::hgetall(const std::string& key,
+    std::map<std::string, std::string>& replied)
+{
+    return GetShard(key).hgetall(key, replied);
+}
+
+bool MiniRedisShardedClient::hset(const std::string& key, const std::string& field,
+    const std::string& value, long long int& replied)
+{
+    return GetShard(key).hset(key, field, value, replied);
+}
+
+bool MiniRedisShardedClient::incr(const std::string& key, long long int& replied)
+{
+    return GetShard(key).incr(key, replied);
+}
+
+bool MiniRedisShardedClient::decr(const std::string& key, long long int& replied)
+{
+    return GetShard(key).decr(key, replied);
+}
+
+bool MiniRedisShardedClient::set(const std::string& key, const std::string& value,
+    uint32_t ttl, std::string& replied)
+{
+    return GetShard(key).set(key, value, ttl, replied);
+}
+
+bool MiniRedisShardedClient::ttl(const std::string& key, long long int& replied)
+{
+    return GetShard(key).ttl(key, replied);
+}
+
+bool MiniRedisShardedClient::del(const std::vector<std::string>& keys, long long int& replied)
+{
+    replied = 0;
+    if (keys.empty() || shards.empty())
+    {
+        return false;
+    }
+
+    // Send DEL to all owning instances first, then collect
+    auto groups = GroupByShard(keys);
+    bool ret = true;
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        if (groups[s].empty())
+        {
+            continue;
+        }
+
+        std::vector<std::string> argv = {"DEL"};
+        for (auto i : groups[s])
+        {
+            argv.push_back(keys[i]);
+        }
+        ret = shards[s].client->PipelineAppend(argv) && ret;
+        ret = shards[s].client->PipelineFlush() && ret;
+    }
+
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        if (groups[s].empty())
+        {
+            continue;
+        }
+
+        redisReply* reply = shards[s].client->PipelineGetReply();
+        if (reply && (reply->type == REDIS_REPLY_INTEGER))
+        {
+            replied += reply->integer;
+        }
+        else
+        {
+            ret = false;
+        }
+        freeReplyObject(reply);
+    }
+
+    return ret;
+}
+
+bool MiniRedisShardedClient::mget(const std::vector<std::string>& keys,
+    std::vector<std::string>& replied)
+{
+    replied.assign(keys.size(), std::string());
+    if (keys.empty() || shards.empty())
+    {
+        return false;
+    }
+
+    auto groups = GroupByShard(keys);
+    bool ret = true;
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        if (groups[s].empty())
+        {
+            continue;
+        }
+
+        std::vector<std::string> argv = {"MGET"};
+        for (auto i : groups[s])
+        {
+            argv.push_back(keys[i]);
+        }
+        ret = shards[s].client->PipelineAppend(argv) && ret;
+        ret = shards[s].client->PipelineFlush() && ret;
+    }
+
+    // Put the values back to the positions of their keys
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        if (groups[s].empty())
+        {
+            continue;
+        }
+
+        redisReply* reply = shards[s].client->PipelineGetReply();
+        if (reply && (reply->type == REDIS_REPLY_ARRAY) && (reply->elements == groups[s].size()))
+        {
+            for (std::size_t j = 0; j < reply->elements; j++)
+            {
+                redisReply* elem = reply->element[j];
+                if (elem->type == REDIS_REPLY_STRING)
+                {
+                    replied[groups[s][j]].assign(elem->str, elem->len);
+                }
+            }
+        }
+        else
+        {
+            ret = false;
+        }
+        freeReplyObject(reply);
+    }
+
+    return ret;
+}
+
+bool MiniRedisShardedClient::mset(const std::vector<std::pair<std::string, std::string>>& items)
+{
+    if (items.empty() || shards.empty())
+    {
+        return false;
+    }
+
+    std::vector<std::string> keys;
+    keys.reserve(items.size());
+    for (auto& x : items)
+    {
+        keys.push_back(x.first);
+    }
+
+    auto groups = GroupByShard(keys);
+    bool ret = true;
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        if (groups[s].empty())
+        {
+            continue;
+        }
+
+        std::vector<std::string> argv = {"MSET"};
+        for (auto i : groups[s])
+        {
+            argv.push_back(items[i].first);
+            argv.push_back(items[i].second);
+        }
+        ret = shards[s].client->PipelineAppend(argv) && ret;
+        ret = shards[s].client->PipelineFlush() && ret;
+    }
+
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        if (groups[s].empty())
+        {
+            continue;
+        }
+
+        redisReply* reply = shards[s].client->PipelineGetReply();
+        ret = reply && (reply->type == REDIS_REPLY_STATUS) && ret;
+        freeReplyObject(reply);
+    }
+
+    return ret;
+}
+
+bool MiniRedisShardedClient::pipeline(const std::vector<std::string>& commands,
+    std::vector<std::string>& replied)
+{
+    replied.assign(commands.size(), std::string());
+    if (commands.empty() || shards.empty())
+    {
+        return false;
+    }
+
+    // The key is the second token
+    std::vector<std::string> keys;
+    keys.reserve(commands.size());
+    for (auto& x : commands)
+    {
+        std::size_t start = x.find(' ');
+        std::string key;
+        if (start != std::string::npos)
+        {
+            start = x.find_first_not_of(' ', start);
+            std::size_t end = x.find(' ', start);
+            if (start != std::string::npos)
+            {
+                key = x.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            }
+        }
+        keys.push_back(key);
+    }
+
+    auto groups = GroupByShard(keys);
+    for (std::size_t i = 0; i < commands.size(); i++)
+    {
+        if (keys[i].empty())
+        {
+            // Commands without key go to the first instance
+            auto& group = groups[GetShardIndex(keys[i])];
+            group.erase(std::find(group.begin(), group.end(), i));
+            groups[0].push_back(i);
+        }
+    }
+
+    bool ret = true;
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        std::sort(groups[s].begin(), groups[s].end());
+        for (auto i : groups[s])
+        {
+            ret = shards[s].client->PipelineAppend(commands[i]) && ret;
+        }
+        if (!groups[s].empty())
+        {
+            ret = shards[s].client->PipelineFlush() && ret;
+        }
+    }
+
+    for (std::size_t s = 0; s < groups.size(); s++)
+    {
+        for (auto i : groups[s])
+        {
+            replied[i] = ReplyToString(shards[s].client->PipelineGetReply());
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,128 @@
+// Client-side sharding across standalone Redis instances
+// Keys are mapped to instances by consistent hashing in the style of ketama:
+// each instance owns virtual nodes on a 64 bits hash ring, proportional to its weight,
+// and the key belongs to the first virtual node clockwise.
+// Adding an instance moves only about 1/N of the keys.
+//
+// If the key contains {hashtag}, only the hashtag is hashed,
+// so that related keys such as {user1000}.following and {user1000}.followers
+// are stored on the same instance.
+//
+// Multi-key commands are split by instance. Commands of all instances are sent first,
+// and then the replies are collected, so that the instances work in parallel.
+//
+// Same as MiniRedisClient, one instance should be used by one thread only.
+//
+
+#ifndef MiniRedisShardedClient_INCLUDED
+#define MiniRedisShardedClient_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include "MiniRedisClient.h"
+
+class MiniRedisShardedClient
+{
+public:
+    MiniRedisShardedClient();
+    ~MiniRedisShardedClient();
+
+    // Add instance with weight, the instance is connected at once if already connected
+    bool AddShard(const std::string& host, uint16_t port = 6379, uint32_t weight = 1);
+    // Virtual nodes per weight, before adding instances
+    void SetVirtualNodes(uint32_t count);
+    void SetTimeoutSeconds(uint32_t sec);
+
+    // Connect to all instances
+    bool Connect();
+
+    std::size_t GetShardCount() const;
+    // Index of the instance owning the key, 0 if there is no instance
+    std::size_t GetShardIndex(const std::string& key) const;
+    // Instance owning the key, for commands not wrapped here
+    // If there is no such instance, a client never connected, on which all commands fail
+    MiniRedisClient& GetShard(const std::string& key);
+    MiniRedisClient& GetShardByIndex(std::size_t index);
+
+    // The part to be hashed: the content of the first non-empty {...}, or the whole key
+    static std::string_view GetHashTag(const std::string& key);
+
+    //////////////////////////////////////////////////
+    // Single key commands, sent to the owning instance
+    //////////////////////////////////////////////////
+    bool del(const std::string& key, long long int& replied);
+    bool exists(const std::string& key, long long int& replied);
+    bool expire(const std::string& key, uint32_t seconds, long long int& replied);
+    template <typename T>
+    bool get(const std::string& key, T& replied);
+    bool hdel(const std::string& key, const std::string& field, long long int& replied);
+    template <typename T>
+    bool hget(const std::string& key, const std::string& field, T& replied);
+    bool hgetall(const std::string& key, std::map<std::string, std::string>& replied);
+    bool hset(const std::string& key, const std::string& field,
+        const std::string& value, long long int& replied);
+    bool incr(const std::string& key, long long int& replied);
+    bool decr(const std::string& key, long long int& replied);
+    bool set(const std::string& key, const std::string& value,
+        uint32_t ttl, std::string& replied);
+    bool ttl(const std::string& key, long long int& replied);
+
+    //////////////////////////////////////////////////
+    // Multi key commands, fanned out to the owning instances
+    //////////////////////////////////////////////////
+    // Reply the total number of keys that were removed
+    bool del(const std::vector<std::string>& keys, long long int& replied);
+    // https://redis.io/commands/mget/
+    // Values in the same order as keys, empty string for keys not existing
+    bool mget(const std::vector<std::string>& keys, std::vector<std::string>& replied);
+    // https://redis.io/commands/mset/
+    bool mset(const std::vector<std::pair<std::string, std::string>>& items);
+
+    // Same format as MiniRedisClient::pipeline()
+    // The second token of each command is the key for routing, e.g. "INCR counter"
+    // Commands without key, like PING, are sent to the first instance
+    // Replies are in the same order as commands
+    bool pipeline(const std::vector<std::string>& commands, std::vector<std::string>& replied);
+
+private:
+    struct Shard
+    {
+        std::unique_ptr<MiniRedisClient> client;
+        uint32_t weight;
+    };
+
+    void Init();
+    void BuildRing();
+    static uint64_t Hash(std::string_view data);
+    // Group the indexes of keys by instance
+    std::vector<std::vector<std::size_t>> GroupByShard(const std::vector<std::string>& keys) const;
+    // Convert the scalar reply to string, and release it
+    static std::string ReplyToString(redisReply* reply);
+
+private:
+    std::vector<Shard> shards;
+    // Virtual nodes sorted by hash, with the index of instance
+    std::vector<std::pair<uint64_t, uint32_t>> ring;
+    uint32_t virtualNodes;
+    uint32_t timeoutSeconds;
+    bool connected;
+    // Returned by GetShard() without instances
+    MiniRedisClient noShard;
+};
+
+template <typename T>
+bool MiniRedisShardedClient::get(const std::string& key, T& replied)
+{
+    return GetShard(key).get(key, replied);
+}
+
+template <typename T>
+bool MiniRedisShardedClient::hget(const std::string& key, const std::string& field, T& replied)
+{
+    return GetShard(key).hget(key, field, replied);
+}
+
+#endif // MiniRedisShardedClient_INCLUDED
@@ -0,0 +1,95 @@
+// Map C++ structs to Redis hashes, with the fields listed once at compile time
+
+#include <hiredis/hiredis.h>
+#include "MiniRedisStruct.h"
+#include "MiniRedisLogger.h"
+
+namespace MiniRedisStruct
+{
+    namespace Detail
+    {
+        bool AppendWrite(const MiniRedisClient& client, const std::string_view* argv, std::size_t argc,
+            uint32_t ttl)
+        {
+            if (!client.PipelineAppend(argv, argc))
+            {
+                return false;
+            }
+            if (ttl == 0)
+            {
+                return true;
+            }
+
+            char buf[MiniRedisNumeric::MaxChars];
+            std::string_view expire[3] = {"EXPIRE", argv[1],
+                std::string_view(buf, MiniRedisNumeric::ToChars(buf, sizeof(buf), ttl))};
+            if (!client.PipelineAppend(expire, 3))
+            {
+                // The caller reads no reply on failure, so drain the HSET already appended
+                freeReplyObject(client.PipelineGetReply());
+                return false;
+            }
+            return true;
+        }
+
+        bool GetWriteReply(const MiniRedisClient& client, uint32_t ttl)
+        {
+            bool ret = true;
+            for (int i = 0; i < (ttl ? 2 : 1); i++)
+            {
+                redisReply* reply = client.PipelineGetReply();
+                if (!reply)
+                {
+                    return false;
+                }
+                if (reply->type == REDIS_REPLY_ERROR)
+                {
+                    MINIREDIS_LOG_WARN("Failed to write struct: %s", reply->str);
+                    ret = false;
+                }
+                freeReplyObject(reply);
+            }
+            return ret;
+        }
+
+        bool GetReadReply(const MiniRedisClient& client, const FieldDecoder* decoders, std::size_t count,
+            bool& found)
+        {
+            found = false;
+            redisReply* reply = client.PipelineGetReply();
+            if (!reply)
+            {
+                return false;
+            }
+            if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != count))
+            {
+                if (reply->type == REDIS_REPLY_ERROR)
+                {
+                    MINIREDIS_LOG_WARN("Failed to read struct: %s", reply->str);
+                }
+                freeReplyObject(reply);
+                return false;
+            }
+
+            bool ret = true;
+            for (std::size_t i = 0; i < count; i++)
+            {
+                redisReply* element = reply->element[i];
+                if (element->type == REDIS_REPLY_NIL)
+                {
+                    continue;
+                }
+
+                found = true;
+                if ((element->type != REDIS_REPLY_STRING) ||
+                    !decoders[i].decode(element->str, element->len, decoders[i].member))
+                {
+                    ret = false;
+                }
+            }
+
+            freeReplyObject(reply);
+            return ret;
+        }
+    }
+}
@@ -0,0 +1,316 @@
+// Map C++ structs to Redis hashes, with the fields listed once at compile time
+//   struct User { long long id; std::string name; double score; bool active; };
+//   MINIREDIS_STRUCT(User, id, name, score, active)
+//   MiniRedisStruct::Write(client, "user:1", user);
+//   MiniRedisStruct::Read(client, "user:1", user);
+// Field names are the member names, and their order is fixed by the list.
+//
+// Write() sends one multi-field HSET, with the arguments pointing into the struct,
+// and numbers encoded by to_chars into stack buffers. Read() sends HMGET of the field list,
+// and decodes each element straight into its member by from_chars, without map or temporary
+// strings. ReadBatch() and WriteBatch() pipeline many objects in one round trip.
+//
+// Member types: std::string, bool as "1" and "0", integers, floating points and MiniRedisFixed.
+// MINIREDIS_STRUCT should be used in the global namespace, with at most 32 fields.
+// Values are not compressed by the codec of client.
+//
+
+#ifndef MiniRedisStruct_INCLUDED
+#define MiniRedisStruct_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include "MiniRedisClient.h"
+#include "MiniRedisNumeric.h"
+
+// Name and member pointer of one field
+template <typename T, typename M>
+struct MiniRedisStructField
+{
+    using Type = M;
+    std::string_view name;
+    M T::* member;
+};
+
+// Specialized by MINIREDIS_STRUCT, with static Fields() returning tuple of MiniRedisStructField
+template <typename T>
+struct MiniRedisStructTraits;
+
+// Apply M to each of the variable arguments, separated by comma
+#define MINIREDIS_EXPAND(x) x
+#define MINIREDIS_FE_1(M, T, x) M(T, x)
+#define MINIREDIS_FE_2(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_1(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_3(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_2(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_4(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_3(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_5(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_4(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_6(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_5(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_7(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_6(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_8(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_7(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_9(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_8(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_10(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_9(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_11(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_10(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_12(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_11(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_13(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_12(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_14(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_13(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_15(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_14(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_16(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_15(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_17(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_16(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_18(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_17(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_19(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_18(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_20(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_19(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_21(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_20(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_22(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_21(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_23(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_22(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_24(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_23(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_25(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_24(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_26(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_25(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_27(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_26(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_28(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_27(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_29(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_28(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_30(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_29(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_31(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_30(M, T, __VA_ARGS__))
+#define MINIREDIS_FE_32(M, T, x, ...) M(T, x), MINIREDIS_EXPAND(MINIREDIS_FE_31(M, T, __VA_ARGS__))
+
+#define MINIREDIS_FE_SELECT( \
+    _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, \
+    _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME, ...) NAME
+
+#define MINIREDIS_FOR_EACH(M, T, ...) MINIREDIS_EXPAND(MINIREDIS_FE_SELECT(__VA_ARGS__, \
+    MINIREDIS_FE_32, MINIREDIS_FE_31, MINIREDIS_FE_30, MINIREDIS_FE_29, MINIREDIS_FE_28, \
+    MINIREDIS_FE_27, MINIREDIS_FE_26, MINIREDIS_FE_25, MINIREDIS_FE_24, MINIREDIS_FE_23, \
+    MINIREDIS_FE_22, MINIREDIS_FE_21, MINIREDIS_FE_20, MINIREDIS_FE_19, MINIREDIS_FE_18, \
+    MINIREDIS_FE_17, MINIREDIS_FE_16, MINIREDIS_FE_15, MINIREDIS_FE_14, MINIREDIS_FE_13, \
+    MINIREDIS_FE_12, MINIREDIS_FE_11, MINIREDIS_FE_10, MINIREDIS_FE_9, MINIREDIS_FE_8, \
+    MINIREDIS_FE_7, MINIREDIS_FE_6, MINIREDIS_FE_5, MINIREDIS_FE_4, MINIREDIS_FE_3, MINIREDIS_FE_2, \
+    MINIREDIS_FE_1)(M, T, __VA_ARGS__))
+
+#define MINIREDIS_STRUCT_FIELD(T, x) MiniRedisStructField<T, decltype(T::x)>{#x, &T::x}
+
+#define MINIREDIS_STRUCT(T, ...) \
+    template <> \
+    struct MiniRedisStructTraits<T> \
+    { \
+        static constexpr auto Fields() \
+        { \
+            return std::make_tuple(MINIREDIS_FOR_EACH(MINIREDIS_STRUCT_FIELD, T, __VA_ARGS__)); \
+        } \
+    };
+
+namespace MiniRedisStruct
+{
+    // Non-template parts, so that hiredis is not exposed in header
+    namespace Detail
+    {
+        // Decode the string into the member pointed by out
+        using DecodeFunc = bool (*)(const char* str, std::size_t len, void* out);
+
+        struct FieldDecoder
+        {
+            void* member;
+            DecodeFunc decode;
+        };
+
+        // Append HSET in argv, and EXPIRE if ttl is not 0
+        // On failure nothing is left to read, the HSET appended is drained
+        bool AppendWrite(const MiniRedisClient& client, const std::string_view* argv, std::size_t argc, 
+            uint32_t ttl);
+        // Read the replies of AppendWrite()
+        bool GetWriteReply(const MiniRedisClient& client, uint32_t ttl);
+        // Read the reply of HMGET, found is false if all fields are nil
+        bool GetReadReply(const MiniRedisClient& client, const FieldDecoder* decoders, std::size_t count, 
+            bool& found);
+
+        template <typename M>
+        bool DecodeField(const char* str, std::size_t len, void* out)
+        {
+            M& member = *static_cast<M*>(out);
+            if constexpr (std::is_same<M, std::string>::value)
+            {
+                member.assign(str, len);
+                return true;
+            }
+            else if constexpr (std::is_same<M, bool>::value)
+            {
+                if ((len != 1) || ((str[0] != '0') && (str[0] != '1')))
+                {
+                    return false;
+                }
+                member = (str[0] == '1');
+                return true;
+            }
+            else
+            {
+                return MiniRedisNumeric::FromChars(str, len, member);
+            }
+        }
+
+        // View of the member, numbers are encoded into buf
+        // Return false if the number can't be encoded
+        template <typename M>
+        bool EncodeField(const M& member, char* buf, std::string_view& encoded)
+        {
+            static_assert(std::is_same<M, std::string>::value || std::is_same<M, bool>::value || 
+                MiniRedisNumeric::IsNumber<M>::value, 
+                "Field should be std::string, bool, number or MiniRedisFixed");
+            if constexpr (std::is_same<M, std::string>::value)
+            {
+                encoded = member;
+            }
+            else if constexpr (std::is_same<M, bool>::value)
+            {
+                encoded = member ? "1" : "0";
+            }
+            else
+            {
+                std::size_t len = MiniRedisNumeric::ToChars(buf, MiniRedisNumeric::MaxChars, member);
+                if (len == 0)
+                {
+                    return false;
+                }
+                encoded = std::string_view(buf, len);
+            }
+            return true;
+        }
+
+        template <typename T>
+        constexpr std::size_t FieldCount = std::tuple_size<decltype(MiniRedisStructTraits<T>::Fields())>::value;
+
+        // HSET key f1 v1 f2 v2 ..., false if any field can't be encoded
+        template <typename T, std::size_t... I>
+        bool FillWrite(const std::string& key, const T& value, std::string_view* argv, 
+            char (*numbers)[MiniRedisNumeric::MaxChars], std::index_sequence<I...>)
+        {
+            constexpr auto fields = MiniRedisStructTraits<T>::Fields();
+            argv[0] = "HSET";
+            argv[1] = key;
+            ((argv[2 + I * 2] = std::get<I>(fields).name), ...);
+            return (EncodeField(value.*(std::get<I>(fields).member), numbers[I], argv[3 + I * 2]) && ...);
+        }
+
+        // HMGET key f1 f2 ..., the same for all objects of T
+        template <typename T, std::size_t... I>
+        void FillRead(const std::string& key, std::string_view* argv, std::index_sequence<I...>)
+        {
+            constexpr auto fields = MiniRedisStructTraits<T>::Fields();
+            argv[0] = "HMGET";
+            argv[1] = key;
+            ((argv[2 + I] = std::get<I>(fields).name), ...);
+        }
+
+        template <typename T, std::size_t... I>
+        void FillDecoders(T& value, FieldDecoder* decoders, std::index_sequence<I...>)
+        {
+            constexpr auto fields = MiniRedisStructTraits<T>::Fields();
+            ((decoders[I] = {&(value.*(std::get<I>(fields).member)), 
+                &DecodeField<typename std::tuple_element<I, decltype(fields)>::type::Type>}), ...);
+        }
+
+        template <typename T>
+        bool AppendWrite(const MiniRedisClient& client, const std::string& key, const T& value, uint32_t ttl)
+        {
+            constexpr std::size_t count = FieldCount<T>;
+            std::string_view argv[2 + count * 2];
+            char numbers[count][MiniRedisNumeric::MaxChars];
+            if (!FillWrite(key, value, argv, numbers, std::make_index_sequence<count>()))
+            {
+                return false;
+            }
+            return AppendWrite(client, argv, 2 + count * 2, ttl);
+        }
+
+        template <typename T>
+        bool AppendRead(const MiniRedisClient& client, const std::string& key)
+        {
+            constexpr std::size_t count = FieldCount<T>;
+            std::string_view argv[2 + count];
+            FillRead<T>(key, argv, std::make_index_sequence<count>());
+            return client.PipelineAppend(argv, 2 + count);
+        }
+
+        template <typename T>
+        bool GetReadReply(const MiniRedisClient& client, T& value, bool& found)
+        {
+            constexpr std::size_t count = FieldCount<T>;
+            FieldDecoder decoders[count];
+            FillDecoders(value, decoders, std::make_index_sequence<count>());
+            return GetReadReply(client, decoders, count, found);
+        }
+    }
+
+    // Write all fields by one HSET, and set TTL in seconds if not 0
+    template <typename T>
+    bool Write(const MiniRedisClient& client, const std::string& key, const T& value, uint32_t ttl = 0)
+    {
+        return Detail::AppendWrite(client, key, value, ttl) && Detail::GetWriteReply(client, ttl);
+    }
+
+    // Read all fields by one HMGET, missing fields keep their values
+    // Return false if the key doesn't exist, or any field can't be decoded
+    template <typename T>
+    bool Read(const MiniRedisClient& client, const std::string& key, T& replied)
+    {
+        bool found = false;
+        return Detail::AppendRead<T>(client, key) && Detail::GetReadReply(client, replied, found) && found;
+    }
+
+    // Write values[i] to keys[i] in one pipeline
+    template <typename T>
+    bool WriteBatch(const MiniRedisClient& client, const std::vector<std::string>& keys, 
+        const std::vector<T>& values, uint32_t ttl = 0)
+    {
+        if (keys.size() != values.size())
+        {
+            return false;
+        }
+
+        std::size_t appended = 0;
+        for (; appended < keys.size(); appended++)
+        {
+            if (!Detail::AppendWrite(client, keys[appended], values[appended], ttl))
+            {
+                break;
+            }
+        }
+
+        // Read the replies of all appended commands, so that the connection stays in sync
+        bool ret = (appended == keys.size());
+        for (std::size_t i = 0; i < appended; i++)
+        {
+            ret = Detail::GetWriteReply(client, ttl) && ret;
+        }
+        return ret;
+    }
+
+    // Read keys in one pipeline, found[i] is false if keys[i] doesn't exist
+    // Return false if failed, or any field can't be decoded
+    template <typename T>
+    bool ReadBatch(const MiniRedisClient& client, const std::vector<std::string>& keys, 
+        std::vector<T>& replied, std::vector<bool>& found)
+    {
+        replied.assign(keys.size(), T());
+        found.assign(keys.size(), false);
+        std::size_t appended = 0;
+        for (; appended < keys.size(); appended++)
+        {
+            if (!Detail::AppendRead<T>(client, keys[appended]))
+            {
+                break;
+            }
+        }
+
+        bool ret = (appended == keys.size());
+        for (std::size_t i = 0; i < appended; i++)
+        {
+            bool exists = false;
+            ret = Detail::GetReadReply(client, replied[i], exists) && ret;
+            found[i] = exists;
+        }
+        return ret;
+    }
+}
+
+#endif // MiniRedisStruct_INCLUDED
@@ -0,0 +1,404 @@
+// Pipelined commands over many connections by one io_uring, Linux only
+
+#ifdef MINIREDIS_IO_URING
+
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <sys/socket.h>
+#include <hiredis/hiredis.h>
+#include "MiniRedisUringTransport.h"
+#include "MiniRedisLogger.h"
+
+namespace
+{
+    // user_data of SQE, index of connection and the operation
+    const uint64_t OP_READ = 0;
+    const uint64_t OP_SEND = 1;
+
+    uint64_t EncodeData(std::size_t index, uint64_t op)
+    {
+        return ((uint64_t)index << 1) | op;
+    }
+}
+
+MiniRedisUringTransport::MiniRedisUringTransport(uint32_t maxConnections, uint32_t bufferBytes)
+    : maxConnections(maxConnections ? maxConnections : 1), bufferBytes(bufferBytes ? bufferBytes : 16 * 1024),
+      ring(), initialized(false), pending(0), inFlight(0), stats()
+{
+}
+
+MiniRedisUringTransport::~MiniRedisUringTransport()
+{
+    if (initialized)
+    {
+        // Complete the SQEs in flight before their buffers are freed
+        for (auto& conn : connections)
+        {
+            shutdown(conn->context->fd, SHUT_RDWR);
+        }
+        while (inFlight > 0)
+        {
+            __kernel_timespec ts = {1, 0};
+            io_uring_cqe* cqe = nullptr;
+            if (io_uring_wait_cqe_timeout(&ring, &cqe, &ts) < 0)
+            {
+                break;
+            }
+            inFlight--;
+            io_uring_cq_advance(&ring, 1);
+        }
+        io_uring_queue_exit(&ring);
+    }
+
+    for (auto& conn : connections)
+    {
+        for (auto& cb : conn->callbacks)
+        {
+            if (cb)
+            {
+                cb(nullptr);
+            }
+        }
+        redisFree(conn->context);
+    }
+}
+
+bool MiniRedisUringTransport::Init()
+{
+    if (initialized)
+    {
+        return true;
+    }
+
+    // One send and one read in flight per connection at most, so the SQ never overflows
+    int ret = io_uring_queue_init(maxConnections * 2, &ring, 0);
+    if (ret < 0)
+    {
+        MINIREDIS_LOG_ERROR("Failed to create io_uring: %s", strerror(-ret));
+        return false;
+    }
+
+    // One registered buffer for all, READ_FIXED may target any range inside it
+    buffers.resize((std::size_t)maxConnections * bufferBytes);
+    iovec iov = {buffers.data(), buffers.size()};
+    ret = io_uring_register_buffers(&ring, &iov, 1);
+    if (ret < 0)
+    {
+        // ENOMEM if the pinned pages exceed RLIMIT_MEMLOCK, on kernels before 5.12
+        MINIREDIS_LOG_ERROR("Failed to register io_uring buffers: %s", strerror(-ret));
+        io_uring_queue_exit(&ring);
+        return false;
+    }
+
+    initialized = true;
+    return true;
+}
+
+int MiniRedisUringTransport::AddConnection(const std::string& host, uint16_t port, uint32_t timeoutSec,
+    const MiniRedisConnectionOptions& options)
+{
+    if (!initialized || (connections.size() >= maxConnections))
+    {
+        return -1;
+    }
+
+    // Connect, set socket options and handshake in blocking mode, then take over the socket
+    MiniRedisClient client;
+    client.SetConnectionOptions(options);
+    if (!client.Connect(host, port, timeoutSec))
+    {
+        return -1;
+    }
+
+    std::unique_ptr<Connection> conn(new Connection());
+    conn->context = client.GetRawContext();
+    connections.push_back(std::move(conn));
+    return (int)connections.size() - 1;
+}
+
+std::size_t MiniRedisUringTransport::GetConnectionCount() const
+{
+    return connections.size();
+}
+
+bool MiniRedisUringTransport::IsConnected(std::size_t index) const
+{
+    return (index < connections.size()) && !connections[index]->broken;
+}
+
+bool MiniRedisUringTransport::Append(std::size_t index, const std::vector<std::string>& argv, UringReplyCbFunc cb)
+{
+    if (!IsConnected(index) || argv.empty())
+    {
+        return false;
+    }
+
+    std::vector<const char*> args;
+    std::vector<std::size_t> lens;
+    args.reserve(argv.size());
+    lens.reserve(argv.size());
+    for (auto& x : argv)
+    {
+        args.push_back(x.data());
+        lens.push_back(x.size());
+    }
+
+    char* cmd = nullptr;
+    long long len = redisFormatCommandArgv(&cmd, (int)argv.size(), args.data(), lens.data());
+    if (len < 0)
+    {
+        return false;
+    }
+
+    Connection& conn = *connections[index];
+    conn.output.append(cmd, len);
+    redisFreeCommand(cmd);
+    conn.callbacks.push_back(std::move(cb));
+    pending++;
+    return true;
+}
+
+uint32_t MiniRedisUringTransport::Prepare(std::size_t index)
+{
+    Connection& conn = *connections[index];
+    if (conn.broken)
+    {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    if (!conn.sendInFlight)
+    {
+        if ((conn.sent == conn.sending.size()) && !conn.output.empty())
+        {
+            // Commands appended meanwhile go out in one send
+            conn.sending.swap(conn.output);
+            conn.output.clear();
+            conn.sent = 0;
+        }
+        if (conn.sent < conn.sending.size())
+        {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_send(sqe, conn.context->fd, conn.sending.data() + conn.sent,
+                conn.sending.size() - conn.sent, MSG_NOSIGNAL);
+            io_uring_sqe_set_data64(sqe, EncodeData(index, OP_SEND));
+            conn.sendInFlight = true;
+            count++;
+        }
+    }
+
+    // Read only while replies are expected, an idle connection holds no SQE
+    if (!conn.readInFlight && !conn.callbacks.empty())
+    {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read_fixed(sqe, conn.context->fd, buffers.data() + index * bufferBytes,
+            bufferBytes, 0, 0);
+        io_uring_sqe_set_data64(sqe, EncodeData(index, OP_READ));
+        conn.readInFlight = true;
+        count++;
+    }
+
+    return count;
+}
+
+int MiniRedisUringTransport::Poll(uint32_t waitMs)
+{
+    if (!initialized)
+    {
+        return -1;
+    }
+
+    uint32_t prepared = 0;
+    for (std::size_t i = 0; i < connections.size(); i++)
+    {
+        prepared += Prepare(i);
+    }
+    inFlight += prepared;
+    stats.sqes += prepared;
+    if (inFlight == 0)
+    {
+        return 0;
+    }
+
+    // Submit all and wait for the first completion in one syscall
+    uint64_t replies = stats.replies;
+    __kernel_timespec ts = {waitMs / 1000, (long long)(waitMs % 1000) * 1000000};
+    io_uring_cqe* cqe = nullptr;
+    stats.enters++;
+    int ret = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, nullptr);
+    if ((ret < 0) && (ret != -ETIME) && (ret != -EINTR))
+    {
+        MINIREDIS_LOG_ERROR("Failed to submit io_uring: %s", strerror(-ret));
+        return -1;
+    }
+
+    // Reap all completions ready, of any connection
+    io_uring_cqe* cqes[256];
+    unsigned count = 0;
+    while ((count = io_uring_peek_batch_cqe(&ring, cqes, 256)) > 0)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            OnCompletion(io_uring_cqe_get_data64(cqes[i]), cqes[i]->res);
+        }
+        io_uring_cq_advance(&ring, count);
+        inFlight -= count;
+        stats.completions += count;
+    }
+
+    return (int)(stats.replies - replies);
+}
+
+bool MiniRedisUringTransport::Drain(uint32_t timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (pending > 0)
+    {
+        uint32_t waitMs = 1000;
+        if (timeoutMs)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+            {
+                return false;
+            }
+            waitMs = std::min<uint32_t>(waitMs, left);
+        }
+
+        if (Poll(waitMs) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::size_t MiniRedisUringTransport::GetPending() const
+{
+    return pending;
+}
+
+MiniRedisUringStats MiniRedisUringTransport::GetStats() const
+{
+    return stats;
+}
+
+void MiniRedisUringTransport::OnCompletion(uint64_t data, int res)
+{
+    std::size_t index = data >> 1;
+    if ((data & 1) == OP_SEND)
+    {
+        OnSent(index, res);
+    }
+    else
+    {
+        OnRead(index, res);
+    }
+}
+
+void MiniRedisUringTransport::OnSent(std::size_t index, int res)
+{
+    Connection& conn = *connections[index];
+    conn.sendInFlight = false;
+    if (conn.broken)
+    {
+        return;
+    }
+
+    if (res < 0)
+    {
+        if ((res != -EAGAIN) && (res != -EINTR))
+        {
+            Break(index, strerror(-res));
+        }
+        return;
+    }
+
+    // Partial send, the rest is queued by next Prepare()
+    conn.sent += res;
+    stats.bytesSent += res;
+}
+
+void MiniRedisUringTransport::OnRead(std::size_t index, int res)
+{
+    Connection& conn = *connections[index];
+    conn.readInFlight = false;
+    if (conn.broken)
+    {
+        return;
+    }
+
+    if (res <= 0)
+    {
+        if ((res == -EAGAIN) || (res == -EINTR))
+        {
+            return;
+        }
+        Break(index, (res == 0) ? "Server closed the connection" : strerror(-res));
+        return;
+    }
+
+    stats.bytesReceived += res;
+    redisReader* reader = conn.context->reader;
+    if (redisReaderFeed(reader, buffers.data() + index * bufferBytes, res) != REDIS_OK)
+    {
+        Break(index, reader->errstr);
+        return;
+    }
+
+    void* reply = nullptr;
+    while (true)
+    {
+        if (redisReaderGetReply(reader, &reply) != REDIS_OK)
+        {
+            Break(index, reader->errstr);
+            return;
+        }
+        if (!reply)
+        {
+            break;
+        }
+
+        redisReply* r = (redisReply*)reply;
+        if ((r->type == REDIS_REPLY_PUSH) || conn.callbacks.empty())
+        {
+            // Push message of RESP3, not a reply of any command
+            freeReplyObject(r);
+            continue;
+        }
+
+        UringReplyCbFunc cb = std::move(conn.callbacks.front());
+        conn.callbacks.pop_front();
+        pending--;
+        stats.replies++;
+        if (cb)
+        {
+            cb(r);
+        }
+        freeReplyObject(r);
+    }
+}
+
+void MiniRedisUringTransport::Break(std::size_t index, const char* reason)
+{
+    Connection& conn = *connections[index];
+    MINIREDIS_LOG_ERROR("io_uring connection %zu broken: %s", index, reason);
+    conn.broken = true;
+    shutdown(conn.context->fd, SHUT_RDWR);
+
+    std::deque<UringReplyCbFunc> callbacks;
+    callbacks.swap(conn.callbacks);
+    pending -= callbacks.size();
+    for (auto& cb : callbacks)
+    {
+        if (cb)
+        {
+            cb(nullptr);
+        }
+    }
+}
+
+#endif // MINIREDIS_IO_URING
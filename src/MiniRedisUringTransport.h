@@ -0,0 +1,117 @@
+// Pipelined commands over many connections by one io_uring, Linux only
+// Built with 'make IO_URING=1', which defines MINIREDIS_IO_URING and links liburing.
+//
+// MiniRedisClient does one read and one write syscall per round trip, and libevent
+// one epoll_wait plus a read and a write per ready connection. With hundreds of
+// connections the syscalls dominate the CPU. Here the sends and reads of all connections
+// are queued in one ring, and submitted and reaped by a single io_uring_enter in Poll().
+// Each connection reads into its own slice of one registered buffer (READ_FIXED),
+// so the kernel doesn't map the pages per read. The bytes are fed to the hiredis reader
+// of the connection, and the replies are dispatched to the callbacks in order.
+//
+// Connections are made and handshaked by MiniRedisClient, then the raw context is taken over.
+// A broken connection fails its pending callbacks with nullptr, and is not reconnected.
+//
+// Not thread safe, one thread appends and polls. Requires liburing 2.2 and Linux 5.11 or later.
+//
+
+#ifndef MiniRedisUringTransport_INCLUDED
+#define MiniRedisUringTransport_INCLUDED
+
+#ifdef MINIREDIS_IO_URING
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <liburing.h>
+#include "MiniRedisClient.h"
+
+struct MiniRedisUringStats
+{
+    // io_uring_enter calls by Poll()
+    uint64_t enters;
+    // Sends and reads submitted
+    uint64_t sqes;
+    uint64_t completions;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t replies;
+};
+
+// Reply is freed after the callback, nullptr if the connection broke
+using UringReplyCbFunc = std::function<void(redisReply* reply)>;
+
+class MiniRedisUringTransport
+{
+public:
+    // Read buffers of all connections are allocated and registered by Init()
+    explicit MiniRedisUringTransport(uint32_t maxConnections = 512, uint32_t bufferBytes = 16 * 1024);
+    ~MiniRedisUringTransport();
+
+    MiniRedisUringTransport(const MiniRedisUringTransport&) = delete;
+    MiniRedisUringTransport& operator=(const MiniRedisUringTransport&) = delete;
+
+    // Create the ring and register the buffers
+    bool Init();
+
+    // Return index of the connection, or -1 on failure
+    int AddConnection(const std::string& host, uint16_t port = 6379, uint32_t timeoutSec = 3,
+        const MiniRedisConnectionOptions& options = MiniRedisConnectionOptions());
+    std::size_t GetConnectionCount() const;
+    bool IsConnected(std::size_t index) const;
+
+    // Queue the command on the connection, sent by next Poll()
+    bool Append(std::size_t index, const std::vector<std::string>& argv, UringReplyCbFunc cb);
+
+    // Submit the queued sends and reads of all connections, wait up to waitMs for completions,
+    // and dispatch the replies. Return number of replies, or -1 if the ring failed
+    int Poll(uint32_t waitMs);
+    // Poll until no reply is pending, 0 waits forever
+    bool Drain(uint32_t timeoutMs = 0);
+    // Callbacks waiting for replies
+    std::size_t GetPending() const;
+
+    MiniRedisUringStats GetStats() const;
+
+private:
+    struct Connection
+    {
+        redisContext* context = nullptr;
+        // Appended, and not sent yet
+        std::string output;
+        // Being sent, kept until the send completes
+        std::string sending;
+        std::size_t sent = 0;
+        bool sendInFlight = false;
+        bool readInFlight = false;
+        bool broken = false;
+        std::deque<UringReplyCbFunc> callbacks;
+    };
+
+    // Queue the send and read of connection if needed, return number of SQEs
+    uint32_t Prepare(std::size_t index);
+    void OnCompletion(uint64_t data, int res);
+    void OnRead(std::size_t index, int res);
+    void OnSent(std::size_t index, int res);
+    // Fail pending callbacks, SQEs in flight complete later
+    void Break(std::size_t index, const char* reason);
+
+private:
+    uint32_t maxConnections;
+    uint32_t bufferBytes;
+    io_uring ring;
+    bool initialized;
+    // maxConnections slices of bufferBytes, registered as fixed buffers
+    std::vector<char> buffers;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::size_t pending;
+    // SQEs submitted and not completed
+    std::size_t inFlight;
+    MiniRedisUringStats stats;
+};
+
+#endif // MINIREDIS_IO_URING
+
+#endif // MiniRedisUringTransport_INCLUDED
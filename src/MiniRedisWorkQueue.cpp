@@ -0,0 +1,510 @@
+// Reliable work queue on Redis lists, with at-least-once delivery
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#include <unistd.h>
+#include <hiredis/hiredis.h>
+#include "MiniRedisWorkQueue.h"
+#include "MiniRedisLogger.h"
+
+namespace
+{
+    // KEYS[1]: pending, KEYS[2]: processing, KEYS[3]: workers
+    // ARGV[1]: count, ARGV[2]: worker id
+    // Refresh heartbeat, and move up to count jobs into processing
+    const char* takeScriptSource =
+        "local t = redis.call('TIME') "
+        "redis.call('ZADD', KEYS[3], t[1] * 1000 + math.floor(t[2] / 1000), ARGV[2]) "
+        "local n = tonumber(ARGV[1]) "
+        "if n <= 0 then return {} end "
+        "local jobs = redis.call('RPOP', KEYS[1], n) "
+        "if not jobs then return {} end "
+        "for i = 1, #jobs do redis.call('LPUSH', KEYS[2], jobs[i]) end "
+        "return jobs";
+
+    // KEYS[1]: workers
+    // ARGV[1]: timeout ms, ARGV[2]: limit
+    // Return the workers without heartbeat for longer than timeout
+    const char* deadScriptSource =
+        "local t = redis.call('TIME') "
+        "local now = t[1] * 1000 + math.floor(t[2] / 1000) "
+        "return redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', now - tonumber(ARGV[1]), "
+        "'LIMIT', 0, tonumber(ARGV[2]))";
+
+    // KEYS[1]: pending, KEYS[2]: processing, KEYS[3]: workers
+    // ARGV[1]: worker id, ARGV[2]: timeout ms
+    // Check the heartbeat again, since the worker may be back after the dead list was taken
+    // Return the jobs moved back, or -1 if the worker is alive
+    const char* requeueScriptSource =
+        "local t = redis.call('TIME') "
+        "local now = t[1] * 1000 + math.floor(t[2] / 1000) "
+        "local s = redis.call('ZSCORE', KEYS[3], ARGV[1]) "
+        "if s and now - tonumber(s) < tonumber(ARGV[2]) then return -1 end "
+        "local n = 0 "
+        "while true do "
+        "  local job = redis.call('LPOP', KEYS[2]) "
+        "  if not job then break end "
+        "  redis.call('RPUSH', KEYS[1], job) "
+        "  n = n + 1 "
+        "end "
+        "redis.call('ZREM', KEYS[3], ARGV[1]) "
+        "return n";
+
+    // Largest batch moved by one script call
+    const std::size_t maxTake = 1000;
+
+    // Binary safe command, in one round trip
+    redisReply* Command(const MiniRedisClient& client, const std::vector<std::string>& argv)
+    {
+        if (!client.PipelineAppend(argv))
+        {
+            return nullptr;
+        }
+        return client.PipelineGetReply();
+    }
+
+    redisReply* EvalScript(const MiniRedisClient& client, MiniRedisQueueScript& script,
+        const std::vector<std::string>& keys, const std::vector<std::string>& args)
+    {
+        if (script.sha.empty())
+        {
+            // Falls back to EVAL if it can't be loaded
+            redisReply* reply = client.execute("SCRIPT LOAD %s", script.source);
+            client.HandleStringReply(reply, script.sha);
+        }
+
+        std::vector<std::string> argv;
+        argv.reserve(keys.size() + args.size() + 3);
+        argv.push_back(script.sha.empty() ? "EVAL" : "EVALSHA");
+        argv.push_back(script.sha.empty() ? script.source : script.sha);
+        argv.push_back(std::to_string(keys.size()));
+        argv.insert(argv.end(), keys.begin(), keys.end());
+        argv.insert(argv.end(), args.begin(), args.end());
+        redisReply* reply = Command(client, argv);
+        if (reply && (reply->type == REDIS_REPLY_ERROR) && (strncmp(reply->str, "NOSCRIPT", 8) == 0))
+        {
+            // Script cache was flushed, or failover to a server without it
+            freeReplyObject(reply);
+            argv[0] = "EVAL";
+            argv[1] = script.source;
+            reply = Command(client, argv);
+        }
+        return reply;
+    }
+}
+
+MiniRedisQueueWorker::MiniRedisQueueWorker(MiniRedisWorkQueue& queue, const std::string& id)
+    : queue(queue), id(id), processingKey(queue.name + ":processing:" + id)
+{
+    takeScript.source = takeScriptSource;
+    requeueScript.source = requeueScriptSource;
+}
+
+MiniRedisQueueWorker::~MiniRedisQueueWorker()
+{
+    // Others can take them at once, instead of waiting for the reaper
+    if (client.IsConnected())
+    {
+        queue.Requeue(client, requeueScript, id, true);
+    }
+}
+
+const std::string& MiniRedisQueueWorker::GetId() const
+{
+    return id;
+}
+
+bool MiniRedisQueueWorker::TakeBatch(std::size_t count, std::vector<std::string>& jobs)
+{
+    redisReply* reply = EvalScript(client, takeScript,
+        {queue.name, processingKey, queue.workersKey}, {std::to_string(count), id});
+    if (!reply || (reply->type != REDIS_REPLY_ARRAY))
+    {
+        MINIREDIS_LOG_ERROR("Failed to take jobs from %s: %s", queue.name.c_str(),
+            (reply && reply->str) ? reply->str : "no reply");
+        freeReplyObject(reply);
+        return false;
+    }
+
+    for (std::size_t i = 0; i < reply->elements; i++)
+    {
+        jobs.emplace_back(reply->element[i]->str, reply->element[i]->len);
+    }
+    freeReplyObject(reply);
+    return true;
+}
+
+bool MiniRedisQueueWorker::Fetch(std::vector<std::string>& jobs, std::size_t maxJobs)
+{
+    jobs.clear();
+    maxJobs = std::min(std::max<std::size_t>(maxJobs, 1), maxTake);
+    if (!TakeBatch(maxJobs, jobs))
+    {
+        return false;
+    }
+
+    if (jobs.empty())
+    {
+        // Wait for the next job, and take the rest of the burst with it
+        char timeout[32];
+        snprintf(timeout, sizeof(timeout), "%.3f", queue.GetBlockMs() / 1000.0);
+        redisReply* reply = Command(client, {"BLMOVE", queue.name, processingKey, "RIGHT", "LEFT", timeout});
+        if (!reply || (reply->type == REDIS_REPLY_ERROR))
+        {
+            MINIREDIS_LOG_ERROR("Failed to wait for jobs of %s: %s", queue.name.c_str(),
+                (reply && reply->str) ? reply->str : "no reply");
+            freeReplyObject(reply);
+            return false;
+        }
+
+        bool got = (reply->type == REDIS_REPLY_STRING);
+        if (got)
+        {
+            jobs.emplace_back(reply->str, reply->len);
+        }
+        freeReplyObject(reply);
+        if (got && (maxJobs > 1))
+        {
+            TakeBatch(maxJobs - 1, jobs);
+        }
+    }
+
+    queue.fetched += jobs.size();
+    return true;
+}
+
+bool MiniRedisQueueWorker::Ack(const std::string& job)
+{
+    // The oldest jobs are at the tail, and are usually acked first
+    long long removed = 0;
+    redisReply* reply = Command(client, {"LREM", processingKey, "-1", job});
+    if (!client.HandleIntegerReply(reply, removed))
+    {
+        return false;
+    }
+
+    queue.acked += removed;
+    return removed > 0;
+}
+
+bool MiniRedisQueueWorker::Ack(const std::vector<std::string>& jobs)
+{
+    std::size_t appended = 0;
+    for (; appended < jobs.size(); appended++)
+    {
+        if (!client.PipelineAppend({"LREM", processingKey, "-1", jobs[appended]}))
+        {
+            break;
+        }
+    }
+
+    bool ret = (appended == jobs.size());
+    for (std::size_t i = 0; i < appended; i++)
+    {
+        long long removed = 0;
+        if (!client.HandleIntegerReply(client.PipelineGetReply(), removed) || (removed == 0))
+        {
+            ret = false;
+        }
+        queue.acked += removed;
+    }
+    return ret;
+}
+
+bool MiniRedisQueueWorker::Heartbeat()
+{
+    std::vector<std::string> none;
+    return TakeBatch(0, none);
+}
+
+MiniRedisWorkQueue::MiniRedisWorkQueue(const std::string& name)
+    : name(name), workersKey(name + ":workers"), port(6379), timeoutSec(3),
+      batchSize(1000), flushIntervalMs(10), maxBuffered(1000000),
+      visibilityTimeoutMs(30000), reapIntervalMs(5000), running(false),
+      pushed(0), flushes(0), fetched(0), acked(0), requeued(0)
+{
+    deadScript.source = deadScriptSource;
+    requeueScript.source = requeueScriptSource;
+}
+
+MiniRedisWorkQueue::~MiniRedisWorkQueue()
+{
+    Stop();
+}
+
+void MiniRedisWorkQueue::SetBatchSize(std::size_t count)
+{
+    batchSize = count ? count : 1;
+}
+
+void MiniRedisWorkQueue::SetFlushIntervalMs(uint32_t ms)
+{
+    flushIntervalMs = ms ? ms : 1;
+}
+
+void MiniRedisWorkQueue::SetMaxBuffered(std::size_t count)
+{
+    maxBuffered = count ? count : 1;
+}
+
+void MiniRedisWorkQueue::SetVisibilityTimeoutMs(uint32_t ms)
+{
+    visibilityTimeoutMs = std::max(ms, 100u);
+}
+
+void MiniRedisWorkQueue::SetReapIntervalMs(uint32_t ms)
+{
+    reapIntervalMs = ms;
+}
+
+uint32_t MiniRedisWorkQueue::GetBlockMs() const
+{
+    return std::min(1000u, visibilityTimeoutMs / 3);
+}
+
+bool MiniRedisWorkQueue::Connect(const std::string& host, uint16_t port, uint32_t timeoutSec)
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    this->host = host;
+    this->port = port;
+    this->timeoutSec = timeoutSec;
+    return client.Connect(host, port, timeoutSec);
+}
+
+void MiniRedisWorkQueue::Start()
+{
+    std::lock_guard<std::mutex> lock(threadMutex);
+    if (running)
+    {
+        return;
+    }
+
+    running = true;
+    thread = std::thread(&MiniRedisWorkQueue::ThreadRoutine, this);
+}
+
+void MiniRedisWorkQueue::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        running = false;
+    }
+
+    cv.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+    // Also when the thread was never started
+    Flush();
+}
+
+void MiniRedisWorkQueue::ThreadRoutine()
+{
+    auto nextReap = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(threadMutex);
+    while (running)
+    {
+        cv.wait_for(lock, std::chrono::milliseconds(flushIntervalMs), [this]() { return !running; });
+
+        lock.unlock();
+        Flush();
+        auto now = std::chrono::steady_clock::now();
+        if (reapIntervalMs && (now >= nextReap))
+        {
+            Reap();
+            nextReap = now + std::chrono::milliseconds(reapIntervalMs);
+        }
+        lock.lock();
+    }
+}
+
+bool MiniRedisWorkQueue::Push(const std::string& job)
+{
+    std::vector<std::string> batch;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        if (buffer.size() >= maxBuffered)
+        {
+            return false;
+        }
+
+        buffer.push_back(job);
+        if (buffer.size() < batchSize)
+        {
+            return true;
+        }
+        batch.swap(buffer);
+    }
+
+    // Full batch is sent by the producer, instead of waiting for the interval
+    PushBatch(batch);
+    return true;
+}
+
+bool MiniRedisWorkQueue::Flush()
+{
+    std::vector<std::string> batch;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        batch.swap(buffer);
+    }
+
+    return batch.empty() || PushBatch(batch);
+}
+
+bool MiniRedisWorkQueue::PushBatch(const std::vector<std::string>& jobs)
+{
+    // Whether each batch was pushed, the batches not appended stay false
+    std::vector<bool> batchDone((jobs.size() + batchSize - 1) / batchSize, false);
+    std::size_t done = 0;
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        if (client.IsConnected() || (!host.empty() && client.Connect(host, port, timeoutSec)))
+        {
+            // All batches in one pipeline
+            std::vector<std::string> argv;
+            std::size_t appended = 0;
+            for (std::size_t start = 0; start < jobs.size(); start += batchSize)
+            {
+                std::size_t end = std::min(jobs.size(), start + batchSize);
+                argv.assign({"LPUSH", name});
+                argv.insert(argv.end(), jobs.begin() + start, jobs.begin() + end);
+                if (!client.PipelineAppend(argv))
+                {
+                    break;
+                }
+                appended = end;
+            }
+
+            // Every reply is read even after a failure, to keep the pipeline in sync
+            for (std::size_t start = 0; start < appended; start += batchSize)
+            {
+                long long len = 0;
+                if (client.HandleIntegerReply(client.PipelineGetReply(), len))
+                {
+                    batchDone[start / batchSize] = true;
+                    done += std::min(jobs.size(), start + batchSize) - start;
+                    flushes++;
+                }
+            }
+        }
+    }
+
+    pushed += done;
+    if (done == jobs.size())
+    {
+        return true;
+    }
+
+    // Failed and unsent batches are kept in front of newer jobs for next flush
+    // Not sure whether a batch was pushed if the connection broke, which may push it twice
+    MINIREDIS_LOG_WARN("Failed to push %zu jobs to %s", jobs.size() - done, name.c_str());
+    std::vector<std::string> failedJobs;
+    failedJobs.reserve(jobs.size() - done);
+    for (std::size_t start = 0; start < jobs.size(); start += batchSize)
+    {
+        if (!batchDone[start / batchSize])
+        {
+            failedJobs.insert(failedJobs.end(), jobs.begin() + start,
+                jobs.begin() + std::min(jobs.size(), start + batchSize));
+        }
+    }
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    buffer.insert(buffer.begin(), std::make_move_iterator(failedJobs.begin()),
+        std::make_move_iterator(failedJobs.end()));
+    return false;
+}
+
+std::unique_ptr<MiniRedisQueueWorker> MiniRedisWorkQueue::CreateWorker(const std::string& id)
+{
+    std::string workerId = id;
+    if (workerId.empty())
+    {
+        static std::atomic<uint64_t> counter(0);
+        char hostname[256] = {0};
+        gethostname(hostname, sizeof(hostname) - 1);
+        workerId = std::string(hostname) + ":" + std::to_string(getpid()) + ":" + std::to_string(counter++);
+    }
+
+    std::unique_ptr<MiniRedisQueueWorker> worker(new MiniRedisQueueWorker(*this, workerId));
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        worker->client.SetConnectionOptions(client.GetConnectionOptions());
+    }
+    if (!worker->client.Connect(host, port, timeoutSec))
+    {
+        return nullptr;
+    }
+
+    // Left by a crashed worker of the same id
+    if (Requeue(worker->client, worker->requeueScript, workerId, true) < 0)
+    {
+        return nullptr;
+    }
+    return worker;
+}
+
+long long MiniRedisWorkQueue::Requeue(MiniRedisClient& client, MiniRedisQueueScript& script,
+    const std::string& workerId, bool force)
+{
+    long long moved = 0;
+    redisReply* reply = EvalScript(client, script,
+        {name, name + ":processing:" + workerId, workersKey},
+        {workerId, force ? "0" : std::to_string(visibilityTimeoutMs)});
+    if (!client.HandleIntegerReply(reply, moved))
+    {
+        MINIREDIS_LOG_ERROR("Failed to requeue jobs of worker %s", workerId.c_str());
+        return -1;
+    }
+
+    if (moved > 0)
+    {
+        requeued += moved;
+        MINIREDIS_LOG_INFO("Requeued %lld jobs of worker %s", moved, workerId.c_str());
+    }
+    return std::max(moved, 0LL);
+}
+
+long long MiniRedisWorkQueue::Reap()
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    if (!client.IsConnected() && (host.empty() || !client.Connect(host, port, timeoutSec)))
+    {
+        return -1;
+    }
+
+    std::vector<std::string> dead;
+    redisReply* reply = EvalScript(client, deadScript, {workersKey},
+        {std::to_string(visibilityTimeoutMs), "100"});
+    if (!client.HandleArrayReply(reply, dead))
+    {
+        return -1;
+    }
+
+    long long total = 0;
+    for (auto& x : dead)
+    {
+        long long moved = Requeue(client, requeueScript, x, false);
+        if (moved > 0)
+        {
+            total += moved;
+        }
+    }
+    return total;
+}
+
+MiniRedisWorkQueueStats MiniRedisWorkQueue::GetStats() const
+{
+    MiniRedisWorkQueueStats x;
+    x.pushed = pushed;
+    x.flushes = flushes;
+    x.fetched = fetched;
+    x.acked = acked;
+    x.requeued = requeued;
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    x.buffered = buffer.size();
+    return x;
+}
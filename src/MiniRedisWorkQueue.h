@@ -0,0 +1,188 @@
+// Reliable work queue on Redis lists, with at-least-once delivery
+// Keys of queue <name>:
+//   <name>                        pending jobs, pushed on the left and taken from the right
+//   <name>:processing:<worker>    jobs taken by one worker and not acked yet
+//   <name>:workers                sorted set of worker heartbeats, by server time in ms
+// Use a hash tag in the name, such as {jobs}, so that all keys are in one cluster slot.
+//
+// Producer side: Push() buffers the jobs, which are sent as one multi-element LPUSH
+// when the batch is full, or by the flush thread after the interval.
+//
+// Consumer side: each MiniRedisQueueWorker has its own connection, so that blocking
+// doesn't stall other commands. Fetch() moves a batch of jobs into the processing list
+// of the worker atomically by a Lua script, and blocks with BLMOVE when the queue is empty.
+// Ack() removes the job from the processing list.
+//
+// Workers refresh their heartbeat on each Fetch(), or by Heartbeat() during long jobs.
+// The reaper moves the processing list of a worker silent for longer than the visibility
+// timeout back to the pending list, so the jobs of a crashed worker run again.
+// A job may run more than once, so the jobs should be idempotent.
+//
+// Requires Redis 6.2 or later, for BLMOVE and RPOP with count.
+//
+
+#ifndef MiniRedisWorkQueue_INCLUDED
+#define MiniRedisWorkQueue_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "MiniRedisClient.h"
+
+struct MiniRedisWorkQueueStats
+{
+    // Jobs pushed to Redis
+    uint64_t pushed;
+    // LPUSH commands sent
+    uint64_t flushes;
+    // Jobs fetched and acked by the workers of this instance
+    uint64_t fetched;
+    uint64_t acked;
+    // Jobs of dead workers moved back to pending
+    uint64_t requeued;
+    // Jobs buffered and not pushed yet
+    std::size_t buffered;
+};
+
+// Lua script called by EVALSHA, and by EVAL if the server doesn't have it
+struct MiniRedisQueueScript
+{
+    const char* source;
+    std::string sha;
+};
+
+class MiniRedisWorkQueue;
+
+// Created by MiniRedisWorkQueue::CreateWorker(), and destroyed before the queue
+// Used by one thread
+class MiniRedisQueueWorker
+{
+public:
+    // Jobs not acked are moved back to pending
+    ~MiniRedisQueueWorker();
+
+    MiniRedisQueueWorker(const MiniRedisQueueWorker&) = delete;
+    MiniRedisQueueWorker& operator=(const MiniRedisQueueWorker&) = delete;
+
+    const std::string& GetId() const;
+
+    // Take up to maxJobs jobs, waiting up to the block timeout if the queue is empty
+    // Return true with no job if nothing arrived in time
+    bool Fetch(std::vector<std::string>& jobs, std::size_t maxJobs = 100);
+    // Job is done, remove it from the processing list
+    bool Ack(const std::string& job);
+    // Ack the jobs in one pipeline
+    bool Ack(const std::vector<std::string>& jobs);
+    // Keep alive during a job longer than the visibility timeout
+    bool Heartbeat();
+
+private:
+    friend class MiniRedisWorkQueue;
+    MiniRedisQueueWorker(MiniRedisWorkQueue& queue, const std::string& id);
+
+    // Move up to count jobs into the processing list without blocking, and refresh heartbeat
+    bool TakeBatch(std::size_t count, std::vector<std::string>& jobs);
+
+private:
+    MiniRedisWorkQueue& queue;
+    std::string id;
+    std::string processingKey;
+    MiniRedisQueueScript takeScript;
+    MiniRedisQueueScript requeueScript;
+    // Dedicated to this worker, and blocked by BLMOVE
+    MiniRedisClient client;
+};
+
+class MiniRedisWorkQueue
+{
+public:
+    explicit MiniRedisWorkQueue(const std::string& name);
+    ~MiniRedisWorkQueue();
+
+    MiniRedisWorkQueue(const MiniRedisWorkQueue&) = delete;
+    MiniRedisWorkQueue& operator=(const MiniRedisWorkQueue&) = delete;
+
+    // Before Start()
+    // Jobs sent in one LPUSH
+    void SetBatchSize(std::size_t count);
+    void SetFlushIntervalMs(uint32_t ms);
+    // Push() fails when this number of jobs are buffered, such as Redis is unreachable
+    void SetMaxBuffered(std::size_t count);
+    // Worker without heartbeat for this long is considered dead
+    void SetVisibilityTimeoutMs(uint32_t ms);
+    // How often the reaper looks for dead workers, 0 disables it
+    void SetReapIntervalMs(uint32_t ms);
+
+    bool Connect(const std::string& host, uint16_t port = 6379, uint32_t timeoutSec = 3);
+    // Start the thread of flush and reaper
+    void Start();
+    // Flush the buffered jobs and stop the thread
+    void Stop();
+
+    // Producer
+    bool Push(const std::string& job);
+    // Send all buffered jobs now
+    bool Flush();
+
+    // Consumer with its own connection, nullptr if failed to connect
+    // Jobs left by a previous worker of the same id are moved back to pending first
+    // Empty id generates a unique one
+    std::unique_ptr<MiniRedisQueueWorker> CreateWorker(const std::string& id = std::string());
+
+    // Move the jobs of dead workers back to pending, return the count or -1 on failure
+    long long Reap();
+
+    MiniRedisWorkQueueStats GetStats() const;
+
+private:
+    friend class MiniRedisQueueWorker;
+
+    // Send jobs by multi-element LPUSH, in batches
+    bool PushBatch(const std::vector<std::string>& jobs);
+    // Move the processing list of worker back to pending if it is dead, or at once if force
+    long long Requeue(MiniRedisClient& client, MiniRedisQueueScript& script,
+        const std::string& workerId, bool force);
+    // Block timeout of workers, below the visibility timeout so that idle workers stay alive
+    uint32_t GetBlockMs() const;
+    void ThreadRoutine();
+
+private:
+    std::string name;
+    std::string workersKey;
+    std::string host;
+    uint16_t port;
+    uint32_t timeoutSec;
+
+    std::size_t batchSize;
+    uint32_t flushIntervalMs;
+    std::size_t maxBuffered;
+    uint32_t visibilityTimeoutMs;
+    uint32_t reapIntervalMs;
+
+    // Jobs waiting for flush
+    mutable std::mutex bufferMutex;
+    std::vector<std::string> buffer;
+
+    // Used by flush and reaper only
+    MiniRedisClient client;
+    std::mutex clientMutex;
+    MiniRedisQueueScript deadScript;
+    MiniRedisQueueScript requeueScript;
+
+    std::thread thread;
+    std::mutex threadMutex;
+    std::condition_variable cv;
+    bool running;
+
+    std::atomic<uint64_t> pushed;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> fetched;
+    std::atomic<uint64_t> acked;
+    std::atomic<uint64_t> requeued;
+};
+
+#endif // MiniRedisWorkQueue_INCLUDED
@@ -1,8 +1,35 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <hiredis/hiredis.h>
 #include "MiniRedisClient.h"
+#include "MiniRedisPreparedCommand.h"
+#include "MiniRedisCodec.h"
 #include "MiniRedisPubSub.h"
+#include "MiniRedisEventLoopGroup.h"
+#include "MiniRedisReplicatedClient.h"
+#include "MiniRedisShardedClient.h"
+#include "MiniRedisRateLimiter.h"
+#include "MiniRedisCounterAggregator.h"
+#include "MiniRedisKeySampler.h"
+#include "MiniRedisLogger.h"
+#include "MiniRedisMirroredHash.h"
+#include "MiniRedisWorkQueue.h"
+#include "MiniRedisMigrator.h"
+#include "MiniRedisUringTransport.h"
+#include "MiniRedisPubSubBench.h"
+#include "MiniRedisMockServer.h"
+#include "MiniRedisStruct.h"
+#include "MiniRedisRespCodec.h"
+#ifdef MINIREDIS_IO_URING
+#include <event2/event.h>
+#include <hiredis/async.h>
+#include <hiredis/adapters/libevent.h>
+#endif
 
 void TestClient()
 {
@@ -88,6 +115,19 @@ void TestClient()
 
     client.decr("counter", repliedInt); 
     client.incr("counter", repliedInt); 
+    client.incrby("counter", 10, repliedInt); 
+    client.decrby("counter", 5, repliedInt); 
+
+    // Typed numbers without string round trips
+    long long int counter = 0;
+    client.get("counter", counter);
+    double ratio = 0;
+    client.set("ratio", 0.25, 0, repliedStr);
+    client.incrbyfloat("ratio", 0.5, ratio);
+    MiniRedisFixed<2> price(1999);
+    client.hset("prices", "item", price, repliedInt);
+    client.hget("prices", "item", price);
+    client.hincrby("prices", "count", 1, repliedInt);
 
     client.lpush("List123", "item 1", repliedInt);
     client.lpush("List123", "item 2", repliedInt);
@@ -119,10 +159,36 @@ void TestClient()
     client.srem("set123", "ele 8", repliedInt);
     //client.del("set123", repliedInt);
 
+    std::vector<std::pair<std::string, double>> scores;
+    for (int i = 0; i < 1000; i++)
+    {
+        scores.emplace_back("player " + std::to_string(i), i * 1.5);
+    }
+    client.zadd("zset123", scores, ZADD_NONE, repliedInt);
+    client.zadd("zset123", "player 0", 2000, ZADD_GT | ZADD_CH, repliedInt);
+    double score = 0;
+    client.zincrby("zset123", 10, "player 1", score);
+    client.zscore("zset123", "player 1", score);
+    std::vector<double> repliedScores;
+    client.zmscore("zset123", {"player 1", "player 2", "invalid"}, repliedScores);
+    client.zcard("zset123", repliedInt);
+    client.zrank("zset123", "player 2", repliedInt);
+    client.zrevrank("zset123", "player 2", repliedInt);
+    client.zrange("zset123", "0", "9", repliedArray);
+    client.zrange("zset123", "(100", "+inf", repliedArray, ZRANGE_BY_SCORE, false, 0, 10);
+    client.zrange("zset123", "+inf", "-inf", scores, ZRANGE_BY_SCORE, true, 0, 1000);
+    MiniRedisScoredView top;
+    client.zrange("zset123", "0", "999", top, ZRANGE_BY_RANK, true);
+    client.zpopmin("zset123", 2, scores);
+    client.zpopmax("zset123", 2, scores);
+    client.zrem("zset123", "player 3", repliedInt);
+    client.zrem("zset123", std::vector<std::string>{"player 4", "player 5"}, repliedInt);
+
     client.set("Blank space", "value", 0, repliedStr);
     std::vector<std::string> keysDel;
     keysDel.push_back("List123");
     keysDel.push_back("set123");
+    keysDel.push_back("zset123");
     keysDel.push_back("Blank space");
     client.del(keysDel, repliedInt);
 
@@ -179,6 +245,55 @@ void TestSub()
     std::cout << "Subscribing done" << std::endl; 
 }
 
+void TestSubBatch()
+{
+    // Messages of one socket read are delivered together, without constructing strings
+    MiniRedisPubSub sub;
+    sub.SetSubscribeBatchCb([](const MiniRedisPubSubMessage* msgs, std::size_t count) {
+        std::cout << "Batch of " << count << " messages" << std::endl;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::cout << "Channel: " << msgs[i].channel << ", content: " << msgs[i].content << std::endl;
+        }
+    });
+    sub.Connect("127.0.0.1", 6379);
+    sub.Subscribe("testChannel1");
+
+    std::this_thread::sleep_for(std::chrono::seconds(60));
+    std::cout << "Subscribing done" << std::endl; 
+}
+
+void TestEventLoopGroup()
+{
+    // 2 loop threads shared by 8 subscribers, instead of 8 threads
+    MiniRedisEventLoopGroup group(2);
+    group.SetPolicy(LOOP_LEAST_LOADED);
+    group.Start();
+
+    std::vector<std::unique_ptr<MiniRedisPubSub>> subs;
+    for (int i = 0; i < 8; i++)
+    {
+        auto sub = std::make_unique<MiniRedisPubSub>();
+        sub->SetEventLoopGroup(&group);
+        sub->SetSubscribeCb(SubscribeCb);
+        sub->Connect("127.0.0.1", 6379);
+        sub->Subscribe("testChannel" + std::to_string(i));
+        subs.push_back(std::move(sub));
+    }
+
+    for (std::size_t i = 0; i < group.GetLoopCount(); i++)
+    {
+        std::cout << "Loop " << i << " has " << group.GetLoad(i) << " connections" << std::endl;
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(60));
+
+    // Disconnect before stopping the loops
+    subs.clear();
+    group.Stop();
+    std::cout << "Subscribing done" << std::endl; 
+}
+
 void TestPub()
 {
     MiniRedisPubSub pub;
@@ -197,9 +312,1044 @@ void TestPub()
     std::cout << "Publishing done" << std::endl; 
 }
 
+void BenchPubSub()
+{
+    // 2 publishers at 20000 messages/s each, fanned out to 4 subscribers
+    MiniRedisPubSubBenchOptions options;
+    options.publishers = 2;
+    options.subscribers = 4;
+    options.channels = 8;
+    options.messagesPerSec = 20000;
+    options.payloadBytes = 128;
+    options.durationMs = 10000;
+
+    MiniRedisPubSubBench bench(options);
+    MiniRedisPubSubBenchResult result;
+    if (!bench.Run(result))
+    {
+        std::cout << "Pub/sub benchmark failed" << std::endl;
+        return;
+    }
+    std::cout << bench.ToJson(result) << std::endl;
+}
+
+void TestMockServer()
+{
+    // No redis-server needed, faults are injected on demand
+    MiniRedisMockServer server;
+    if (!server.Start())
+    {
+        return;
+    }
+
+    std::string repliedStr;
+    MiniRedisClient client;
+    client.SetCommandTimeoutMs(100);
+    client.Connect("127.0.0.1", server.GetPort());
+    client.set("mock", "value", 60, repliedStr);
+    client.get("mock", repliedStr);
+    std::cout << "GET: " << repliedStr << std::endl;
+
+    // Slower than the command timeout
+    server.SetLatencyMs("GET", 200);
+    bool ret = client.get("mock", repliedStr);
+    std::cout << "Slow GET: " << ret << ", timeout: " << (client.GetLastError() == REDIS_ERROR_TIMEOUT) << std::endl;
+    server.ClearFaults();
+
+    // Replies in 7 byte pieces, 1 ms apart
+    client.Connect();
+    server.SetFragment(7, 1);
+    std::vector<std::string> commands(100, "GET mock");
+    std::vector<std::string> repliedArray;
+    client.pipeline(commands, repliedArray);
+    std::cout << "Fragmented pipeline: " << repliedArray.size() << " replies" << std::endl;
+    server.ClearFaults();
+
+    // Connection reset in the middle
+    server.InjectFault("GET", MOCK_FAULT_RESET);
+    ret = client.get("mock", repliedStr);
+    std::cout << "Reset GET: " << ret << ", error: " << client.GetLastError() << std::endl;
+    ret = client.Connect() && client.get("mock", repliedStr);
+    std::cout << "Reconnected GET: " << ret << std::endl;
+
+    MiniRedisMockStats stats = server.GetStats();
+    std::cout << "Mock server commands: " << stats.commands << ", faults: " << stats.faults 
+        << ", bytes out: " << stats.bytesOut << std::endl;
+    server.Stop();
+}
+
+struct TestUser
+{
+    long long id = 0;
+    std::string name;
+    double score = 0;
+    bool active = false;
+    MiniRedisFixed<2> balance;
+};
+
+MINIREDIS_STRUCT(TestUser, id, name, score, active, balance)
+
+void TestStruct()
+{
+    MiniRedisClient client;
+    client.Connect("127.0.0.1", 6379);
+
+    TestUser user;
+    user.id = 1;
+    user.name = "Alice";
+    user.score = 97.5;
+    user.active = true;
+    user.balance = MiniRedisFixed<2>(102450);
+    std::cout << "Write: " << MiniRedisStruct::Write(client, "user:1", user, 3600) << std::endl;
+
+    TestUser loaded;
+    bool ret = MiniRedisStruct::Read(client, "user:1", loaded);
+    std::cout << "Read: " << ret << ", " << loaded.id << " " << loaded.name << " " << loaded.score 
+        << " " << loaded.active << " " << loaded.balance.ToDouble() << std::endl;
+
+    // One round trip for the batch
+    std::vector<std::string> keys;
+    std::vector<TestUser> users(1000);
+    for (std::size_t i = 0; i < users.size(); i++)
+    {
+        keys.push_back("user:batch:" + std::to_string(i));
+        users[i].id = i;
+        users[i].name = "user" + std::to_string(i);
+        users[i].score = i * 0.5;
+        users[i].active = (i % 2 == 0);
+    }
+    keys.push_back("user:missing");
+
+    auto start = std::chrono::steady_clock::now();
+    MiniRedisStruct::WriteBatch(client, std::vector<std::string>(keys.begin(), keys.end() - 1), users, 3600);
+    std::vector<bool> found;
+    ret = MiniRedisStruct::ReadBatch(client, keys, users, found);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "Batch: " << ret << ", " << users.size() << " objects in " << elapsed.count() 
+        << " us, last found: " << found.back() << ", user:batch:999 " << users[999].name << std::endl;
+}
+
+template <typename T>
+bool NumericRoundTrip(T value)
+{
+    char buf[MiniRedisNumeric::MaxChars];
+    std::size_t len = MiniRedisNumeric::ToChars(buf, sizeof(buf), value);
+    T decoded;
+    if ((len == 0) || !MiniRedisNumeric::FromChars(buf, len, decoded))
+    {
+        return false;
+    }
+    if constexpr (MiniRedisNumeric::IsFixed<T>::value)
+    {
+        return decoded.raw == value.raw;
+    }
+    else
+    {
+        return decoded == value;
+    }
+}
+
+void TestNumeric()
+{
+    // Encoding only, no server is needed
+    const long long maxRaw = std::numeric_limits<long long>::max();
+    const long long minRaw = std::numeric_limits<long long>::min() + 1;
+    bool ret = NumericRoundTrip(maxRaw) && NumericRoundTrip(std::numeric_limits<long long>::min()) && 
+        NumericRoundTrip(std::numeric_limits<unsigned long long>::max()) && 
+        NumericRoundTrip(std::numeric_limits<double>::max()) && 
+        NumericRoundTrip(-std::numeric_limits<double>::denorm_min()) && 
+        NumericRoundTrip(MiniRedisFixed<0>(maxRaw)) && NumericRoundTrip(MiniRedisFixed<0>(minRaw)) && 
+        NumericRoundTrip(MiniRedisFixed<2>(maxRaw)) && NumericRoundTrip(MiniRedisFixed<2>(minRaw)) && 
+        NumericRoundTrip(MiniRedisFixed<2>(1000000000000000LL)) && NumericRoundTrip(MiniRedisFixed<2>(-5)) && 
+        NumericRoundTrip(MiniRedisFixed<18>(maxRaw)) && NumericRoundTrip(MiniRedisFixed<18>(minRaw));
+    std::cout << "Numeric round trip at limits: " << ret << std::endl;
+}
+
+void TestCodec()
+{
+    std::string repliedStr;
+    MiniRedisClient client;
+    client.Connect("127.0.0.1", 6379);
+    client.SetCodec(std::make_shared<MiniRedisLZCodec>(), 1024);
+
+    std::string blob;
+    for (int i = 0; i < 2000; i++)
+    {
+        blob += "{\"id\":" + std::to_string(i) + ",\"name\":\"user\",\"active\":true},";
+    }
+    client.set("codec", blob, 60, repliedStr);
+    client.get("codec", repliedStr);
+    std::cout << "Codec round trip: " << (repliedStr == blob) << std::endl;
+
+    MiniRedisCodecStats stats = client.GetCodecStats();
+    std::cout << "Compression ratio: " << stats.GetRatio() 
+        << ", compress ns: " << stats.compressNanos 
+        << ", decompress ns: " << stats.decompressNanos << std::endl;
+
+    long long int repliedInt = 0;
+    client.del("codec", repliedInt);
+}
+
+void TestResp3()
+{
+    std::string repliedStr;
+    long long int repliedInt = 0;
+    MiniRedisClient client;
+    client.SetProtocol(3);
+    client.SetPushCb([](const std::vector<std::string>& items) {
+        for (auto& x : items)
+        {
+            std::cout << x << " ";
+        }
+        std::cout << std::endl;
+    });
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    // Map decoded directly, without re-pairing array
+    client.hset("resp3", "a", "1", repliedInt);
+    client.hset("resp3", "b", "2", repliedInt);
+    std::unordered_map<std::string, std::string> repliedMap;
+    client.hgetall("resp3", repliedMap);
+    double val = 0;
+    client.incrbyfloat("resp3:double", 1.5, val);
+
+    // Push messages on the command connection
+    client.subscribe("resp3Channel");
+    for (int i = 0; i < 10; i++)
+    {
+        client.ProcessPush(1000);
+    }
+    client.unsubscribe("resp3Channel");
+    client.ProcessPush(1000);
+
+    std::vector<std::string> keysDel = {"resp3", "resp3:double"};
+    client.del(keysDel, repliedInt);
+}
+
+// Start replicas with:
+//   redis-server --port 6380 --replicaof 127.0.0.1 6379
+//   redis-server --port 6381 --replicaof 127.0.0.1 6379
+void TestReplicas()
+{
+    MiniRedisReplicatedClient client;
+    client.SetPrimary("127.0.0.1", 6379);
+    client.AddReplica("127.0.0.1", 6380);
+    client.AddReplica("127.0.0.1", 6381);
+    if (!client.Connect())
+    {
+        return;
+    }
+
+    std::string repliedStr;
+    client.set("replicated", "value", 60, repliedStr);
+    for (int i = 0; i < 100000; i++)
+    {
+        client.get("replicated", repliedStr);
+    }
+
+    // Duplicate the reads slower than p95 to another replica
+    client.SetHedgePercentile(0.95);
+    for (int i = 0; i < 100000; i++)
+    {
+        freeReplyObject(client.execute("GET", {"replicated"}));
+    }
+    std::cout << "Hedge delay us: " << client.GetHedgeDelayUs() 
+        << ", hedged reads: " << client.GetHedgeCount() << std::endl;
+
+    for (auto& x : client.GetReplicaStats())
+    {
+        std::cout << x.host << ":" << x.port << " up: " << x.up << ", fresh: " << x.fresh 
+            << ", latency us: " << x.latencyUs << ", lag: " << x.lagBytes 
+            << ", reads: " << x.reads << ", hedge wins: " << x.hedgeWins << std::endl;
+    }
+}
+
+void TestGetOrCompute()
+{
+    // 16 threads miss the same key at the same time, but only one computes it
+    std::atomic<int> computed(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 16; i++)
+    {
+        threads.emplace_back([&computed]() {
+            MiniRedisClient client;
+            if (!client.Connect("127.0.0.1", 6379))
+            {
+                return;
+            }
+
+            MiniRedisComputeOptions opts;
+            opts.ttlSeconds = 10;
+            std::string value;
+            client.get_or_compute("report:daily", [&computed](std::string& v) {
+                computed++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                v = "expensive result";
+                return true;
+            }, opts, value);
+        });
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    std::cout << "Computed " << computed << " times for 16 threads" << std::endl;
+}
+
+void TestDeadline()
+{
+    MiniRedisClient client;
+    client.SetCommandTimeoutMs(200);
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    // Shorter deadline for this scope only
+    {
+        MiniRedisDeadline deadline(client, 50);
+        redisReply* reply = client.execute("DEBUG SLEEP 1");
+        if (!reply && (client.GetLastError() == REDIS_ERROR_TIMEOUT))
+        {
+            std::cout << "DEBUG SLEEP timed out, reconnecting" << std::endl;
+        }
+        freeReplyObject(reply);
+    }
+
+    // The connection is closed after timeout
+    client.Connect();
+    std::cout << "PING: " << client.ping() << std::endl;
+}
+
+// Start instances with:
+//   redis-server --port 6380
+//   redis-server --port 6381
+void TestSharded()
+{
+    MiniRedisShardedClient client;
+    client.AddShard("127.0.0.1", 6379);
+    client.AddShard("127.0.0.1", 6380);
+    client.AddShard("127.0.0.1", 6381);
+    if (!client.Connect())
+    {
+        return;
+    }
+
+    std::vector<std::pair<std::string, std::string>> items;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; i++)
+    {
+        std::string key = "sharded:" + std::to_string(i);
+        items.emplace_back(key, std::to_string(i));
+        keys.push_back(key);
+    }
+    client.mset(items);
+
+    std::vector<std::string> repliedArray;
+    client.mget(keys, repliedArray);
+    std::cout << "Sharded mget: " << repliedArray.size() << ", last: " << repliedArray.back() << std::endl;
+
+    long long int repliedInt = 0;
+    client.del(keys, repliedInt);
+    std::cout << "Sharded del: " << repliedInt << std::endl;
+}
+
+void TestChunked()
+{
+    MiniRedisClient client;
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    // 64 MB value, written and read with 1 MB chunks, 4 in flight
+    std::string content(64 << 20, 'x');
+    std::istringstream input(content);
+    client.set_chunked("chunked", input, 60);
+
+    std::size_t total = 0;
+    client.get_chunked("chunked", [&total](const char*, std::size_t len) {
+        total += len;
+        return true;
+    });
+    std::cout << "Chunked read: " << total << std::endl;
+
+    long long int repliedInt = 0;
+    client.del("chunked", repliedInt);
+}
+
+// Start server with Unix socket enabled:
+//   redis-server --unixsocket /tmp/redis.sock --unixsocketperm 700
+void BenchUnixSocket()
+{
+    MiniRedisConnectionOptions tcpOptions;
+    tcpOptions.clientName = "bench-tcp";
+    MiniRedisConnectionOptions unixOptions;
+    unixOptions.unixSocket = "/tmp/redis.sock";
+    unixOptions.clientName = "bench-unix";
+
+    const int rounds = 100000;
+    std::string key("bench:socket");
+    for (auto& options : {tcpOptions, unixOptions})
+    {
+        MiniRedisClient client;
+        client.SetConnectionOptions(options);
+        if (!client.Connect("127.0.0.1", 6379))
+        {
+            continue;
+        }
+
+        std::string repliedStr;
+        client.set(key, "value", 60, repliedStr);
+        std::vector<double> latency;
+        latency.reserve(rounds);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            client.get(key, repliedStr);
+            auto end = std::chrono::steady_clock::now();
+            latency.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+        std::sort(latency.begin(), latency.end());
+        std::cout << (options.unixSocket.empty() ? "TCP loopback" : "Unix socket") 
+            << " GET: " << rounds / ms * 1000 << " ops/s" 
+            << ", p50 us: " << latency[rounds / 2] 
+            << ", p99 us: " << latency[rounds * 99 / 100] << std::endl; 
+    }
+}
+
+void BenchRateLimiter()
+{
+    // 4 limiters, as if in 4 processes, share the limit of 10000 permits/s
+    const double rate = 10000;
+    const double burst = 1000;
+    const int seconds = 5;
+    std::string key("ratelimit:api");
+    MiniRedisClient cleaner;
+    if (cleaner.Connect("127.0.0.1", 6379))
+    {
+        long long int deleted = 0;
+        cleaner.del(key, deleted);
+    }
+
+    std::vector<std::unique_ptr<MiniRedisRateLimiter>> limiters;
+    for (int i = 0; i < 4; i++)
+    {
+        limiters.push_back(std::make_unique<MiniRedisRateLimiter>(key, rate, burst));
+        if (!limiters.back()->Connect("127.0.0.1", 6379))
+        {
+            return;
+        }
+    }
+
+    std::atomic<uint64_t> checks(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (auto& limiter : limiters)
+    {
+        threads.emplace_back([&limiter, &checks, start, seconds]() {
+            uint64_t count = 0;
+            while (std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds))
+            {
+                limiter->TryAcquire();
+                count++;
+            }
+            checks += count;
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t acquired = 0;
+    uint64_t leases = 0;
+    for (auto& limiter : limiters)
+    {
+        MiniRedisRateLimiterStats stats = limiter->GetStats();
+        acquired += stats.acquired;
+        leases += stats.leases;
+        std::cout << "Limiter acquired: " << stats.acquired << ", leases: " << stats.leases 
+            << ", lease size: " << stats.leaseSize << std::endl;
+    }
+
+    // The initial burst is allowed on top of the rate
+    double allowed = rate * elapsed + burst;
+    std::cout << "Permit checks: " << checks / elapsed << " /s" 
+        << ", Redis calls per check: " << (double)leases / checks << std::endl;
+    std::cout << "Acquired: " << acquired << ", allowed: " << allowed 
+        << ", drift: " << (acquired - allowed) / allowed * 100 << "%" << std::endl;
+}
+
+void TestCounterAggregator()
+{
+    MiniRedisCounterAggregator counters;
+    counters.SetFlushIntervalMs(500);
+    if (!counters.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+    counters.Start();
+
+    // 4 threads count 1M events on 100 keys, sent as a few hundred commands per flush
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&counters]() {
+            for (int i = 0; i < 250000; i++)
+            {
+                counters.incrby("hits:" + std::to_string(i % 50), 1);
+                counters.hincrby("stats:api", "calls:" + std::to_string(i % 50), 1);
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    counters.Stop();
+    MiniRedisCounterStats stats = counters.GetStats();
+    std::cout << "Events: " << stats.events << ", commands: " << stats.commands 
+        << ", flushes: " << stats.flushes << ", failures: " << stats.failures << std::endl;
+}
+
+void TestKeySampler()
+{
+    auto sampler = std::make_shared<MiniRedisKeySampler>();
+    sampler->SetSampleRate(10);
+    sampler->SetSlowThresholdUs(1000);
+
+    MiniRedisClient client;
+    client.SetSampler(sampler);
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    // Skewed keys, about half of the traffic goes to user:0
+    std::string value(1024, 'v');
+    std::string replied;
+    for (int i = 0; i < 100000; i++)
+    {
+        std::string key = "user:" + std::to_string((i % 2) ? 0 : i % 1000);
+        client.set(key, value, 0, replied);
+    }
+    // Large key by bytes
+    client.set("blob", std::string(1024 * 1024, 'b'), 0, replied);
+    for (int i = 0; i < 100; i++)
+    {
+        client.get("blob", replied);
+    }
+    // Slow command
+    freeReplyObject(client.execute("DEBUG SLEEP %s", "0.01"));
+
+    MiniRedisKeySampler::Print(sampler->Snapshot(), std::cout);
+}
+
+void TestLogger()
+{
+    // Route the diagnostics of the client into the logger of the application
+    MiniRedisLogger& logger = MiniRedisLogger::Instance();
+    logger.SetLevel(REDIS_LOG_DEBUG);
+    logger.SetSink([](const MiniRedisLogRecord& record) {
+        std::cout << "[app] " << MiniRedisLogger::Format(record) << std::endl;
+    });
+
+    // Fails, and is logged by the background thread
+    MiniRedisClient client;
+    client.Connect("127.0.0.1", 1);
+
+    MiniRedisPubSub sub;
+    sub.Connect("127.0.0.1", 6379);
+    sub.Subscribe("testChannel1");
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    sub.Disconnect();
+
+    logger.Flush();
+    std::cout << "Dropped: " << logger.GetDropped() << std::endl;
+    logger.SetSink(nullptr);
+    logger.SetLevel(REDIS_LOG_INFO);
+}
+
+void TestMirroredHash()
+{
+    MiniRedisClient client;
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+    freeReplyObject(client.execute("CONFIG SET notify-keyspace-events Khgxe"));
+    long long int added = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        client.hset("routes", "shard:" + std::to_string(i), "10.0.0." + std::to_string(i % 256), added);
+    }
+
+    MiniRedisMirroredHash routes("routes");
+    if (!routes.Start("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    // Local reads, no round trip
+    const int loops = 1000000;
+    std::string value;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++)
+    {
+        routes.hget("shard:" + std::to_string(i % 1000), value);
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << loops << " local hget in " << us << " us" << std::endl;
+
+    // Changed on server, and seen by the mirror after the notification
+    client.hset("routes", "shard:1", "10.0.1.1", added);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    routes.hget("shard:1", value);
+    MiniRedisMirroredHashStats stats = routes.GetStats();
+    std::cout << "shard:1 is " << value << ", version: " << stats.version << ", fields: " << stats.fields
+        << ", events: " << stats.events << ", scans: " << stats.scans << ", gaps: " << stats.gaps << std::endl;
+
+    routes.Stop();
+}
+
+void BenchWorkQueue()
+{
+    const int jobs = 1000000;
+    const int workers = 4;
+    MiniRedisWorkQueue queue("{jobs}");
+    if (!queue.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+    queue.Start();
+
+    std::atomic<int> done(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < workers; i++)
+    {
+        threads.emplace_back([&queue, &done, jobs]() {
+            std::unique_ptr<MiniRedisQueueWorker> worker = queue.CreateWorker();
+            std::vector<std::string> batch;
+            while (worker && (done < jobs))
+            {
+                if (!worker->Fetch(batch, 500))
+                {
+                    break;
+                }
+                // Process the jobs here, and ack them together
+                worker->Ack(batch);
+                done += (int)batch.size();
+            }
+        });
+    }
+
+    for (int i = 0; i < jobs; i++)
+    {
+        queue.Push("job:" + std::to_string(i));
+    }
+    queue.Flush();
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    queue.Stop();
+    MiniRedisWorkQueueStats stats = queue.GetStats();
+    std::cout << "Jobs: " << stats.acked << " in " << ms << " ms, " << (ms ? stats.acked * 1000 / ms : 0) 
+        << " jobs/s, LPUSH: " << stats.flushes << ", requeued: " << stats.requeued << std::endl;
+}
+
+void TestMigrator()
+{
+    // Copy from the server on 6379 to another one on 6380
+    MiniRedisClient client;
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    const int keys = 100000;
+    for (int i = 0; i < keys; i += 1000)
+    {
+        for (int j = i; j < i + 1000; j++)
+        {
+            // Half of them with TTL
+            std::vector<std::string> argv = {"SET", "migrate:" + std::to_string(j), std::string(100, 'x')};
+            if (j % 2)
+            {
+                argv.insert(argv.end(), {"PX", "600000"});
+            }
+            client.PipelineAppend(argv);
+        }
+        for (int j = i; j < i + 1000; j++)
+        {
+            freeReplyObject(client.PipelineGetReply());
+        }
+    }
+
+    MiniRedisMigrator migrator("127.0.0.1", 6379, "127.0.0.1", 6380);
+    MiniRedisMigrationOptions options;
+    options.match = "migrate:*";
+    options.threads = 8;
+    migrator.SetOptions(options);
+    migrator.SetProgressCb([](const MiniRedisMigrationProgress& x) {
+        std::cout << (x.done ? "Done" : "Progress") << ": scanned " << x.scanned << ", migrated " << x.migrated
+            << ", skipped " << x.skipped << ", failed " << x.failed << ", " << (uint64_t)x.keysPerSec 
+            << " keys/s, " << x.elapsedMs << " ms" << std::endl;
+    });
+    bool ret = migrator.Run();
+    std::cout << "Migration " << (ret ? "succeeded" : "failed") << std::endl;
+}
+
+#ifdef MINIREDIS_IO_URING
+// Same rounds by hiredis async contexts on one libevent loop, which uses epoll
+double BenchEpollPath(int conns, int depth, int rounds)
+{
+    struct State
+    {
+        event_base* base;
+        int left;
+    } state = {event_base_new(), 0};
+
+    std::vector<redisAsyncContext*> contexts;
+    for (int i = 0; i < conns; i++)
+    {
+        redisAsyncContext* ac = redisAsyncConnect("127.0.0.1", 6379);
+        if (!ac || ac->err)
+        {
+            std::cout << "Failed to connect" << std::endl;
+            break;
+        }
+        redisLibeventAttach(ac, state.base);
+        contexts.push_back(ac);
+    }
+
+    auto onReply = [](redisAsyncContext*, void*, void* privdata) {
+        State* s = (State*)privdata;
+        if (--s->left == 0)
+        {
+            event_base_loopbreak(s->base);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds && !contexts.empty(); r++)
+    {
+        state.left = (int)contexts.size() * depth;
+        for (std::size_t i = 0; i < contexts.size(); i++)
+        {
+            for (int d = 0; d < depth; d++)
+            {
+                redisAsyncCommand(contexts[i], onReply, &state, "INCR bench:uring:%d", (int)i);
+            }
+        }
+        event_base_dispatch(state.base);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto ac : contexts)
+    {
+        redisAsyncFree(ac);
+    }
+    event_base_free(state.base);
+    return (double)contexts.size() * depth * rounds / ms * 1000;
+}
+
+double BenchUringPath(int conns, int depth, int rounds)
+{
+    MiniRedisUringTransport transport(conns);
+    if (!transport.Init())
+    {
+        return 0;
+    }
+    for (int i = 0; i < conns; i++)
+    {
+        if (transport.AddConnection("127.0.0.1", 6379) < 0)
+        {
+            break;
+        }
+    }
+
+    std::size_t count = transport.GetConnectionCount();
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds && count; r++)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::string key = "bench:uring:" + std::to_string(i);
+            for (int d = 0; d < depth; d++)
+            {
+                transport.Append(i, {"INCR", key}, nullptr);
+            }
+        }
+        transport.Drain();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    MiniRedisUringStats stats = transport.GetStats();
+    std::cout << "    io_uring_enter: " << stats.enters << ", SQEs: " << stats.sqes 
+        << ", replies: " << stats.replies << std::endl;
+    return (double)count * depth * rounds / ms * 1000;
+}
+
+void BenchUringTransport()
+{
+    // Each round sends depth commands on every connection and waits for all replies
+    const int totalOps = 512000;
+    const int depth = 16;
+    for (int conns : {1, 64, 512})
+    {
+        int rounds = std::max(1, totalOps / (conns * depth));
+        double epoll = BenchEpollPath(conns, depth, rounds);
+        double uring = BenchUringPath(conns, depth, rounds);
+        std::cout << "Connections " << conns << ": epoll " << (uint64_t)epoll << " ops/s, io_uring " 
+            << (uint64_t)uring << " ops/s" << std::endl;
+    }
+}
+#endif
+
+// Compare prepared command with the printf-style execute path
+void BenchPreparedCommand()
+{
+    const int loops = 1000000;
+    std::string key("stats:1001");
+    std::string field("hits");
+    MiniRedisPreparedCommand hincrby("HINCRBY %b %b 1");
+
+    // Encoding only, no server is needed
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++)
+    {
+        char* cmd = nullptr;
+        int len = redisFormatCommand(&cmd, "HINCRBY %b %b 1", 
+            key.c_str(), key.size(), field.c_str(), field.size());
+        if (len > 0)
+        {
+            redisFreeCommand(cmd);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "redisFormatCommand: " << loops / ms * 1000 << " ops/s" << std::endl; 
+
+    std::string buf;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++)
+    {
+        hincrby.Format(buf, {key, field});
+    }
+    end = std::chrono::steady_clock::now();
+    ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "Prepared Format: " << loops / ms * 1000 << " ops/s" << std::endl; 
+
+    // Round trips against server
+    MiniRedisClient client;
+    if (!client.Connect("127.0.0.1", 6379))
+    {
+        return;
+    }
+
+    const int rounds = 100000;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        redisReply* reply = client.execute("HINCRBY %b %b 1", 
+            key.c_str(), key.size(), field.c_str(), field.size());
+        freeReplyObject(reply);
+    }
+    end = std::chrono::steady_clock::now();
+    ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "execute: " << rounds / ms * 1000 << " ops/s" << std::endl; 
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        redisReply* reply = client.execute(hincrby, {key, field});
+        freeReplyObject(reply);
+    }
+    end = std::chrono::steady_clock::now();
+    ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "execute prepared: " << rounds / ms * 1000 << " ops/s" << std::endl; 
+
+    // Pipeline
+    std::vector<std::string> commands(rounds, "HINCRBY " + key + " " + field + " 1");
+    std::vector<std::string> repliedArray;
+    start = std::chrono::steady_clock::now();
+    client.pipeline(commands, repliedArray);
+    end = std::chrono::steady_clock::now();
+    ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "pipeline: " << rounds / ms * 1000 << " ops/s" << std::endl; 
+
+    std::vector<std::vector<std::string>> args(rounds, {key, field});
+    start = std::chrono::steady_clock::now();
+    client.pipeline(hincrby, args, repliedArray);
+    end = std::chrono::steady_clock::now();
+    ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << "pipeline prepared: " << rounds / ms * 1000 << " ops/s" << std::endl; 
+
+    long long int repliedInt = 0;
+    client.del(key, repliedInt);
+}
+
+// Decode the whole input in chunks of a socket read, return MB/s
+double BenchHiredisReader(const std::string& input, std::size_t& replies)
+{
+    const std::size_t chunk = 16 * 1024;
+    auto start = std::chrono::steady_clock::now();
+    redisReader* reader = redisReaderCreate();
+    replies = 0;
+    for (std::size_t off = 0; off < input.size(); off += chunk)
+    {
+        redisReaderFeed(reader, input.data() + off, std::min(chunk, input.size() - off));
+        void* reply = nullptr;
+        while ((redisReaderGetReply(reader, &reply) == REDIS_OK) && reply)
+        {
+            freeReplyObject(reply);
+            replies++;
+        }
+    }
+    redisReaderFree(reader);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return input.size() / ms / 1000;
+}
+
+double BenchRespDecoder(const std::string& input, bool useSimd, std::size_t& replies)
+{
+    const std::size_t chunk = 16 * 1024;
+    auto start = std::chrono::steady_clock::now();
+    MiniRedisRespDecoder decoder(useSimd);
+    MiniRedisRespReply reply;
+    replies = 0;
+    for (std::size_t off = 0; off < input.size(); off += chunk)
+    {
+        decoder.Feed(input.data() + off, std::min(chunk, input.size() - off));
+        while (decoder.GetReply(reply) == RESP_DECODE_OK)
+        {
+            replies++;
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return input.size() / ms / 1000;
+}
+
+void BenchRespCodec()
+{
+    // Synthetic replies, no server is needed
+    std::vector<std::pair<std::string, std::string>> inputs;
+    std::string smembers = "*200000\r\n";
+    for (int i = 0; i < 200000; i++)
+    {
+        std::string member = "member:" + std::to_string(i);
+        smembers += "$" + std::to_string(member.size()) + "\r\n" + member + "\r\n";
+    }
+    inputs.emplace_back("smembers 200000", smembers);
+
+    std::string hgetall = "*100000\r\n";
+    for (int i = 0; i < 50000; i++)
+    {
+        std::string field = "field:" + std::to_string(i);
+        std::string value(100, 'v');
+        hgetall += "$" + std::to_string(field.size()) + "\r\n" + field + "\r\n";
+        hgetall += "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+    }
+    inputs.emplace_back("hgetall 50000", hgetall);
+
+    // Replies of a pipeline of INCR on large counters
+    std::string pipeline;
+    for (int i = 0; i < 200000; i++)
+    {
+        pipeline += ":" + std::to_string(10000000000LL + i * 7919LL) + "\r\n";
+    }
+    inputs.emplace_back("pipeline 200000", pipeline);
+
+    std::cout << "SIMD level: " << MiniRedisRespDecoder::GetSimdLevel() << std::endl;
+    for (auto& input : inputs)
+    {
+        std::size_t hiredisReplies = 0;
+        std::size_t scalarReplies = 0;
+        std::size_t simdReplies = 0;
+        double hiredis = BenchHiredisReader(input.second, hiredisReplies);
+        double scalar = BenchRespDecoder(input.second, false, scalarReplies);
+        double simd = BenchRespDecoder(input.second, true, simdReplies);
+        std::cout << input.first << ": hiredis " << hiredis << " MB/s, scalar " << scalar 
+            << " MB/s, simd " << simd << " MB/s, replies " << hiredisReplies << "/" << scalarReplies 
+            << "/" << simdReplies << std::endl;
+    }
+
+    // Encoding of SET key value
+    const int loops = 1000000;
+    std::string key("stats:1001");
+    std::string value(64, 'x');
+    const char* argv[] = {"SET", key.c_str(), value.c_str()};
+    std::size_t argvLen[] = {3, key.size(), value.size()};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++)
+    {
+        char* cmd = nullptr;
+        long long len = redisFormatCommandArgv(&cmd, 3, argv, argvLen);
+        if (len > 0)
+        {
+            redisFreeCommand(cmd);
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "redisFormatCommandArgv: " << loops / ms * 1000 << " ops/s" << std::endl;
+
+    std::string buf;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++)
+    {
+        buf.clear();
+        MiniRedisResp::AppendCommand(buf, {"SET", key, value});
+    }
+    ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "MiniRedisResp::AppendCommand: " << loops / ms * 1000 << " ops/s" << std::endl;
+}
+
 int main()
 {
     TestClient();
     //TestPub();
     //TestSub();
+    //TestSubBatch();
+    //TestEventLoopGroup();
+    //BenchPubSub();
+    //BenchPreparedCommand();
+    //BenchRespCodec();
+    //BenchUnixSocket();
+    //BenchRateLimiter();
+    //TestCounterAggregator();
+    //TestKeySampler();
+    //TestLogger();
+    //TestMirroredHash();
+    //BenchWorkQueue();
+    //TestMigrator();
+    //TestMockServer();
+    //TestStruct();
+#ifdef MINIREDIS_IO_URING
+    //BenchUringTransport();
+#endif
+    //TestNumeric();
+    //TestCodec();
+    //TestResp3();
+    //TestReplicas();
+    //TestDeadline();
+    //TestGetOrCompute();
+    //TestSharded();
+    //TestChunked();
 }